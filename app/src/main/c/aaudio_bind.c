@@ -1,12 +1,8 @@
-#include <assert.h>
-#include <errno.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
 #include <time.h>
 
 #include <aaudio/AAudio.h>
@@ -14,7 +10,7 @@
 #include "audio.h"
 #include "config.h"
 #include "logging.h"
-#include "render.h"
+#include "sink.h"
 
 static const char *FILENAME = "aaudio_bind.c";
 
@@ -46,240 +42,535 @@ init_aaudio_fmt (int wav_fmt_code, int *fmt, size_t *siz)
     }
 }
 
+static pthread_once_t        native_once = PTHREAD_ONCE_INIT;
+static struct audio_outfmt_t native_fmt;
+static int                   native_stat = NCAP_EGEN;
+
+/**
+ * open a stream with nothing but the performance mode set; AAudio fills in
+ * the rate, channel count and format of the device's mixer
+ */
 static void
-sclbuf (void *buf, const aaudio_format_t fmt, const size_t width, size_t len)
+query_native (void)
 {
-    int   pth_ret;
-    float scl;
-
-    if ((pth_ret = pthread_mutex_lock (&config_mx)) != 0) {
-        logwf ("WARN: failed to lock config_mx. Error code %d: %s. Dropping "
-               "frame...",
-               pth_ret, strerror (pth_ret));
-        scl = 0;
-    } else {
-        scl = ncap_config.volume / 100.0f;
+    AAudioStreamBuilder *builder;
+    AAudioStream        *stream;
+
+    if (AAudio_createStreamBuilder (&builder) != AAUDIO_OK) {
+        loge ("ERROR: AAudio_createStreamBuilder failed");
+        return;
     }
 
-    pthread_mutex_unlock (&config_mx);
-
-    for (; len--; buf += width) {
-        switch (fmt) {
-            case AAUDIO_FORMAT_PCM_I16:
-                *(int16_t *)buf *= scl;
-                break;
-            case AAUDIO_FORMAT_PCM_I32:
-                *(int32_t *)buf *= scl;
-                break;
-            case AAUDIO_FORMAT_PCM_FLOAT:
-                *(float *)buf *= scl;
-                break;
-            case AAUDIO_FORMAT_INVALID:
-            default:
-                return;
-        }
+    AAudioStreamBuilder_setPerformanceMode (
+        builder, to_aaudio_pm (ncap_config.aaudio_optimize));
+
+    aaudio_result_t res = AAudioStreamBuilder_openStream (builder, &stream);
+    AAudioStreamBuilder_delete (builder);
+
+    if (res != AAUDIO_OK) {
+        logef ("ERROR: opening the probe stream failed with code %d", res);
+        return;
     }
-}
 
-pthread_mutex_t audio_mx     = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t  audio_cv     = PTHREAD_COND_INITIALIZER;
-bool            audio_isplay = false;
+    native_fmt.sample_rate = AAudioStream_getSampleRate (stream);
+    native_fmt.channels    = AAudioStream_getChannelCount (stream);
+
+    switch (AAudioStream_getFormat (stream)) {
+        case AAUDIO_FORMAT_PCM_I16:
+            native_fmt.wFormatTag = 1;
+            break;
+        case AAUDIO_FORMAT_PCM_I32:
+            native_fmt.wFormatTag = 2;
+            break;
+        default: // float, and I24 which nothing here produces
+            native_fmt.wFormatTag = 3;
+    }
+
+    AAudioStream_close (stream);
+
+    logif ("native output: %u Hz, %u channels, format %u",
+           native_fmt.sample_rate, native_fmt.channels,
+           native_fmt.wFormatTag);
+
+    if (native_fmt.sample_rate > 0 && native_fmt.channels > 0)
+        native_stat = NCAP_OK;
+}
 
 int
-audio_play (const char *fn)
+audio_native_fmt (struct audio_outfmt_t *fmt)
 {
-    FILE *fp = fopen (fn, "rb");
+    pthread_once (&native_once, query_native);
 
-    if (fp == NULL) {
-        logef ("Failed to open file `%s': error: %s", fn, strerror (errno));
-        return NCAP_EIO;
+    if (native_stat == NCAP_OK)
+        *fmt = native_fmt;
+
+    return native_stat;
+}
+// the sink
+
+struct aaudio_sink_t {
+    struct sink_t         base;
+    AAudioStream         *stream;
+    sink_pull_t           pull;
+    void                 *ctx;
+    struct aaudio_grant_t grant; // of the open stream
+};
+
+static struct aaudio_sink_t aaudio_sink;
+
+static aaudio_data_callback_result_t
+data_cb (AAudioStream *stream, void *ctx, void *audio, int32_t nframes)
+{
+    struct aaudio_sink_t *this = ctx;
+
+    (void)stream;
+
+    // keep the stream running on silence; the player stops it
+    this->pull (this->ctx, audio, nframes);
+
+    return AAUDIO_CALLBACK_RESULT_CONTINUE;
+}
+
+static void
+error_cb (AAudioStream *stream, void *ctx, aaudio_result_t err)
+{
+    (void)stream;
+
+    // stream calls are not allowed here; the player closes it
+    if (err == AAUDIO_ERROR_DISCONNECTED)
+        atomic_store (&((struct aaudio_sink_t *)ctx)->base.isdisconn, true);
+}
+
+// stream negotiation
+
+/**
+ * what to ask for, lowest latency first. low latency in exclusive mode is
+ * what gets an MMAP stream; AAudio may grant less than asked, and the
+ * exclusive stream may fail to open at all, e.g. on a format the hardware
+ * does not take
+ */
+static const struct {
+    aaudio_performance_mode_t pm;
+    aaudio_sharing_mode_t     sharing;
+} ladder[] = {
+    { AAUDIO_PERFORMANCE_MODE_LOW_LATENCY, AAUDIO_SHARING_MODE_EXCLUSIVE },
+    { AAUDIO_PERFORMANCE_MODE_LOW_LATENCY, AAUDIO_SHARING_MODE_SHARED },
+    { AAUDIO_PERFORMANCE_MODE_NONE, AAUDIO_SHARING_MODE_SHARED },
+    { AAUDIO_PERFORMANCE_MODE_POWER_SAVING, AAUDIO_SHARING_MODE_SHARED },
+};
+
+#define NLADDER (sizeof ladder / sizeof *ladder)
+#define NGRANT  8
+
+/**
+ * what each device granted, by device ID and configured mode, so that later
+ * opens start at the rung that worked. the device of the default route is
+ * only known once a stream is open, so lookups use the last one seen
+ */
+static struct {
+    pthread_mutex_t       mx;
+    struct aaudio_grant_t ent[NGRANT];
+    size_t                next;  // slot to replace when full
+    int32_t               devid; // of the last open stream
+    bool                  isset; // an open has succeeded
+} grants = { .mx = PTHREAD_MUTEX_INITIALIZER };
+
+/** @return the first rung at or below the configured performance mode */
+static uint8_t
+ladder_start (uint8_t cfg_code)
+{
+    switch (to_aaudio_pm (cfg_code)) {
+        case AAUDIO_PERFORMANCE_MODE_LOW_LATENCY:
+            return 0;
+        case AAUDIO_PERFORMANCE_MODE_POWER_SAVING:
+            return 3;
+        default:
+            return 2;
     }
+}
 
-    logif ("Opened file `%s'", fn);
+/** call with grants.mx held. @return NULL if devid was never granted */
+static struct aaudio_grant_t *
+grant_find (int32_t devid, uint8_t start)
+{
+    for (size_t i = 0; i < NGRANT; ++i) {
+        struct aaudio_grant_t *const g = &grants.ent[i];
 
-    struct cwav_header_t header;
-    fread (&header, CWAV_HEADER_SIZ, 1, fp);
+        if (g->burst > 0 && g->devid == devid && g->start == start)
+            return g;
+    }
 
-#ifndef NDEBUG
-    // clang-format off
-    logvf ("WAV header RIFF:\t%.4s",          header.riff.ckID);
-    logvf ("WAV header file size:\t%u",       header.riff.cksize);
-    logvf ("WAV header WAVE:\t%.4s",          header.riff.WAVEID);
-    logvf ("WAV header fmt :\t%.4s",          header.fmt.ckID);
-    logvf ("WAV header block size:\t%u",      header.fmt.cksize);
-    logvf ("WAV header audio fmt:\t%u",       header.fmt.wFormatTag);
-    logvf ("WAV header channels:\t%u",        header.fmt.nChannels);
-    logvf ("WAV header sample rate:\t%u",     header.fmt.nSamplesPerSec);
-    logvf ("WAV header byte rate:\t%u",       header.fmt.nAvgBytesPerSec);
-    logvf ("WAV header block alignment:\t%u", header.fmt.nBlockAlign);
-    logvf ("WAV header bits per sample:\t%u", header.fmt.wBitsPerSample);
-    logvf ("WAV header data:\t%.4s",          header.data.ckID);
-    logvf ("WAV header data size:\t%u",       header.data.cksize);
-// clang-format on
-#endif // !NDEBUG
+    return NULL;
+}
+
+/** @return the rung to try first */
+static uint8_t
+grant_lookup (uint8_t start)
+{
+    uint8_t tier = start;
+
+    pthread_mutex_lock (&grants.mx);
+
+    const struct aaudio_grant_t *g
+        = grants.isset ? grant_find (grants.devid, start) : NULL;
+
+    if (g != NULL) {
+        tier = g->tier;
+        logif ("device %d granted rung %u before; starting there",
+               grants.devid, tier);
+    }
+
+    pthread_mutex_unlock (&grants.mx);
+
+    return tier;
+}
+
+/** record what the open stream got */
+static void
+grant_record (struct aaudio_sink_t *this, uint8_t start, uint8_t tier)
+{
+    AAudioStream *const    stream = this->stream;
+    struct aaudio_grant_t *g      = &this->grant;
+
+    g->devid      = AAudioStream_getDeviceId (stream);
+    g->pm         = AAudioStream_getPerformanceMode (stream);
+    g->sharing    = AAudioStream_getSharingMode (stream);
+    g->burst      = AAudioStream_getFramesPerBurst (stream);
+    g->latency_ns = -1;
+    g->start      = start;
+
+    // e.g. exclusive asked, shared granted: next time, ask for what works
+    for (uint8_t i = tier; i < NLADDER; ++i) {
+        if (ladder[i].pm == g->pm && ladder[i].sharing == g->sharing) {
+            tier = i;
+            break;
+        }
+    }
+
+    g->tier = tier;
+
+    logif ("device %d granted performance mode %d, sharing mode %d, bursts "
+           "of %d frames",
+           g->devid, g->pm, g->sharing, g->burst);
+
+    pthread_mutex_lock (&grants.mx);
+
+    struct aaudio_grant_t *ent = grant_find (g->devid, start);
+
+    if (ent == NULL) {
+        ent         = &grants.ent[grants.next];
+        grants.next = (grants.next + 1) % NGRANT;
+    }
+
+    *ent         = *g;
+    grants.devid = g->devid;
+    grants.isset = true;
+
+    pthread_mutex_unlock (&grants.mx);
+}
+
+/**
+ * the measured output latency: how long until a frame written now is heard.
+ * needs a running stream, so it is taken on the first poll that has a
+ * timestamp
+ */
+static void
+grant_measure (struct aaudio_sink_t *this)
+{
+    AAudioStream *const stream = this->stream;
+    int64_t             pos, t_ns;
+    struct timespec     now;
+
+    if (this->grant.latency_ns >= 0
+        || AAudioStream_getTimestamp (stream, CLOCK_MONOTONIC, &pos, &t_ns)
+               != AAUDIO_OK)
+        return;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+
+    const int64_t rate = AAudioStream_getSampleRate (stream);
+
+    if (rate <= 0)
+        return;
+
+    const int64_t ahead   = AAudioStream_getFramesWritten (stream) - pos;
+    const int64_t now_ns  = now.tv_sec * 1000000000LL + now.tv_nsec;
+    const int64_t latency = ahead * 1000000000LL / rate - (now_ns - t_ns);
+
+    if (latency < 0)
+        return;
+
+    this->grant.latency_ns = latency;
+
+    logif ("device %d output latency: %.1f ms", this->grant.devid,
+           latency / 1e6);
+
+    pthread_mutex_lock (&grants.mx);
 
-    // stream builder
+    struct aaudio_grant_t *ent
+        = grant_find (this->grant.devid, this->grant.start);
 
-    const uint64_t nstimeout   = 1000000000;
-    const uint32_t channels    = header.fmt.nChannels;
-    const uint32_t sample_rate = header.fmt.nSamplesPerSec;
+    if (ent != NULL)
+        ent->latency_ns = latency;
 
+    pthread_mutex_unlock (&grants.mx);
+}
+
+int
+sink_aaudio_grant (struct aaudio_grant_t *grant)
+{
+    const uint8_t start = ladder_start (ncap_config.aaudio_optimize);
+
+    pthread_mutex_lock (&grants.mx);
+
+    const struct aaudio_grant_t *g
+        = grants.isset ? grant_find (grants.devid, start) : NULL;
+
+    if (g != NULL)
+        *grant = *g;
+
+    pthread_mutex_unlock (&grants.mx);
+
+    return g != NULL ? NCAP_OK : NCAP_EGEN;
+}
+
+static aaudio_result_t
+try_open (struct aaudio_sink_t *this, const struct cwav_header_t *header,
+          aaudio_format_t fmt, uint8_t tier)
+{
     AAudioStreamBuilder *builder;
-    aaudio_result_t      res = AAudio_createStreamBuilder (&builder);
+    aaudio_result_t      res;
+
+    if ((res = AAudio_createStreamBuilder (&builder)) != AAUDIO_OK) {
+        logef ("ERROR: AAudio_createStreamBuilder failed with code %d", res);
+        return res;
+    }
+
+    AAudioStreamBuilder_setFormat (builder, fmt);
+    AAudioStreamBuilder_setChannelCount (builder, header->fmt.nChannels);
+    AAudioStreamBuilder_setSampleRate (builder, header->fmt.nSamplesPerSec);
+    AAudioStreamBuilder_setPerformanceMode (builder, ladder[tier].pm);
+    AAudioStreamBuilder_setSharingMode (builder, ladder[tier].sharing);
+    AAudioStreamBuilder_setErrorCallback (builder, error_cb, this);
 
-    // init aaudio setup data
-    int    AAUDIO_FMT;
-    size_t PCM_DATA_WIDTH;
-    int    stat = init_aaudio_fmt (header.fmt.wFormatTag, &AAUDIO_FMT,
-                                   &PCM_DATA_WIDTH);
+    if (this->pull != NULL)
+        AAudioStreamBuilder_setDataCallback (builder, data_cb, this);
 
-    if (stat < 0) {
-        logef ("ERROR: init_aaudio_fmt failed with code %d\n", stat);
+    res = AAudioStreamBuilder_openStream (builder, &this->stream);
+    AAudioStreamBuilder_delete (builder);
+
+    return res;
+}
+
+static int
+aa_open (struct sink_t *base, const struct cwav_header_t *header,
+         sink_pull_t pull, void *ctx)
+{
+    struct aaudio_sink_t *this = (struct aaudio_sink_t *)base;
+    aaudio_result_t       res  = AAUDIO_ERROR_UNAVAILABLE;
+    int                   fmt;
+    size_t                width;
+
+    if (init_aaudio_fmt (header->fmt.wFormatTag, &fmt, &width) != NCAP_OK) {
+        logef ("ERROR: init_aaudio_fmt failed for format %u",
+               header->fmt.wFormatTag);
         return NCAP_EGEN;
     }
 
-    logif ("Using AAudio format with code %d", AAUDIO_FMT);
-    logif ("Using PCM data width of %zu", PCM_DATA_WIDTH);
+    logif ("Using AAudio format with code %d", fmt);
 
-    if (AAUDIO_FMT == AAUDIO_FORMAT_UNSPECIFIED)
-        logw ("WARN: using AAUDIO_FORMAT_UNSPECIFIED");
+    this->pull = pull;
+    this->ctx  = ctx;
+    atomic_store (&base->isdisconn, false);
 
-    AAudioStreamBuilder_setFormat (builder, AAUDIO_FMT);
-    AAudioStreamBuilder_setChannelCount (builder, channels);
-    AAudioStreamBuilder_setSampleRate (builder, sample_rate);
-    AAudioStreamBuilder_setPerformanceMode (
-        builder, to_aaudio_pm (ncap_config.aaudio_optimize));
+    const uint8_t start = ladder_start (ncap_config.aaudio_optimize);
+    uint8_t       tier  = grant_lookup (start);
 
-    // stream
+    for (; tier < NLADDER; ++tier) {
+        if ((res = try_open (this, header, fmt, tier)) == AAUDIO_OK)
+            break;
 
-    AAudioStream *stream;
-    res = AAudioStreamBuilder_openStream (builder, &stream);
-    AAudioStreamBuilder_delete (builder);
+        logwf ("WARN: opening with performance mode %d, sharing mode %d "
+               "failed with code %d. falling back...",
+               ladder[tier].pm, ladder[tier].sharing, res);
+    }
 
     if (res != AAUDIO_OK) {
-        loge ("AAudio openStream failed");
+        logef ("ERROR: AAudio openStream failed with code %d", res);
         return NCAP_EGEN;
     }
 
-    const int32_t frames_per_burst = AAudioStream_getFramesPerBurst (stream);
-    const int32_t buf_cap = AAudioStream_getBufferCapacityInFrames (stream);
-    int32_t       buf_siz = AAudioStream_getBufferSizeInFrames (stream);
+    grant_record (this, start, tier);
+
+    base->burst   = AAudioStream_getFramesPerBurst (this->stream);
+    base->buf_cap = AAudioStream_getBufferCapacityInFrames (this->stream);
+    base->buf_siz = AAudioStream_getBufferSizeInFrames (this->stream);
 
 #ifndef NDEBUG
     // clang-format off
-    logvf ("device id: %d",        AAudioStream_getDeviceId (stream));
-    logvf ("direction: %d",        AAudioStream_getDirection (stream));
-    logvf ("sharing mode: %d",     AAudioStream_getSharingMode (stream));
-    logvf ("stream channels: %d",  channels);
-    logvf ("frames_per_burst: %d", frames_per_burst);
-    logvf ("sample_rate: %d",      sample_rate);
-    logvf ("buf_cap: %d",          buf_cap);
-    logvf ("buf_siz: %d",          buf_siz);
+    logvf ("direction: %d",    AAudioStream_getDirection (this->stream));
     // clang-format on
 #endif // !NDEBUG
 
-    AAudioStream_requestStart (stream);
-    aaudio_stream_state_t state = AAUDIO_STREAM_STATE_UNINITIALIZED;
-    res                         = AAudioStream_waitForStateChange (
-        stream, AAUDIO_STREAM_STATE_STARTING, &state, nstimeout);
-
-    const size_t buflen      = frames_per_burst * channels;
-    void        *buf         = malloc (buflen * PCM_DATA_WIDTH);
-    int32_t      prev_ur_cnt = 0;
-
-    const time_t timer_start = time (NULL);
-    const time_t dur         = 5;
+    return NCAP_OK;
+}
 
-    logi ("Stream started. Playing audio...");
+/** request a state change and wait for it to leave the transient state */
+static int
+change_state (AAudioStream *stream, aaudio_result_t res,
+              aaudio_stream_state_t transient)
+{
+    const uint64_t        nstimeout = 1000000000;
+    aaudio_stream_state_t state     = AAUDIO_STREAM_STATE_UNINITIALIZED;
 
-    int pthread_err;
+    if (res == AAUDIO_OK)
+        res = AAudioStream_waitForStateChange (stream, transient, &state,
+                                               nstimeout);
 
-    while (res >= AAUDIO_OK && !feof (fp) && time (NULL) - timer_start < dur) {
-        // check for pause (playback control)
+    if (res != AAUDIO_OK) {
+        logef ("ERROR: AAudio state change failed with code %d", res);
+        return NCAP_EGEN;
+    }
 
-        if ((pthread_err = pthread_mutex_lock (&audio_mx)) != 0) {
-            logef ("ERROR: pthread_mutex_lock on audio_mx failed with error "
-                   "code %d: "
-                   "%s. stopping playback...",
-                   pthread_err, strerror (pthread_err));
-            break;
-        }
+    return NCAP_OK;
+}
 
-        if (!audio_isplay)
-            logi ("audio_isplay = false. waiting for audio_cv...");
+static int
+aa_start (struct sink_t *base)
+{
+    AAudioStream *stream = ((struct aaudio_sink_t *)base)->stream;
 
-        while (!audio_isplay)
-            pthread_cond_wait (&audio_cv, &audio_mx);
+    return change_state (stream, AAudioStream_requestStart (stream),
+                         AAUDIO_STREAM_STATE_STARTING);
+}
 
-        pthread_mutex_unlock (&audio_mx);
+static int
+aa_pause (struct sink_t *base)
+{
+    AAudioStream *stream = ((struct aaudio_sink_t *)base)->stream;
 
-        // check for window close
+    return AAudioStream_requestPause (stream) == AAUDIO_OK ? NCAP_OK
+                                                           : NCAP_EGEN;
+}
 
-        int pth_ret;
-        if ((pth_ret = pthread_mutex_trylock (&render_wclose_mx)) == 0) {
-            if (wclose) {
-                logi ("stopping playback...; wclose = true");
-                pthread_mutex_unlock (&render_wclose_mx);
-                break;
-            }
+static int
+aa_stop (struct sink_t *base)
+{
+    AAudioStream *stream = ((struct aaudio_sink_t *)base)->stream;
 
-            pthread_mutex_unlock (&render_wclose_mx);
-        } else {
-            logwf ("WARN: could not acquire render_wclose_mx. Error "
-                   "code %d: %s. continuing...",
-                   pth_ret, strerror (pth_ret));
-        }
+    return change_state (stream, AAudioStream_requestStop (stream),
+                         AAUDIO_STREAM_STATE_STOPPING);
+}
 
-        // play
+static void
+aa_close (struct sink_t *base)
+{
+    struct aaudio_sink_t *this = (struct aaudio_sink_t *)base;
+    aaudio_result_t       res;
 
-        if (fread (buf, PCM_DATA_WIDTH, buflen, fp) <= 0)
-            logw ("WARN: fread returned with code <= 0");
+    if ((res = AAudioStream_close (this->stream)) != AAUDIO_OK)
+        logef ("ERROR: AAudio failed to close with code %d", res);
 
-        sclbuf (buf, AAUDIO_FMT, PCM_DATA_WIDTH, buflen);
-        res = AAudioStream_write (stream, buf, frames_per_burst, nstimeout);
+    this->stream = NULL;
+}
 
-        if (buf_siz < buf_cap) {
-            int32_t ur_cnt = AAudioStream_getXRunCount (stream);
+static int
+aa_write (struct sink_t *base, const void *buf, int32_t nframes)
+{
+    const uint64_t nstimeout = 1000000000;
+    AAudioStream  *stream    = ((struct aaudio_sink_t *)base)->stream;
 
-            logdf ("Underruns: %d", ur_cnt);
+    const aaudio_result_t res
+        = AAudioStream_write (stream, buf, nframes, nstimeout);
 
-            if (ur_cnt > prev_ur_cnt) {
-                prev_ur_cnt = ur_cnt;
-                buf_siz     = AAudioStream_setBufferSizeInFrames (
-                    stream, buf_siz + frames_per_burst);
-            }
-        }
+    if (res < AAUDIO_OK) {
+        logef ("ERROR: AAudioStream_write failed with code %d", res);
+        return NCAP_EIO;
     }
 
-    if (res < AAUDIO_OK)
-        logef ("Write loop stopped due to AAudio error with code %d.", res);
+    return NCAP_OK;
+}
 
-    // deinit
+static int32_t
+aa_latency (struct sink_t *base)
+{
+    AAudioStream *stream = ((struct aaudio_sink_t *)base)->stream;
 
-    free (buf);
-    fclose (fp);
+    return AAudioStream_getFramesWritten (stream)
+           - AAudioStream_getFramesRead (stream);
+}
 
-    logif ("Audio play ended after %u secs. Stopping stream...",
-           (uint32_t)dur);
+/**
+ * a timestamp taken before a pause stays around after it, so one older than
+ * the buffer could hold is stale
+ */
+static int
+aa_timestamp (struct sink_t *base, int64_t *ahead, int64_t *t_ns)
+{
+    AAudioStream   *stream = ((struct aaudio_sink_t *)base)->stream;
+    int64_t         pos;
+    struct timespec now;
 
-    AAudioStream_requestStop (stream);
-    state = AAUDIO_STREAM_STATE_UNINITIALIZED;
-    res   = AAudioStream_waitForStateChange (
-        stream, AAUDIO_STREAM_STATE_STOPPING, &state, nstimeout);
+    if (AAudioStream_getTimestamp (stream, CLOCK_MONOTONIC, &pos, t_ns)
+        != AAUDIO_OK)
+        return NCAP_EGEN;
 
-    if (res != AAUDIO_OK)
-        loge ("AAudio failed to stop. Closing anyway...");
-    else
-        logi ("AAudio stream stopped.");
+    clock_gettime (CLOCK_MONOTONIC, &now);
 
-    res = AAudioStream_close (stream);
+    const int64_t rate   = AAudioStream_getSampleRate (stream);
+    const int64_t now_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
 
-    if (res != AAUDIO_OK) {
-        loge ("AAudio failed to close");
+    if (rate <= 0
+        || (now_ns - *t_ns) * rate / 1000000000LL
+               > base->buf_siz + base->burst)
         return NCAP_EGEN;
-    }
 
-    logi ("AAudio stream closed.");
+    *ahead = AAudioStream_getFramesWritten (stream) - pos;
 
     return NCAP_OK;
 }
+
+/** polled by the player while running, which grant_measure needs */
+static int32_t
+aa_xruns (struct sink_t *base)
+{
+    struct aaudio_sink_t *this = (struct aaudio_sink_t *)base;
+
+    grant_measure (this);
+
+    return AAudioStream_getXRunCount (this->stream);
+}
+
+static int32_t
+aa_setbuf (struct sink_t *base, int32_t frames)
+{
+    AAudioStream *stream = ((struct aaudio_sink_t *)base)->stream;
+    const int32_t siz = AAudioStream_setBufferSizeInFrames (stream, frames);
+
+    if (siz > 0)
+        base->buf_siz = siz;
+
+    return base->buf_siz;
+}
+
+static const struct sink_ops_t aaudio_ops = {
+    .open      = aa_open,
+    .start     = aa_start,
+    .pause     = aa_pause,
+    .stop      = aa_stop,
+    .close     = aa_close,
+    .write     = aa_write,
+    .latency   = aa_latency,
+    .xruns     = aa_xruns,
+    .setbuf    = aa_setbuf,
+    .timestamp = aa_timestamp,
+};
+
+struct sink_t *
+sink_aaudio (void)
+{
+    aaudio_sink.base.ops  = &aaudio_ops;
+    aaudio_sink.base.name = "aaudio";
+
+    return &aaudio_sink.base;
+}
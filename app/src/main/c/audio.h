@@ -4,8 +4,10 @@
 #define AUDIO_H
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #define CWAV_HEADER_SIZ 44
 
@@ -56,12 +58,89 @@ struct cwav_header_t {
 
 // TODO(M-Y-Sun): add err2str
 
-extern pthread_mutex_t audio_mx;
-extern pthread_cond_t  audio_cv;
-extern bool            audio_isplay;
+// playback control (pause, close, volume) is in playctl.h
 
-extern int libav_cvt_cwav (const char *fn_in, const char *fn_out);
+struct loudness_t;
+struct pcmbuf_t;
+struct sink_t;
+struct tagcache_meta_t;
+struct trackq_t;
 
-extern int audio_play (const char *fn);
+/**
+ * PCM format the decoder converts to. wFormatTag as in cwav_header_t: 1 for
+ * S16, 2 for S32, 3 for FLT
+ */
+struct audio_outfmt_t {
+    uint32_t sample_rate; // 0 to keep each track's own format
+    uint16_t channels;
+    uint16_t wFormatTag;
+};
+
+/**
+ * the format the output device mixes in, so that streams opened with it
+ * skip AAudio's resampler. queried once, then cached
+ *
+ * @return NCAP_OK, or NCAP_EGEN if the device could not be queried
+ */
+extern int audio_native_fmt (struct audio_outfmt_t *fmt);
+
+/** call before decoding. fmt->sample_rate 0 disables conversion */
+extern void libav_set_outfmt (const struct audio_outfmt_t *fmt);
+
+/**
+ * @param meter if not NULL, measures the decoded track. only complete if this
+ * returns NCAP_OK
+ */
+extern int libav_cvt_cwav (const char *fn_in, const char *fn_out,
+                           struct loudness_t *meter);
+
+/** free the decoders kept between tracks */
+extern void libav_deinit (void);
+
+/**
+ * decode fn_in into pb, blocking while pb is full. always closes pb
+ *
+ * @param fp_tee if not NULL, also write a WAV file to it. the file is only
+ * complete if this returns NCAP_OK and fp_tee has no error indicator set
+ * @param meter if not NULL, measures the decoded track, as libav_cvt_cwav
+ */
+extern int libav_decode_pcmbuf (const char *fn_in, struct pcmbuf_t *pb,
+                                FILE *fp_tee, struct loudness_t *meter);
+
+/**
+ * decode fn_in at its own format only to measure it. safe to call from
+ * several threads at once
+ */
+extern int libav_measure (const char *fn_in, struct loudness_t *meter);
+
+/**
+ * read the tags and duration of fn_in from its header, decoding nothing
+ * unless the header has no duration. safe to call from several threads at
+ * once. what fn_in does not have is left 0 or ""
+ */
+extern int libav_read_meta (const char *fn_in, struct tagcache_meta_t *meta);
+
+/**
+ * where audio_play and audio_play_trackq send their output. set before
+ * playing; defaults to sink_aaudio() on the device
+ */
+extern void audio_set_sink (struct sink_t *sink);
+
+/**
+ * play a WAV file written by libav_cvt_cwav. the output stream stays open
+ * for the next track of the same format until audio_close
+ *
+ * @param norm loudness normalization gain, 0 to 1. see lufstab_gain
+ */
+extern int audio_play (const char *fn, float norm);
+
+/**
+ * play every track in q on as few streams as possible, switching tracks at
+ * the exact sample boundary. the stream is only reopened on a format change
+ */
+extern int audio_play_trackq (struct trackq_t *q);
+
+/** close the output stream audio_play and audio_play_trackq left open */
+extern void audio_close (void);
 
 #endif // !AUDIO_H
@@ -8,21 +8,10 @@
 
 #ifndef NCAP_ISTEST
 #include <aaudio/AAudio.h>
-#include "logging.h"
-#else // NCAP_ISTEST
-#define loge(fmt)       puts
-#define logw(fmt)       puts
-#define logi(fmt)       puts
-#define logd(fmt)       puts
-#define logv(fmt)       puts
-#define logef(fmt, ...) printf
-#define logwf(fmt, ...) printf
-#define logif(fmt, ...) printf
-#define logdf(fmt, ...) printf
-#define logvf(fmt, ...) printf
-#endif // NCAP_ISTEST
+#endif // !NCAP_ISTEST
 
 #include "config.h"
+#include "logging.h"
 
 static const char *FILENAME = "config.c";
 
@@ -161,7 +150,19 @@ config_logdump ()
     logif ("isshuffle:\t%hhu", ncap_config.isshuffle);
     logif ("aaudio_optimize:\t%hhu", ncap_config.aaudio_optimize);
     logif ("volume:\t%hhu", ncap_config.volume);
+    logif ("isstream:\t%hhu", ncap_config.isstream);
+    logif ("loudnorm:\t%hhu", ncap_config.loudnorm);
     logif ("cur_track:\t%u", ncap_config.cur_track);
+    logif ("pcmcache_mib:\t%u", ncap_config.pcmcache_mib);
+    logif ("latency_ms:\t%u", ncap_config.latency_ms);
+    logif ("xfade_ms:\t%u", ncap_config.xfade_ms);
+    logif ("eq_preset:\t%hhu", ncap_config.eq_preset);
+    logif ("eq_preamp_db:\t%.1f", ncap_config.eq_preamp_db);
+
+    for (uint8_t i = 0; i < ncap_config.eq_nbands && i < EQ_MAX_BANDS; ++i)
+        logif ("eq_bands[%hhu]:\ttype %u, %.0f Hz, %.1f dB, q %.2f", i,
+               ncap_config.eq_bands[i].type, ncap_config.eq_bands[i].hz,
+               ncap_config.eq_bands[i].db, ncap_config.eq_bands[i].q);
     logif ("track_path_len:\t%u", ncap_config.track_path_len);
     logif ("track_path:\t%s", ncap_config.track_path);
 
@@ -172,7 +173,7 @@ int
 to_aaudio_pm (uint8_t cfg_code)
 {
 #ifndef NCAP_ISTEST
-    switch (cfg_code) {
+    switch (cfg_code & CONFIG_AAUDIO_PM_MASK) {
         case 1:
             return AAUDIO_PERFORMANCE_MODE_LOW_LATENCY;
         case 2:
@@ -8,6 +8,7 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "eq.h"
 #include "logging.h"
 
 extern pthread_mutex_t config_mx;
@@ -24,16 +25,37 @@ extern struct config_t {
      * 1: low latench (AAUDIO_PERFORMANCE_MODE_LOW_LATENCY)
      *
      * 2: low latench (AAUDIO_PERFORMANCE_MODE_POWER_SAVING)
+     *
+     * the lowest latency to ask for: streams fall back from it to power
+     * saving if the device refuses. 1 also tries exclusive (MMAP) first
+     *
+     * plus CONFIG_AAUDIO_BLOCKING to write from the audio thread instead of
+     * the data callback
      */
     uint8_t  aaudio_optimize;
-    uint8_t  volume; // 0 to 100
+    uint8_t  volume;    // 0 to 100
+    uint8_t  isstream;  // bool. decode into memory while playing
+    uint8_t  loudnorm;  // bool. normalize loudness, see lufstab.h
+    uint8_t  eq_preset; // index into eq_presets, or EQ_PRESET_CUSTOM
+    uint8_t  eq_nbands; // of eq_bands
     uint32_t cur_track;
+    uint32_t pcmcache_mib; // MiB of decoded audio kept on disk. 0 disables
+    uint32_t latency_ms;   // output latency target. 0: the device's default
+    uint32_t xfade_ms;     // crossfade between tracks. 0: gapless
+
+    // the EQ_PRESET_CUSTOM preset
+    float            eq_preamp_db;
+    struct eq_band_t eq_bands[EQ_MAX_BANDS];
+
     uint32_t track_path_len;
     char    *track_path; // path to media
 } ncap_config;
 
 extern FILE *ncap_config_fp;
 
+#define CONFIG_AAUDIO_PM_MASK  0x3
+#define CONFIG_AAUDIO_BLOCKING 0x4
+
 #define CONFIG_ETHRD       -3
 #define CONFIG_EMEM        -2
 #define CONFIG_ERR         -1
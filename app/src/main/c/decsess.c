@@ -0,0 +1,304 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/error.h>
+#include <libavutil/frame.h>
+
+#include "decsess.h"
+#include "logging.h"
+
+static const char *FILENAME = "decsess.c";
+
+// idle sessions kept. a playlist rarely mixes more than a few codecs
+#define IDLE_SLOTS 4
+
+// FLAC STREAMINFO, and the "fLaC" marker and block header some demuxers keep
+// before it
+#define FLAC_INFO_SIZ 34
+#define FLAC_HDR_SIZ  8
+
+static pthread_mutex_t pool_mx = PTHREAD_MUTEX_INITIALIZER;
+static struct decsess_t *idle[IDLE_SLOTS];
+static uint64_t          tick = 0;
+
+static struct decsess_stats_t stats;
+
+static bool
+bytes_eq (const uint8_t *a, int asiz, const uint8_t *b, int bsiz)
+{
+    return asiz == bsiz && (asiz == 0 || memcmp (a, b, asiz) == 0);
+}
+
+/**
+ * @return STREAMINFO within FLAC extradata, or NULL if there is none
+ */
+static const uint8_t *
+flac_info (const uint8_t *p, int siz)
+{
+    if (siz >= FLAC_HDR_SIZ + FLAC_INFO_SIZ && memcmp (p, "fLaC", 4) == 0)
+        return p + FLAC_HDR_SIZ;
+
+    return siz >= FLAC_INFO_SIZ ? p : NULL;
+}
+
+/**
+ * whether two STREAMINFO blocks set up the decoder the same. only the block
+ * sizes, rate, channels and bits per sample do; the frame sizes, total
+ * samples and MD5 differ from file to file
+ */
+static bool
+flac_eq (const uint8_t *a, int asiz, const uint8_t *b, int bsiz)
+{
+    const uint8_t *ia = flac_info (a, asiz);
+    const uint8_t *ib = flac_info (b, bsiz);
+
+    if (ia == NULL || ib == NULL)
+        return bytes_eq (a, asiz, b, bsiz);
+
+    // bytes 0-3 block sizes, 10 to the high nibble of 13 rate, channels, bps
+    return memcmp (ia, ib, 4) == 0 && memcmp (ia + 10, ib + 10, 3) == 0
+           && (ia[13] & 0xf0) == (ib[13] & 0xf0);
+}
+
+/**
+ * split Xiph-laced extradata into its three headers, as libavformat stores
+ * them for Vorbis
+ *
+ * @return false if p is not three laced headers
+ */
+static bool
+xiph_split (const uint8_t *p, int siz, const uint8_t *hdr[3], int len[3])
+{
+    int off = 1;
+    int sum = 0;
+
+    if (siz < 1 || p[0] != 2)
+        return false;
+
+    for (int i = 0; i < 2; ++i) {
+        len[i] = 0;
+
+        while (off < siz && p[off] == 0xff) {
+            len[i] += 0xff;
+            ++off;
+        }
+
+        if (off >= siz)
+            return false;
+
+        len[i] += p[off++];
+        sum += len[i];
+    }
+
+    if (sum > siz - off)
+        return false;
+
+    len[2] = siz - off - sum;
+    hdr[0] = p + off;
+    hdr[1] = hdr[0] + len[0];
+    hdr[2] = hdr[1] + len[1];
+
+    return true;
+}
+
+/**
+ * whether two Vorbis extradata set up the decoder the same: the
+ * identification and setup headers. the comment header between them holds
+ * the tags of each file
+ */
+static bool
+vorbis_eq (const uint8_t *a, int asiz, const uint8_t *b, int bsiz)
+{
+    const uint8_t *ha[3], *hb[3];
+    int            la[3], lb[3];
+
+    if (!xiph_split (a, asiz, ha, la) || !xiph_split (b, bsiz, hb, lb))
+        return bytes_eq (a, asiz, b, bsiz);
+
+    return bytes_eq (ha[0], la[0], hb[0], lb[0])
+           && bytes_eq (ha[2], la[2], hb[2], lb[2]);
+}
+
+/** whether a decoder opened with extradata a can decode b */
+static bool
+extradata_eq (const AVCodecParameters *a, const AVCodecParameters *b)
+{
+    switch (a->codec_id) {
+    case AV_CODEC_ID_FLAC:
+        return flac_eq (a->extradata, a->extradata_size, b->extradata,
+                        b->extradata_size);
+
+    case AV_CODEC_ID_VORBIS:
+        return vorbis_eq (a->extradata, a->extradata_size, b->extradata,
+                          b->extradata_size);
+
+    default:
+        return bytes_eq (a->extradata, a->extradata_size, b->extradata,
+                         b->extradata_size);
+    }
+}
+
+/** whether a decoder opened with a can decode a stream described by b */
+static bool
+pareq (const AVCodecParameters *a, const AVCodecParameters *b)
+{
+    return a->codec_id == b->codec_id && a->sample_rate == b->sample_rate
+           && a->format == b->format && a->block_align == b->block_align
+           && a->bits_per_coded_sample == b->bits_per_coded_sample
+           && av_channel_layout_compare (&a->ch_layout, &b->ch_layout) == 0
+           && extradata_eq (a, b);
+}
+
+static void
+destroy (struct decsess_t *s)
+{
+    swr_free (&s->swr);
+    av_channel_layout_uninit (&s->swr_ilayout);
+    av_channel_layout_uninit (&s->swr_olayout);
+    av_packet_free (&s->pkt);
+    av_frame_free (&s->frame);
+    avcodec_free_context (&s->cctx);
+    avcodec_parameters_free (&s->par);
+    free (s);
+}
+
+static struct decsess_t *
+create (const AVCodec *codec, const AVCodecParameters *par)
+{
+    struct decsess_t *s = calloc (1, sizeof *s);
+    int               avret;
+
+    if (s == NULL)
+        return NULL;
+
+    if ((s->cctx = avcodec_alloc_context3 (codec)) == NULL
+        || (s->frame = av_frame_alloc ()) == NULL
+        || (s->pkt = av_packet_alloc ()) == NULL
+        || (s->par = avcodec_parameters_alloc ()) == NULL
+        || avcodec_parameters_copy (s->par, par) < 0) {
+        loge ("ERROR: allocating decoder session failed");
+        goto err;
+    }
+
+    if ((avret = avcodec_parameters_to_context (s->cctx, par)) < 0) {
+        logef ("ERROR: avcodec_parameters_to_context failed with error "
+               "code %d: %s\n",
+               avret, av_err2str (avret));
+        goto err;
+    }
+
+    if ((avret = avcodec_open2 (s->cctx, codec, NULL)) < 0) {
+        logef ("avcodec_open2 failed with error code %d: %s\n", avret,
+               av_err2str (avret));
+        goto err;
+    }
+
+    return s;
+
+err:
+    destroy (s);
+    return NULL;
+}
+
+struct decsess_t *
+decsess_acquire (const AVCodec *codec, const AVCodecParameters *par)
+{
+    struct decsess_t *s = NULL;
+
+    pthread_mutex_lock (&pool_mx);
+
+    for (int i = 0; i < IDLE_SLOTS; ++i) {
+        if (idle[i] != NULL && pareq (idle[i]->par, par)) {
+            s       = idle[i];
+            idle[i] = NULL;
+            break;
+        }
+    }
+
+    if (s != NULL)
+        ++stats.hits;
+    else
+        ++stats.misses;
+
+    pthread_mutex_unlock (&pool_mx);
+
+    if (s == NULL) {
+        logdf ("new decoder session for %s", codec->name);
+        return create (codec, par);
+    }
+
+    logdf ("reusing decoder session for %s", codec->name);
+
+    // drops buffered frames and clears the eof state of the last drain
+    avcodec_flush_buffers (s->cctx);
+
+    return s;
+}
+
+void
+decsess_release (struct decsess_t *s, bool isok)
+{
+    struct decsess_t *evict = NULL;
+
+    if (!isok) {
+        destroy (s);
+        return;
+    }
+
+    av_frame_unref (s->frame);
+    av_packet_unref (s->pkt);
+
+    pthread_mutex_lock (&pool_mx);
+
+    s->tick = ++tick;
+
+    int slot = 0;
+
+    for (int i = 0; i < IDLE_SLOTS; ++i) {
+        if (idle[i] == NULL) {
+            slot = i;
+            break;
+        }
+
+        if (idle[i]->tick < idle[slot]->tick)
+            slot = i;
+    }
+
+    if ((evict = idle[slot]) != NULL)
+        ++stats.evictions;
+
+    idle[slot] = s;
+
+    pthread_mutex_unlock (&pool_mx);
+
+    if (evict != NULL)
+        destroy (evict);
+}
+
+void
+decsess_clear (void)
+{
+    pthread_mutex_lock (&pool_mx);
+
+    for (int i = 0; i < IDLE_SLOTS; ++i) {
+        if (idle[i] != NULL) {
+            destroy (idle[i]);
+            idle[i] = NULL;
+        }
+    }
+
+    pthread_mutex_unlock (&pool_mx);
+}
+
+void
+decsess_stats (struct decsess_stats_t *out)
+{
+    pthread_mutex_lock (&pool_mx);
+    *out = stats;
+    pthread_mutex_unlock (&pool_mx);
+}
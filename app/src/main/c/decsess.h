@@ -0,0 +1,58 @@
+#pragma once
+
+#ifndef DECSESS_H
+#define DECSESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <libavcodec/avcodec.h>
+#include <libswresample/swresample.h>
+
+/**
+ * An opened decoder with its frame and packet. Idle sessions are pooled by
+ * codec_id and stream parameters; acquiring a matching one only flushes it,
+ * which skips the context allocation and codec open between tracks.
+ */
+struct decsess_t {
+    AVCodecContext     *cctx;
+    AVFrame            *frame;
+    AVPacket           *pkt;
+    AVCodecParameters  *par;  // what cctx was opened with
+    uint64_t            tick; // when last released, for eviction
+
+    // converter to the output format, NULL until first needed. kept with
+    // the decoder since the decoded format rarely changes between tracks
+    SwrContext         *swr;
+    enum AVSampleFormat swr_ifmt;
+    int                 swr_irate;
+    AVChannelLayout     swr_ilayout;
+    enum AVSampleFormat swr_ofmt;
+    int                 swr_orate;
+    AVChannelLayout     swr_olayout;
+};
+
+struct decsess_stats_t {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+/**
+ * @return an opened, flushed session for par, or NULL on failure
+ */
+extern struct decsess_t *decsess_acquire (const AVCodec *codec,
+                                          const AVCodecParameters *par);
+
+/**
+ * return s to the pool. pass isok false after a decode error so that a
+ * decoder in an unknown state is freed rather than reused
+ */
+extern void decsess_release (struct decsess_t *s, bool isok);
+
+/** free every idle session */
+extern void decsess_clear (void);
+
+extern void decsess_stats (struct decsess_stats_t *stats);
+
+#endif // !DECSESS_H
@@ -0,0 +1,603 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif // __linux__
+
+#include "audio.h"
+#include "dirscan.h"
+#include "logging.h"
+#include "strvec.h"
+
+static const char *FILENAME = "dirscan.c";
+
+#define DENTS_SIZ 32768 // bytes of entries per getdents64
+
+#define OPEN_FLAGS (O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
+
+const char *const dirscan_audio_exts[] = {
+    "aac", "aif", "aiff", "ape", "flac", "m4a", "mka",
+    "mp3", "oga", "ogg",  "opus", "wav", "wma", "wv",
+    NULL,
+};
+
+#ifdef NCAP_ISTEST
+bool dirscan_isuntyped = false;
+#endif // NCAP_ISTEST
+
+/** a directory to scan: open, or only named while the queue is full */
+struct dir_t {
+    int    fd;     // -1 until opened
+    char  *rel;    // path from the root, NULL for the root itself
+    size_t rellen; // without the NUL
+};
+
+struct scan_t {
+    pthread_mutex_t mx;
+    pthread_cond_t  cv; // something was queued, or the scan is done
+
+    struct dir_t q[DIRSCAN_QUEUE_CAP];
+    size_t       head;
+    size_t       len;
+    size_t       nreserved; // slots taken by workers opening a directory
+    int          nbusy;     // workers scanning; they may queue more
+
+    int                rootfd;
+    size_t             rootlen;
+    const char *const *exts;
+};
+
+struct worker_t {
+    struct scan_t *scan;
+    char          *dents; // DENTS_SIZ, getdents64 only
+    int            ret;
+
+    // NUL separated paths found
+    char  *found;
+    size_t found_len;
+    size_t found_cap;
+    size_t nfound;
+
+    // directories that did not fit in the queue, by path
+    struct dir_t *stack;
+    size_t        nstack;
+    size_t        stack_cap;
+};
+
+// reading a directory
+
+#ifdef __linux__
+struct dirent64_t {
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+#endif // __linux__
+
+struct dirit_t {
+    int fd;
+#ifdef __linux__
+    char *buf;
+    long  len;
+    long  off;
+#else
+    DIR *dp;
+#endif // __linux__
+};
+
+/** takes fd, closed by dirit_close. @return NCAP_OK or NCAP_EIO */
+static int
+dirit_open (struct dirit_t *it, int fd, char *dents)
+{
+    it->fd = fd;
+
+#ifdef __linux__
+    it->buf = dents;
+    it->len = 0;
+    it->off = 0;
+#else
+    (void)dents;
+
+    if ((it->dp = fdopendir (fd)) == NULL) {
+        close (fd);
+        return NCAP_EIO;
+    }
+#endif // __linux__
+
+    return NCAP_OK;
+}
+
+/** @return 1 with the next entry, 0 at the end, or -1 on error */
+static int
+dirit_next (struct dirit_t *it, const char **name, unsigned char *type)
+{
+#ifdef __linux__
+    if (it->off >= it->len) {
+        it->len = syscall (SYS_getdents64, it->fd, it->buf, DENTS_SIZ);
+        it->off = 0;
+
+        if (it->len <= 0)
+            return it->len < 0 ? -1 : 0;
+    }
+
+    const struct dirent64_t *ent = (const void *)(it->buf + it->off);
+
+    it->off += ent->d_reclen;
+    *name = ent->d_name;
+    *type = ent->d_type;
+#else
+    struct dirent *ent;
+
+    errno = 0;
+
+    if ((ent = readdir (it->dp)) == NULL)
+        return errno != 0 ? -1 : 0;
+
+    *name = ent->d_name;
+    *type = ent->d_type;
+#endif // __linux__
+
+    return 1;
+}
+
+static void
+dirit_close (struct dirit_t *it)
+{
+#ifdef __linux__
+    close (it->fd);
+#else
+    closedir (it->dp);
+#endif // __linux__
+}
+
+// what a worker found
+
+bool
+dirscan_isext (const char *name, const char *const *exts)
+{
+    const char *dot = strrchr (name, '.');
+
+    if (exts == NULL)
+        return true;
+
+    if (dot == NULL)
+        return false;
+
+    for (; *exts != NULL; ++exts)
+        if (strcasecmp (dot + 1, *exts) == 0)
+            return true;
+
+    return false;
+}
+
+/** @return rel/name in a new string, or NULL */
+static char *
+join (const struct dir_t *d, const char *name, size_t namelen)
+{
+    char *p = malloc (d->rellen + namelen + 2);
+
+    if (p == NULL)
+        return NULL;
+
+    if (d->rel == NULL) {
+        memcpy (p, name, namelen + 1);
+    } else {
+        memcpy (p, d->rel, d->rellen);
+        p[d->rellen] = '/';
+        memcpy (p + d->rellen + 1, name, namelen + 1);
+    }
+
+    return p;
+}
+
+/** @return whether rel/name joined to the root fits in PATH_MAX */
+static bool
+fits (const struct worker_t *w, const struct dir_t *d, const char *name,
+      size_t namelen)
+{
+    if (w->scan->rootlen + 1 + d->rellen + 1 + namelen < PATH_MAX)
+        return true;
+
+    logwf ("WARN: skipping `%s/%s': the path is too long",
+           d->rel != NULL ? d->rel : ".", name);
+    return false;
+}
+
+static void
+add_file (struct worker_t *w, const struct dir_t *d, const char *name,
+          size_t namelen)
+{
+    const size_t siz = (d->rel != NULL ? d->rellen + 1 : 0) + namelen + 1;
+
+    if (w->found_len + siz > w->found_cap) {
+        size_t cap = w->found_cap > 0 ? w->found_cap : 4096;
+        char  *p;
+
+        while (cap < w->found_len + siz)
+            cap <<= 1;
+
+        if ((p = realloc (w->found, cap)) == NULL) {
+            w->ret = NCAP_EALLOC;
+            return;
+        }
+
+        w->found     = p;
+        w->found_cap = cap;
+    }
+
+    char *dst = w->found + w->found_len;
+
+    if (d->rel != NULL) {
+        memcpy (dst, d->rel, d->rellen);
+        dst[d->rellen] = '/';
+        dst += d->rellen + 1;
+    }
+
+    memcpy (dst, name, namelen + 1);
+    w->found_len += siz;
+    ++w->nfound;
+}
+
+// the queue
+
+/** @return whether a slot was reserved for a directory about to be opened */
+static bool
+reserve (struct scan_t *scan)
+{
+    bool isroom;
+
+    pthread_mutex_lock (&scan->mx);
+
+    if ((isroom = scan->len + scan->nreserved < DIRSCAN_QUEUE_CAP))
+        ++scan->nreserved;
+
+    pthread_mutex_unlock (&scan->mx);
+
+    return isroom;
+}
+
+/** fill a reserved slot, or give it back if d->fd is -1 */
+static void
+enqueue (struct scan_t *scan, const struct dir_t *d)
+{
+    pthread_mutex_lock (&scan->mx);
+
+    --scan->nreserved;
+
+    if (d->fd >= 0) {
+        scan->q[(scan->head + scan->len++) % DIRSCAN_QUEUE_CAP] = *d;
+        pthread_cond_signal (&scan->cv);
+    }
+
+    pthread_mutex_unlock (&scan->mx);
+}
+
+static void
+push_stack (struct worker_t *w, const struct dir_t *d)
+{
+    if (w->nstack == w->stack_cap) {
+        const size_t  cap = w->stack_cap > 0 ? w->stack_cap << 1 : 16;
+        struct dir_t *p   = realloc (w->stack, cap * sizeof *p);
+
+        if (p == NULL) {
+            w->ret = NCAP_EALLOC;
+            free (d->rel);
+            return;
+        }
+
+        w->stack     = p;
+        w->stack_cap = cap;
+    }
+
+    w->stack[w->nstack++] = *d;
+}
+
+/** queue dir's subdirectory name, or keep it if the queue is full */
+static void
+add_dir (struct worker_t *w, const struct dir_t *dir, const char *name,
+         size_t namelen)
+{
+    struct dir_t d = { .fd = -1, .rellen = dir->rellen + 1 + namelen };
+
+    if (dir->rel == NULL)
+        d.rellen = namelen;
+
+    if ((d.rel = join (dir, name, namelen)) == NULL) {
+        w->ret = NCAP_EALLOC;
+        return;
+    }
+
+    if (!reserve (w->scan)) {
+        push_stack (w, &d);
+        return;
+    }
+
+    if ((d.fd = openat (dir->fd, name, OPEN_FLAGS)) < 0) {
+        logwf ("WARN: skipping `%s': %s", d.rel, strerror (errno));
+        free (d.rel);
+    }
+
+    enqueue (w->scan, &d);
+}
+
+// scanning
+
+/** @return an entry's DT_ type, asking the filesystem if it did not say */
+static unsigned char
+entry_type (int dirfd, const char *name, unsigned char type)
+{
+    struct stat st;
+
+#ifdef NCAP_ISTEST
+    if (dirscan_isuntyped)
+        type = DT_UNKNOWN;
+#endif // NCAP_ISTEST
+
+    if (type != DT_UNKNOWN)
+        return type;
+
+    if (fstatat (dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+        return DT_UNKNOWN;
+
+    return S_ISREG (st.st_mode) ? DT_REG
+           : S_ISDIR (st.st_mode) ? DT_DIR
+                                  : DT_UNKNOWN;
+}
+
+/** scan the open directory d, closing it and freeing d->rel */
+static void
+scan_dir (struct worker_t *w, struct dir_t *d)
+{
+    struct dirit_t it;
+    const char    *name;
+    unsigned char  type;
+    int            stat;
+
+    if (dirit_open (&it, d->fd, w->dents) != NCAP_OK) {
+        logwf ("WARN: skipping `%s': %s", d->rel != NULL ? d->rel : ".",
+               strerror (errno));
+        free (d->rel);
+        return;
+    }
+
+    while (w->ret == NCAP_OK && (stat = dirit_next (&it, &name, &type)) > 0) {
+        if (name[0] == '.'
+            && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+
+        const size_t namelen = strlen (name);
+
+        switch (entry_type (it.fd, name, type)) {
+            case DT_REG:
+                if (dirscan_isext (name, w->scan->exts)
+                    && fits (w, d, name, namelen))
+                    add_file (w, d, name, namelen);
+                break;
+            case DT_DIR:
+                if (fits (w, d, name, namelen))
+                    add_dir (w, d, name, namelen);
+                break;
+            default: // links, devices, and what could not be typed
+                break;
+        }
+    }
+
+    if (stat < 0)
+        logwf ("WARN: reading `%s' failed: %s", d->rel != NULL ? d->rel : ".",
+               strerror (errno));
+
+    dirit_close (&it);
+    free (d->rel);
+}
+
+/** scan what did not fit in the queue, handing it over when there is room */
+static void
+scan_stack (struct worker_t *w)
+{
+    struct scan_t *const scan = w->scan;
+
+    while (w->nstack > 0) {
+        struct dir_t d = w->stack[--w->nstack];
+
+        // the bottom of the stack goes to idle workers
+        if (w->nstack > 0 && reserve (scan)) {
+            struct dir_t *const far = &w->stack[0];
+            struct dir_t        q   = *far;
+
+            *far = d;
+            d    = q;
+
+            if ((d.fd = openat (scan->rootfd, d.rel, OPEN_FLAGS)) < 0) {
+                logwf ("WARN: skipping `%s': %s", d.rel, strerror (errno));
+                free (d.rel);
+            }
+
+            enqueue (scan, &d);
+            continue;
+        }
+
+        if ((d.fd = openat (scan->rootfd, d.rel, OPEN_FLAGS)) < 0) {
+            logwf ("WARN: skipping `%s': %s", d.rel, strerror (errno));
+            free (d.rel);
+            continue;
+        }
+
+        scan_dir (w, &d);
+    }
+}
+
+static void *
+tfn_scan (void *args)
+{
+    struct worker_t *const w    = args;
+    struct scan_t *const   scan = w->scan;
+    struct dir_t           d;
+
+    pthread_mutex_lock (&scan->mx);
+
+    for (;;) {
+        // an empty queue with no worker busy stays empty
+        while (scan->len == 0 && scan->nbusy > 0)
+            pthread_cond_wait (&scan->cv, &scan->mx);
+
+        if (scan->len == 0)
+            break;
+
+        d          = scan->q[scan->head];
+        scan->head = (scan->head + 1) % DIRSCAN_QUEUE_CAP;
+        --scan->len;
+        ++scan->nbusy;
+
+        pthread_mutex_unlock (&scan->mx);
+
+        scan_dir (w, &d);
+        scan_stack (w);
+
+        pthread_mutex_lock (&scan->mx);
+
+        if (--scan->nbusy == 0 && scan->len == 0)
+            pthread_cond_broadcast (&scan->cv);
+    }
+
+    pthread_mutex_unlock (&scan->mx);
+
+    return NULL;
+}
+
+static int
+cmp_str (const void *a, const void *b)
+{
+    return strcmp (*(char *const *)a, *(char *const *)b);
+}
+
+/** push what the workers found onto sv. @return NCAP_OK or NCAP_EALLOC */
+static int
+merge (strvec_t *sv, const struct worker_t *ws, int nworkers)
+{
+    const size_t siz0   = sv->siz;
+    size_t       nfound = 0;
+    size_t       nbytes = 0;
+
+    for (int i = 0; i < nworkers; ++i) {
+        nfound += ws[i].nfound;
+        nbytes += ws[i].found_len;
+    }
+
+    for (int i = 0; i < nworkers; ++i) {
+        // the buffers are laid out as strvec_pushn takes them
+        if ((i == 0 && strvec_reserve (sv, nfound, nbytes) != STRQUEUE_OK)
+            || strvec_pushn (sv, ws[i].found, ws[i].found_len, ws[i].nfound)
+                   != STRQUEUE_OK) {
+            while (sv->siz > siz0)
+                strvec_popb (sv);
+
+            return NCAP_EALLOC;
+        }
+    }
+
+    qsort (sv->ptr + siz0, sv->siz - siz0, sizeof *sv->ptr, cmp_str);
+
+    return NCAP_OK;
+}
+
+int
+dirscan (strvec_t *sv, const char *dir, const char *const *exts,
+         int nthreads)
+{
+    struct worker_t ws[DIRSCAN_MAX_THREADS] = { 0 };
+    pthread_t       tids[DIRSCAN_MAX_THREADS];
+    struct scan_t   scan   = { .rootlen = strlen (dir), .exts = exts };
+    const size_t    siz0   = sv->siz;
+    int             nspawn = 0;
+    int             ret    = NCAP_OK;
+
+    if ((scan.rootfd = open (dir, OPEN_FLAGS)) < 0) {
+        logef ("ERROR: opening `%s' failed: %s", dir, strerror (errno));
+        return NCAP_EIO;
+    }
+
+    // the root through an fd of its own: scan_dir closes it
+    if ((scan.q[0].fd = openat (scan.rootfd, ".", OPEN_FLAGS)) < 0) {
+        logef ("ERROR: opening `%s' failed: %s", dir, strerror (errno));
+        close (scan.rootfd);
+        return NCAP_EIO;
+    }
+
+    scan.len = 1;
+    pthread_mutex_init (&scan.mx, NULL);
+    pthread_cond_init (&scan.cv, NULL);
+
+    nthreads = nthreads < 1                     ? 1
+               : nthreads > DIRSCAN_MAX_THREADS ? DIRSCAN_MAX_THREADS
+                                                : nthreads;
+
+    for (int i = 0; i < nthreads; ++i) {
+        ws[i].scan = &scan;
+
+#ifdef __linux__
+        if ((ws[i].dents = malloc (DENTS_SIZ)) == NULL) {
+            nthreads = i;
+            break;
+        }
+#endif // __linux__
+    }
+
+    if (nthreads == 0) {
+        close (scan.q[0].fd);
+        ret = NCAP_EALLOC;
+        goto exit;
+    }
+
+    // this thread is one of them
+    while (nspawn + 1 < nthreads
+           && pthread_create (&tids[nspawn], NULL, tfn_scan, &ws[nspawn + 1])
+                  == 0)
+        ++nspawn;
+
+    tfn_scan (&ws[0]);
+
+    for (int i = 0; i < nspawn; ++i)
+        pthread_join (tids[i], NULL);
+
+    for (int i = 0; i <= nspawn; ++i)
+        if (ws[i].ret != NCAP_OK)
+            ret = ws[i].ret;
+
+    if (ret == NCAP_OK)
+        ret = merge (sv, ws, nspawn + 1);
+
+    logif ("scanned `%s' on %d threads: %zu files", dir, nspawn + 1,
+           sv->siz - siz0);
+
+exit:
+    for (int i = 0; i < DIRSCAN_MAX_THREADS; ++i) {
+        free (ws[i].dents);
+        free (ws[i].found);
+
+        while (ws[i].nstack > 0)
+            free (ws[i].stack[--ws[i].nstack].rel);
+
+        free (ws[i].stack);
+    }
+
+    pthread_cond_destroy (&scan.cv);
+    pthread_mutex_destroy (&scan.mx);
+    close (scan.rootfd);
+
+    return ret;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#ifndef DIRSCAN_H
+#define DIRSCAN_H
+
+#include <stdbool.h>
+
+#include "strvec.h"
+
+/**
+ * Recursive directory scanner. Worker threads share a bounded queue of open
+ * directory fds. Each worker reads its directory in large batches
+ * (getdents64 on Linux and Android) and opens subdirectories relative to
+ * their parent's fd. When the queue is full, a worker keeps the extra
+ * subdirectories by path and scans them itself. File names go into a buffer
+ * per worker, and the buffers are merged once every worker is done.
+ *
+ * Some filesystems report no entry types (DT_UNKNOWN); those entries are
+ * typed with fstatat. Symbolic links are skipped, so a link cannot make the
+ * scan loop.
+ */
+
+#define DIRSCAN_MAX_THREADS 16
+#define DIRSCAN_QUEUE_CAP   64 // open directory fds waiting for a worker
+
+/** the audio files the player lists, for dirscan's exts */
+extern const char *const dirscan_audio_exts[];
+
+/**
+ * @param exts as for dirscan
+ * @return whether name ends in one of exts
+ */
+extern bool dirscan_isext (const char *name, const char *const *exts);
+
+#ifdef NCAP_ISTEST
+/** treat every entry as DT_UNKNOWN, as some filesystems report them */
+extern bool dirscan_isuntyped;
+#endif // NCAP_ISTEST
+
+/**
+ * push the regular files under dir onto sv, as paths relative to dir, in
+ * strcmp order. skips paths that would not fit in PATH_MAX once joined to
+ * dir
+ *
+ * @param exts NULL terminated. keep files with one of these extensions
+ * (compared without case, e.g. "flac"). NULL to keep every file
+ * @param nthreads clamped to 1 to DIRSCAN_MAX_THREADS. this thread is one
+ * of them
+ * @return NCAP_OK, NCAP_EIO if dir cannot be read, or NCAP_EALLOC. on
+ * error sv keeps what it held before
+ */
+extern int dirscan (strvec_t *sv, const char *dir, const char *const *exts,
+                    int nthreads);
+
+#endif // !DIRSCAN_H
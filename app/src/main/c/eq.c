@@ -0,0 +1,526 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "eq.h"
+#include "simd.h"
+
+// the largest float below 2^31, where S32 output is clamped
+#define S32_MAXF 2147483520.0f
+
+// frames widened to float at a time
+#define CHUNK 128
+
+// state below this is flushed to 0, so a decaying tail never goes denormal
+#define DENORM 1e-25f
+
+const struct eq_preset_t eq_presets[] = {
+    { .name = "off" },
+    {
+        .name      = "bass",
+        .preamp_db = -5,
+        .nbands    = 1,
+        .bands     = { { 105, 5, 0.7f, EQ_LOWSHELF } },
+    },
+    {
+        .name      = "treble",
+        .preamp_db = -4,
+        .nbands    = 1,
+        .bands     = { { 8000, 4, 0.7f, EQ_HIGHSHELF } },
+    },
+    {
+        .name      = "vocal",
+        .preamp_db = -3,
+        .nbands    = 5,
+        .bands     = { { 100, -2, 1, EQ_LOWSHELF },
+                       { 300, -1.5f, 1, EQ_PEAK },
+                       { 1500, 2, 1, EQ_PEAK },
+                       { 3000, 3, 1.2f, EQ_PEAK },
+                       { 10000, -1, 1, EQ_HIGHSHELF } },
+    },
+    {
+        // octave bands, as a 10 band graphic EQ
+        .name      = "smile",
+        .preamp_db = -4,
+        .nbands    = 10,
+        .bands     = { { 31, 4, 1.41f, EQ_PEAK },
+                       { 62, 3, 1.41f, EQ_PEAK },
+                       { 125, 2, 1.41f, EQ_PEAK },
+                       { 250, 0, 1.41f, EQ_PEAK },
+                       { 500, -1, 1.41f, EQ_PEAK },
+                       { 1000, -1, 1.41f, EQ_PEAK },
+                       { 2000, 0, 1.41f, EQ_PEAK },
+                       { 4000, 2, 1.41f, EQ_PEAK },
+                       { 8000, 3, 1.41f, EQ_PEAK },
+                       { 16000, 4, 1.41f, EQ_PEAK } },
+    },
+};
+
+const uint8_t eq_npresets = sizeof eq_presets / sizeof *eq_presets;
+
+/**
+ * RBJ cookbook coefficients of band at rate
+ *
+ * @return whether band is a filter at rate, into c: b0 b1 b2 a1 a2 over a0
+ */
+static bool
+design (const struct eq_band_t *band, double rate, double c[5])
+{
+    if (!(band->hz > 0) || band->hz >= rate / 2)
+        return false;
+
+    const double a  = pow (10, band->db / 40.0);
+    const double w0 = 2 * M_PI * band->hz / rate;
+    const double cw = cos (w0);
+    const double sw = sin (w0);
+    double       b0, b1, b2, a0, a1, a2;
+
+    if (band->type == EQ_PEAK) {
+        const double alpha = sw / (2 * (band->q > 0 ? band->q : M_SQRT1_2));
+
+        b0 = 1 + alpha * a;
+        b1 = -2 * cw;
+        b2 = 1 - alpha * a;
+        a0 = 1 + alpha / a;
+        a1 = -2 * cw;
+        a2 = 1 - alpha / a;
+    } else if (band->type == EQ_LOWSHELF || band->type == EQ_HIGHSHELF) {
+        const double s  = band->q > 0 && band->q < 1 ? band->q : 1;
+        const double sa = 2 * sqrt (a) * sw / 2
+                          * sqrt ((a + 1 / a) * (1 / s - 1) + 2);
+        const double k  = band->type == EQ_LOWSHELF ? 1 : -1;
+
+        // k flips the signs where the high shelf differs from the low
+        b0 = a * ((a + 1) - k * (a - 1) * cw + sa);
+        b1 = k * 2 * a * ((a - 1) - k * (a + 1) * cw);
+        b2 = a * ((a + 1) - k * (a - 1) * cw - sa);
+        a0 = (a + 1) + k * (a - 1) * cw + sa;
+        a1 = -k * 2 * ((a - 1) + k * (a + 1) * cw);
+        a2 = (a + 1) + k * (a - 1) * cw - sa;
+    } else {
+        return false;
+    }
+
+    c[0] = b0 / a0;
+    c[1] = b1 / a0;
+    c[2] = b2 / a0;
+    c[3] = a1 / a0;
+    c[4] = a2 / a0;
+
+    return true;
+}
+
+void
+eq_init (struct eq_t *this, int rate, int channels,
+         const struct eq_band_t *bands, int nbands, float preamp_db)
+{
+    double c[5];
+
+    this->nbands   = 0;
+    this->channels = channels;
+
+    for (int s = 0; s < EQ_NSTAGES; ++s) {
+        this->b0[s] = 1;
+        this->b1[s] = this->b2[s] = this->a1[s] = this->a2[s] = 0;
+    }
+
+    memset (this->z1, 0, sizeof this->z1);
+    memset (this->z2, 0, sizeof this->z2);
+
+    if (channels < 1 || channels > EQ_MAX_CHANNELS)
+        return;
+
+    for (int i = 0; i < nbands && i < EQ_MAX_BANDS; ++i) {
+        if (!design (&bands[i], rate, c))
+            continue;
+
+        const int s = this->nbands++;
+
+        this->b0[s] = (float)c[0];
+        this->b1[s] = (float)c[1];
+        this->b2[s] = (float)c[2];
+        this->a1[s] = (float)c[3];
+        this->a2[s] = (float)c[4];
+    }
+
+    // the first stage's feedforward, or a stage of its own
+    if (preamp_db != 0) {
+        const float g = powf (10, preamp_db / 20);
+
+        this->b0[0] *= g;
+        this->b1[0] *= g;
+        this->b2[0] *= g;
+
+        if (this->nbands == 0)
+            this->nbands = 1;
+    }
+}
+
+/** the stages in order over n interleaved frames */
+static void
+cascade_scalar (struct eq_t *this, float *x, size_t n)
+{
+    const size_t c = this->channels;
+
+    for (int s = 0; s < this->nbands; ++s) {
+        const float b0 = this->b0[s], b1 = this->b1[s], b2 = this->b2[s];
+        const float a1 = this->a1[s], a2 = this->a2[s];
+
+        for (size_t ch = 0; ch < c; ++ch) {
+            float z1 = this->z1[s][ch];
+            float z2 = this->z2[s][ch];
+
+            for (size_t i = ch; i < n * c; i += c) {
+                const float in = x[i];
+                const float y  = b0 * in + z1;
+
+                z1   = b1 * in - a1 * y + z2;
+                z2   = b2 * in - a2 * y;
+                x[i] = y;
+            }
+
+            this->z1[s][ch] = z1;
+            this->z2[s][ch] = z2;
+        }
+    }
+}
+
+/*
+ * the stereo kernels run a group of consecutive stages as a pipeline. pair
+ * k of the vector's lanes is stage j + W - 1 - k of the group: the top pair
+ * takes frame i, and each pair below takes what the pair above it put out
+ * on the step before. so pair 0 puts out frame i - (W - 1) of the group's
+ * output, and the first and last W - 1 steps only update the pairs that have
+ * a frame
+ */
+
+#if defined(SIMD_HAS_NEON)
+
+/** stages j (lanes 2, 3) and j + 1 (lanes 0, 1) */
+static void
+group2_v128 (struct eq_t *this, int j, float *x, size_t n)
+{
+#define PAIR(v) vcombine_f32 (vdup_n_f32 (v[j + 1]), vdup_n_f32 (v[j]))
+    const float32x4_t b0 = PAIR (this->b0), b1 = PAIR (this->b1);
+    const float32x4_t b2 = PAIR (this->b2), a1 = PAIR (this->a1);
+    const float32x4_t a2 = PAIR (this->a2);
+#undef PAIR
+
+    // lanes 2, 3 only on the first step, 0, 1 only on the last
+    const uint32x4_t first = vcombine_u32 (vdup_n_u32 (0), vdup_n_u32 (~0u));
+    const uint32x4_t last  = vmvnq_u32 (first);
+
+    float32x4_t z1 = vcombine_f32 (vld1_f32 (this->z1[j + 1]),
+                                   vld1_f32 (this->z1[j]));
+    float32x4_t z2 = vcombine_f32 (vld1_f32 (this->z2[j + 1]),
+                                   vld1_f32 (this->z2[j]));
+    float32x4_t carry = vdupq_n_f32 (0);
+
+    for (size_t s = 0; s <= n; ++s) {
+        const float32x4_t in = vcombine_f32 (
+            vget_high_f32 (carry), s < n ? vld1_f32 (x + 2 * s)
+                                         : vdup_n_f32 (0));
+        const float32x4_t y = vaddq_f32 (vmulq_f32 (b0, in), z1);
+        const float32x4_t nz1 = vaddq_f32 (
+            vsubq_f32 (vmulq_f32 (b1, in), vmulq_f32 (a1, y)), z2);
+        const float32x4_t nz2 = vsubq_f32 (vmulq_f32 (b2, in),
+                                           vmulq_f32 (a2, y));
+
+        if (s > 0 && s < n) {
+            z1 = nz1;
+            z2 = nz2;
+        } else {
+            const uint32x4_t m = s == 0 ? first : last;
+
+            z1 = vbslq_f32 (m, nz1, z1);
+            z2 = vbslq_f32 (m, nz2, z2);
+        }
+
+        if (s > 0)
+            vst1_f32 (x + 2 * (s - 1), vget_low_f32 (y));
+
+        carry = y;
+    }
+
+    vst1_f32 (this->z1[j + 1], vget_low_f32 (z1));
+    vst1_f32 (this->z1[j], vget_high_f32 (z1));
+    vst1_f32 (this->z2[j + 1], vget_low_f32 (z2));
+    vst1_f32 (this->z2[j], vget_high_f32 (z2));
+}
+
+#elif defined(SIMD_HAS_X86)
+
+static inline __m128
+select_v128 (__m128 m, __m128 a, __m128 b)
+{
+    return _mm_or_ps (_mm_and_ps (m, a), _mm_andnot_ps (m, b));
+}
+
+static inline __m128
+load_pair_v128 (const float *hi, const float *lo)
+{
+    const __m128 z = _mm_setzero_ps ();
+    return _mm_loadh_pi (_mm_loadl_pi (z, (const __m64 *)hi),
+                         (const __m64 *)lo);
+}
+
+/** stages j (lanes 2, 3) and j + 1 (lanes 0, 1) */
+static void
+group2_v128 (struct eq_t *this, int j, float *x, size_t n)
+{
+#define PAIR(v) _mm_setr_ps (v[j + 1], v[j + 1], v[j], v[j])
+    const __m128 b0 = PAIR (this->b0), b1 = PAIR (this->b1);
+    const __m128 b2 = PAIR (this->b2), a1 = PAIR (this->a1);
+    const __m128 a2 = PAIR (this->a2);
+#undef PAIR
+
+    // lanes 2, 3 only on the first step, 0, 1 only on the last
+    const __m128 first
+        = _mm_castsi128_ps (_mm_setr_epi32 (0, 0, ~0, ~0));
+    const __m128 last = _mm_castsi128_ps (_mm_setr_epi32 (~0, ~0, 0, 0));
+
+    __m128 z1    = load_pair_v128 (this->z1[j + 1], this->z1[j]);
+    __m128 z2    = load_pair_v128 (this->z2[j + 1], this->z2[j]);
+    __m128 carry = _mm_setzero_ps ();
+
+    for (size_t s = 0; s <= n; ++s) {
+        const __m128 hi = _mm_movehl_ps (carry, carry);
+        const __m128 in = s < n ? _mm_loadh_pi (hi, (const __m64 *)(x + 2 * s))
+                                : _mm_movelh_ps (hi, _mm_setzero_ps ());
+        const __m128 y  = _mm_add_ps (_mm_mul_ps (b0, in), z1);
+        const __m128 nz1 = _mm_add_ps (
+            _mm_sub_ps (_mm_mul_ps (b1, in), _mm_mul_ps (a1, y)), z2);
+        const __m128 nz2 = _mm_sub_ps (_mm_mul_ps (b2, in),
+                                       _mm_mul_ps (a2, y));
+
+        if (s > 0 && s < n) {
+            z1 = nz1;
+            z2 = nz2;
+        } else {
+            const __m128 m = s == 0 ? first : last;
+
+            z1 = select_v128 (m, nz1, z1);
+            z2 = select_v128 (m, nz2, z2);
+        }
+
+        if (s > 0)
+            _mm_storel_pi ((__m64 *)(x + 2 * (s - 1)), y);
+
+        carry = y;
+    }
+
+    _mm_storel_pi ((__m64 *)this->z1[j + 1], z1);
+    _mm_storeh_pi ((__m64 *)this->z1[j], z1);
+    _mm_storel_pi ((__m64 *)this->z2[j + 1], z2);
+    _mm_storeh_pi ((__m64 *)this->z2[j], z2);
+}
+
+/** stages j to j + 3: stage j + 3 - k in pair k */
+SIMD_TARGET_AVX2 static void
+group4_v256 (struct eq_t *this, int j, float *x, size_t n)
+{
+#define QUAD(v)                                                               \
+    _mm256_setr_ps (v[j + 3], v[j + 3], v[j + 2], v[j + 2], v[j + 1],        \
+                    v[j + 1], v[j], v[j])
+    const __m256 b0 = QUAD (this->b0), b1 = QUAD (this->b1);
+    const __m256 b2 = QUAD (this->b2), a1 = QUAD (this->a1);
+    const __m256 a2 = QUAD (this->a2);
+    __m256       z1 = _mm256_setr_ps (
+        this->z1[j + 3][0], this->z1[j + 3][1], this->z1[j + 2][0],
+        this->z1[j + 2][1], this->z1[j + 1][0], this->z1[j + 1][1],
+        this->z1[j][0], this->z1[j][1]);
+    __m256 z2 = _mm256_setr_ps (
+        this->z2[j + 3][0], this->z2[j + 3][1], this->z2[j + 2][0],
+        this->z2[j + 2][1], this->z2[j + 1][0], this->z2[j + 1][1],
+        this->z2[j][0], this->z2[j][1]);
+#undef QUAD
+
+    const __m256i down  = _mm256_setr_epi32 (2, 3, 4, 5, 6, 7, 6, 7);
+    __m256        carry = _mm256_setzero_ps ();
+
+    for (size_t s = 0; s < n + 3; ++s) {
+        const __m256 xin
+            = s < n ? _mm256_castpd_ps (
+                          _mm256_broadcast_sd ((const double *)(x + 2 * s)))
+                    : _mm256_setzero_ps ();
+        const __m256 in = _mm256_blend_ps (
+            _mm256_permutevar8x32_ps (carry, down), xin, 0xc0);
+        const __m256 y   = _mm256_add_ps (_mm256_mul_ps (b0, in), z1);
+        const __m256 nz1 = _mm256_add_ps (
+            _mm256_sub_ps (_mm256_mul_ps (b1, in), _mm256_mul_ps (a1, y)),
+            z2);
+        const __m256 nz2 = _mm256_sub_ps (_mm256_mul_ps (b2, in),
+                                          _mm256_mul_ps (a2, y));
+
+        if (s >= 3 && s < n) {
+            z1 = nz1;
+            z2 = nz2;
+        } else {
+            // pair k has frame s - 3 + k
+            int32_t valid[8];
+
+            for (int l = 0; l < 8; ++l) {
+                const size_t f = s + l / 2; // the frame + 3
+                valid[l]       = f >= 3 && f - 3 < n ? ~0 : 0;
+            }
+
+            const __m256 m = _mm256_castsi256_ps (
+                _mm256_loadu_si256 ((const __m256i *)valid));
+
+            z1 = _mm256_blendv_ps (z1, nz1, m);
+            z2 = _mm256_blendv_ps (z2, nz2, m);
+        }
+
+        if (s >= 3)
+            _mm_storel_pi ((__m64 *)(x + 2 * (s - 3)),
+                           _mm256_castps256_ps128 (y));
+
+        carry = y;
+    }
+
+    float v1[8], v2[8];
+
+    _mm256_storeu_ps (v1, z1);
+    _mm256_storeu_ps (v2, z2);
+
+    for (int k = 0; k < 4; ++k) {
+        for (int ch = 0; ch < 2; ++ch) {
+            this->z1[j + 3 - k][ch] = v1[2 * k + ch];
+            this->z2[j + 3 - k][ch] = v2[2 * k + ch];
+        }
+    }
+}
+
+#endif
+
+static void
+cascade (struct eq_t *this, float *x, size_t n, bool issimd)
+{
+    const int level = simd_level ();
+
+    (void)level;
+
+    if (n == 0)
+        return;
+
+    if (!issimd || this->channels != 2) {
+        cascade_scalar (this, x, n);
+        return;
+    }
+
+    // stages past nbands pass through, so groups may overrun it
+
+#if defined(SIMD_HAS_X86)
+    if (level >= SIMD_V256) {
+        for (int j = 0; j < this->nbands; j += 4)
+            group4_v256 (this, j, x, n);
+
+        return;
+    }
+#endif
+
+#if defined(SIMD_HAS_NEON) || defined(SIMD_HAS_X86)
+    if (level >= SIMD_V128) {
+        for (int j = 0; j < this->nbands; j += 2)
+            group2_v128 (this, j, x, n);
+
+        return;
+    }
+#endif
+
+    cascade_scalar (this, x, n);
+}
+
+/** round to nearest. the vector kernels round ties to even instead */
+static int32_t
+round_s32 (float x)
+{
+    return x < 0 ? (int32_t)(x - 0.5f) : (int32_t)(x + 0.5f);
+}
+
+/** n samples to float in [-1, 1) */
+static void
+widen (float *dst, const void *src, uint16_t fmt, size_t n)
+{
+    if (fmt == 1) {
+        for (size_t i = 0; i < n; ++i)
+            dst[i] = ((const int16_t *)src)[i] * (1.0f / 32768);
+    } else {
+        for (size_t i = 0; i < n; ++i)
+            dst[i] = (float)((const int32_t *)src)[i] * (1.0f / 2147483648.0f);
+    }
+}
+
+/** n samples back from float, saturating */
+static void
+narrow (void *dst, const float *src, uint16_t fmt, size_t n)
+{
+    if (fmt == 1) {
+        for (size_t i = 0; i < n; ++i) {
+            const float y = src[i] * 32768;
+
+            ((int16_t *)dst)[i] = y >= INT16_MAX   ? INT16_MAX
+                                  : y <= INT16_MIN ? INT16_MIN
+                                                   : round_s32 (y);
+        }
+    } else {
+        for (size_t i = 0; i < n; ++i) {
+            const float y = src[i] * 2147483648.0f;
+
+            ((int32_t *)dst)[i] = y > S32_MAXF     ? INT32_MAX - 127
+                                  : y < -S32_MAXF ? INT32_MIN
+                                                  : round_s32 (y);
+        }
+    }
+}
+
+static void
+apply (struct eq_t *this, void *buf, uint16_t fmt, size_t nframes,
+       bool issimd)
+{
+    const size_t c = this->channels;
+    float        tmp[CHUNK * EQ_MAX_CHANNELS];
+
+    if (this->nbands == 0 || fmt < 1 || fmt > 3)
+        return;
+
+    if (fmt == 3) {
+        cascade (this, buf, nframes, issimd);
+    } else {
+        const size_t width = fmt == 1 ? 2 : 4;
+
+        for (size_t f = 0; f < nframes; f += CHUNK) {
+            const size_t k = nframes - f < CHUNK ? nframes - f : CHUNK;
+            uint8_t     *p = (uint8_t *)buf + f * c * width;
+
+            widen (tmp, p, fmt, k * c);
+            cascade (this, tmp, k, issimd);
+            narrow (p, tmp, fmt, k * c);
+        }
+    }
+
+    for (int s = 0; s < this->nbands; ++s) {
+        for (size_t ch = 0; ch < c; ++ch) {
+            if (this->z1[s][ch] > -DENORM && this->z1[s][ch] < DENORM)
+                this->z1[s][ch] = 0;
+
+            if (this->z2[s][ch] > -DENORM && this->z2[s][ch] < DENORM)
+                this->z2[s][ch] = 0;
+        }
+    }
+}
+
+void
+eq_apply (struct eq_t *this, void *buf, uint16_t fmt, size_t nframes)
+{
+    apply (this, buf, fmt, nframes, true);
+}
+
+void
+eq_apply_scalar (struct eq_t *this, void *buf, uint16_t fmt,
+                 size_t nframes)
+{
+    apply (this, buf, fmt, nframes, false);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#ifndef EQ_H
+#define EQ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Parametric equalizer: a cascade of RBJ cookbook biquads in transposed
+ * direct form II, run in float. Stereo is vectorized across bands as well as
+ * channels: the vector holds a few consecutive bands, each a sample behind
+ * the one before it, so every lane does useful work while the recursion
+ * runs one sample per step. S16 and S32 are widened to float per chunk and
+ * narrowed back with saturation.
+ */
+
+#define EQ_MAX_BANDS    10
+#define EQ_MAX_CHANNELS 8
+
+// stages: EQ_MAX_BANDS rounded up to the widest kernel's bands per vector
+#define EQ_NSTAGES 12
+
+#define EQ_PEAK      0
+#define EQ_LOWSHELF  1
+#define EQ_HIGHSHELF 2
+
+/** eq_presets index of the preset kept in the config file */
+#define EQ_PRESET_CUSTOM 0xff
+
+struct eq_band_t {
+    float    hz;   // center or corner frequency
+    float    db;   // gain
+    float    q;    // bandwidth; the shelf slope for shelves, 1 the steepest
+    uint32_t type; // EQ_PEAK, EQ_LOWSHELF or EQ_HIGHSHELF
+};
+
+struct eq_preset_t {
+    const char      *name;
+    float            preamp_db; // headroom for the boosts
+    uint8_t          nbands;
+    struct eq_band_t bands[EQ_MAX_BANDS];
+};
+
+/** the first is "off" */
+extern const struct eq_preset_t eq_presets[];
+extern const uint8_t            eq_npresets;
+
+struct eq_t {
+    int nbands; // 0: bypass
+    int channels;
+
+    // normalized by a0. stages from nbands on pass their input through
+    float b0[EQ_NSTAGES], b1[EQ_NSTAGES], b2[EQ_NSTAGES];
+    float a1[EQ_NSTAGES], a2[EQ_NSTAGES];
+
+    float z1[EQ_NSTAGES][EQ_MAX_CHANNELS];
+    float z2[EQ_NSTAGES][EQ_MAX_CHANNELS];
+};
+
+/**
+ * bands at or above Nyquist are dropped. more than EQ_MAX_CHANNELS channels
+ * are bypassed
+ *
+ * @param preamp_db applied along with the first band
+ */
+extern void eq_init (struct eq_t *this, int rate, int channels,
+                     const struct eq_band_t *bands, int nbands,
+                     float preamp_db);
+
+/**
+ * filter buf in place. does nothing if this has no bands
+ *
+ * @param fmt wFormatTag: 1 for S16, 2 for S32, 3 for FLT. others are left
+ * as they are
+ */
+extern void eq_apply (struct eq_t *this, void *buf, uint16_t fmt,
+                      size_t nframes);
+
+/** reference implementation for the tests and benchmarks */
+extern void eq_apply_scalar (struct eq_t *this, void *buf, uint16_t fmt,
+                             size_t nframes);
+
+#endif // !EQ_H
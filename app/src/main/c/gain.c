@@ -0,0 +1,401 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gain.h"
+#include "simd.h"
+
+// the largest float below 2^31, where S32 products are clamped
+#define S32_MAXF 2147483520.0f
+
+/** round to nearest. the vector kernels round ties to even instead */
+static int32_t
+round_s32 (float x)
+{
+    return x < 0 ? (int32_t)(x - 0.5f) : (int32_t)(x + 0.5f);
+}
+
+static int32_t
+q15 (float g)
+{
+    const int32_t q = round_s32 (g * 32768.0f);
+    return q > 32767 ? 32767 : q;
+}
+
+/** frames [begin, end) */
+static void
+ramp_range (void *buf, uint16_t fmt, int channels, size_t begin, size_t end,
+            float g0, float step)
+{
+    const size_t c = channels;
+
+    switch (fmt) {
+        case 1: {
+            int16_t *p = (int16_t *)buf + begin * c;
+
+            for (size_t f = begin; f < end; ++f) {
+                const int32_t g = q15 (g0 + step * (float)f);
+
+                for (size_t ch = 0; ch < c; ++ch, ++p)
+                    *p = (*p * g + 0x4000) >> 15;
+            }
+
+            break;
+        }
+        case 2: {
+            int32_t *p = (int32_t *)buf + begin * c;
+
+            for (size_t f = begin; f < end; ++f) {
+                const float g = g0 + step * (float)f;
+
+                for (size_t ch = 0; ch < c; ++ch, ++p) {
+                    const float y = (float)*p * g;
+                    *p            = round_s32 (y > S32_MAXF ? S32_MAXF : y);
+                }
+            }
+
+            break;
+        }
+        case 3: {
+            float *p = (float *)buf + begin * c;
+
+            for (size_t f = begin; f < end; ++f) {
+                const float g = g0 + step * (float)f;
+
+                for (size_t ch = 0; ch < c; ++ch)
+                    *p++ *= g;
+            }
+
+            break;
+        }
+        default:
+            return;
+    }
+}
+
+void
+gain_ramp_scalar (void *buf, uint16_t fmt, int channels, size_t nframes,
+                  float g0, float step)
+{
+    ramp_range (buf, fmt, channels, 0, nframes, g0, step);
+}
+
+/*
+ * the kernels take mono or stereo. lane l of a vector is sample l of the
+ * vector's first frame f, so its gain is g0 + step * (f + offs[l]), with
+ * offs[l] = l / channels. each returns the frames it did
+ */
+
+#if defined(SIMD_HAS_NEON)
+
+static inline float32x4_t
+gain_v128 (size_t f, const float *offs, float g0, float step)
+{
+    const float32x4_t vf
+        = vaddq_f32 (vdupq_n_f32 ((float)f), vld1q_f32 (offs));
+    return vaddq_f32 (vdupq_n_f32 (g0), vmulq_n_f32 (vf, step));
+}
+
+static inline int32x4_t
+cvt_s32 (float32x4_t v)
+{
+#if defined(__aarch64__)
+    return vcvtnq_s32_f32 (v);
+#else
+    return vcvtq_s32_f32 (v); // truncates; within an LSB of the reference
+#endif
+}
+
+static size_t
+ramp16_v128 (void *buf, int c, size_t n, float g0, float step,
+             const float *offs)
+{
+    const size_t fpv = 8 / c;
+    int16_t     *p   = buf;
+    size_t       f   = 0;
+
+    for (; f + fpv <= n; f += fpv, p += 8) {
+        const float32x4_t lo = vmulq_n_f32 (gain_v128 (f, offs, g0, step),
+                                            32768.0f);
+        const float32x4_t hi = vmulq_n_f32 (
+            gain_v128 (f, offs + 4, g0, step), 32768.0f);
+        const int16x8_t   g  = vcombine_s16 (vqmovn_s32 (cvt_s32 (lo)),
+                                             vqmovn_s32 (cvt_s32 (hi)));
+
+        vst1q_s16 (p, vqrdmulhq_s16 (vld1q_s16 (p), g));
+    }
+
+    return f;
+}
+
+static size_t
+ramp32_v128 (void *buf, int c, size_t n, float g0, float step,
+             const float *offs)
+{
+    const size_t      fpv = 4 / c;
+    const float32x4_t max = vdupq_n_f32 (S32_MAXF);
+    int32_t          *p   = buf;
+    size_t            f   = 0;
+
+    for (; f + fpv <= n; f += fpv, p += 4) {
+        const float32x4_t y = vmulq_f32 (vcvtq_f32_s32 (vld1q_s32 (p)),
+                                         gain_v128 (f, offs, g0, step));
+        vst1q_s32 (p, cvt_s32 (vminq_f32 (y, max)));
+    }
+
+    return f;
+}
+
+static size_t
+rampf_v128 (void *buf, int c, size_t n, float g0, float step,
+            const float *offs)
+{
+    const size_t fpv = 4 / c;
+    float       *p   = buf;
+    size_t       f   = 0;
+
+    for (; f + fpv <= n; f += fpv, p += 4)
+        vst1q_f32 (p, vmulq_f32 (vld1q_f32 (p),
+                                 gain_v128 (f, offs, g0, step)));
+
+    return f;
+}
+
+#elif defined(SIMD_HAS_X86)
+
+static inline __m128
+gain_v128 (size_t f, const float *offs, float g0, float step)
+{
+    const __m128 vf = _mm_add_ps (_mm_set1_ps ((float)f), _mm_loadu_ps (offs));
+    return _mm_add_ps (_mm_set1_ps (g0), _mm_mul_ps (_mm_set1_ps (step), vf));
+}
+
+static inline __m128i
+q15_v128 (size_t f, const float *offs, float g0, float step)
+{
+    const __m128 q  = _mm_set1_ps (32768.0f);
+    const __m128 lo = _mm_mul_ps (gain_v128 (f, offs, g0, step), q);
+    const __m128 hi = _mm_mul_ps (gain_v128 (f, offs + 4, g0, step), q);
+
+    // saturates a gain of 1 to 32767
+    return _mm_packs_epi32 (_mm_cvtps_epi32 (lo), _mm_cvtps_epi32 (hi));
+}
+
+/** (x * g + 0x4000) >> 15 per lane, as SSSE3's pmulhrsw */
+static inline __m128i
+mulhrs_v128 (__m128i x, __m128i g)
+{
+    const __m128i lo   = _mm_mullo_epi16 (x, g);
+    const __m128i hi   = _mm_mulhi_epi16 (x, g);
+    const __m128i half = _mm_set1_epi32 (0x4000);
+    const __m128i a    = _mm_srai_epi32 (
+        _mm_add_epi32 (_mm_unpacklo_epi16 (lo, hi), half), 15);
+    const __m128i b = _mm_srai_epi32 (
+        _mm_add_epi32 (_mm_unpackhi_epi16 (lo, hi), half), 15);
+
+    return _mm_packs_epi32 (a, b);
+}
+
+static size_t
+ramp16_v128 (void *buf, int c, size_t n, float g0, float step,
+             const float *offs)
+{
+    const size_t fpv = 8 / c;
+    int16_t     *p   = buf;
+    size_t       f   = 0;
+
+    for (; f + fpv <= n; f += fpv, p += 8) {
+        const __m128i x = _mm_loadu_si128 ((const __m128i *)p);
+        _mm_storeu_si128 ((__m128i *)p,
+                          mulhrs_v128 (x, q15_v128 (f, offs, g0, step)));
+    }
+
+    return f;
+}
+
+static size_t
+ramp32_v128 (void *buf, int c, size_t n, float g0, float step,
+             const float *offs)
+{
+    const size_t fpv = 4 / c;
+    const __m128 max = _mm_set1_ps (S32_MAXF);
+    int32_t     *p   = buf;
+    size_t       f   = 0;
+
+    for (; f + fpv <= n; f += fpv, p += 4) {
+        const __m128 x = _mm_cvtepi32_ps (_mm_loadu_si128 ((__m128i *)p));
+        const __m128 y = _mm_mul_ps (x, gain_v128 (f, offs, g0, step));
+        _mm_storeu_si128 ((__m128i *)p, _mm_cvtps_epi32 (_mm_min_ps (y, max)));
+    }
+
+    return f;
+}
+
+static size_t
+rampf_v128 (void *buf, int c, size_t n, float g0, float step,
+            const float *offs)
+{
+    const size_t fpv = 4 / c;
+    float       *p   = buf;
+    size_t       f   = 0;
+
+    for (; f + fpv <= n; f += fpv, p += 4)
+        _mm_storeu_ps (p, _mm_mul_ps (_mm_loadu_ps (p),
+                                      gain_v128 (f, offs, g0, step)));
+
+    return f;
+}
+
+SIMD_TARGET_AVX2 static inline __m256
+gain_v256 (size_t f, const float *offs, float g0, float step)
+{
+    const __m256 vf = _mm256_add_ps (_mm256_set1_ps ((float)f),
+                                     _mm256_loadu_ps (offs));
+    return _mm256_add_ps (_mm256_set1_ps (g0),
+                          _mm256_mul_ps (_mm256_set1_ps (step), vf));
+}
+
+/**
+ * the 256-bit pack works within each 128-bit lane, so it yields gains
+ * 0-3 | 8-11 | 4-7 | 12-15. the permute restores order
+ */
+SIMD_TARGET_AVX2 static size_t
+ramp16_v256 (void *buf, int c, size_t n, float g0, float step,
+             const float *offs)
+{
+    const size_t fpv = 16 / c;
+    const __m256 q   = _mm256_set1_ps (32768.0f);
+    int16_t     *p   = buf;
+    size_t       f   = 0;
+
+    for (; f + fpv <= n; f += fpv, p += 16) {
+        const __m256i lo = _mm256_cvtps_epi32 (
+            _mm256_mul_ps (gain_v256 (f, offs, g0, step), q));
+        const __m256i hi = _mm256_cvtps_epi32 (
+            _mm256_mul_ps (gain_v256 (f, offs + 8, g0, step), q));
+        const __m256i g = _mm256_permute4x64_epi64 (
+            _mm256_packs_epi32 (lo, hi), 0xd8);
+        const __m256i x = _mm256_loadu_si256 ((const __m256i *)p);
+
+        _mm256_storeu_si256 ((__m256i *)p, _mm256_mulhrs_epi16 (x, g));
+    }
+
+    return f;
+}
+
+SIMD_TARGET_AVX2 static size_t
+ramp32_v256 (void *buf, int c, size_t n, float g0, float step,
+             const float *offs)
+{
+    const size_t fpv = 8 / c;
+    const __m256 max = _mm256_set1_ps (S32_MAXF);
+    int32_t     *p   = buf;
+    size_t       f   = 0;
+
+    for (; f + fpv <= n; f += fpv, p += 8) {
+        const __m256 x
+            = _mm256_cvtepi32_ps (_mm256_loadu_si256 ((__m256i *)p));
+        const __m256 y = _mm256_mul_ps (x, gain_v256 (f, offs, g0, step));
+        _mm256_storeu_si256 ((__m256i *)p,
+                             _mm256_cvtps_epi32 (_mm256_min_ps (y, max)));
+    }
+
+    return f;
+}
+
+SIMD_TARGET_AVX2 static size_t
+rampf_v256 (void *buf, int c, size_t n, float g0, float step,
+            const float *offs)
+{
+    const size_t fpv = 8 / c;
+    float       *p   = buf;
+    size_t       f   = 0;
+
+    for (; f + fpv <= n; f += fpv, p += 8)
+        _mm256_storeu_ps (p, _mm256_mul_ps (_mm256_loadu_ps (p),
+                                            gain_v256 (f, offs, g0, step)));
+
+    return f;
+}
+
+#endif
+
+/** @return frames done by a vector kernel; the caller finishes the tail */
+static size_t
+ramp_simd (void *buf, uint16_t fmt, int channels, size_t nframes, float g0,
+           float step)
+{
+    const int level = simd_level ();
+    float     offs[16];
+
+    for (int l = 0; l < 16; ++l)
+        offs[l] = (float)(l / channels);
+
+    (void)level, (void)buf, (void)fmt, (void)nframes, (void)g0, (void)step;
+
+#if defined(SIMD_HAS_X86)
+    if (level >= SIMD_V256) {
+        switch (fmt) {
+            case 1:
+                return ramp16_v256 (buf, channels, nframes, g0, step, offs);
+            case 2:
+                return ramp32_v256 (buf, channels, nframes, g0, step, offs);
+            case 3:
+                return rampf_v256 (buf, channels, nframes, g0, step, offs);
+        }
+    }
+#endif
+
+#if defined(SIMD_HAS_NEON) || defined(SIMD_HAS_X86)
+    if (level >= SIMD_V128) {
+        switch (fmt) {
+            case 1:
+                return ramp16_v128 (buf, channels, nframes, g0, step, offs);
+            case 2:
+                return ramp32_v128 (buf, channels, nframes, g0, step, offs);
+            case 3:
+                return rampf_v128 (buf, channels, nframes, g0, step, offs);
+        }
+    }
+#endif
+
+    return 0;
+}
+
+void
+gain_ramp (void *buf, uint16_t fmt, int channels, size_t nframes, float g0,
+           float step)
+{
+    size_t done = 0;
+
+    if (channels == 1 || channels == 2)
+        done = ramp_simd (buf, fmt, channels, nframes, g0, step);
+
+    ramp_range (buf, fmt, channels, done, nframes, g0, step);
+}
+
+static float
+clamp (float g)
+{
+    return g < 0 ? 0 : g > 1 ? 1 : g;
+}
+
+void
+gain_init (struct gain_t *this, float g)
+{
+    this->cur = clamp (g);
+}
+
+void
+gain_apply (struct gain_t *this, void *buf, uint16_t fmt, int channels,
+            size_t nframes, float target)
+{
+    const float g0 = this->cur;
+
+    target = clamp (target);
+
+    if (nframes == 0 || (g0 == 1 && target == 1))
+        return;
+
+    gain_ramp (buf, fmt, channels, nframes, g0, (target - g0) / nframes);
+    this->cur = target;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#ifndef GAIN_H
+#define GAIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Volume for interleaved PCM. A change of gain is ramped linearly across
+ * the next burst instead of applied as a step, which would click. S16 is
+ * scaled in Q15 fixed point, S32 and FLT in float. Mono and stereo use the
+ * simd_level kernels; other layouts a scalar loop.
+ */
+struct gain_t {
+    float cur; // gain the last burst ended on
+};
+
+/** @param g initial gain, 0 to 1 */
+extern void gain_init (struct gain_t *this, float g);
+
+/**
+ * scale buf in place, from this->cur on the first frame toward target,
+ * which the next burst starts on. unity gain is a no-op
+ *
+ * @param fmt wFormatTag: 1 for S16, 2 for S32, 3 for FLT. others are left
+ * as they are
+ * @param target 0 to 1
+ */
+extern void gain_apply (struct gain_t *this, void *buf, uint16_t fmt,
+                        int channels, size_t nframes, float target);
+
+/** frame f is scaled by g0 + step * f */
+extern void gain_ramp (void *buf, uint16_t fmt, int channels, size_t nframes,
+                       float g0, float step);
+
+/** reference implementation for the tests and benchmarks */
+extern void gain_ramp_scalar (void *buf, uint16_t fmt, int channels,
+                              size_t nframes, float g0, float step);
+
+#endif // !GAIN_H
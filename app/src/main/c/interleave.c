@@ -0,0 +1,201 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "interleave.h"
+#include "simd.h"
+
+// samples of type T from each plane into dst, frame by frame
+#define INTERLEAVE_T(T, dst, src, channels, begin, end)                       \
+    do {                                                                      \
+        T *d_ = (T *)(dst) + (size_t)(begin) * (channels);                    \
+        for (size_t f_ = (begin); f_ < (end); ++f_)                           \
+            for (int ch_ = 0; ch_ < (channels); ++ch_)                        \
+                *d_++ = ((const T *)(src)[ch_])[f_];                          \
+    } while (0)
+
+/** frames [begin, end) */
+static void
+interleave_range (uint8_t *dst, uint8_t *const *src, int channels,
+                  size_t begin, size_t end, int bytes_per_sample)
+{
+    switch (bytes_per_sample) {
+        case 1:
+            INTERLEAVE_T (uint8_t, dst, src, channels, begin, end);
+            break;
+        case 2:
+            INTERLEAVE_T (uint16_t, dst, src, channels, begin, end);
+            break;
+        case 4:
+            INTERLEAVE_T (uint32_t, dst, src, channels, begin, end);
+            break;
+        case 8:
+            INTERLEAVE_T (uint64_t, dst, src, channels, begin, end);
+            break;
+        default:
+            dst += begin * channels * bytes_per_sample;
+            for (size_t f = begin; f < end; ++f)
+                for (int ch = 0; ch < channels; ++ch, dst += bytes_per_sample)
+                    memcpy (dst, src[ch] + bytes_per_sample * f,
+                            bytes_per_sample);
+    }
+}
+
+void
+interleave_scalar (uint8_t *dst, uint8_t *const *src, int channels,
+                   size_t nframes, int bytes_per_sample)
+{
+    interleave_range (dst, src, channels, 0, nframes, bytes_per_sample);
+}
+
+#if defined(SIMD_HAS_NEON)
+
+/** @return frames done */
+static size_t
+stereo16_v128 (uint8_t *dst, const uint8_t *l, const uint8_t *r, size_t n)
+{
+    size_t f = 0;
+
+    for (; f + 8 <= n; f += 8) {
+        uint16x8x2_t v = { { vld1q_u16 ((const uint16_t *)l + f),
+                             vld1q_u16 ((const uint16_t *)r + f) } };
+        vst2q_u16 ((uint16_t *)dst + 2 * f, v);
+    }
+
+    return f;
+}
+
+static size_t
+stereo32_v128 (uint8_t *dst, const uint8_t *l, const uint8_t *r, size_t n)
+{
+    size_t f = 0;
+
+    for (; f + 4 <= n; f += 4) {
+        uint32x4x2_t v = { { vld1q_u32 ((const uint32_t *)l + f),
+                             vld1q_u32 ((const uint32_t *)r + f) } };
+        vst2q_u32 ((uint32_t *)dst + 2 * f, v);
+    }
+
+    return f;
+}
+
+#elif defined(SIMD_HAS_X86)
+
+static size_t
+stereo16_v128 (uint8_t *dst, const uint8_t *l, const uint8_t *r, size_t n)
+{
+    size_t f = 0;
+
+    for (; f + 8 <= n; f += 8) {
+        const __m128i a = _mm_loadu_si128 ((const __m128i *)(l + 2 * f));
+        const __m128i b = _mm_loadu_si128 ((const __m128i *)(r + 2 * f));
+        _mm_storeu_si128 ((__m128i *)(dst + 4 * f), _mm_unpacklo_epi16 (a, b));
+        _mm_storeu_si128 ((__m128i *)(dst + 4 * f + 16),
+                          _mm_unpackhi_epi16 (a, b));
+    }
+
+    return f;
+}
+
+static size_t
+stereo32_v128 (uint8_t *dst, const uint8_t *l, const uint8_t *r, size_t n)
+{
+    size_t f = 0;
+
+    for (; f + 4 <= n; f += 4) {
+        const __m128i a = _mm_loadu_si128 ((const __m128i *)(l + 4 * f));
+        const __m128i b = _mm_loadu_si128 ((const __m128i *)(r + 4 * f));
+        _mm_storeu_si128 ((__m128i *)(dst + 8 * f), _mm_unpacklo_epi32 (a, b));
+        _mm_storeu_si128 ((__m128i *)(dst + 8 * f + 16),
+                          _mm_unpackhi_epi32 (a, b));
+    }
+
+    return f;
+}
+
+/**
+ * the 256-bit unpacks work within each 128-bit lane, so lo holds frames
+ * 0-3 | 8-11 and hi 4-7 | 12-15 (for 16 bit). the permutes restore order
+ */
+SIMD_TARGET_AVX2 static size_t
+stereo16_v256 (uint8_t *dst, const uint8_t *l, const uint8_t *r, size_t n)
+{
+    size_t f = 0;
+
+    for (; f + 16 <= n; f += 16) {
+        const __m256i a  = _mm256_loadu_si256 ((const __m256i *)(l + 2 * f));
+        const __m256i b  = _mm256_loadu_si256 ((const __m256i *)(r + 2 * f));
+        const __m256i lo = _mm256_unpacklo_epi16 (a, b);
+        const __m256i hi = _mm256_unpackhi_epi16 (a, b);
+        _mm256_storeu_si256 ((__m256i *)(dst + 4 * f),
+                             _mm256_permute2x128_si256 (lo, hi, 0x20));
+        _mm256_storeu_si256 ((__m256i *)(dst + 4 * f + 32),
+                             _mm256_permute2x128_si256 (lo, hi, 0x31));
+    }
+
+    return f;
+}
+
+SIMD_TARGET_AVX2 static size_t
+stereo32_v256 (uint8_t *dst, const uint8_t *l, const uint8_t *r, size_t n)
+{
+    size_t f = 0;
+
+    for (; f + 8 <= n; f += 8) {
+        const __m256i a  = _mm256_loadu_si256 ((const __m256i *)(l + 4 * f));
+        const __m256i b  = _mm256_loadu_si256 ((const __m256i *)(r + 4 * f));
+        const __m256i lo = _mm256_unpacklo_epi32 (a, b);
+        const __m256i hi = _mm256_unpackhi_epi32 (a, b);
+        _mm256_storeu_si256 ((__m256i *)(dst + 8 * f),
+                             _mm256_permute2x128_si256 (lo, hi, 0x20));
+        _mm256_storeu_si256 ((__m256i *)(dst + 8 * f + 32),
+                             _mm256_permute2x128_si256 (lo, hi, 0x31));
+    }
+
+    return f;
+}
+
+#endif
+
+/** @return frames done by a vector kernel; the caller finishes the tail */
+static size_t
+stereo_simd (uint8_t *dst, uint8_t *const *src, size_t nframes,
+             int bytes_per_sample)
+{
+    const int level = simd_level ();
+
+    (void)level, (void)dst, (void)src, (void)nframes, (void)bytes_per_sample;
+
+#if defined(SIMD_HAS_X86)
+    if (level >= SIMD_V256)
+        return bytes_per_sample == 2
+                   ? stereo16_v256 (dst, src[0], src[1], nframes)
+                   : stereo32_v256 (dst, src[0], src[1], nframes);
+#endif
+
+#if defined(SIMD_HAS_NEON) || defined(SIMD_HAS_X86)
+    if (level >= SIMD_V128)
+        return bytes_per_sample == 2
+                   ? stereo16_v128 (dst, src[0], src[1], nframes)
+                   : stereo32_v128 (dst, src[0], src[1], nframes);
+#endif
+
+    return 0;
+}
+
+void
+interleave (uint8_t *dst, uint8_t *const *src, int channels, size_t nframes,
+            int bytes_per_sample)
+{
+    size_t done = 0;
+
+    if (channels == 1) {
+        memcpy (dst, src[0], nframes * bytes_per_sample);
+        return;
+    }
+
+    if (channels == 2 && (bytes_per_sample == 2 || bytes_per_sample == 4))
+        done = stereo_simd (dst, src, nframes, bytes_per_sample);
+
+    interleave_range (dst, src, channels, done, nframes, bytes_per_sample);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#ifndef INTERLEAVE_H
+#define INTERLEAVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * planar to interleaved PCM. stereo 2 and 4 byte samples (S16P, S32P, FLTP)
+ * use the simd_level kernels; mono is a copy and other layouts a typed loop
+ *
+ * @param dst channels * nframes * bytes_per_sample bytes
+ * @param src one plane per channel, as in AVFrame.extended_data
+ */
+extern void interleave (uint8_t *dst, uint8_t *const *src, int channels,
+                        size_t nframes, int bytes_per_sample);
+
+/** reference implementation for the tests and benchmarks */
+extern void interleave_scalar (uint8_t *dst, uint8_t *const *src,
+                               int channels, size_t nframes,
+                               int bytes_per_sample);
+
+#endif // !INTERLEAVE_H
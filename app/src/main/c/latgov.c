@@ -0,0 +1,149 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "latgov.h"
+#include "logging.h"
+
+static const char *FILENAME = "latgov.c";
+
+struct latgov_stats_t latgov_stats;
+
+#define STORE(field, val)                                                     \
+    atomic_store_explicit (&this->stats->field, (val), memory_order_relaxed)
+
+#define ADD(field, val)                                                       \
+    atomic_fetch_add_explicit (&this->stats->field, (val),                    \
+                               memory_order_relaxed)
+
+static void
+publish (struct latgov_t *this)
+{
+    if (this->stats == NULL)
+        return;
+
+    STORE (buf_frames, this->siz);
+
+    if (this->siz > atomic_load_explicit (&this->stats->peak_frames,
+                                          memory_order_relaxed))
+        STORE (peak_frames, this->siz);
+}
+
+void
+latgov_init (struct latgov_t *this, struct latgov_stats_t *stats,
+             const struct sink_t *sink, uint32_t rate, uint32_t target_ms,
+             int64_t now_ms)
+{
+    const int32_t burst = sink->burst > 0 ? sink->burst : 1;
+    int32_t       floor = sink->buf_siz;
+
+    if (target_ms > 0) {
+        const int64_t frames = (int64_t)target_ms * rate / 1000;
+
+        floor = (frames + burst - 1) / burst * burst;
+    }
+
+    if (floor > sink->buf_cap)
+        floor = sink->buf_cap;
+
+    if (floor < burst)
+        floor = burst;
+
+    this->stats    = stats;
+    this->burst    = burst;
+    this->cap      = sink->buf_cap > burst ? sink->buf_cap : burst;
+    this->floor    = floor;
+    this->siz      = floor;
+    this->nxrun    = 0;
+    this->last_ms  = now_ms;
+    this->hold_ms  = LATGOV_HOLD_MS;
+    this->isshrunk = false;
+
+    logif ("latency target %u ms: %d frames, bursts of %d, cap %d", target_ms,
+           floor, burst, this->cap);
+
+    if (stats != NULL) {
+        STORE (floor_frames, floor);
+        STORE (rate, (int)rate);
+        publish (this);
+    }
+}
+
+int32_t
+latgov_update (struct latgov_t *this, int32_t xruns, int64_t now_ms)
+{
+    if (xruns > this->nxrun) {
+        if (this->stats != NULL)
+            ADD (xruns, xruns - this->nxrun);
+
+        this->nxrun = xruns;
+
+        // the last shrink went too far: wait longer before the next one
+        if (this->isshrunk && now_ms - this->last_ms < this->hold_ms
+            && this->hold_ms < LATGOV_HOLD_MAX_MS) {
+            this->hold_ms *= 2;
+            logif ("underrun after a shrink; holding for %lld ms",
+                   (long long)this->hold_ms);
+        }
+
+        this->isshrunk = false;
+        this->last_ms  = now_ms;
+
+        if (this->siz < this->cap) {
+            this->siz = this->siz + this->burst < this->cap
+                            ? this->siz + this->burst
+                            : this->cap;
+
+            logif ("underrun %d; growing the buffer to %d frames", xruns,
+                   this->siz);
+
+            if (this->stats != NULL)
+                ADD (ngrow, 1);
+
+            publish (this);
+        }
+    } else if (this->siz > this->floor
+               && now_ms - this->last_ms >= this->hold_ms) {
+        this->siz = this->siz - this->burst > this->floor
+                        ? this->siz - this->burst
+                        : this->floor;
+
+        this->isshrunk = true;
+        this->last_ms  = now_ms;
+
+        logdf ("stable for %lld ms; shrinking the buffer to %d frames",
+               (long long)this->hold_ms, this->siz);
+
+        if (this->stats != NULL)
+            ADD (nshrink, 1);
+
+        publish (this);
+    }
+
+    return this->siz;
+}
+
+void
+latgov_settle (struct latgov_t *this, int32_t frames)
+{
+    if (frames <= 0 || frames == this->siz)
+        return;
+
+    logif ("the device took %d of %d frames", frames, this->siz);
+
+    // e.g. a cap the device did not report: don't ask for more again
+    if (frames < this->siz)
+        this->cap = frames > this->floor ? frames : this->floor;
+
+    // the device's minimum is above the target: don't keep shrinking to it
+    if (frames > this->siz && this->siz <= this->floor) {
+        this->floor = frames;
+
+        if (this->stats != NULL)
+            STORE (floor_frames, frames);
+    }
+
+    this->siz = frames;
+    publish (this);
+}
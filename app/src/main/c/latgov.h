@@ -0,0 +1,84 @@
+#pragma once
+
+#ifndef LATGOV_H
+#define LATGOV_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sink.h"
+
+/**
+ * Latency governor: picks the output buffer size. It starts at the target
+ * latency, grows by a burst when the device reports new underruns, and
+ * shrinks back a burst at a time after LATGOV_HOLD_MS without one. A shrink
+ * that is followed by an underrun within the hold doubles the hold, so an
+ * unstable device settles instead of oscillating.
+ */
+
+#define LATGOV_HOLD_MS     5000
+#define LATGOV_HOLD_MAX_MS 80000
+
+/**
+ * the governor's decisions, for the UI and logs. relaxed atomics, so any
+ * thread may read them at any time; one writer (the audio thread)
+ */
+struct latgov_stats_t {
+    atomic_int  buf_frames;   // current buffer size
+    atomic_int  floor_frames; // the target, never shrunk below
+    atomic_int  peak_frames;  // largest buffer size this session
+    atomic_int  rate;         // of the stream, to convert frames to time
+    atomic_uint xruns;        // underruns this session
+    atomic_uint ngrow;
+    atomic_uint nshrink;
+};
+
+extern struct latgov_stats_t latgov_stats;
+
+struct latgov_t {
+    struct latgov_stats_t *stats;
+
+    int32_t burst;    // frames
+    int32_t cap;      // frames
+    int32_t floor;    // frames
+    int32_t siz;      // frames. the current decision
+    int32_t nxrun;    // the device's count at the last update
+    int64_t last_ms;  // time of the last change
+    int64_t hold_ms;  // stable time before the next shrink
+    bool    isshrunk; // the last change was a shrink
+};
+
+/**
+ * start governing an open sink. the floor is target_ms rounded up to whole
+ * bursts, or the sink's buffer size at open if target_ms is 0
+ *
+ * @param stats where to publish; may be NULL
+ */
+extern void latgov_init (struct latgov_t *this, struct latgov_stats_t *stats,
+                         const struct sink_t *sink, uint32_t rate,
+                         uint32_t target_ms, int64_t now_ms);
+
+/**
+ * @param xruns the device's underrun count since open
+ * @return the buffer size to set, in frames
+ */
+extern int32_t latgov_update (struct latgov_t *this, int32_t xruns,
+                              int64_t now_ms);
+
+/** record the buffer size the device actually took */
+extern void latgov_settle (struct latgov_t *this, int32_t frames);
+
+/** @return the buffer size in ms */
+static inline double
+latgov_stats_ms (const struct latgov_stats_t *stats)
+{
+    const int rate = atomic_load_explicit (&stats->rate, memory_order_relaxed);
+
+    return rate == 0 ? 0
+                     : atomic_load_explicit (&stats->buf_frames,
+                                             memory_order_relaxed)
+                           * 1000.0 / rate;
+}
+
+#endif // !LATGOV_H
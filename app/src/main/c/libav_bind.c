@@ -29,12 +29,17 @@
 #include <assert.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/errno.h>
 
+#include <libavutil/channel_layout.h>
 #include <libavutil/error.h>
 #include <libavutil/frame.h>
+#include <libavutil/mathematics.h>
 #include <libavutil/mem.h>
 
 #include <libavcodec/avcodec.h>
@@ -42,7 +47,13 @@
 #include <libavformat/avformat.h>
 
 #include "audio.h"
+#include "decsess.h"
+#include "interleave.h"
 #include "logging.h"
+#include "loudness.h"
+#include "pcmbuf.h"
+#include "tagcache.h"
+#include "trackidx.h"
 
 #define AUDIO_INBUF_SIZE    20480
 #define AUDIO_REFILL_THRESH 4096
@@ -50,10 +61,89 @@
 static const char *FILENAME = "libav_bind.c";
 
 /**
- * call after initialization of ctx
+ * interleaved PCM as handed to a pcmout_t
  */
+struct pcmfmt_t {
+    enum AVSampleFormat fmt; // packed
+    int                 rate;
+    int                 channels;
+};
+
+/**
+ * destination of the decoded, interleaved PCM. embed as the first member of
+ * the concrete output struct
+ */
+struct pcmout_t {
+    /** called once the codec context is open, before any write */
+    int (*begin) (struct pcmout_t *this, const struct pcmfmt_t *fmt);
+
+    /** @return NCAP_OK, or an error code to stop decoding */
+    int (*write) (struct pcmout_t *this, const void *buf, size_t siz);
+
+    /** optional. called after the decoder is flushed */
+    void (*end) (struct pcmout_t *this, const struct pcmfmt_t *fmt);
+
+    uint32_t        samples; // frames written so far
+    uint32_t        est;     // frames the container says it holds, or 0
+    struct pcmfmt_t fmt;     // what is written
+    bool            isswr;   // frames went through the session's SwrContext
+    bool            isnative; // ignore outfmt: decode to the track's format
+
+    struct loudness_t *meter; // measures what is written. may be NULL
+
+    // reusable block for interleaving or converting frames
+    uint8_t *blk;
+    size_t   blksiz;
+};
+
+/**
+ * target of the conversion; sample_rate 0 keeps the decoded rate and layout.
+ * set by the audio thread while the loudness scan decodes, so it is packed
+ * into one word: sample_rate, then channels, then wFormatTag
+ */
+static atomic_uint_least64_t outfmt;
+
+void
+libav_set_outfmt (const struct audio_outfmt_t *fmt)
+{
+    atomic_store_explicit (&outfmt,
+                           fmt->sample_rate
+                               | (uint_least64_t)fmt->channels << 32
+                               | (uint_least64_t)fmt->wFormatTag << 48,
+                           memory_order_release);
+
+    logif ("converting decoded audio to %u Hz, %u channels, format %u",
+           fmt->sample_rate, fmt->channels, fmt->wFormatTag);
+}
+
+/**
+ * the format to hand to out for a stream decoded by ctx
+ */
+static void
+init_pcmfmt (struct pcmfmt_t *fmt, const AVCodecContext *ctx, bool isnative)
+{
+    const uint_least64_t packed
+        = isnative ? 0 : atomic_load_explicit (&outfmt, memory_order_acquire);
+
+    if ((uint32_t)packed != 0) {
+        fmt->fmt      = (enum AVSampleFormat)(packed >> 48 & 0xffff);
+        fmt->rate     = (int)(uint32_t)packed;
+        fmt->channels = (int)(packed >> 32 & 0xffff);
+        return;
+    }
+
+    fmt->fmt      = av_get_packed_sample_fmt (ctx->sample_fmt);
+    fmt->rate     = ctx->sample_rate;
+    fmt->channels = ctx->ch_layout.nb_channels;
+
+    // U8, DBL and S64 cannot be played
+    if (fmt->fmt != AV_SAMPLE_FMT_S16 && fmt->fmt != AV_SAMPLE_FMT_S32
+        && fmt->fmt != AV_SAMPLE_FMT_FLT)
+        fmt->fmt = AV_SAMPLE_FMT_FLT;
+}
+
 static void
-gen_wav_header (struct cwav_header_t *header, const AVCodecContext *const ctx,
+gen_wav_header (struct cwav_header_t *header, const struct pcmfmt_t *fmt,
                 uint32_t datasiz, uint32_t samples)
 {
     // RIFF chunk
@@ -65,12 +155,12 @@ gen_wav_header (struct cwav_header_t *header, const AVCodecContext *const ctx,
     // clang-format off
     strncpy (header->fmt.ckID, "fmt\0", 4);
     header->fmt.cksize     = 16; // 16 is for PCM
-    header->fmt.wFormatTag = (int)ctx->sample_fmt % 5; // 1 is S16; 6 is S16P
-                                                       // 3 is float; 8 is float planar
-                                                       // 0xfffe or 65534 is extended
-    const uint32_t channels         = header->fmt.nChannels = ctx->ch_layout.nb_channels;
-    const uint32_t sample_rate      = header->fmt.nSamplesPerSec = ctx->sample_rate;
-    const uint32_t bytes_per_sample = av_get_bytes_per_sample (ctx->sample_fmt);
+    header->fmt.wFormatTag = (int)fmt->fmt % 5; // 1 is S16; 6 is S16P
+                                                // 3 is float; 8 is float planar
+                                                // 0xfffe or 65534 is extended
+    const uint32_t channels         = header->fmt.nChannels = fmt->channels;
+    const uint32_t sample_rate      = header->fmt.nSamplesPerSec = fmt->rate;
+    const uint32_t bytes_per_sample = av_get_bytes_per_sample (fmt->fmt);
     header->fmt.wBitsPerSample  = bytes_per_sample << 3;
     header->fmt.nAvgBytesPerSec = sample_rate * channels * bytes_per_sample;
     header->fmt.nBlockAlign     = channels * bytes_per_sample;
@@ -81,13 +171,150 @@ gen_wav_header (struct cwav_header_t *header, const AVCodecContext *const ctx,
     header->data.cksize = samples * channels * bytes_per_sample;
 }
 
+static int
+reserve_blk (struct pcmout_t *out, size_t siz)
+{
+    if (out->blksiz >= siz)
+        return NCAP_OK;
+
+    uint8_t *blk = realloc (out->blk, siz);
+
+    if (blk == NULL) {
+        loge ("ERROR: realloc of the output block failed");
+        return NCAP_EALLOC;
+    }
+
+    out->blk    = blk;
+    out->blksiz = siz;
+
+    return NCAP_OK;
+}
+
+/**
+ * point sess->swr at a converter from frame's format to out->fmt. the
+ * context is only rebuilt when either side changed; swr_init on a cached one
+ * keeps its filter bank and only resets the stream state
+ */
+static int
+init_swr (struct decsess_t *sess, const AVFrame *frame,
+          const struct pcmout_t *out)
+{
+    const enum AVSampleFormat ifmt = frame->format;
+    int                       avret;
+
+    const bool iskeep
+        = sess->swr != NULL && sess->swr_ifmt == ifmt
+          && sess->swr_irate == frame->sample_rate
+          && av_channel_layout_compare (&sess->swr_ilayout, &frame->ch_layout)
+                 == 0
+          && sess->swr_ofmt == out->fmt.fmt && sess->swr_orate == out->fmt.rate
+          && sess->swr_olayout.nb_channels == out->fmt.channels;
+
+    if (!iskeep) {
+        av_channel_layout_uninit (&sess->swr_ilayout);
+        av_channel_layout_uninit (&sess->swr_olayout);
+        av_channel_layout_default (&sess->swr_olayout, out->fmt.channels);
+
+        if ((avret = av_channel_layout_copy (&sess->swr_ilayout,
+                                             &frame->ch_layout))
+                < 0
+            || (avret = swr_alloc_set_opts2 (
+                    &sess->swr, &sess->swr_olayout, out->fmt.fmt,
+                    out->fmt.rate, &sess->swr_ilayout, ifmt,
+                    frame->sample_rate, 0, NULL))
+                   < 0) {
+            logef ("ERROR: swr_alloc_set_opts2 failed with code %d: %s",
+                   avret, av_err2str (avret));
+            swr_free (&sess->swr);
+            return NCAP_EALLOC;
+        }
+
+        sess->swr_ifmt  = ifmt;
+        sess->swr_irate = frame->sample_rate;
+        sess->swr_ofmt  = out->fmt.fmt;
+        sess->swr_orate = out->fmt.rate;
+
+        logif ("resampling %s %d Hz %d ch to %s %d Hz %d ch",
+               av_get_sample_fmt_name (ifmt), frame->sample_rate,
+               frame->ch_layout.nb_channels,
+               av_get_sample_fmt_name (out->fmt.fmt), out->fmt.rate,
+               out->fmt.channels);
+    }
+
+    if ((avret = swr_init (sess->swr)) < 0) {
+        logef ("ERROR: swr_init failed with code %d: %s", avret,
+               av_err2str (avret));
+        swr_free (&sess->swr);
+        return NCAP_EGEN;
+    }
+
+    return NCAP_OK;
+}
+
+/**
+ * hand nframes in out->fmt to out, measuring them on the way
+ */
+static int
+emit (struct pcmout_t *out, const void *buf, size_t siz, int nframes)
+{
+    int ret;
+
+    if ((ret = out->write (out, buf, siz)) != NCAP_OK)
+        return ret;
+
+    // AV_SAMPLE_FMT_S16, S32 and FLT are wFormatTag 1, 2 and 3
+    if (out->meter != NULL)
+        loudness_add (out->meter, buf, out->fmt.fmt, nframes);
+
+    out->samples += nframes;
+
+    return NCAP_OK;
+}
+
+/**
+ * convert nb_samples of in (NULL to drain) and write the result to out
+ */
+static int
+write_swr (struct decsess_t *sess, const uint8_t *const *in, int nb_samples,
+           struct pcmout_t *out)
+{
+    const size_t framesiz
+        = (size_t)av_get_bytes_per_sample (out->fmt.fmt) * out->fmt.channels;
+    int n;
+    int ret;
+
+    do {
+        const int cap = swr_get_out_samples (sess->swr, nb_samples);
+
+        if (cap <= 0)
+            return NCAP_OK;
+
+        if ((ret = reserve_blk (out, cap * framesiz)) != NCAP_OK)
+            return ret;
+
+        if ((n = swr_convert (sess->swr, &out->blk, cap, in, nb_samples))
+            < 0) {
+            logef ("ERROR: swr_convert failed with code %d: %s", n,
+                   av_err2str (n));
+            return NCAP_EGEN;
+        }
+
+        if (n > 0 && (ret = emit (out, out->blk, n * framesiz, n)) != NCAP_OK)
+            return ret;
+    } while (in == NULL && n > 0); // draining may take several calls
+
+    return NCAP_OK;
+}
+
 /**
- * @return 0 on success
+ * @return 0 on success, < 0 on a libav error, > 0 if out failed
  */
 static int
-decode (AVCodecContext *ctx, AVPacket *pkt, AVFrame *frame, FILE *fp_out)
+decode (struct decsess_t *sess, AVPacket *pkt, struct pcmout_t *out)
 {
-    int avret = avcodec_send_packet (ctx, pkt);
+    AVCodecContext *const ctx   = sess->cctx;
+    AVFrame *const        frame = sess->frame;
+    int                   avret = avcodec_send_packet (ctx, pkt);
 
     if (avret < 0) {
         logef ("ERROR: avcodec_send_packet failed with code %d: %s\n", avret,
@@ -107,39 +334,65 @@ decode (AVCodecContext *ctx, AVPacket *pkt, AVFrame *frame, FILE *fp_out)
             return avret;
         }
 
-        const int datasiz  = av_get_bytes_per_sample (ctx->sample_fmt);
-        const int channels = ctx->ch_layout.nb_channels;
+        const enum AVSampleFormat fmt      = frame->format;
+        const int                 datasiz  = av_get_bytes_per_sample (fmt);
+        const int                 channels = frame->ch_layout.nb_channels;
+        const size_t siz = (size_t)frame->nb_samples * datasiz * channels;
+        const void  *buf = frame->data[0];
+        int          ret;
+
+        // once a track needed converting, stay on the converter so that no
+        // buffered samples are skipped
+        if (out->isswr || av_get_packed_sample_fmt (fmt) != out->fmt.fmt
+            || frame->sample_rate != out->fmt.rate
+            || channels != out->fmt.channels) {
+            if (!out->isswr) {
+                if ((ret = init_swr (sess, frame, out)) != NCAP_OK)
+                    return ret;
+
+                out->isswr = true;
+            }
 
-        // assert (frame->nb_samples * datasiz * channels ==
-        // frame->linesize[0]);
+            if ((ret = write_swr (sess,
+                                  (const uint8_t *const *)frame->extended_data,
+                                  frame->nb_samples, out))
+                != NCAP_OK)
+                return ret;
 
-        if (av_sample_fmt_is_planar (ctx->sample_fmt)) {
-            for (int f = 0; f < frame->nb_samples; ++f) {
-                for (int ch = 0; ch < channels; ++ch)
-                    fwrite (frame->data[ch] + datasiz * f, datasiz, 1, fp_out);
+            continue;
+        }
 
-                for (int ch = 0; ch < frame->nb_extended_buf; ++ch)
-                    fwrite (frame->extended_data[ch] + datasiz * f, datasiz, 1,
-                            fp_out);
-            }
-        } else {
-            fwrite (frame->data[0], 1, frame->linesize[0], fp_out);
+        if (av_sample_fmt_is_planar (fmt)) {
+            if ((ret = reserve_blk (out, siz)) != NCAP_OK)
+                return ret;
+
+            interleave (out->blk, frame->extended_data, channels,
+                        frame->nb_samples, datasiz);
+            buf = out->blk;
         }
+
+        if ((ret = emit (out, buf, siz, frame->nb_samples)) != NCAP_OK)
+            return ret;
     }
 
     return 0;
 }
 
-static const AVCodec *
-init_codec (const char *fn, AVFormatContext **fctx)
+/**
+ * @return NCAP_OK, NCAP_EIO if fn cannot be opened, or NCAP_EGEN if it has
+ * no decodable audio stream
+ */
+static int
+init_codec (const char *fn, AVFormatContext **fctx, const AVCodec **codec)
 {
     int avret;
 
+    // also the existence check: fails with ENOENT etc. on a bad path
     if ((avret = avformat_open_input (fctx, fn, NULL, NULL)) != 0) {
         logef ("ERROR: avformat_open_input failed with error code %d: "
                "%s\n",
                avret, av_err2str (avret));
-        return NULL;
+        return NCAP_EIO;
     }
 
     if ((avret = avformat_find_stream_info (*fctx, NULL)) < 0) {
@@ -148,7 +401,7 @@ init_codec (const char *fn, AVFormatContext **fctx)
             "ERROR: avformat_find_stream_info failed with error code "
             "%d\n",
             avret);
-        return NULL;
+        return NCAP_EGEN;
     }
 
     logdf ("AVFormat format:\t%s\n", (*fctx)->iformat->name);
@@ -158,78 +411,39 @@ init_codec (const char *fn, AVFormatContext **fctx)
     if ((*fctx)->nb_streams != 1) {
         logef ("expected 1 audio input stream, found %d\n",
                (*fctx)->nb_streams);
-        return NULL;
+        return NCAP_EGEN;
     }
 
     const AVCodecParameters *const params = (*fctx)->streams[0]->codecpar;
 
     if (params->codec_type != AVMEDIA_TYPE_AUDIO) {
         logef ("not an input stream, found %d\n", params->codec_type);
-        return NULL;
+        return NCAP_EGEN;
     }
 
-    const AVCodec *codec = avcodec_find_decoder (params->codec_id);
+    if ((*codec = avcodec_find_decoder (params->codec_id)) == NULL) {
+        logef ("ERROR: no decoder for codec_id %d\n", params->codec_id);
+        return NCAP_EGEN;
+    }
 
-    logdf ("codec_id:\t%d\n", codec->id);
-    logdf ("codec name:\t%s\n", codec->name);
-    logdf ("codec long name:\t%s\n", codec->long_name);
+    logdf ("codec_id:\t%d\n", (*codec)->id);
+    logdf ("codec name:\t%s\n", (*codec)->name);
+    logdf ("codec long name:\t%s\n", (*codec)->long_name);
 
     logdf ("channels:\t%d\n", params->ch_layout.nb_channels);
     logdf ("block align:\t%d\n", params->block_align);
 
-    return codec;
+    return NCAP_OK;
 }
 
+/**
+ * decode all of fn_in into out
+ */
 static int
-init_codec_context (const AVCodec *const codec, const AVStream *const stream,
-                    AVCodecContext **cctx)
-{
-    int avret;
-
-    if ((avret = avcodec_parameters_to_context (*cctx, stream->codecpar))
-        < 0) {
-        logef ("ERROR: avcodec_parameters_to_context failed with error "
-               "code %d: %s\n",
-               avret, av_err2str (avret));
-        return avret;
-    }
-
-    if ((avret = avcodec_open2 (*cctx, codec, NULL)) < 0) {
-        logef ("avcodec_open2 failed with error code %d: %s\n", avret,
-               av_err2str (avret));
-        return avret;
-    }
-
-    return 0;
-}
-
-int
-libav_cvt_cwav (const char *fn_in, const char *fn_out)
+transcode (const char *fn_in, struct pcmout_t *out)
 {
-    logdf ("testing fopen `%s' for rb", fn_in);
-    FILE *fp_in = fopen (fn_in, "rb");
-
-    if (fp_in == NULL) {
-        logef ("ERROR fopen `%s' for rb failed: errno %d: %s", fn_in, errno,
-               strerror (errno));
-        return NCAP_EIO;
-    }
-
-    fclose (fp_in);
-    logdf ("fopen `%s' test succeeded", fn_in);
-
     int ret = NCAP_OK;
 
-    logdf ("opening file `%s' for wb...", fn_out);
-
-    FILE *fp_out = fopen (fn_out, "wb"); // 2: deinit_fp_out
-
-    if (fp_out == NULL) {
-        logef ("ERROR: fopen `%s' failed for wb: errno %d: %s", fn_out, errno,
-               strerror (errno));
-        return NCAP_EIO;
-    }
-
     // init decoder
 
     logd ("initializing avformat context...");
@@ -238,109 +452,143 @@ libav_cvt_cwav (const char *fn_in, const char *fn_out)
 
     if (fctx == NULL) {
         loge ("ERROR: avformat_alloc_context failed\n");
-        ret = NCAP_EALLOC;
-        goto deinit_fp_out;
+        return NCAP_EALLOC;
     }
 
     logd ("initializing codec with init_codec...");
 
-    const AVCodec *codec = init_codec (fn_in, &fctx);
+    const AVCodec *codec;
 
-    if (codec == NULL) {
-        loge ("ERROR: avcodec_find_decoder failed\n");
-        ret = NCAP_EALLOC;
+    if ((ret = init_codec (fn_in, &fctx, &codec)) != NCAP_OK) {
+        loge ("ERROR: init_codec failed\n");
         goto deinit_fctx;
     }
 
-    logd ("initializing allocating avcodec context...");
+    logd ("acquiring decoder session...");
 
-    AVCodecContext *cctx = avcodec_alloc_context3 (codec); // deinit_cctx
+    const AVCodecParameters *par = fctx->streams[0]->codecpar;
 
-    if (cctx == NULL) {
-        loge ("ERROR: avcodec_alloc_context3 failed\n");
-        ret = NCAP_EALLOC;
-        goto deinit_fctx;
-    }
-
-    logd ("initializing initializing codec context with "
-          "init_codec_context...");
+    struct decsess_t *sess = decsess_acquire (codec, par); // deinit_sess
 
-    int avret = init_codec_context (codec, fctx->streams[0], &cctx);
-
-    if (avret < 0) {
-        loge ("ERROR: init_codec_context failed\n");
+    if (sess == NULL) {
+        loge ("ERROR: decsess_acquire failed\n");
         ret = NCAP_EALLOC;
         goto deinit_fctx;
     }
 
-    logd ("initializing initializing parser...");
+    AVPacket *const pkt   = sess->pkt;
+    int             avret = 0;
 
-    AVCodecParserContext *parser = av_parser_init (codec->id); // deinit_parser
-
-    if (parser == NULL) {
-        loge ("ERROR: av_parser_init failed\n");
-        ret = NCAP_EALLOC;
-        goto deinit_cctx;
-    }
+    init_pcmfmt (&out->fmt, sess->cctx, out->isnative);
+    out->isswr = false;
+    out->est   = fctx->duration > 0
+                     ? av_rescale (fctx->duration, out->fmt.rate, AV_TIME_BASE)
+                     : 0;
 
-    logd ("allocating frame...");
+    if (out->meter != NULL)
+        loudness_init (out->meter, out->fmt.rate, out->fmt.channels);
 
-    AVFrame *frame = av_frame_alloc (); // deinit_frame
-
-    if (frame == NULL) {
-        loge ("ERROR: av_frame_alloc failed\n");
-        ret = NCAP_EALLOC;
-        goto deinit_parser;
-    }
-
-    logd ("allocating packet...");
-
-    AVPacket *pkt = av_packet_alloc (); // deinit_pkt
-
-    if (pkt == NULL) {
-        loge ("ERROR: av_packet_alloc failed\n");
-        ret = NCAP_EALLOC;
-        goto deinit_frame;
+    if ((ret = out->begin (out, &out->fmt)) != NCAP_OK) {
+        logef ("ERROR: pcm output begin failed with code %d", ret);
+        goto deinit_sess;
     }
 
-    logd ("reserving bytes for WAV header...");
-
-    // allocate space for WAV header
-    fseek (fp_out, CWAV_HEADER_SIZ, SEEK_SET);
-
     logd ("reading frames...");
 
     // decode until eof
 
-    uint32_t samples = 0;
-
     while (av_read_frame (fctx, pkt) >= 0) {
         if (fctx->streams[pkt->stream_index]->codecpar->codec_type
             != AVMEDIA_TYPE_AUDIO) {
             loge ("ERROR: packet read was not from audio stream. "
                   "stopping...\n");
+            av_packet_unref (pkt);
             break;
         }
 
-        if (pkt->size <= 0)
+        if (pkt->size <= 0) {
+            av_packet_unref (pkt);
             continue;
+        }
+
+        avret = decode (sess, pkt, out);
+        av_packet_unref (pkt);
 
-        decode (cctx, pkt, frame, fp_out);
-        samples += frame->nb_samples;
+        if (avret > 0) {
+            logef ("pcm output stopped with code %d. stopping...", avret);
+            ret = avret;
+            goto deinit_sess;
+        }
     }
 
     // flush the decoder
     pkt->data = NULL;
     pkt->size = 0;
-    decode (cctx, pkt, frame, fp_out);
+
+    if ((avret = decode (sess, pkt, out)) > 0)
+        ret = avret;
+
+    // and the resampler's delay line
+    if (ret == NCAP_OK && out->isswr)
+        ret = write_swr (sess, NULL, 0, out);
+
+    if (out->end != NULL)
+        out->end (out, &out->fmt);
+
+deinit_sess:
+    // a decoder stopped mid-stream is flushed on its next acquire
+    decsess_release (sess, avret >= 0);
+
+deinit_fctx:
+    avformat_close_input (&fctx);
+
+    free (out->blk);
+    out->blk    = NULL;
+    out->blksiz = 0;
+
+    return ret;
+}
+
+// WAV file output
+
+struct cwav_out_t {
+    struct pcmout_t base;
+    FILE           *fp;
+};
+
+static int
+cwav_begin (struct pcmout_t *this, const struct pcmfmt_t *fmt)
+{
+    logd ("reserving bytes for WAV header...");
+
+    // allocate space for WAV header
+    return fseek (((struct cwav_out_t *)this)->fp, CWAV_HEADER_SIZ, SEEK_SET)
+                   == 0
+               ? NCAP_OK
+               : NCAP_EIO;
+}
+
+static int
+cwav_write (struct pcmout_t *this, const void *buf, size_t siz)
+{
+    return fwrite (buf, 1, siz, ((struct cwav_out_t *)this)->fp) == siz
+               ? NCAP_OK
+               : NCAP_EIO;
+}
+
+static void
+cwav_end (struct pcmout_t *this, const struct pcmfmt_t *fmt)
+{
+    FILE *const fp = ((struct cwav_out_t *)this)->fp;
 
     logd ("generating header...");
 
     // construct and write WAV header
     struct cwav_header_t header;
-    gen_wav_header (&header, cctx, ftell (fp_out), samples);
-    fseek (fp_out, 0, SEEK_SET);
-    fwrite (&header, CWAV_HEADER_SIZ, 1, fp_out);
+    gen_wav_header (&header, fmt, ftell (fp) - CWAV_HEADER_SIZ,
+                    this->samples);
+    fseek (fp, 0, SEEK_SET);
+    fwrite (&header, CWAV_HEADER_SIZ, 1, fp);
 
 #ifndef NDEBUG
     // clang-format off
@@ -359,24 +607,243 @@ libav_cvt_cwav (const char *fn_in, const char *fn_out)
     logvf ("WAV header data size:\t%u",       header.data.cksize);
 // clang-format on
 #endif // !NDEBUG
+}
 
-deinit_pkt:
-    av_packet_free (&pkt);
+void
+libav_deinit (void)
+{
+    struct decsess_stats_t stats;
 
-deinit_frame: // deinit_frame:
-    av_frame_free (&frame);
+    decsess_stats (&stats);
 
-deinit_parser:
-    av_parser_close (parser);
+    const uint64_t nacquired = stats.hits + stats.misses;
 
-deinit_fctx:
-    avformat_close_input (&fctx);
+    logif ("decoder sessions: %" PRIu64 " hits, %" PRIu64 " misses (%.1f%% "
+           "reused), %" PRIu64 " evictions",
+           stats.hits, stats.misses,
+           nacquired > 0 ? 100.0 * stats.hits / nacquired : 0.0,
+           stats.evictions);
 
-deinit_cctx:
-    avcodec_free_context (&cctx);
+    decsess_clear ();
+}
+
+int
+libav_cvt_cwav (const char *fn_in, const char *fn_out,
+                struct loudness_t *meter)
+{
+    logdf ("opening file `%s' for wb...", fn_out);
+
+    FILE *fp_out = fopen (fn_out, "wb");
+
+    if (fp_out == NULL) {
+        logef ("ERROR: fopen `%s' failed for wb: errno %d: %s", fn_out, errno,
+               strerror (errno));
+        return NCAP_EIO;
+    }
+
+    struct cwav_out_t out = {
+        .base = { .begin = cwav_begin,
+                  .write = cwav_write,
+                  .end   = cwav_end,
+                  .meter = meter },
+        .fp   = fp_out,
+    };
+
+    const int ret = transcode (fn_in, &out.base);
 
-deinit_fp_out:
     fclose (fp_out);
 
     return ret;
 }
+
+// in-memory stream output, optionally also written to a WAV file
+
+struct pcmbuf_out_t {
+    struct cwav_out_t tee; // tee.fp is NULL when not teeing
+    struct pcmbuf_t  *pb;
+};
+
+static int
+pcmbuf_out_begin (struct pcmout_t *this, const struct pcmfmt_t *fmt)
+{
+    struct pcmbuf_out_t *const out = (struct pcmbuf_out_t *)this;
+
+    // the length is the container's estimate until the decode finishes.
+    // only the player's position reads it
+    struct cwav_header_t header;
+    gen_wav_header (&header, fmt, 0, this->est);
+    pcmbuf_setfmt (out->pb, &header);
+
+    if (out->tee.fp != NULL)
+        cwav_begin (this, fmt);
+
+    return NCAP_OK;
+}
+
+static int
+pcmbuf_out_write (struct pcmout_t *this, const void *buf, size_t siz)
+{
+    struct pcmbuf_out_t *const out = (struct pcmbuf_out_t *)this;
+
+    // a failed tee write only sets the error indicator of tee.fp; playback
+    // goes on regardless
+    if (out->tee.fp != NULL)
+        cwav_write (this, buf, siz);
+
+    return pcmbuf_write (out->pb, buf, siz);
+}
+
+static void
+pcmbuf_out_end (struct pcmout_t *this, const struct pcmfmt_t *fmt)
+{
+    if (((struct pcmbuf_out_t *)this)->tee.fp != NULL)
+        cwav_end (this, fmt);
+}
+
+int
+libav_decode_pcmbuf (const char *fn_in, struct pcmbuf_t *pb, FILE *fp_tee,
+                     struct loudness_t *meter)
+{
+    struct pcmbuf_out_t out = {
+        .tee = {
+            .base = {
+                .begin = pcmbuf_out_begin,
+                .write = pcmbuf_out_write,
+                .end   = pcmbuf_out_end,
+                .meter = meter,
+            },
+            .fp = fp_tee,
+        },
+        .pb = pb,
+    };
+
+    const int ret = transcode (fn_in, &out.tee.base);
+
+    logdf ("decoded %u samples from `%s' into pcmbuf", out.tee.base.samples,
+           fn_in);
+
+    // always close so a waiting consumer wakes up, even if begin never ran
+    pcmbuf_close (pb, ret);
+
+    return ret;
+}
+
+// loudness measurement only
+
+static int
+null_begin (struct pcmout_t *this, const struct pcmfmt_t *fmt)
+{
+    (void)this, (void)fmt;
+    return NCAP_OK;
+}
+
+static int
+null_write (struct pcmout_t *this, const void *buf, size_t siz)
+{
+    (void)this, (void)buf, (void)siz;
+    return NCAP_OK;
+}
+
+int
+libav_measure (const char *fn_in, struct loudness_t *meter)
+{
+    // in the track's own format: nothing is played, so skip the resampler
+    struct pcmout_t out = {
+        .begin    = null_begin,
+        .write    = null_write,
+        .isnative = true,
+        .meter    = meter,
+    };
+
+    return transcode (fn_in, &out);
+}
+
+// tags only
+
+static const struct {
+    enum AVCodecID        id;
+    enum trackidx_codec_t codec;
+} codec_ids[] = {
+    { AV_CODEC_ID_AAC, TRACKIDX_CODEC_AAC },
+    { AV_CODEC_ID_ALAC, TRACKIDX_CODEC_AAC },
+    { AV_CODEC_ID_APE, TRACKIDX_CODEC_APE },
+    { AV_CODEC_ID_FLAC, TRACKIDX_CODEC_FLAC },
+    { AV_CODEC_ID_MP3, TRACKIDX_CODEC_MP3 },
+    { AV_CODEC_ID_OPUS, TRACKIDX_CODEC_OPUS },
+    { AV_CODEC_ID_VORBIS, TRACKIDX_CODEC_VORBIS },
+    { AV_CODEC_ID_WAVPACK, TRACKIDX_CODEC_WAVPACK },
+    { AV_CODEC_ID_WMAV1, TRACKIDX_CODEC_WMA },
+    { AV_CODEC_ID_WMAV2, TRACKIDX_CODEC_WMA },
+};
+
+/** copy tag key of the file, or else of its stream, to dst */
+static void
+copy_tag (char *dst, const AVFormatContext *fctx, const AVStream *st,
+          const char *key)
+{
+    const AVDictionaryEntry *e = av_dict_get (fctx->metadata, key, NULL, 0);
+
+    // Ogg keeps its comments on the stream
+    if (e == NULL && st != NULL)
+        e = av_dict_get (st->metadata, key, NULL, 0);
+
+    snprintf (dst, TAGCACHE_TAG_SIZ, "%s", e != NULL ? e->value : "");
+}
+
+int
+libav_read_meta (const char *fn_in, struct tagcache_meta_t *meta)
+{
+    AVFormatContext *fctx = NULL;
+    const AVStream  *st   = NULL;
+    char             trackno[TAGCACHE_TAG_SIZ];
+    int              avret;
+
+    // the demuxer reads the header and tags, and decodes nothing
+    if ((avret = avformat_open_input (&fctx, fn_in, NULL, NULL)) != 0) {
+        logef ("ERROR: avformat_open_input failed with error code %d: %s",
+               avret, av_err2str (avret));
+        return NCAP_EIO;
+    }
+
+    for (unsigned i = 0; i < fctx->nb_streams && st == NULL; ++i)
+        if (fctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO)
+            st = fctx->streams[i];
+
+    // a header without the length: probe packets for it, as playback does
+    if (fctx->duration == AV_NOPTS_VALUE
+        && (st == NULL || st->duration == AV_NOPTS_VALUE)
+        && avformat_find_stream_info (fctx, NULL) < 0)
+        logwf ("WARN: no duration found for `%s'", fn_in);
+
+    meta->duration_ms = 0;
+
+    if (fctx->duration != AV_NOPTS_VALUE && fctx->duration > 0)
+        meta->duration_ms = (uint32_t)(fctx->duration / (AV_TIME_BASE / 1000));
+    else if (st != NULL && st->duration != AV_NOPTS_VALUE && st->duration > 0)
+        meta->duration_ms = (uint32_t)av_rescale_q (
+            st->duration, st->time_base, (AVRational){ 1, 1000 });
+
+    meta->codec = TRACKIDX_CODEC_UNKNOWN;
+
+    for (size_t i = 0;
+         st != NULL && i < sizeof codec_ids / sizeof *codec_ids; ++i)
+        if (st->codecpar->codec_id == codec_ids[i].id)
+            meta->codec = codec_ids[i].codec;
+
+    if (st != NULL && meta->codec == TRACKIDX_CODEC_UNKNOWN
+        && st->codecpar->codec_id >= AV_CODEC_ID_FIRST_AUDIO
+        && st->codecpar->codec_id < AV_CODEC_ID_ADPCM_IMA_QT)
+        meta->codec = strcmp (fctx->iformat->name, "aiff") == 0
+                          ? TRACKIDX_CODEC_AIFF
+                          : TRACKIDX_CODEC_WAV; // plain PCM
+
+    copy_tag (meta->title, fctx, st, "title");
+    copy_tag (meta->artist, fctx, st, "artist");
+    copy_tag (meta->album, fctx, st, "album");
+    copy_tag (trackno, fctx, st, "track");
+    meta->trackno = (uint32_t)strtoul (trackno, NULL, 10); // "3/12" is 3
+
+    avformat_close_input (&fctx);
+
+    return NCAP_OK;
+}
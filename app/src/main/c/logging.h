@@ -3,6 +3,8 @@
 #ifndef LOGGING_H
 #define LOGGING_H
 
+#ifndef NCAP_ISTEST
+
 #include <android/log.h>
 #include <libavutil/error.h>
 
@@ -22,4 +24,27 @@
 #define logvf(fmt, ...) __android_log_print (ANDROID_LOG_VERBOSE, APPID, "%s: %s: " fmt, FILENAME, __func__, __VA_ARGS__)
 // clang-format on
 
+#else // NCAP_ISTEST
+
+#include <stdio.h>
+
+// host builds of the tests: errors and warnings go to stderr, the rest is
+// only type checked
+
+// clang-format off
+#define loge(fmt) fprintf (stderr, "%s: %s: " fmt "\n", FILENAME, __func__)
+#define logw(fmt) fprintf (stderr, "%s: %s: " fmt "\n", FILENAME, __func__)
+#define logi(fmt) do { if (0) printf ("%s: %s: " fmt, FILENAME, __func__); } while (0)
+#define logd(fmt) do { if (0) printf ("%s: %s: " fmt, FILENAME, __func__); } while (0)
+#define logv(fmt) do { if (0) printf ("%s: %s: " fmt, FILENAME, __func__); } while (0)
+
+#define logef(fmt, ...) fprintf (stderr, "%s: %s: " fmt "\n", FILENAME, __func__, __VA_ARGS__)
+#define logwf(fmt, ...) fprintf (stderr, "%s: %s: " fmt "\n", FILENAME, __func__, __VA_ARGS__)
+#define logif(fmt, ...) do { if (0) printf ("%s: %s: " fmt, FILENAME, __func__, __VA_ARGS__); } while (0)
+#define logdf(fmt, ...) do { if (0) printf ("%s: %s: " fmt, FILENAME, __func__, __VA_ARGS__); } while (0)
+#define logvf(fmt, ...) do { if (0) printf ("%s: %s: " fmt, FILENAME, __func__, __VA_ARGS__); } while (0)
+// clang-format on
+
+#endif // !NCAP_ISTEST
+
 #endif // !LOGGING_H
@@ -0,0 +1,300 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "loudness.h"
+
+// frames per true peak pass: the skip test is made once per chunk
+#define TP_CHUNK 64
+
+/** BS.1770 loudness of a mean square */
+static double
+lufs_of (double z)
+{
+    return -0.691 + 10 * log10 (z);
+}
+
+/**
+ * the K-weighting filters for rate, from the 48 kHz design in BS.1770
+ * re-derived with the bilinear transform, as in libebur128
+ */
+static void
+init_kweight (struct loudness_t *this)
+{
+    double f0 = 1681.974450955533;
+    double q  = 0.7071752369554196;
+    double k  = tan (M_PI * f0 / this->rate);
+
+    const double vh = pow (10, 3.999843853973347 / 20);
+    const double vb = pow (vh, 0.4996667741545416);
+    double       a0 = 1 + k / q + k * k;
+
+    this->shelf_b[0] = (vh + vb * k / q + k * k) / a0;
+    this->shelf_b[1] = 2 * (k * k - vh) / a0;
+    this->shelf_b[2] = (vh - vb * k / q + k * k) / a0;
+    this->shelf_a[0] = 2 * (k * k - 1) / a0;
+    this->shelf_a[1] = (1 - k / q + k * k) / a0;
+
+    f0 = 38.13547087602444;
+    q  = 0.5003270373238773;
+    k  = tan (M_PI * f0 / this->rate);
+    a0 = 1 + k / q + k * k;
+
+    this->hp_b[0] = 1;
+    this->hp_b[1] = -2;
+    this->hp_b[2] = 1;
+    this->hp_a[0] = 2 * (k * k - 1) / a0;
+    this->hp_a[1] = (1 - k / q + k * k) / a0;
+}
+
+/**
+ * a Hann windowed sinc for 4x upsampling, split into phases, each normalized
+ * to unity gain at DC. taps are stored newest sample last, to match tp_hist
+ */
+static void
+init_truepeak (struct loudness_t *this)
+{
+    const int    n = LOUDNESS_TP_PHASES * LOUDNESS_TP_TAPS;
+    const double c = (n - 1) / 2.0;
+
+    this->tp_gain = 0;
+
+    for (int p = 0; p < LOUDNESS_TP_PHASES; ++p) {
+        double sum = 0;
+        double abs = 0;
+
+        for (int j = 0; j < LOUDNESS_TP_TAPS; ++j) {
+            const int i
+                = LOUDNESS_TP_PHASES * (LOUDNESS_TP_TAPS - 1 - j) + p;
+            const double t = (i - c) / LOUDNESS_TP_PHASES;
+            const double w = 0.5 - 0.5 * cos (2 * M_PI * (i + 0.5) / n);
+            const double h = w * (t == 0 ? 1 : sin (M_PI * t) / (M_PI * t));
+
+            this->tp_h[p][j] = (float)h;
+            sum += h;
+        }
+
+        for (int j = 0; j < LOUDNESS_TP_TAPS; ++j) {
+            this->tp_h[p][j] /= (float)sum;
+            abs += fabsf (this->tp_h[p][j]);
+        }
+
+        if (abs > this->tp_gain)
+            this->tp_gain = (float)abs;
+    }
+}
+
+void
+loudness_init (struct loudness_t *this, int rate, int channels)
+{
+    memset (this, 0, sizeof *this);
+
+    this->isok     = rate >= 8000 && channels > 0
+                 && channels <= LOUDNESS_MAX_CHANNELS;
+    this->rate     = rate;
+    this->channels = channels;
+
+    if (!this->isok)
+        return;
+
+    // BS.1770: surrounds count 1.41 times, LFE not at all
+    for (int ch = 0; ch < channels; ++ch)
+        this->weight[ch] = 1;
+
+    if (channels == 5) {
+        this->weight[3] = this->weight[4] = 1.41;
+    } else if (channels == 6 || channels == 8) {
+        this->weight[3] = 0;
+
+        for (int ch = 4; ch < channels; ++ch)
+            this->weight[ch] = 1.41;
+    }
+
+    this->sub_len = rate / 10;
+
+    init_kweight (this);
+    init_truepeak (this);
+}
+
+static float
+sample (const void *buf, uint16_t fmt, size_t i)
+{
+    switch (fmt) {
+        case 1:
+            return ((const int16_t *)buf)[i] * (1.0f / 32768);
+        case 2:
+            return ((const int32_t *)buf)[i] * (1.0f / 2147483648.0f);
+        default:
+            return ((const float *)buf)[i];
+    }
+}
+
+/** a 400 ms block ends every 100 ms once 4 sub-blocks are done */
+static void
+end_subblock (struct loudness_t *this)
+{
+    this->sub[this->nsub++ % 4] = this->sub_acc / this->sub_len;
+    this->sub_acc               = 0;
+    this->sub_fill              = 0;
+
+    if (this->nsub < 4)
+        return;
+
+    const double z = (this->sub[0] + this->sub[1] + this->sub[2]
+                      + this->sub[3])
+                     / 4;
+
+    if (z <= 0)
+        return;
+
+    const double l = lufs_of (z);
+
+    if (l < LOUDNESS_GATE_LUFS)
+        return;
+
+    int bin = (int)((l - LOUDNESS_GATE_LUFS) * 10);
+
+    if (bin >= LOUDNESS_NBINS)
+        bin = LOUDNESS_NBINS - 1;
+
+    ++this->hist_n[bin];
+    this->hist_e[bin] += z;
+}
+
+/** K-weight one channel's sample; @return its weighted square */
+static double
+kweight (struct loudness_t *this, int ch, double x)
+{
+    double *const z = this->z[ch];
+    double        y;
+
+    y    = this->shelf_b[0] * x + z[0];
+    z[0] = this->shelf_b[1] * x - this->shelf_a[0] * y + z[1];
+    z[1] = this->shelf_b[2] * x - this->shelf_a[1] * y;
+    x    = y;
+
+    y    = this->hp_b[0] * x + z[2];
+    z[2] = this->hp_b[1] * x - this->hp_a[0] * y + z[3];
+    z[3] = this->hp_b[2] * x - this->hp_a[1] * y;
+
+    return this->weight[ch] * y * y;
+}
+
+/** @return the largest magnitude upsampled from win, oldest sample first */
+static float
+interp_peak (const struct loudness_t *this, const float *win)
+{
+    float peak = 0;
+
+    for (int p = 0; p < LOUDNESS_TP_PHASES; ++p) {
+        float y = 0;
+
+        for (int j = 0; j < LOUDNESS_TP_TAPS; ++j)
+            y += this->tp_h[p][j] * win[j];
+
+        y    = fabsf (y);
+        peak = y > peak ? y : peak;
+    }
+
+    return peak;
+}
+
+/** frames [begin, end) of a chunk */
+static void
+add_chunk (struct loudness_t *this, const void *buf, uint16_t fmt,
+           size_t begin, size_t end)
+{
+    const int c    = this->channels;
+    float     vmax = 0;
+
+    // the window of every sample in the chunk: its history and the chunk
+    for (int ch = 0; ch < c; ++ch)
+        for (int j = 0; j < LOUDNESS_TP_TAPS; ++j) {
+            const float a = fabsf (this->tp_hist[ch][j]);
+            vmax          = a > vmax ? a : vmax;
+        }
+
+    for (size_t i = begin * c; i < end * c; ++i) {
+        const float a = fabsf (sample (buf, fmt, i));
+        vmax          = a > vmax ? a : vmax;
+    }
+
+    // no sample here is above the peak, and neither is any interpolation
+    const bool isinterp = vmax * this->tp_gain > this->peak;
+
+    if (vmax > this->peak)
+        this->peak = vmax;
+
+    for (size_t f = begin; f < end; ++f) {
+        const size_t pos = this->tp_pos;
+        double       e   = 0;
+
+        for (int ch = 0; ch < c; ++ch) {
+            const float x = sample (buf, fmt, f * c + ch);
+            float      *h = this->tp_hist[ch];
+
+            // written twice so the window is always contiguous
+            h[pos] = h[pos + LOUDNESS_TP_TAPS] = x;
+
+            if (isinterp) {
+                const float y = interp_peak (this, h + pos + 1);
+                this->peak    = y > this->peak ? y : this->peak;
+            }
+
+            e += kweight (this, ch, x);
+        }
+
+        this->tp_pos = (pos + 1) % LOUDNESS_TP_TAPS;
+        this->sub_acc += e;
+
+        if (++this->sub_fill == this->sub_len)
+            end_subblock (this);
+    }
+}
+
+void
+loudness_add (struct loudness_t *this, const void *buf, uint16_t fmt,
+              size_t nframes)
+{
+    if (!this->isok || fmt < 1 || fmt > 3)
+        return;
+
+    for (size_t f = 0; f < nframes; f += TP_CHUNK)
+        add_chunk (this, buf, fmt, f,
+                   nframes - f < TP_CHUNK ? nframes : f + TP_CHUNK);
+}
+
+void
+loudness_result (const struct loudness_t *this, float *lufs, float *peak)
+{
+    uint64_t n = 0;
+    double   e = 0;
+
+    *peak = this->peak;
+    *lufs = LOUDNESS_SILENT;
+
+    for (int i = 0; i < LOUDNESS_NBINS; ++i) {
+        n += this->hist_n[i];
+        e += this->hist_e[i];
+    }
+
+    if (n == 0)
+        return;
+
+    // relative gate, to the nearest bin
+    const double rel = lufs_of (e / n) - 10;
+    int          i0  = (int)((rel - LOUDNESS_GATE_LUFS) * 10 + 0.5);
+
+    n = 0;
+    e = 0;
+
+    for (int i = i0 < 0 ? 0 : i0; i < LOUDNESS_NBINS; ++i) {
+        n += this->hist_n[i];
+        e += this->hist_e[i];
+    }
+
+    if (n > 0)
+        *lufs = (float)lufs_of (e / n);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * EBU R128 / ITU-R BS.1770 loudness meter, fed the PCM a decoder produces so
+ * that measuring takes no second read of the file. Integrated loudness is
+ * gated as in BS.1770-4: 400 ms blocks every 100 ms, an absolute gate at
+ * -70 LUFS and a relative one 10 LU below. Blocks are binned by loudness
+ * instead of kept, so memory does not grow with the track. True peak is the
+ * peak of the signal upsampled 4x, skipping windows that cannot exceed the
+ * peak so far.
+ */
+
+#define LOUDNESS_MAX_CHANNELS 8
+
+// gating histogram: 0.1 LU bins from the absolute gate up
+#define LOUDNESS_GATE_LUFS -70
+#define LOUDNESS_NBINS     800
+
+// true peak interpolator: 4 phases of 12 taps
+#define LOUDNESS_TP_PHASES 4
+#define LOUDNESS_TP_TAPS   12
+
+/** what lufs is for a track with no block above the absolute gate */
+#define LOUDNESS_SILENT LOUDNESS_GATE_LUFS
+
+struct loudness_t {
+    bool isok; // the rate and layout can be measured
+    int  rate;
+    int  channels;
+
+    // K-weighting: a high shelf, then a high pass, per channel
+    double shelf_b[3], shelf_a[2];
+    double hp_b[3], hp_a[2];
+    double z[LOUDNESS_MAX_CHANNELS][4]; // direct form II transposed state
+    double weight[LOUDNESS_MAX_CHANNELS];
+
+    // 100 ms sub-blocks; a gating block is the last 4
+    size_t sub_len;  // frames per sub-block
+    size_t sub_fill; // frames in the current one
+    double sub_acc;  // weighted sum of squares of the current one
+    double sub[4];   // mean squares of the last 4
+    size_t nsub;     // sub-blocks done
+
+    uint32_t hist_n[LOUDNESS_NBINS];
+    double   hist_e[LOUDNESS_NBINS]; // sum of the binned blocks' energies
+
+    // true peak
+    float  tp_h[LOUDNESS_TP_PHASES][LOUDNESS_TP_TAPS];
+    float  tp_gain; // largest sum of |h| over a phase
+    float  tp_hist[LOUDNESS_MAX_CHANNELS][2 * LOUDNESS_TP_TAPS];
+    size_t tp_pos;  // where the next sample goes in tp_hist, mod TAPS
+    float  peak;    // linear
+};
+
+/**
+ * start measuring a track. channels above LOUDNESS_MAX_CHANNELS are not
+ * supported; this->isok is false then and loudness_add does nothing
+ */
+extern void loudness_init (struct loudness_t *this, int rate, int channels);
+
+/**
+ * @param fmt wFormatTag: 1 for S16, 2 for S32, 3 for FLT. others are
+ * skipped
+ */
+extern void loudness_add (struct loudness_t *this, const void *buf,
+                          uint16_t fmt, size_t nframes);
+
+/**
+ * @param lufs integrated loudness, or LOUDNESS_SILENT
+ * @param peak true peak, linear. 1 is full scale
+ */
+extern void loudness_result (const struct loudness_t *this, float *lufs,
+                             float *peak);
+
+#endif // !LOUDNESS_H
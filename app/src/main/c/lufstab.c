@@ -0,0 +1,376 @@
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio.h"
+#include "dirscan.h"
+#include "logging.h"
+#include "loudness.h"
+#include "lufstab.h"
+#include "pcmcache.h"
+#include "strvec.h"
+
+static const char *FILENAME = "lufstab.c";
+
+#define MAGIC   "NCLT"
+#define VERSION 1
+
+// rewrite the file on load once it has this many more records than keys
+#define STALE_SLACK 64
+
+#define SCAN_MAX_THREADS 16
+
+struct header_t {
+    char     magic[4];
+    uint32_t version;
+};
+
+static pthread_mutex_t       tab_mx = PTHREAD_MUTEX_INITIALIZER;
+static struct lufstab_ent_t *ents   = NULL; // sorted by key
+static size_t                len    = 0;
+static size_t                cap    = 0;
+static FILE                 *fp     = NULL; // appended to by lufstab_put
+
+/** call with tab_mx held. @return the index of key, or where it goes */
+static size_t
+lower_bound (uint64_t key)
+{
+    size_t lo = 0;
+    size_t hi = len;
+
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+
+        if (ents[mid].key < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/** call with tab_mx held */
+static int
+upsert (const struct lufstab_ent_t *ent)
+{
+    const size_t i = lower_bound (ent->key);
+
+    if (i < len && ents[i].key == ent->key) {
+        ents[i] = *ent;
+        return NCAP_OK;
+    }
+
+    if (len == cap) {
+        const size_t          ncap = cap ? cap << 1 : 256;
+        struct lufstab_ent_t *tmp  = realloc (ents, ncap * sizeof *ents);
+
+        if (tmp == NULL) {
+            loge ("ERROR: realloc for the loudness table failed");
+            return NCAP_EALLOC;
+        }
+
+        ents = tmp;
+        cap  = ncap;
+    }
+
+    memmove (ents + i + 1, ents + i, (len - i) * sizeof *ents);
+    ents[i] = *ent;
+    ++len;
+
+    return NCAP_OK;
+}
+
+/**
+ * call with tab_mx held
+ *
+ * @return records read, or 0 if fn does not exist or is not a table
+ */
+static size_t
+load (const char *fn)
+{
+    FILE                *in = fopen (fn, "rb");
+    struct header_t      header;
+    struct lufstab_ent_t ent;
+    size_t               nrec = 0;
+
+    if (in == NULL)
+        return 0;
+
+    if (fread (&header, sizeof header, 1, in) != 1
+        || memcmp (header.magic, MAGIC, 4) != 0 || header.version != VERSION) {
+        logwf ("WARN: `%s' is not a loudness table. replacing it", fn);
+        fclose (in);
+        return 0;
+    }
+
+    // a record cut short by a kill is dropped
+    while (fread (&ent, sizeof ent, 1, in) == 1 && upsert (&ent) == NCAP_OK)
+        ++nrec;
+
+    fclose (in);
+
+    return nrec;
+}
+
+/** call with tab_mx held. write the table whole, then move it into place */
+static int
+rewrite (const char *fn)
+{
+    const struct header_t header = { .magic = MAGIC, .version = VERSION };
+    char                  tmp[PATH_MAX];
+    FILE                 *out;
+
+    snprintf (tmp, sizeof tmp, "%s.tmp", fn);
+
+    if ((out = fopen (tmp, "wb")) == NULL) {
+        logef ("ERROR: fopen `%s' failed for wb: %s", tmp, strerror (errno));
+        return NCAP_EIO;
+    }
+
+    const bool ok = fwrite (&header, sizeof header, 1, out) == 1
+                    && (len == 0
+                        || fwrite (ents, sizeof *ents, len, out) == len);
+
+    if (fclose (out) != 0 || !ok || rename (tmp, fn) != 0) {
+        logef ("ERROR: could not rewrite `%s'", fn);
+        remove (tmp);
+        return NCAP_EIO;
+    }
+
+    return NCAP_OK;
+}
+
+int
+lufstab_init (const char *fn)
+{
+    int ret = NCAP_OK;
+
+    pthread_mutex_lock (&tab_mx);
+
+    if (fp != NULL)
+        fclose (fp);
+
+    fp  = NULL;
+    len = 0;
+
+    const size_t nrec = load (fn);
+
+    logif ("loudness table `%s': %zu tracks in %zu records", fn, len, nrec);
+
+    if ((nrec == 0 || nrec > len + STALE_SLACK)
+        && (ret = rewrite (fn)) != NCAP_OK)
+        goto exit;
+
+    if ((fp = fopen (fn, "ab")) == NULL) {
+        logef ("ERROR: fopen `%s' failed for ab: %s", fn, strerror (errno));
+        ret = NCAP_EIO;
+    }
+
+exit:
+    pthread_mutex_unlock (&tab_mx);
+    return ret;
+}
+
+void
+lufstab_deinit (void)
+{
+    pthread_mutex_lock (&tab_mx);
+
+    if (fp != NULL)
+        fclose (fp);
+
+    free (ents);
+    fp   = NULL;
+    ents = NULL;
+    len  = 0;
+    cap  = 0;
+
+    pthread_mutex_unlock (&tab_mx);
+}
+
+bool
+lufstab_find (uint64_t key, struct lufstab_ent_t *ent)
+{
+    pthread_mutex_lock (&tab_mx);
+
+    const size_t i     = lower_bound (key);
+    const bool   found = i < len && ents[i].key == key;
+
+    if (found)
+        *ent = ents[i];
+
+    pthread_mutex_unlock (&tab_mx);
+
+    return found;
+}
+
+int
+lufstab_put (const struct lufstab_ent_t *ent)
+{
+    int ret;
+
+    pthread_mutex_lock (&tab_mx);
+
+    if ((ret = upsert (ent)) == NCAP_OK && fp != NULL
+        && (fwrite (ent, sizeof *ent, 1, fp) != 1 || fflush (fp) != 0)) {
+        logw ("WARN: could not append to the loudness table");
+        ret = NCAP_EIO;
+    }
+
+    pthread_mutex_unlock (&tab_mx);
+
+    return ret;
+}
+
+float
+lufstab_gain (const struct lufstab_ent_t *ent)
+{
+    if (ent->lufs <= LOUDNESS_SILENT)
+        return 1;
+
+    float g = powf (10, (LUFSTAB_TARGET_LUFS - ent->lufs) / 20);
+
+    if (ent->peak > 0 && g * ent->peak > 1)
+        g = 1 / ent->peak;
+
+    return g < 1 ? g : 1;
+}
+
+static int
+put_meter (uint64_t key, const char *fn_src, const struct loudness_t *meter)
+{
+    struct lufstab_ent_t ent = { .key = key };
+
+    loudness_result (meter, &ent.lufs, &ent.peak);
+
+    logif ("`%s': %.1f LUFS, true peak %.1f dBTP", fn_src, ent.lufs,
+           20 * log10f (ent.peak > 0 ? ent.peak : 1e-6f));
+
+    return lufstab_put (&ent);
+}
+
+int
+lufstab_put_meter (const char *fn_src, const struct loudness_t *meter)
+{
+    uint64_t key;
+    int      ret;
+
+    if (!meter->isok)
+        return NCAP_EGEN;
+
+    if ((ret = pcmcache_key (fn_src, &key)) != NCAP_OK)
+        return ret;
+
+    return put_meter (key, fn_src, meter);
+}
+
+// batch scan
+
+struct scan_t {
+    const strvec_t    *sv; // paths relative to dir
+    const char        *dir;
+    lufstab_measure_t  measure;
+    const atomic_bool *isstop;
+    atomic_size_t      next; // index into sv
+    atomic_size_t      nmeasured;
+};
+
+static void *
+tfn_scan (void *args_vp)
+{
+    struct scan_t       *scan = args_vp;
+    struct lufstab_ent_t ent;
+    struct loudness_t    meter;
+    uint64_t             key;
+    size_t               i;
+    char                 fn[PATH_MAX];
+
+    while ((i = atomic_fetch_add (&scan->next, 1)) < scan->sv->siz
+           && !atomic_load_explicit (scan->isstop, memory_order_relaxed)) {
+        // dirscan keeps only paths that fit
+        snprintf (fn, sizeof fn, "%s/%s", scan->dir, scan->sv->ptr[i]);
+
+        if (pcmcache_key (fn, &key) != NCAP_OK || lufstab_find (key, &ent))
+            continue;
+
+        if (scan->measure (fn, &meter) != NCAP_OK || !meter.isok) {
+            logwf ("WARN: could not measure `%s'", fn);
+            continue;
+        }
+
+        put_meter (key, fn, &meter);
+        atomic_fetch_add (&scan->nmeasured, 1);
+    }
+
+    return NULL;
+}
+
+/** @return files measured */
+static size_t
+scan_files (const strvec_t *sv, const char *dir, int nthreads,
+            lufstab_measure_t measure, const atomic_bool *isstop)
+{
+    struct scan_t scan = {
+        .sv      = sv,
+        .dir     = dir,
+        .measure = measure,
+        .isstop  = isstop,
+    };
+    pthread_t tids[SCAN_MAX_THREADS];
+    int       nspawn = 0;
+
+    atomic_init (&scan.next, 0);
+    atomic_init (&scan.nmeasured, 0);
+
+    if (nthreads > SCAN_MAX_THREADS)
+        nthreads = SCAN_MAX_THREADS;
+
+    // this thread is one of them
+    while (nspawn + 1 < nthreads && (size_t)nspawn + 1 < sv->siz
+           && pthread_create (&tids[nspawn], NULL, tfn_scan, &scan) == 0)
+        ++nspawn;
+
+    logif ("measuring the loudness of %zu files on %d threads", sv->siz,
+           nspawn + 1);
+
+    tfn_scan (&scan);
+
+    for (int i = 0; i < nspawn; ++i)
+        pthread_join (tids[i], NULL);
+
+    return atomic_load (&scan.nmeasured);
+}
+
+int
+lufstab_scan (const char *dir, int nthreads, lufstab_measure_t measure,
+              const atomic_bool *isstop, size_t *nmeasured)
+{
+    strvec_t sv;
+    size_t   n = 0;
+    int      ret;
+
+    if (strvec_init (&sv) != STRQUEUE_OK)
+        return NCAP_EALLOC;
+
+    if ((ret = dirscan (&sv, dir, dirscan_audio_exts, nthreads)) != NCAP_OK)
+        goto exit;
+
+    n = scan_files (&sv, dir, nthreads, measure, isstop);
+    logif ("measured %zu new tracks in `%s'", n, dir);
+
+exit:
+    if (nmeasured != NULL)
+        *nmeasured = n;
+
+    strvec_deinit (&sv);
+
+    return ret;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#ifndef LUFSTAB_H
+#define LUFSTAB_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "loudness.h"
+
+/**
+ * Persistent table of track loudness, keyed like the PCM cache (see
+ * pcmcache_key), so each track is measured once and an edited file again.
+ * The file is a header and fixed-size records, appended to as tracks are
+ * measured; on load the last record of a key wins, and a file mostly made of
+ * stale records is rewritten. Lookups binary search a sorted copy in memory.
+ */
+
+/** the level tracks are normalized to: the ReplayGain 2.0 reference */
+#define LUFSTAB_TARGET_LUFS -18.0f
+
+struct lufstab_ent_t {
+    uint64_t key;
+    float    lufs; // integrated loudness
+    float    peak; // true peak, linear
+};
+
+/** what measures a file for lufstab_scan, e.g. libav_measure */
+typedef int (*lufstab_measure_t) (const char *fn, struct loudness_t *meter);
+
+/**
+ * load fn, creating it if needed. may be called again to switch files
+ *
+ * @return NCAP_OK, NCAP_EIO or NCAP_EALLOC. the table is empty but usable
+ * in memory on error
+ */
+extern int lufstab_init (const char *fn);
+
+extern void lufstab_deinit (void);
+
+/** @return whether key was found, copied to ent */
+extern bool lufstab_find (uint64_t key, struct lufstab_ent_t *ent);
+
+/**
+ * add or replace an entry, in memory and on disk
+ *
+ * @return NCAP_OK, NCAP_EALLOC, or NCAP_EIO if only kept in memory
+ */
+extern int lufstab_put (const struct lufstab_ent_t *ent);
+
+/**
+ * @return the gain that brings ent to LUFSTAB_TARGET_LUFS without its true
+ * peak clipping. attenuates only, as the volume stage tops out at unity
+ */
+extern float lufstab_gain (const struct lufstab_ent_t *ent);
+
+/** key fn_src and store what meter measured of it */
+extern int lufstab_put_meter (const char *fn_src,
+                              const struct loudness_t *meter);
+
+/**
+ * measure every audio file under dir that has no entry, on nthreads
+ * threads. blocks until done or *isstop is set. see dirscan_audio_exts
+ *
+ * @param nmeasured if not NULL, set to the files measured
+ * @return NCAP_OK, NCAP_EIO if dir cannot be read, or NCAP_EALLOC
+ */
+extern int lufstab_scan (const char *dir, int nthreads,
+                         lufstab_measure_t measure, const atomic_bool *isstop,
+                         size_t *nmeasured);
+
+#endif // !LUFSTAB_H
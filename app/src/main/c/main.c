@@ -1,31 +1,42 @@
-#include <dirent.h>
 #include <errno.h>
 #include <jni.h>
+#include <limits.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "audio.h"
 #include "config.h"
+#include "dirscan.h"
 #include "logging.h"
+#include "loudness.h"
+#include "lufstab.h"
+#include "pcmbuf.h"
+#include "pcmcache.h"
+#include "playctl.h"
+#include "playpos.h"
 #include "properties.h"
 #include "render.h"
 #include "strvec.h"
+#include "tagcache.h"
+#include "tagparse.h"
+#include "trackidx.h"
+#include "trackwatch.h"
+#include "trackq.h"
 
 static const char *FILENAME = "main.c";
 
 #ifndef MAX_PATH_LEN
-#define MAX_PATH_LEN 128
+#define MAX_PATH_LEN PATH_MAX // tracks may be nested deep in track_path
 #endif
 
 static ANativeActivity *activity;
 
-static const struct timespec retry_ts
-    = { .tv_sec = 0, .tv_nsec = 250000000 }; // 250 ms
-
 static void
 path_concat (char *dst, const char *restrict prefix, const char *restrict file)
 {
@@ -39,35 +50,18 @@ path_concat (char *dst, const char *restrict prefix, const char *restrict file)
     dst[malloc_siz - 1] = '\0';
 }
 
+/** tags read natively where the container allows, else by libav */
 static int
-load_dir (strvec_t *sv, const char *path)
+read_meta (const char *fn, struct tagcache_meta_t *meta)
 {
-    struct dirent *dir;
-    DIR           *dp = opendir (path);
-
-    if (dp == NULL) {
-        logef ("opendir failed for path `%s': %s", path, strerror (errno));
-        return -1;
-    }
-
-    while ((dir = readdir (dp)) != NULL) {
-        if (dir->d_type != DT_REG) {
-            logvf ("skipping file `%s': not a DT_REG file", dir->d_name);
-            continue;
-        }
+    const int ret = tagparse_read (fn, meta);
 
-        strvec_pushb (sv, dir->d_name, strlen (dir->d_name));
-        logvf ("pushed file `%s'", dir->d_name);
-    }
-
-    if (closedir (dp) != 0) {
-        logef ("ERROR: closedir failed: %s", strerror (errno));
-        return -1;
-    }
+    if (ret != NCAP_EGEN)
+        return ret;
 
-    logdf ("closed DIR pointer to path `%s'", path);
+    memset (meta, 0, sizeof *meta);
 
-    return 0;
+    return libav_read_meta (fn, meta);
 }
 
 struct audio_play_args_t {
@@ -76,115 +70,367 @@ struct audio_play_args_t {
     int               errstat;
 };
 
+struct lookahead_args_t {
+    const char *const      prefix;
+    const strvec_t *const  sv;
+    struct trackq_t *const q;
+};
+
+/**
+ * @param gain set to the loudness normalization gain of fn_in, or 1
+ * @return whether fn_in should be measured: normalization is on and it has
+ * no entry yet
+ */
+static bool
+track_gain (const char *fn_in, float *gain)
+{
+    struct lufstab_ent_t ent;
+    uint64_t             key;
+
+    *gain = 1;
+
+    if (!ncap_config.loudnorm || pcmcache_key (fn_in, &key) != NCAP_OK)
+        return false;
+
+    if (!lufstab_find (key, &ent))
+        return true;
+
+    *gain = lufstab_gain (&ent);
+    logif ("`%s': %.1f LUFS. normalizing by %.2f", fn_in, ent.lufs, *gain);
+
+    return false;
+}
+
+/**
+ * store what meter measured of a track decoded whole
+ *
+ * @return its gain, as track_gain
+ */
+static float
+put_meter (const char *fn_in, const struct loudness_t *meter)
+{
+    float gain = 1;
+
+    if (lufstab_put_meter (fn_in, meter) != NCAP_OK)
+        logwf ("WARN: could not store the loudness of `%s'", fn_in);
+    else
+        track_gain (fn_in, &gain);
+
+    return gain;
+}
+
+/**
+ * fill pb from the PCM cache, or decode fn_in into it and cache the result
+ *
+ * @param meter if not NULL, measures fn_in if it is decoded. valid only if
+ * this returns NCAP_OK and meter->isok
+ */
+static int
+decode_cached (const char *fn_in, struct pcmbuf_t *pb,
+               struct loudness_t *meter)
+{
+    struct pcmcache_ent_t ent;
+    int                   ret;
+
+    switch (pcmcache_find (fn_in, &ent)) {
+        case PCMCACHE_HIT:
+            logif ("reading `%s' from the PCM cache", fn_in);
+            return pcmcache_read_pcmbuf (&ent, pb);
+        case PCMCACHE_MISS:
+            break;
+        default:
+            return libav_decode_pcmbuf (fn_in, pb, NULL, meter);
+    }
+
+    FILE *fp = fopen (ent.tmp, "wb");
+
+    if (fp == NULL) {
+        logwf ("WARN: fopen `%s' failed for wb: %s. not caching", ent.tmp,
+               strerror (errno));
+        return libav_decode_pcmbuf (fn_in, pb, NULL, meter);
+    }
+
+    ret = libav_decode_pcmbuf (fn_in, pb, fp, meter);
+
+    const bool iscomplete = ret == NCAP_OK && !ferror (fp);
+
+    if (fclose (fp) == 0 && iscomplete)
+        pcmcache_commit (&ent);
+    else
+        pcmcache_discard (&ent);
+
+    return ret;
+}
+
+/**
+ * decode the tracks in sv order into q. each track is queued before it is
+ * decoded, and decoding blocks while its ring is full, so track i + 1 starts
+ * decoding once track i is decoded but still playing
+ */
 static void *
-tfn_audio_play (void *args_vp)
+tfn_lookahead (void *args_vp)
 {
+    struct lookahead_args_t *args  = args_vp;
+    size_t                   burst = 0;
+    char                     fn_in[MAX_PATH_LEN];
+    struct loudness_t        meter;
+
+    for (size_t i = 0; i < args->sv->siz && !trackq_isstop (args->q); ++i) {
+        trackq_reclaim (args->q);
+
+        // the first track waits for the stream to size its ring; later ones
+        // reuse the burst of the stream that is already open
+        struct pcmbuf_t *pb = pcmbuf_new (burst);
+
+        if (pb == NULL) {
+            loge ("ERROR: alloc for pcmbuf failed. stopping look-ahead...");
+            break;
+        }
+
+        pb->id     = i;
+        pb->min_ms = ncap_config.xfade_ms;
+
+        path_concat (fn_in, args->prefix, args->sv->ptr[i]);
+
+        // a track is measured while it first plays, at unity gain
+        const bool ismeasure = track_gain (fn_in, &pb->gain);
+
+        meter.isok = false; // stays so on a PCM cache hit
+
+        if (!trackq_push (args->q, pb)) {
+            pcmbuf_free (pb);
+            break;
+        }
+
+        // pairs with trackq_stop: either it drains and aborts pb, or we see
+        // the stop here and never decode into pb
+        if (trackq_isstop (args->q))
+            break;
+
+        logif ("decoding `%s' ahead of playback...", fn_in);
+
+        const int ret = decode_cached (fn_in, pb, ismeasure ? &meter : NULL);
+
+        if (ret != NCAP_OK)
+            logwf ("WARN: decoding `%s' stopped with code %d", fn_in, ret);
+        else if (ismeasure && meter.isok)
+            put_meter (fn_in, &meter);
+
+        const size_t pb_burst = pcmbuf_burst (pb);
+
+        if (pb_burst != 0)
+            burst = pb_burst;
+    }
+
+    trackq_end (args->q);
+    logd ("look-ahead decoder thread exiting");
+
+    pthread_exit (NULL);
+}
+
+/**
+ * play the whole track list gaplessly, decoding one track ahead
+ */
+static int
+play_gapless (const char *prefix, const strvec_t *sv)
+{
+    struct trackq_t q;
+    int             ret;
+
+    if ((ret = trackq_init (&q)) != NCAP_OK) {
+        loge ("ERROR: trackq_init failed");
+        return ret;
+    }
+
+    pthread_t               lookahead_tid;
+    struct lookahead_args_t lookahead_args = {
+        .prefix = prefix,
+        .sv     = sv,
+        .q      = &q,
+    };
+
     int pth_ret;
 
-    if ((pth_ret = pthread_mutex_lock (&render_ready_mx)) != 0) {
-        logwf ("WARN: could not lock render_ready_mx. Error code %d: %s",
+    if ((pth_ret = pthread_create (&lookahead_tid, NULL, tfn_lookahead,
+                                   &lookahead_args))
+        != 0) {
+        logef ("ERROR: could not spawn look-ahead thread. Error code %d: %s",
                pth_ret, strerror (pth_ret));
-        pthread_exit (NULL);
+        trackq_deinit (&q);
+        return NCAP_EALLOC;
     }
 
-    while (!render_ready)
-        pthread_cond_wait (&render_ready_cv, &render_ready_mx);
+    ret = audio_play_trackq (&q);
 
-    pthread_mutex_unlock (&render_ready_mx);
+    // playback may stop before the decoder is done (e.g. PLAYCTL_CLOSE)
+    trackq_stop (&q);
+    pthread_join (lookahead_tid, NULL);
+    trackq_deinit (&q);
 
-    logi ("render_ready = true; audio_play thread proceeding");
+    return ret;
+}
 
-    struct audio_play_args_t *args = args_vp;
-    strvec_t *const           sv   = args->sv;
-    int                       pth_err;
+/**
+ * decode the whole track to a WAV file, then play it. the file is a PCM cache
+ * entry when possible, else NCAP_AUDIO_CACHE_FILE
+ */
+static int
+play_cwav (const char *fn_in)
+{
+    static char              fn_out[MAX_PATH_LEN];
+    static struct loudness_t meter;
+    struct pcmcache_ent_t    ent;
+    float                    norm;
+    int                      ret;
+
+    const bool ismeasure = track_gain (fn_in, &norm);
+
+    switch (pcmcache_find (fn_in, &ent)) {
+        case PCMCACHE_HIT:
+            logif ("playing `%s' from the PCM cache", fn_in);
+            snprintf (fn_out, sizeof fn_out, "%s", ent.path);
+            goto play;
+        case PCMCACHE_MISS:
+            logif ("converting `%s' to cache entry `%s'...", fn_in, ent.tmp);
+
+            if ((ret = libav_cvt_cwav (fn_in, ent.tmp,
+                                       ismeasure ? &meter : NULL))
+                != NCAP_OK) {
+                logef ("ERROR: libav_cvt_wav failed with code %d\n", ret);
+                pcmcache_discard (&ent);
+                return ret;
+            }
 
-    for (size_t i = 0; i < sv->siz; ++i) {
-        // get path
+            // decoded whole before it plays, so normalized already
+            if (ismeasure)
+                norm = put_meter (fn_in, &meter);
 
-        logvf ("preparing to play `%s'", sv->ptr[i]);
+            if (pcmcache_commit (&ent) == NCAP_OK) {
+                snprintf (fn_out, sizeof fn_out, "%s", ent.path);
+                goto play;
+            }
 
-        static char fn_in[MAX_PATH_LEN], fn_out[MAX_PATH_LEN];
-        path_concat (fn_in, args->prefix, sv->ptr[i]);
-        path_concat (fn_out, activity->internalDataPath,
-                     NCAP_AUDIO_CACHE_FILE);
+            // not cacheable (e.g. over budget): use the scratch file
+            break;
+        default:
+            break;
+    }
 
-        // get PCM
+    path_concat (fn_out, activity->internalDataPath, NCAP_AUDIO_CACHE_FILE);
 
-        logif ("converting `%s' to WAV file `%s'...", fn_in, fn_out);
+    logif ("converting `%s' to WAV file `%s'...", fn_in, fn_out);
 
-        if ((args->errstat = libav_cvt_cwav (fn_in, fn_out)) != NCAP_OK) {
-            logef ("ERROR: libav_cvt_wav failed with code %d. aborting...\n",
-                   args->errstat);
-            goto exit;
-        }
+    if ((ret = libav_cvt_cwav (fn_in, fn_out, ismeasure ? &meter : NULL))
+        != NCAP_OK) {
+        logef ("ERROR: libav_cvt_wav failed with code %d\n", ret);
+        return ret;
+    }
 
-        // update render
+    if (ismeasure)
+        norm = put_meter (fn_in, &meter);
 
-        logd ("locking render_atrid_mx mutex to update render...");
+play:
+    logi ("playing audio...");
 
-        while ((pth_err = pthread_mutex_lock (&render_atrid_mx)) != 0) {
-            logwf ("WARN: failed to lock render_atrid_mx. Error code %d: %s. "
-                   "Retrying...",
-                   pth_err, strerror (pth_err));
-            nanosleep (&retry_ts, NULL);
-        }
+    if ((ret = audio_play (fn_out, norm)) != NCAP_OK)
+        logef ("ERROR: audio_play failed with code %d\n", ret);
 
-        render_atrid = i;
+    return ret;
+}
 
-        pthread_mutex_unlock (&render_atrid_mx);
+struct lufscan_args_t {
+    const char *path;
+    atomic_bool isstop;
+};
 
-        // play audio
+/**
+ * measure the tracks that have no loudness entry yet on every core, so that
+ * they play normalized the first time. each finishes its track on stop
+ */
+static void *
+tfn_lufscan (void *args_vp)
+{
+    struct lufscan_args_t *args = args_vp;
+    const long             ncpu = sysconf (_SC_NPROCESSORS_ONLN);
 
-        logi ("playing audio...");
+    lufstab_scan (args->path, ncpu > 0 ? (int)ncpu : 1, libav_measure,
+                  &args->isstop, NULL);
 
-        if ((args->errstat = audio_play (fn_out)) != NCAP_OK) {
-            logef ("ERROR: libav_cvt_wav failed with code %d. aborting...\n",
-                   args->errstat);
+    logd ("loudness scan thread exiting");
+
+    pthread_exit (NULL);
+}
+
+static void *
+tfn_audio_play (void *args_vp)
+{
+    if (playctl_waitfor (PLAYCTL_READY | PLAYCTL_CLOSE, 0) & PLAYCTL_CLOSE) {
+        logi ("PLAYCTL_CLOSE set before render was ready. exiting...");
+        pthread_exit (NULL);
+    }
+
+    logi ("PLAYCTL_READY is set; audio_play thread proceeding");
+
+    struct audio_play_args_t *args = args_vp;
+    strvec_t *const           sv   = args->sv;
+    struct audio_outfmt_t     outfmt;
+
+    // decode straight to what the device mixes in
+    if (audio_native_fmt (&outfmt) == NCAP_OK)
+        libav_set_outfmt (&outfmt);
+    else
+        logw ("WARN: could not query the output device. playing tracks at "
+              "their own rates...");
+
+    if (ncap_config.isstream) {
+        args->errstat = play_gapless (args->prefix, sv);
+
+        if (args->errstat != NCAP_EALLOC)
             goto exit;
-        }
 
-        // check for wclose
+        logw ("WARN: streaming failed to start. falling back to the WAV "
+              "cache file...");
+    }
 
-        logi ("locking render_wclose_mx...");
+    for (size_t i = 0; i < sv->siz; ++i) {
+        // get path
+
+        logvf ("preparing to play `%s'", sv->ptr[i]);
+
+        static char fn_in[MAX_PATH_LEN];
+        path_concat (fn_in, args->prefix, sv->ptr[i]);
+
+        // update render
 
-        while ((pth_ret = pthread_mutex_lock (&render_wclose_mx)) != 0) {
-            logwf ("WARN: could not lock render_wclose_mx. Error "
-                   "code %d: %s. Retrying...",
-                   pth_ret, strerror (pth_ret));
-            nanosleep (&retry_ts, NULL);
+        playctl_settrack (i);
+
+        // play audio
+
+        if ((args->errstat = play_cwav (fn_in)) != NCAP_OK) {
+            logef ("ERROR: playback failed with code %d. aborting...\n",
+                   args->errstat);
+            goto exit;
         }
 
-        logdf ("%d", wclose);
+        // check for window close
 
-        if (wclose) {
-            logd ("wclose = true, exiting thread early...");
-            pthread_mutex_unlock (&render_wclose_mx);
+        if (playctl_load () & PLAYCTL_CLOSE) {
+            logd ("PLAYCTL_CLOSE is set, exiting thread early...");
             break;
         }
-
-        pthread_mutex_unlock (&render_wclose_mx);
-        logi ("unlocked render_wclose_mx");
     }
 
 exit:
-    while ((pth_err = pthread_mutex_lock (&render_atrid_mx)) != 0) {
-        logwf ("WARN: failed to lock render_atrid_mx. Error code %d: %s. "
-               "Retrying...",
-               pth_err, strerror (pth_err));
-        nanosleep (&retry_ts, NULL);
-    }
-
-    render_atrid = -1;
-
-    pthread_mutex_unlock (&render_atrid_mx);
+    audio_close ();
+    playctl_settrack (-1);
     pthread_exit (NULL);
 }
 
 int
 main (void)
 {
-    audio_isplay = false;
-    wclose       = false;
+    playctl_init (PLAYCTL_PAUSE);
+    playpos_init ();
 
     activity = GetAndroidApp ()->activity;
 
@@ -200,6 +446,13 @@ main (void)
             ncap_config.isrepeat        = 0; // false
             ncap_config.isshuffle       = 0; // false
             ncap_config.volume          = 100;
+            ncap_config.isstream        = 1; // true
+            ncap_config.loudnorm        = 1; // true
+            ncap_config.pcmcache_mib    = 512;
+            ncap_config.latency_ms      = 0; // the device's default
+            ncap_config.xfade_ms        = 0; // gapless
+            ncap_config.eq_preset       = 0; // off
+            ncap_config.eq_nbands       = 0;
             ncap_config.track_path      = "/sdcard/Music/NCAP-share";
             ncap_config.track_path_len  = strlen (ncap_config.track_path) + 1;
             logi ("writing to config...");
@@ -220,12 +473,70 @@ main (void)
     }
 
     config_logdump ();
+    playctl_setvol (ncap_config.volume);
+
+    static char cachedir[MAX_PATH_LEN];
+    path_concat (cachedir, activity->internalDataPath, NCAP_PCMCACHE_DIR);
+
+    if (pcmcache_init (cachedir, (uint64_t)ncap_config.pcmcache_mib << 20)
+        != NCAP_OK)
+        logw ("WARN: pcmcache_init failed. decoding every track...");
+
+    static char lufstabfile[MAX_PATH_LEN];
+    path_concat (lufstabfile, activity->internalDataPath, NCAP_LUFSTAB_FILE);
+
+    if (lufstab_init (lufstabfile) != NCAP_OK)
+        logw ("WARN: lufstab_init failed. loudness is measured every run");
 
     logif ("loading tracks in configured directory `%s'...",
            ncap_config.track_path);
-    strvec_t sv;
+    static char idxfile[MAX_PATH_LEN];
+    path_concat (idxfile, activity->internalDataPath, NCAP_TRACKIDX_FILE);
+
+    struct trackidx_t idx;
+    strvec_t          sv;
     strvec_init (&sv);
-    load_dir (&sv, ncap_config.track_path);
+
+    if (trackidx_open (&idx, idxfile) != NCAP_OK
+        || trackidx_update (&idx, idxfile, ncap_config.track_path,
+                            dirscan_audio_exts, NULL)
+               != NCAP_OK)
+        logw ("WARN: the track index could not be updated");
+
+    strvec_reserve (&sv, idx.ntracks, 0);
+
+    for (size_t i = 0; i < idx.ntracks; ++i) {
+        const char *path = trackidx_path (&idx, i);
+        strvec_pushb (&sv, path, strlen (path));
+    }
+
+    // without an index, a scan still finds the tracks
+    if (idx.ntracks == 0) {
+        const long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+
+        if (dirscan (&sv, ncap_config.track_path, dirscan_audio_exts,
+                     ncpu > 0 ? (int)ncpu : 1)
+            != NCAP_OK)
+            logw ("WARN: the track directory could not be scanned");
+    }
+
+    static char tagfile[MAX_PATH_LEN];
+    path_concat (tagfile, activity->internalDataPath, NCAP_TAGCACHE_FILE);
+
+    // before the first list is made, so it starts from the cache
+    const long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+
+    if (tagcache_start (tagfile, ncap_config.track_path,
+                        ncpu > 0 ? (int)ncpu : 1, read_meta)
+        != NCAP_OK)
+        logw ("WARN: tagcache_start failed. tags are not read");
+
+    // idx is the watcher's from here until trackwatch_stop
+    if (trackwatch_start (&idx, idxfile, ncap_config.track_path,
+                          dirscan_audio_exts)
+        != NCAP_OK)
+        logw ("WARN: the track directory is not watched. new tracks show "
+              "on the next start");
 
     pthread_t                audio_tid;
     struct audio_play_args_t audio_args = {
@@ -236,6 +547,17 @@ main (void)
     pthread_create (&audio_tid, NULL, tfn_audio_play, &audio_args);
     logi ("spawned audio_play thread");
 
+    pthread_t             lufscan_tid;
+    struct lufscan_args_t lufscan_args = { .path = ncap_config.track_path };
+    bool                  islufscan    = false;
+
+    atomic_init (&lufscan_args.isstop, false);
+
+    if (ncap_config.loudnorm)
+        islufscan = pthread_create (&lufscan_tid, NULL, tfn_lufscan,
+                                    &lufscan_args)
+                    == 0;
+
     render (&sv);
 
     logi ("joining threads...");
@@ -243,7 +565,17 @@ main (void)
     logdf ("audio_play thread joined with a status code of %d...",
            audio_args.errstat);
 
+    if (islufscan) {
+        atomic_store (&lufscan_args.isstop, true);
+        pthread_join (lufscan_tid, NULL);
+    }
+
+    trackwatch_stop ();
+    tagcache_stop ();
     strvec_deinit (&sv);
+    trackidx_close (&idx);
+    lufstab_deinit ();
+    libav_deinit ();
 
     logi ("deinit config...");
 
@@ -0,0 +1,484 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mix.h"
+#include "simd.h"
+
+// the largest float below 2^31, where S32 mixes are clamped
+#define S32_MAXF 2147483520.0f
+
+/*
+ * sin (u * pi / 2) on [0, 1] as u * (C1 + C3 u^2 + C5 u^4 + C7 u^6), a
+ * minimax fit: within 8e-7, and 1 - 6e-7 at u = 1
+ */
+#define C1 1.5707910f
+#define C3 -0.6458932f
+#define C5 0.0794351f
+#define C7 -0.0043336f
+
+static float
+clamp01 (float t)
+{
+    return t < 0 ? 0 : t > 1 ? 1 : t;
+}
+
+float
+mix_curve (float t)
+{
+    const float u  = clamp01 (t);
+    const float u2 = u * u;
+
+    return u * (C1 + u2 * (C3 + u2 * (C5 + u2 * C7)));
+}
+
+/** round to nearest. the vector kernels round ties to even instead */
+static int32_t
+round_s32 (float x)
+{
+    return x < 0 ? (int32_t)(x - 0.5f) : (int32_t)(x + 0.5f);
+}
+
+/** frames [begin, end) */
+static void
+mix_range (void *dst, const void *out, const void *in, uint16_t fmt,
+           int channels, size_t begin, size_t end, float t0, float step)
+{
+    const size_t c = channels;
+
+    for (size_t f = begin; f < end; ++f) {
+        const float t  = t0 + step * (float)f;
+        const float gi = mix_curve (t);
+        const float go = mix_curve (1 - t);
+
+        for (size_t i = f * c; i < (f + 1) * c; ++i) {
+            switch (fmt) {
+                case 1: {
+                    const float y = ((const int16_t *)out)[i] * go
+                                    + ((const int16_t *)in)[i] * gi;
+                    const int32_t r = round_s32 (y);
+
+                    ((int16_t *)dst)[i] = r > INT16_MAX   ? INT16_MAX
+                                          : r < INT16_MIN ? INT16_MIN
+                                                          : r;
+                    break;
+                }
+                case 2: {
+                    const float y = (float)((const int32_t *)out)[i] * go
+                                    + (float)((const int32_t *)in)[i] * gi;
+
+                    ((int32_t *)dst)[i] = y > S32_MAXF     ? INT32_MAX - 127
+                                          : y < -S32_MAXF ? INT32_MIN
+                                                          : round_s32 (y);
+                    break;
+                }
+                case 3:
+                    ((float *)dst)[i] = ((const float *)out)[i] * go
+                                        + ((const float *)in)[i] * gi;
+                    break;
+                default:
+                    return;
+            }
+        }
+    }
+}
+
+void
+mix_xfade_scalar (void *dst, const void *out, const void *in, uint16_t fmt,
+                  int channels, size_t nframes, float t0, float step)
+{
+    mix_range (dst, out, in, fmt, channels, 0, nframes, t0, step);
+}
+
+/*
+ * the kernels take mono or stereo. as in gain.c, lane l of a vector is
+ * sample l of the vector's first frame f, so its fade position is
+ * t0 + step * (f + offs[l]), with offs[l] = l / channels. each returns the
+ * frames it did
+ */
+
+#if defined(SIMD_HAS_NEON)
+
+static inline float32x4_t
+curve_v128 (float32x4_t u)
+{
+    u                    = vminq_f32 (vmaxq_f32 (u, vdupq_n_f32 (0)),
+                                      vdupq_n_f32 (1));
+    const float32x4_t u2 = vmulq_f32 (u, u);
+    float32x4_t       p  = vmlaq_n_f32 (vdupq_n_f32 (C5), u2, C7);
+
+    p = vmlaq_f32 (vdupq_n_f32 (C3), u2, p);
+    p = vmlaq_f32 (vdupq_n_f32 (C1), u2, p);
+
+    return vmulq_f32 (u, p);
+}
+
+static inline float32x4_t
+pos_v128 (size_t f, const float *offs, float t0, float step)
+{
+    const float32x4_t vf
+        = vaddq_f32 (vdupq_n_f32 ((float)f), vld1q_f32 (offs));
+    return vaddq_f32 (vdupq_n_f32 (t0), vmulq_n_f32 (vf, step));
+}
+
+/** out * curve (1 - t) + in * curve (t) */
+static inline float32x4_t
+mix_v128 (float32x4_t a, float32x4_t b, float32x4_t t)
+{
+    const float32x4_t go = curve_v128 (vsubq_f32 (vdupq_n_f32 (1), t));
+    return vmlaq_f32 (vmulq_f32 (a, go), b, curve_v128 (t));
+}
+
+static inline int32x4_t
+cvt_s32 (float32x4_t v)
+{
+#if defined(__aarch64__)
+    return vcvtnq_s32_f32 (v);
+#else
+    return vcvtq_s32_f32 (v); // truncates; within an LSB of the reference
+#endif
+}
+
+static size_t
+mix16_v128 (void *dst, const void *out, const void *in, int c, size_t n,
+            float t0, float step, const float *offs)
+{
+    const size_t   fpv = 8 / c;
+    const int16_t *a   = out;
+    const int16_t *b   = in;
+    int16_t       *d   = dst;
+    size_t         f   = 0;
+
+    for (; f + fpv <= n; f += fpv, a += 8, b += 8, d += 8) {
+        const int16x8_t   va = vld1q_s16 (a);
+        const int16x8_t   vb = vld1q_s16 (b);
+        const float32x4_t lo
+            = mix_v128 (vcvtq_f32_s32 (vmovl_s16 (vget_low_s16 (va))),
+                        vcvtq_f32_s32 (vmovl_s16 (vget_low_s16 (vb))),
+                        pos_v128 (f, offs, t0, step));
+        const float32x4_t hi
+            = mix_v128 (vcvtq_f32_s32 (vmovl_s16 (vget_high_s16 (va))),
+                        vcvtq_f32_s32 (vmovl_s16 (vget_high_s16 (vb))),
+                        pos_v128 (f, offs + 4, t0, step));
+
+        vst1q_s16 (d, vcombine_s16 (vqmovn_s32 (cvt_s32 (lo)),
+                                    vqmovn_s32 (cvt_s32 (hi))));
+    }
+
+    return f;
+}
+
+static size_t
+mix32_v128 (void *dst, const void *out, const void *in, int c, size_t n,
+            float t0, float step, const float *offs)
+{
+    const size_t      fpv = 4 / c;
+    const float32x4_t max = vdupq_n_f32 (S32_MAXF);
+    const int32_t    *a   = out;
+    const int32_t    *b   = in;
+    int32_t          *d   = dst;
+    size_t            f   = 0;
+
+    for (; f + fpv <= n; f += fpv, a += 4, b += 4, d += 4) {
+        const float32x4_t y = mix_v128 (vcvtq_f32_s32 (vld1q_s32 (a)),
+                                        vcvtq_f32_s32 (vld1q_s32 (b)),
+                                        pos_v128 (f, offs, t0, step));
+        vst1q_s32 (d, cvt_s32 (vminq_f32 (y, max)));
+    }
+
+    return f;
+}
+
+static size_t
+mixf_v128 (void *dst, const void *out, const void *in, int c, size_t n,
+           float t0, float step, const float *offs)
+{
+    const size_t fpv = 4 / c;
+    const float *a   = out;
+    const float *b   = in;
+    float       *d   = dst;
+    size_t       f   = 0;
+
+    for (; f + fpv <= n; f += fpv, a += 4, b += 4, d += 4)
+        vst1q_f32 (d, mix_v128 (vld1q_f32 (a), vld1q_f32 (b),
+                                pos_v128 (f, offs, t0, step)));
+
+    return f;
+}
+
+#elif defined(SIMD_HAS_X86)
+
+static inline __m128
+curve_v128 (__m128 u)
+{
+    u               = _mm_min_ps (_mm_max_ps (u, _mm_setzero_ps ()),
+                                  _mm_set1_ps (1));
+    const __m128 u2 = _mm_mul_ps (u, u);
+    __m128       p  = _mm_add_ps (_mm_set1_ps (C5),
+                                  _mm_mul_ps (u2, _mm_set1_ps (C7)));
+
+    p = _mm_add_ps (_mm_set1_ps (C3), _mm_mul_ps (u2, p));
+    p = _mm_add_ps (_mm_set1_ps (C1), _mm_mul_ps (u2, p));
+
+    return _mm_mul_ps (u, p);
+}
+
+static inline __m128
+pos_v128 (size_t f, const float *offs, float t0, float step)
+{
+    const __m128 vf = _mm_add_ps (_mm_set1_ps ((float)f), _mm_loadu_ps (offs));
+    return _mm_add_ps (_mm_set1_ps (t0), _mm_mul_ps (_mm_set1_ps (step), vf));
+}
+
+/** out * curve (1 - t) + in * curve (t) */
+static inline __m128
+mix_v128 (__m128 a, __m128 b, __m128 t)
+{
+    const __m128 go = curve_v128 (_mm_sub_ps (_mm_set1_ps (1), t));
+    return _mm_add_ps (_mm_mul_ps (a, go), _mm_mul_ps (b, curve_v128 (t)));
+}
+
+/** SSE2 has no pmovsxwd: widen by unpacking against itself, then shift */
+static inline __m128
+lo_ps (__m128i x)
+{
+    return _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpacklo_epi16 (x, x), 16));
+}
+
+static inline __m128
+hi_ps (__m128i x)
+{
+    return _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpackhi_epi16 (x, x), 16));
+}
+
+static size_t
+mix16_v128 (void *dst, const void *out, const void *in, int c, size_t n,
+            float t0, float step, const float *offs)
+{
+    const size_t   fpv = 8 / c;
+    const int16_t *a   = out;
+    const int16_t *b   = in;
+    int16_t       *d   = dst;
+    size_t         f   = 0;
+
+    for (; f + fpv <= n; f += fpv, a += 8, b += 8, d += 8) {
+        const __m128i va = _mm_loadu_si128 ((const __m128i *)a);
+        const __m128i vb = _mm_loadu_si128 ((const __m128i *)b);
+        const __m128  lo = mix_v128 (lo_ps (va), lo_ps (vb),
+                                     pos_v128 (f, offs, t0, step));
+        const __m128  hi = mix_v128 (hi_ps (va), hi_ps (vb),
+                                     pos_v128 (f, offs + 4, t0, step));
+
+        _mm_storeu_si128 ((__m128i *)d,
+                          _mm_packs_epi32 (_mm_cvtps_epi32 (lo),
+                                           _mm_cvtps_epi32 (hi)));
+    }
+
+    return f;
+}
+
+static size_t
+mix32_v128 (void *dst, const void *out, const void *in, int c, size_t n,
+            float t0, float step, const float *offs)
+{
+    const size_t   fpv = 4 / c;
+    const __m128   max = _mm_set1_ps (S32_MAXF);
+    const int32_t *a   = out;
+    const int32_t *b   = in;
+    int32_t       *d   = dst;
+    size_t         f   = 0;
+
+    for (; f + fpv <= n; f += fpv, a += 4, b += 4, d += 4) {
+        const __m128 y = mix_v128 (
+            _mm_cvtepi32_ps (_mm_loadu_si128 ((const __m128i *)a)),
+            _mm_cvtepi32_ps (_mm_loadu_si128 ((const __m128i *)b)),
+            pos_v128 (f, offs, t0, step));
+        _mm_storeu_si128 ((__m128i *)d, _mm_cvtps_epi32 (_mm_min_ps (y, max)));
+    }
+
+    return f;
+}
+
+static size_t
+mixf_v128 (void *dst, const void *out, const void *in, int c, size_t n,
+           float t0, float step, const float *offs)
+{
+    const size_t fpv = 4 / c;
+    const float *a   = out;
+    const float *b   = in;
+    float       *d   = dst;
+    size_t       f   = 0;
+
+    for (; f + fpv <= n; f += fpv, a += 4, b += 4, d += 4)
+        _mm_storeu_ps (d, mix_v128 (_mm_loadu_ps (a), _mm_loadu_ps (b),
+                                    pos_v128 (f, offs, t0, step)));
+
+    return f;
+}
+
+SIMD_TARGET_AVX2 static inline __m256
+curve_v256 (__m256 u)
+{
+    u = _mm256_min_ps (_mm256_max_ps (u, _mm256_setzero_ps ()),
+                       _mm256_set1_ps (1));
+    const __m256 u2 = _mm256_mul_ps (u, u);
+    __m256       p  = _mm256_add_ps (_mm256_set1_ps (C5),
+                                     _mm256_mul_ps (u2, _mm256_set1_ps (C7)));
+
+    p = _mm256_add_ps (_mm256_set1_ps (C3), _mm256_mul_ps (u2, p));
+    p = _mm256_add_ps (_mm256_set1_ps (C1), _mm256_mul_ps (u2, p));
+
+    return _mm256_mul_ps (u, p);
+}
+
+SIMD_TARGET_AVX2 static inline __m256
+pos_v256 (size_t f, const float *offs, float t0, float step)
+{
+    const __m256 vf = _mm256_add_ps (_mm256_set1_ps ((float)f),
+                                     _mm256_loadu_ps (offs));
+    return _mm256_add_ps (_mm256_set1_ps (t0),
+                          _mm256_mul_ps (_mm256_set1_ps (step), vf));
+}
+
+SIMD_TARGET_AVX2 static inline __m256
+mix_v256 (__m256 a, __m256 b, __m256 t)
+{
+    const __m256 go = curve_v256 (_mm256_sub_ps (_mm256_set1_ps (1), t));
+    return _mm256_add_ps (_mm256_mul_ps (a, go),
+                          _mm256_mul_ps (b, curve_v256 (t)));
+}
+
+SIMD_TARGET_AVX2 static inline __m256
+s16_ps (const int16_t *p)
+{
+    return _mm256_cvtepi32_ps (
+        _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((const __m128i *)p)));
+}
+
+/** the pack works within 128-bit lanes; the permute restores order */
+SIMD_TARGET_AVX2 static size_t
+mix16_v256 (void *dst, const void *out, const void *in, int c, size_t n,
+            float t0, float step, const float *offs)
+{
+    const size_t   fpv = 16 / c;
+    const int16_t *a   = out;
+    const int16_t *b   = in;
+    int16_t       *d   = dst;
+    size_t         f   = 0;
+
+    for (; f + fpv <= n; f += fpv, a += 16, b += 16, d += 16) {
+        const __m256i lo = _mm256_cvtps_epi32 (mix_v256 (
+            s16_ps (a), s16_ps (b), pos_v256 (f, offs, t0, step)));
+        const __m256i hi = _mm256_cvtps_epi32 (mix_v256 (
+            s16_ps (a + 8), s16_ps (b + 8), pos_v256 (f, offs + 8, t0, step)));
+
+        _mm256_storeu_si256 (
+            (__m256i *)d,
+            _mm256_permute4x64_epi64 (_mm256_packs_epi32 (lo, hi), 0xd8));
+    }
+
+    return f;
+}
+
+SIMD_TARGET_AVX2 static size_t
+mix32_v256 (void *dst, const void *out, const void *in, int c, size_t n,
+            float t0, float step, const float *offs)
+{
+    const size_t   fpv = 8 / c;
+    const __m256   max = _mm256_set1_ps (S32_MAXF);
+    const int32_t *a   = out;
+    const int32_t *b   = in;
+    int32_t       *d   = dst;
+    size_t         f   = 0;
+
+    for (; f + fpv <= n; f += fpv, a += 8, b += 8, d += 8) {
+        const __m256 y = mix_v256 (
+            _mm256_cvtepi32_ps (_mm256_loadu_si256 ((const __m256i *)a)),
+            _mm256_cvtepi32_ps (_mm256_loadu_si256 ((const __m256i *)b)),
+            pos_v256 (f, offs, t0, step));
+        _mm256_storeu_si256 ((__m256i *)d,
+                             _mm256_cvtps_epi32 (_mm256_min_ps (y, max)));
+    }
+
+    return f;
+}
+
+SIMD_TARGET_AVX2 static size_t
+mixf_v256 (void *dst, const void *out, const void *in, int c, size_t n,
+           float t0, float step, const float *offs)
+{
+    const size_t fpv = 8 / c;
+    const float *a   = out;
+    const float *b   = in;
+    float       *d   = dst;
+    size_t       f   = 0;
+
+    for (; f + fpv <= n; f += fpv, a += 8, b += 8, d += 8)
+        _mm256_storeu_ps (d, mix_v256 (_mm256_loadu_ps (a),
+                                       _mm256_loadu_ps (b),
+                                       pos_v256 (f, offs, t0, step)));
+
+    return f;
+}
+
+#endif
+
+/** @return frames done by a vector kernel; the caller finishes the tail */
+static size_t
+mix_simd (void *dst, const void *out, const void *in, uint16_t fmt,
+          int channels, size_t nframes, float t0, float step)
+{
+    const int level = simd_level ();
+    float     offs[16];
+
+    for (int l = 0; l < 16; ++l)
+        offs[l] = (float)(l / channels);
+
+    (void)level, (void)dst, (void)out, (void)in, (void)fmt, (void)nframes,
+        (void)t0, (void)step;
+
+#if defined(SIMD_HAS_X86)
+    if (level >= SIMD_V256) {
+        switch (fmt) {
+            case 1:
+                return mix16_v256 (dst, out, in, channels, nframes, t0, step,
+                                   offs);
+            case 2:
+                return mix32_v256 (dst, out, in, channels, nframes, t0, step,
+                                   offs);
+            case 3:
+                return mixf_v256 (dst, out, in, channels, nframes, t0, step,
+                                  offs);
+        }
+    }
+#endif
+
+#if defined(SIMD_HAS_NEON) || defined(SIMD_HAS_X86)
+    if (level >= SIMD_V128) {
+        switch (fmt) {
+            case 1:
+                return mix16_v128 (dst, out, in, channels, nframes, t0, step,
+                                   offs);
+            case 2:
+                return mix32_v128 (dst, out, in, channels, nframes, t0, step,
+                                   offs);
+            case 3:
+                return mixf_v128 (dst, out, in, channels, nframes, t0, step,
+                                  offs);
+        }
+    }
+#endif
+
+    return 0;
+}
+
+void
+mix_xfade (void *dst, const void *out, const void *in, uint16_t fmt,
+           int channels, size_t nframes, float t0, float step)
+{
+    size_t done = 0;
+
+    if (channels == 1 || channels == 2)
+        done = mix_simd (dst, out, in, fmt, channels, nframes, t0, step);
+
+    mix_range (dst, out, in, fmt, channels, done, nframes, t0, step);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#ifndef MIX_H
+#define MIX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Two-input mixer for crossfades of interleaved PCM: frame f of dst is
+ * out * mix_curve (1 - t) + in * mix_curve (t), t = t0 + step * f, an
+ * equal-power fade. The curve is a polynomial evaluated per vector lane, so
+ * the kernels need no tables. S16 and S32 are mixed in float and saturated.
+ * Mono and stereo use the simd_level kernels; other layouts a scalar loop.
+ */
+
+/** @return sin (t * pi / 2) for t in [0, 1], within 1e-6 */
+extern float mix_curve (float t);
+
+/**
+ * @param dst may be out or in
+ * @param fmt wFormatTag: 1 for S16, 2 for S32, 3 for FLT. others are left
+ * as they are
+ * @param t0 fade position of the first frame, 0 to 1. clamped
+ * @param step per frame
+ */
+extern void mix_xfade (void *dst, const void *out, const void *in,
+                       uint16_t fmt, int channels, size_t nframes, float t0,
+                       float step);
+
+/** reference implementation for the tests and benchmarks */
+extern void mix_xfade_scalar (void *dst, const void *out, const void *in,
+                              uint16_t fmt, int channels, size_t nframes,
+                              float t0, float step);
+
+#endif // !MIX_H
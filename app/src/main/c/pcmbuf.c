@@ -0,0 +1,317 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "audio.h"
+#include "logging.h"
+#include "pcmbuf.h"
+#include "properties.h"
+#include "ringbuf.h"
+
+static const char *FILENAME = "pcmbuf.c";
+
+// read chunk of pcmbuf_fill_wav
+#define READ_CHUNK (64 << 10)
+
+void
+pcmbuf_init (struct pcmbuf_t *this, size_t burst_hint)
+{
+    pthread_mutex_init (&this->mx, NULL);
+    pthread_cond_init (&this->cv, NULL);
+
+    this->burst_hint = burst_hint;
+    this->min_ms     = 0;
+    this->gain       = 1;
+    this->id         = -1;
+    this->err        = NCAP_OK;
+    atomic_init (&this->isfmt, false);
+    atomic_init (&this->burst, 0);
+    atomic_init (&this->iseof, false);
+    atomic_init (&this->isabort, false);
+}
+
+void
+pcmbuf_deinit (struct pcmbuf_t *this)
+{
+    if (atomic_load_explicit (&this->burst, memory_order_relaxed) != 0)
+        ringbuf_deinit (&this->ring);
+
+    pthread_cond_destroy (&this->cv);
+    pthread_mutex_destroy (&this->mx);
+}
+
+struct pcmbuf_t *
+pcmbuf_new (size_t burst_hint)
+{
+    // aligned_alloc wants a multiple of the alignment
+    const size_t     siz  = (sizeof (struct pcmbuf_t) + RINGBUF_CACHELINE - 1)
+                            / RINGBUF_CACHELINE * RINGBUF_CACHELINE;
+    struct pcmbuf_t *this = aligned_alloc (RINGBUF_CACHELINE, siz);
+
+    if (this != NULL)
+        pcmbuf_init (this, burst_hint);
+
+    return this;
+}
+
+void
+pcmbuf_free (struct pcmbuf_t *this)
+{
+    pcmbuf_deinit (this);
+    free (this);
+}
+
+/**
+ * call with mx held
+ */
+static int
+attach (struct pcmbuf_t *this, size_t frames_per_burst)
+{
+    const uint64_t min_frames = (uint64_t)this->min_ms
+                                * this->header.fmt.nSamplesPerSec / 1000;
+    size_t         nbursts    = NCAP_PCMBUF_BURSTS;
+    int            ret;
+
+    // twice, as the producer only keeps the ring 3/4 full
+    if (frames_per_burst != 0
+        && 2 * min_frames > (uint64_t)nbursts * frames_per_burst)
+        nbursts = (2 * min_frames + frames_per_burst - 1) / frames_per_burst;
+
+    ret = ringbuf_init (&this->ring, this->header.fmt.nBlockAlign,
+                        frames_per_burst, nbursts);
+
+    if (ret == NCAP_OK) {
+        // sleep for a quarter of the ring so it never runs more than 3/4
+        // empty on account of the producer
+        const uint64_t ns = (uint64_t)this->ring.cap * 250000000
+                            / this->header.fmt.nSamplesPerSec;
+
+        this->poll_ts.tv_sec  = ns / 1000000000;
+        this->poll_ts.tv_nsec = ns % 1000000000;
+
+        // last: the burst publishes the ring to pcmbuf_burst
+        atomic_store_explicit (&this->burst, this->ring.burst,
+                               memory_order_release);
+        pthread_cond_broadcast (&this->cv);
+    }
+
+    return ret;
+}
+
+void
+pcmbuf_setfmt (struct pcmbuf_t *this, const struct cwav_header_t *header)
+{
+    pthread_mutex_lock (&this->mx);
+    this->header = *header;
+
+    // a failed early attach is retried by the consumer in pcmbuf_attach
+    if (this->burst_hint != 0)
+        attach (this, this->burst_hint);
+
+    atomic_store_explicit (&this->isfmt, true, memory_order_release);
+    pthread_cond_broadcast (&this->cv);
+    pthread_mutex_unlock (&this->mx);
+}
+
+int
+pcmbuf_waitfmt (struct pcmbuf_t *this, struct cwav_header_t *header)
+{
+    int ret = NCAP_OK;
+
+    pthread_mutex_lock (&this->mx);
+
+    while (!atomic_load (&this->isfmt) && !atomic_load (&this->iseof))
+        pthread_cond_wait (&this->cv, &this->mx);
+
+    if (atomic_load (&this->isfmt))
+        *header = this->header;
+    else
+        ret = this->err == NCAP_OK ? NCAP_EGEN : this->err;
+
+    pthread_mutex_unlock (&this->mx);
+
+    return ret;
+}
+
+int
+pcmbuf_tryfmt (struct pcmbuf_t *this, struct cwav_header_t *header)
+{
+    // iseof first: isfmt is always published before it
+    const bool iseof = atomic_load_explicit (&this->iseof,
+                                             memory_order_acquire);
+
+    if (atomic_load_explicit (&this->isfmt, memory_order_acquire)) {
+        *header = this->header;
+        return 1;
+    }
+
+    return iseof ? -1 : 0;
+}
+
+int
+pcmbuf_attach (struct pcmbuf_t *this, size_t frames_per_burst)
+{
+    int ret = NCAP_OK;
+
+    pthread_mutex_lock (&this->mx);
+
+    if (atomic_load_explicit (&this->burst, memory_order_relaxed) == 0)
+        ret = attach (this, frames_per_burst);
+
+    pthread_mutex_unlock (&this->mx);
+
+    return ret;
+}
+
+size_t
+pcmbuf_burst (struct pcmbuf_t *this)
+{
+    return atomic_load_explicit (&this->burst, memory_order_acquire);
+}
+
+void
+pcmbuf_waitfill (struct pcmbuf_t *this, size_t nframes)
+{
+    const struct timespec ts = { .tv_sec = 0, .tv_nsec = 1000000 }; // 1 ms
+
+    if (nframes > this->ring.cap)
+        nframes = this->ring.cap;
+
+    while (ringbuf_readable (&this->ring) < nframes
+           && !atomic_load_explicit (&this->iseof, memory_order_acquire))
+        nanosleep (&ts, NULL);
+}
+
+int
+pcmbuf_write (struct pcmbuf_t *this, const void *buf, size_t siz)
+{
+    pthread_mutex_lock (&this->mx);
+
+    while (atomic_load_explicit (&this->burst, memory_order_relaxed) == 0
+           && !atomic_load (&this->isabort))
+        pthread_cond_wait (&this->cv, &this->mx);
+
+    const bool isattach
+        = atomic_load_explicit (&this->burst, memory_order_relaxed) != 0;
+
+    pthread_mutex_unlock (&this->mx);
+
+    if (!isattach)
+        return NCAP_EIO;
+
+    const uint8_t *src     = buf;
+    size_t         nframes = siz / this->ring.framesiz;
+
+    while (!atomic_load_explicit (&this->isabort, memory_order_relaxed)) {
+        const size_t n = ringbuf_write (&this->ring, src, nframes);
+
+        src += n * this->ring.framesiz;
+        nframes -= n;
+
+        if (nframes == 0)
+            return NCAP_OK;
+
+        nanosleep (&this->poll_ts, NULL);
+    }
+
+    return NCAP_EIO;
+}
+
+size_t
+pcmbuf_read (struct pcmbuf_t *this, void *dst, size_t nframes, bool *iseof)
+{
+    *iseof = false;
+
+    if (ringbuf_readable (&this->ring) >= nframes)
+        return ringbuf_read (&this->ring, dst, nframes);
+
+    if (!atomic_load_explicit (&this->iseof, memory_order_acquire))
+        return 0;
+
+    // the producer is done, so whatever is left is all there will be
+    const size_t n = ringbuf_read (&this->ring, dst, nframes);
+    *iseof         = ringbuf_readable (&this->ring) == 0;
+
+    return n;
+}
+
+void
+pcmbuf_close (struct pcmbuf_t *this, int err)
+{
+    pthread_mutex_lock (&this->mx);
+    this->err = err;
+    atomic_store_explicit (&this->iseof, true, memory_order_release);
+    pthread_cond_broadcast (&this->cv);
+    pthread_mutex_unlock (&this->mx);
+}
+
+void
+pcmbuf_abort (struct pcmbuf_t *this)
+{
+    atomic_store_explicit (&this->isabort, true, memory_order_release);
+}
+
+void
+pcmbuf_wake (struct pcmbuf_t *this)
+{
+    // under mx, so a producer that saw no abort is already waiting
+    pthread_mutex_lock (&this->mx);
+    pthread_cond_broadcast (&this->cv);
+    pthread_mutex_unlock (&this->mx);
+}
+
+int
+pcmbuf_fill_wav (struct pcmbuf_t *this, const char *fn)
+{
+    FILE *fp = fopen (fn, "rb");
+    int   ret;
+
+    if (fp == NULL) {
+        logef ("ERROR: fopen `%s' failed: %s", fn, strerror (errno));
+        ret = NCAP_EIO;
+        goto exit;
+    }
+
+    struct cwav_header_t header;
+
+    if (fread (&header, CWAV_HEADER_SIZ, 1, fp) != 1
+        || memcmp (header.riff.ckID, "RIFF", 4) != 0
+        || header.fmt.nBlockAlign == 0) {
+        logef ("ERROR: `%s' is not a WAV file from libav_cvt_cwav", fn);
+        ret = NCAP_EIO;
+        goto deinit_fp;
+    }
+
+    pcmbuf_setfmt (this, &header);
+
+    uint8_t     *buf = malloc (READ_CHUNK);
+    const size_t len = READ_CHUNK / header.fmt.nBlockAlign;
+    size_t       n;
+
+    if (buf == NULL) {
+        ret = NCAP_EALLOC;
+        goto deinit_fp;
+    }
+
+    ret = NCAP_OK;
+
+    while (ret == NCAP_OK
+           && (n = fread (buf, header.fmt.nBlockAlign, len, fp)) > 0)
+        ret = pcmbuf_write (this, buf, n * header.fmt.nBlockAlign);
+
+    free (buf);
+
+deinit_fp:
+    fclose (fp);
+
+exit:
+    pcmbuf_close (this, ret);
+    return ret;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#ifndef PCMBUF_H
+#define PCMBUF_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "audio.h"
+#include "ringbuf.h"
+
+/**
+ * Interleaved PCM stream from one decoder (producer) to one audio writer
+ * (consumer).
+ *
+ * The ring is sized from the output's burst size. Without a burst hint it is
+ * only allocated once the consumer has opened its stream (pcmbuf_attach);
+ * with one (e.g. the burst of the stream that is already playing), the
+ * producer allocates it as soon as the format is known, so a track can be
+ * decoded ahead of playback. The mutex and condition variable are only used
+ * for that handshake, before playback. The ring is published by its burst,
+ * stored last, so what the consumer calls while playing (pcmbuf_tryfmt,
+ * pcmbuf_burst, pcmbuf_read, pcmbuf_abort) is lock-free and makes no
+ * syscalls; a producer waiting on the condition variable is woken apart, by
+ * pcmbuf_wake.
+ */
+struct pcmbuf_t {
+    struct ringbuf_t ring; // valid once burst is set
+
+    pthread_mutex_t      mx;
+    pthread_cond_t       cv;
+    struct cwav_header_t header; // valid once isfmt
+    atomic_bool          isfmt;
+    atomic_size_t        burst;      // ring.burst once the ring is set, or 0
+    size_t               burst_hint; // 0 to wait for pcmbuf_attach
+    uint32_t             min_ms;  // ms the ring must hold, e.g. a crossfade
+    float                gain;    // loudness normalization, 0 to 1
+    struct timespec      poll_ts; // producer sleep while the ring is full
+    int                  id;      // caller defined, e.g. the track index
+
+    atomic_bool iseof;   // set by the producer when done
+    atomic_bool isabort; // set by the consumer when done
+    int         err;     // producer status once iseof is set
+};
+
+/**
+ * @param burst_hint frames per burst to size the ring with once the format
+ * is known, or 0 to wait for pcmbuf_attach
+ */
+extern void pcmbuf_init (struct pcmbuf_t *this, size_t burst_hint);
+
+extern void pcmbuf_deinit (struct pcmbuf_t *this);
+
+/**
+ * allocate and init a pcmbuf on its own cache lines, as the ring's counters
+ * are aligned to RINGBUF_CACHELINE; plain malloc does not guarantee that
+ *
+ * @return NULL if out of memory
+ */
+extern struct pcmbuf_t *pcmbuf_new (size_t burst_hint);
+
+/** deinit and free a pcmbuf from pcmbuf_new */
+extern void pcmbuf_free (struct pcmbuf_t *this);
+
+/** producer: publish the stream format. call before the first write */
+extern void pcmbuf_setfmt (struct pcmbuf_t *this,
+                           const struct cwav_header_t *header);
+
+/**
+ * consumer: block until the format is known
+ *
+ * @return NCAP_OK, or the producer error if it ended before setting a format
+ */
+extern int pcmbuf_waitfmt (struct pcmbuf_t *this,
+                           struct cwav_header_t *header);
+
+/**
+ * consumer: lock-free pcmbuf_waitfmt
+ *
+ * @return 1 if the format was copied to header, 0 if it is not known yet,
+ * or -1 if the producer ended without one
+ */
+extern int pcmbuf_tryfmt (struct pcmbuf_t *this, struct cwav_header_t *header);
+
+/**
+ * consumer: allocate a ring of NCAP_PCMBUF_BURSTS bursts, or more to hold
+ * twice min_ms, and let the producer start writing. does nothing if the ring
+ * already exists
+ *
+ * @return NCAP_OK or NCAP_EALLOC
+ */
+extern int pcmbuf_attach (struct pcmbuf_t *this, size_t frames_per_burst);
+
+/**
+ * consumer: sleep until nframes are queued or the producer is done. only for
+ * use before playback starts
+ */
+extern void pcmbuf_waitfill (struct pcmbuf_t *this, size_t nframes);
+
+/**
+ * producer: blocks until all of buf is queued or the consumer aborts. siz
+ * must be a whole number of frames
+ *
+ * @return NCAP_OK, or NCAP_EIO if the consumer aborted
+ */
+extern int pcmbuf_write (struct pcmbuf_t *this, const void *buf, size_t siz);
+
+/**
+ * consumer: lock-free. reads nframes (usually one burst) if queued. fewer are
+ * only returned once the producer is done
+ *
+ * @param iseof set when the stream is fully drained
+ * @return frames read. 0 without iseof is an underrun
+ */
+extern size_t pcmbuf_read (struct pcmbuf_t *this, void *dst, size_t nframes,
+                           bool *iseof);
+
+/**
+ * lock-free
+ *
+ * @return frames per burst the ring was sized for, or 0 if not attached. the
+ * ring may be read once this is not 0
+ */
+extern size_t pcmbuf_burst (struct pcmbuf_t *this);
+
+/**
+ * producer: stream a WAV file written by libav_cvt_cwav into this. always
+ * closes this
+ */
+extern int pcmbuf_fill_wav (struct pcmbuf_t *this, const char *fn);
+
+/** producer: no more data will be written */
+extern void pcmbuf_close (struct pcmbuf_t *this, int err);
+
+/**
+ * consumer: lock-free. no more data will be read. a producer writing sees it
+ * within a poll; one still waiting for the ring needs pcmbuf_wake
+ */
+extern void pcmbuf_abort (struct pcmbuf_t *this);
+
+/**
+ * wake a producer waiting for the ring, e.g. after pcmbuf_abort. locks, so
+ * not for the data callback
+ */
+extern void pcmbuf_wake (struct pcmbuf_t *this);
+
+#endif // !PCMBUF_H
@@ -0,0 +1,278 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "audio.h"
+#include "logging.h"
+#include "pcmbuf.h"
+#include "pcmcache.h"
+
+static const char *FILENAME = "pcmcache.c";
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+#define ENTRY_EXT ".wav"
+#define TMP_EXT   ".tmp"
+
+// room left in a path for "/%016x.wav"
+#define NAME_LEN 24
+
+static pthread_mutex_t cache_mx = PTHREAD_MUTEX_INITIALIZER;
+static char            cache_dir[PCMCACHE_PATH_LEN - NAME_LEN];
+static uint64_t        cache_budget = 0;
+
+struct entry_t {
+    char     name[32];
+    off_t    siz;
+    uint64_t mtime_ns;
+};
+
+uint64_t
+pcmcache_hash (const void *buf, size_t siz, uint64_t h)
+{
+    const uint8_t *p = buf;
+
+    while (siz--) {
+        h ^= *p++;
+        h *= FNV_PRIME;
+    }
+
+    return h;
+}
+
+static bool
+hasext (const char *name, const char *ext)
+{
+    const size_t len    = strlen (name);
+    const size_t extlen = strlen (ext);
+
+    return len > extlen && strcmp (name + len - extlen, ext) == 0;
+}
+
+static int
+cmp_mtime (const void *a, const void *b)
+{
+    const uint64_t ta = ((const struct entry_t *)a)->mtime_ns;
+    const uint64_t tb = ((const struct entry_t *)b)->mtime_ns;
+
+    return (ta > tb) - (ta < tb);
+}
+
+/**
+ * call with cache_mx held. also removes stale temporary files when rmtmp
+ */
+static void
+evict (bool rmtmp)
+{
+    DIR *dp = opendir (cache_dir);
+
+    if (dp == NULL) {
+        logef ("opendir failed for `%s': %s", cache_dir, strerror (errno));
+        return;
+    }
+
+    struct entry_t *ents  = NULL;
+    size_t          len   = 0;
+    size_t          cap   = 0;
+    uint64_t        total = 0;
+    struct dirent  *dir;
+    struct stat     st;
+    char            path[PCMCACHE_PATH_LEN];
+
+    while ((dir = readdir (dp)) != NULL) {
+        const bool istmp = hasext (dir->d_name, TMP_EXT);
+
+        if (!istmp && !hasext (dir->d_name, ENTRY_EXT))
+            continue;
+
+        // not written by us: ours fit, as pcmcache_lookup builds them
+        if (snprintf (path, sizeof path, "%s/%s", cache_dir, dir->d_name)
+            >= (int)sizeof path)
+            continue;
+
+        if (istmp) {
+            if (rmtmp) {
+                logif ("removing stale cache file `%s'", dir->d_name);
+                remove (path);
+            }
+
+            continue;
+        }
+
+        if (stat (path, &st) != 0
+            || strlen (dir->d_name) >= sizeof ents->name)
+            continue;
+
+        if (len == cap) {
+            cap                 = cap ? cap << 1 : 64;
+            struct entry_t *tmp = realloc (ents, cap * sizeof *ents);
+
+            if (tmp == NULL) {
+                loge ("ERROR: realloc failed. skipping eviction");
+                goto exit;
+            }
+
+            ents = tmp;
+        }
+
+        strcpy (ents[len].name, dir->d_name);
+        ents[len].siz      = st.st_size;
+        ents[len].mtime_ns = (uint64_t)st.st_mtim.tv_sec * 1000000000
+                             + st.st_mtim.tv_nsec;
+        total += st.st_size;
+        ++len;
+    }
+
+    logdf ("cache holds %zu entries, %" PRIu64 " of %" PRIu64 " bytes", len,
+           total, cache_budget);
+
+    if (total > cache_budget) {
+        qsort (ents, len, sizeof *ents, cmp_mtime);
+
+        for (size_t i = 0; i < len && total > cache_budget; ++i) {
+            if (snprintf (path, sizeof path, "%s/%s", cache_dir,
+                          ents[i].name)
+                    < (int)sizeof path
+                && remove (path) == 0) {
+                total -= ents[i].siz;
+                logif ("evicted `%s'", ents[i].name);
+            }
+        }
+    }
+
+exit:
+    free (ents);
+    closedir (dp);
+}
+
+int
+pcmcache_init (const char *dir, uint64_t budget)
+{
+    int ret = NCAP_OK;
+
+    pthread_mutex_lock (&cache_mx);
+
+    cache_budget = budget;
+
+    if (budget == 0) {
+        logi ("PCM cache disabled");
+        goto exit;
+    }
+
+    if (strlen (dir) >= sizeof cache_dir) {
+        logef ("ERROR: cache dir `%s' is too long", dir);
+        cache_budget = 0;
+        ret          = NCAP_EIO;
+        goto exit;
+    }
+
+    snprintf (cache_dir, sizeof cache_dir, "%s", dir);
+
+    if (mkdir (cache_dir, 0700) != 0 && errno != EEXIST) {
+        logef ("ERROR: mkdir `%s' failed: %s", cache_dir, strerror (errno));
+        cache_budget = 0;
+        ret          = NCAP_EIO;
+        goto exit;
+    }
+
+    evict (true);
+
+exit:
+    pthread_mutex_unlock (&cache_mx);
+    return ret;
+}
+
+int
+pcmcache_key (const char *fn_src, uint64_t *key)
+{
+    struct stat st;
+
+    if (stat (fn_src, &st) != 0) {
+        logef ("stat `%s' failed: %s", fn_src, strerror (errno));
+        return NCAP_EIO;
+    }
+
+    const int64_t meta[3] = { st.st_size, st.st_mtim.tv_sec,
+                              st.st_mtim.tv_nsec };
+
+    *key = pcmcache_hash (fn_src, strlen (fn_src), FNV_OFFSET);
+    *key = pcmcache_hash (meta, sizeof meta, *key);
+
+    return NCAP_OK;
+}
+
+int
+pcmcache_find (const char *fn_src, struct pcmcache_ent_t *ent)
+{
+    if (cache_budget == 0)
+        return PCMCACHE_EOFF;
+
+    if (pcmcache_key (fn_src, &ent->key) != NCAP_OK)
+        return PCMCACHE_ERR;
+
+    snprintf (ent->path, sizeof ent->path, "%s/%016" PRIx64 ENTRY_EXT,
+              cache_dir, ent->key);
+    snprintf (ent->tmp, sizeof ent->tmp, "%s/%016" PRIx64 TMP_EXT, cache_dir,
+              ent->key);
+
+    // bump recency; fails with ENOENT on a miss
+    if (utimensat (AT_FDCWD, ent->path, NULL, 0) == 0) {
+        logdf ("cache hit for `%s'", fn_src);
+        return PCMCACHE_HIT;
+    }
+
+    logdf ("cache miss for `%s'", fn_src);
+    return PCMCACHE_MISS;
+}
+
+int
+pcmcache_commit (const struct pcmcache_ent_t *ent)
+{
+    struct stat st;
+    int         ret = NCAP_OK;
+
+    pthread_mutex_lock (&cache_mx);
+
+    if (stat (ent->tmp, &st) != 0 || (uint64_t)st.st_size > cache_budget) {
+        logwf ("WARN: not caching `%s': missing or larger than the budget",
+               ent->tmp);
+        remove (ent->tmp);
+        ret = NCAP_EIO;
+        goto exit;
+    }
+
+    if (rename (ent->tmp, ent->path) != 0) {
+        logef ("ERROR: rename `%s' failed: %s", ent->tmp, strerror (errno));
+        remove (ent->tmp);
+        ret = NCAP_EIO;
+        goto exit;
+    }
+
+    evict (false);
+
+exit:
+    pthread_mutex_unlock (&cache_mx);
+    return ret;
+}
+
+void
+pcmcache_discard (const struct pcmcache_ent_t *ent)
+{
+    remove (ent->tmp);
+}
+
+int
+pcmcache_read_pcmbuf (const struct pcmcache_ent_t *ent, struct pcmbuf_t *pb)
+{
+    return pcmbuf_fill_wav (pb, ent->path);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#ifndef PCMCACHE_H
+#define PCMCACHE_H
+
+#include <stdint.h>
+
+#include "pcmbuf.h"
+
+#define PCMCACHE_PATH_LEN 256
+
+#define PCMCACHE_HIT  1
+#define PCMCACHE_MISS 0
+#define PCMCACHE_EOFF -1 // caching is disabled
+#define PCMCACHE_ERR  -2
+
+/**
+ * Persistent cache of decoded tracks as WAV files, named by a hash of the
+ * source's path, size and mtime. An entry is written to a temporary file and
+ * renamed into place once complete, so a partial entry is never visible.
+ * Recency is the entry's mtime, bumped on every hit; the least recently used
+ * entries are evicted once the cache exceeds its byte budget.
+ */
+struct pcmcache_ent_t {
+    uint64_t key;
+    char     path[PCMCACHE_PATH_LEN]; // the entry
+    char     tmp[PCMCACHE_PATH_LEN];  // where to write it on a miss
+};
+
+/**
+ * creates dir if needed, removes temporary files left by a killed process
+ * and evicts down to budget
+ *
+ * @param budget bytes. 0 disables caching
+ * @return NCAP_OK, or NCAP_EIO if dir cannot be used
+ */
+extern int pcmcache_init (const char *dir, uint64_t budget);
+
+/**
+ * @return PCMCACHE_HIT if ent->path can be played, PCMCACHE_MISS if ent->tmp
+ * should be written and then committed, or < 0 if the cache cannot be used
+ * for fn_src
+ */
+extern int pcmcache_find (const char *fn_src, struct pcmcache_ent_t *ent);
+
+/**
+ * move a fully written ent->tmp into place, then evict down to the budget
+ *
+ * @return NCAP_OK, or NCAP_EIO if the entry was discarded
+ */
+extern int pcmcache_commit (const struct pcmcache_ent_t *ent);
+
+/** remove a partially written ent->tmp */
+extern void pcmcache_discard (const struct pcmcache_ent_t *ent);
+
+/**
+ * stream a cached entry into pb with no decoding. always closes pb
+ */
+extern int pcmcache_read_pcmbuf (const struct pcmcache_ent_t *ent,
+                                 struct pcmbuf_t *pb);
+
+/**
+ * the key of fn_src, as entries are named: a hash of its path, size and
+ * mtime. also keys the loudness table
+ *
+ * @return NCAP_OK, or NCAP_EIO if fn_src cannot be stat'd
+ */
+extern int pcmcache_key (const char *fn_src, uint64_t *key);
+
+/** FNV-1a, exposed for the tests */
+extern uint64_t pcmcache_hash (const void *buf, size_t siz, uint64_t h);
+
+#endif // !PCMCACHE_H
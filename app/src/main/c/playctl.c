@@ -0,0 +1,128 @@
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif // __linux__
+
+#include "playctl.h"
+
+_Atomic uint32_t playctl = PLAYCTL_PAUSE | 100u << PLAYCTL_VOL_SHIFT;
+
+// threads in playctl_wait. lets the writers skip the wake syscall
+static atomic_int nwait = 0;
+
+static void
+wake (void)
+{
+    if (atomic_load_explicit (&nwait, memory_order_seq_cst) == 0)
+        return;
+
+#ifdef __linux__
+    syscall (SYS_futex, &playctl, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif // __linux__
+}
+
+void
+playctl_init (uint32_t flags)
+{
+    atomic_store (&playctl, (flags & PLAYCTL_FLAGS)
+                                | 100u << PLAYCTL_VOL_SHIFT);
+}
+
+uint32_t
+playctl_set (uint32_t flags)
+{
+    const uint32_t old = atomic_fetch_or (&playctl, flags & PLAYCTL_FLAGS);
+    wake ();
+    return old | (flags & PLAYCTL_FLAGS);
+}
+
+uint32_t
+playctl_clear (uint32_t flags)
+{
+    const uint32_t old = atomic_fetch_and (&playctl, ~(flags & PLAYCTL_FLAGS));
+    wake ();
+    return old & ~(flags & PLAYCTL_FLAGS);
+}
+
+uint32_t
+playctl_toggle (uint32_t flags)
+{
+    const uint32_t old = atomic_fetch_xor (&playctl, flags & PLAYCTL_FLAGS);
+    wake ();
+    return old ^ (flags & PLAYCTL_FLAGS);
+}
+
+/** replace the bits in mask with val */
+static void
+update (uint32_t mask, uint32_t val)
+{
+    uint32_t old = atomic_load (&playctl);
+
+    while (!atomic_compare_exchange_weak (&playctl, &old,
+                                          (old & ~mask) | val))
+        ;
+
+    wake ();
+}
+
+void
+playctl_setvol (unsigned vol)
+{
+    update (PLAYCTL_VOL_MASK, (vol > 100 ? 100 : vol) << PLAYCTL_VOL_SHIFT);
+}
+
+void
+playctl_settrack (int id)
+{
+    const uint32_t val = id < 0 || id > PLAYCTL_TRACK_MAX ? 0 : id + 1;
+
+    update (~(PLAYCTL_FLAGS | PLAYCTL_VOL_MASK), val << PLAYCTL_TRACK_SHIFT);
+}
+
+uint32_t
+playctl_wait (uint32_t old, int64_t timeout_ns)
+{
+    const struct timespec ts = {
+        .tv_sec  = timeout_ns / 1000000000,
+        .tv_nsec = timeout_ns % 1000000000,
+    };
+
+    atomic_fetch_add (&nwait, 1);
+
+#ifdef __linux__
+    // returns at once if the word already changed
+    syscall (SYS_futex, &playctl, FUTEX_WAIT_PRIVATE, old,
+             timeout_ns < 0 ? NULL : &ts, NULL, 0);
+#else
+    // no futex: poll every ms
+    const struct timespec poll_ts = { .tv_sec = 0, .tv_nsec = 1000000 };
+
+    for (int64_t left = timeout_ns;
+         atomic_load (&playctl) == old && (timeout_ns < 0 || left > 0);
+         left -= poll_ts.tv_nsec)
+        nanosleep (&poll_ts, NULL);
+
+    (void)ts;
+#endif // __linux__
+
+    atomic_fetch_sub (&nwait, 1);
+
+    return playctl_load ();
+}
+
+uint32_t
+playctl_waitfor (uint32_t set, uint32_t clr)
+{
+    uint32_t word;
+
+    while (((word = playctl_load ()) & set) == 0 && (word & clr) == clr)
+        playctl_wait (word, -1);
+
+    return word;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#ifndef PLAYCTL_H
+#define PLAYCTL_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Player state shared by the UI, the audio thread and the sink's real-time
+ * thread, in one atomic word: control flags, the volume and the track that
+ * is playing. Reads are a relaxed load and never block; a thread that has
+ * nothing to do until the state changes sleeps in playctl_wait (a futex on
+ * Linux and Android).
+ *
+ * bits 0-2 flags, 3-9 volume (0 to 100), 10-31 track id + 1 (0 for none)
+ */
+
+#define PLAYCTL_PAUSE 0x1u // hold playback; the audio thread keeps its place
+#define PLAYCTL_CLOSE 0x2u // stop playback and exit
+#define PLAYCTL_READY 0x4u // the UI is up; the audio thread may start
+
+#define PLAYCTL_FLAGS 0x7u
+
+#define PLAYCTL_VOL_SHIFT   3
+#define PLAYCTL_VOL_MASK    (0x7fu << PLAYCTL_VOL_SHIFT)
+#define PLAYCTL_TRACK_SHIFT 10
+#define PLAYCTL_TRACK_MAX   ((int)(0xffffffffu >> PLAYCTL_TRACK_SHIFT) - 1)
+
+extern _Atomic uint32_t playctl;
+
+/** set flags, volume 100 and no track. call before the threads start */
+extern void playctl_init (uint32_t flags);
+
+static inline uint32_t
+playctl_load (void)
+{
+    return atomic_load_explicit (&playctl, memory_order_acquire);
+}
+
+static inline unsigned
+playctl_vol (uint32_t word)
+{
+    return (word & PLAYCTL_VOL_MASK) >> PLAYCTL_VOL_SHIFT;
+}
+
+/** @return the track id, or -1 for none */
+static inline int
+playctl_track (uint32_t word)
+{
+    return (int)(word >> PLAYCTL_TRACK_SHIFT) - 1;
+}
+
+/** set and clear flags, then wake the waiters. @return the new word */
+extern uint32_t playctl_set (uint32_t flags);
+extern uint32_t playctl_clear (uint32_t flags);
+extern uint32_t playctl_toggle (uint32_t flags);
+
+/** @param vol 0 to 100; clamped */
+extern void playctl_setvol (unsigned vol);
+
+/** @param id -1 for none. ids past PLAYCTL_TRACK_MAX are shown as none */
+extern void playctl_settrack (int id);
+
+/**
+ * sleep while the word is still old, up to timeout_ns (forever if < 0).
+ * may return early
+ *
+ * @return the current word
+ */
+extern uint32_t playctl_wait (uint32_t old, int64_t timeout_ns);
+
+/**
+ * sleep until any flag in set is set or any flag in clr is clear, e.g.
+ * playctl_waitfor (PLAYCTL_CLOSE, PLAYCTL_PAUSE) to hold while paused
+ *
+ * @return the current word
+ */
+extern uint32_t playctl_waitfor (uint32_t set, uint32_t clr);
+
+#endif // !PLAYCTL_H
@@ -0,0 +1,1134 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "audio.h"
+#include "config.h"
+#include "eq.h"
+#include "gain.h"
+#include "latgov.h"
+#include "logging.h"
+#include "mix.h"
+#include "pcmbuf.h"
+#include "playctl.h"
+#include "playpos.h"
+#include "properties.h"
+#include "sink.h"
+#include "trackq.h"
+
+static const char *FILENAME = "player.c";
+
+static struct sink_t *out_sink = NULL;
+
+void
+audio_set_sink (struct sink_t *sink)
+{
+    out_sink = sink;
+}
+
+static struct sink_t *
+get_sink (void)
+{
+#ifndef NCAP_ISTEST
+    if (out_sink == NULL)
+        out_sink = sink_aaudio ();
+#endif // !NCAP_ISTEST
+
+    return out_sink;
+}
+
+/** @return bytes per sample of a wFormatTag the sinks take, or 0 */
+static size_t
+sample_width (uint16_t wFormatTag)
+{
+    switch (wFormatTag) {
+        case 1: // S16
+            return 2;
+        case 2: // S32
+        case 3: // FLT
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+/** @return frames in the data chunk of header, or 0 if unknown */
+static int64_t
+header_frames (const struct cwav_header_t *header)
+{
+    return header->fmt.nBlockAlign != 0
+               ? header->data.cksize / header->fmt.nBlockAlign
+               : 0;
+}
+
+/** @return the volume in word as a gain */
+static float
+volume_gain (uint32_t word)
+{
+    return playctl_vol (word) / 100.0f;
+}
+
+/**
+ * where play pulls interleaved PCM from
+ */
+struct pcmsrc_t {
+    /** optional. called once the sink is open, before it is started */
+    int (*prepare) (void *ctx, int32_t frames_per_burst);
+
+    /**
+     * @param iseof set once no more frames will be returned
+     * @return number of frames read into buf. short reads are padded with
+     * silence by the caller
+     */
+    size_t (*read) (void *ctx, void *buf, size_t framesiz, size_t nframes,
+                    bool *iseof);
+
+    /**
+     * optional. called every few ms from the thread that runs play, never
+     * from the sink's pull, to do what read must not (logging, locks)
+     */
+    void (*poll) (void *ctx);
+
+    /**
+     * optional. the loudness normalization gain, 0 to 1, of what read last
+     * returned. lock-free like read
+     */
+    float (*norm) (void *ctx);
+
+    /**
+     * optional. the track what read last returned is from: its track, end
+     * (frames of it read so far) and len. lock-free like read. without it,
+     * the track is playctl's and starts with the first read
+     */
+    void (*tell) (void *ctx, struct playpos_t *pos);
+
+    void *ctx;
+};
+
+/** the gain to bring what src last read to, at the volume in word */
+static float
+src_gain (const struct pcmsrc_t *src, uint32_t word)
+{
+    const float g = volume_gain (word);
+    return src->norm != NULL ? g * src->norm (src->ctx) : g;
+}
+
+struct file_src_t {
+    FILE *fp;
+    float norm;
+};
+
+static size_t
+read_file (void *ctx, void *buf, size_t framesiz, size_t nframes, bool *iseof)
+{
+    struct file_src_t *src = ctx;
+    const size_t       n   = fread (buf, framesiz, nframes, src->fp);
+
+    *iseof = n < nframes;
+    return n;
+}
+
+static float
+norm_file (void *ctx)
+{
+    return ((struct file_src_t *)ctx)->norm;
+}
+
+static int
+prepare_pcmbuf (void *pb, int32_t frames_per_burst)
+{
+    struct cwav_header_t header;
+    int                  ret;
+
+    // the ring is sized from the format, which the producer may not have
+    // read yet
+    if ((ret = pcmbuf_waitfmt (pb, &header)) != NCAP_OK) {
+        logef ("ERROR: the PCM source ended with code %d", ret);
+        return ret;
+    }
+
+    if ((ret = pcmbuf_attach (pb, frames_per_burst)) != NCAP_OK) {
+        loge ("ERROR: pcmbuf_attach failed");
+        return ret;
+    }
+
+    logd ("waiting for the decoder to prefill the ring...");
+    pcmbuf_waitfill (pb, frames_per_burst * NCAP_PCMBUF_PREFILL);
+
+    return NCAP_OK;
+}
+
+static size_t
+read_pcmbuf (void *pb, void *buf, size_t framesiz, size_t nframes,
+             bool *iseof)
+{
+    (void)framesiz;
+    return pcmbuf_read (pb, buf, nframes, iseof);
+}
+
+static float
+norm_pcmbuf (void *pb)
+{
+    return ((struct pcmbuf_t *)pb)->gain;
+}
+
+/**
+ * state shared with the sink's pull. it only reads src, atomics and what is
+ * set before the sink starts: no locks, allocations or I/O
+ */
+struct cbstate_t {
+    const struct pcmsrc_t *src; // per track. set while iseof, then published
+    struct sink_t         *sink;
+    uint16_t               fmt; // wFormatTag
+    int                    channels;
+    int32_t                rate;
+    size_t                 framesiz; // bytes per frame
+    struct eq_t            eq;       // only used by the writing thread
+    struct gain_t          gain;     // only used by the writing thread
+    struct latgov_t        gov;      // only used by the control thread
+
+    // the position, for a src without tell. only used by the writing thread
+    int64_t nread; // frames of src
+    int64_t len;   // frames of src, 0 if unknown
+    bool    ispub; // the last position published was running
+
+    atomic_bool iseof;      // src is drained
+    atomic_uint src_ur_cnt; // pulls src could not fill
+};
+
+/**
+ * publish where the listener is in src's track, after a burst that took n
+ * frames of it. the sink's timestamp puts the frames it holds between the
+ * listener and the end of what src returned
+ *
+ * @param iscounted the sink counts the burst already: it was written, not
+ * pulled
+ */
+static void
+publish_pos (struct cbstate_t *cb, const struct pcmsrc_t *src, uint32_t w,
+             size_t n, bool isrunning, bool iscounted)
+{
+    struct sink_t *const sink = cb->sink;
+    struct playpos_t     pos  = { .rate = cb->rate, .isrunning = isrunning };
+    int64_t              ahead;
+
+    cb->nread += n;
+    cb->ispub = isrunning;
+
+    if (src->tell != NULL) {
+        src->tell (src->ctx, &pos);
+    } else {
+        pos.track = playctl_track (w);
+        pos.end   = cb->nread;
+        pos.len   = cb->len;
+    }
+
+    if (sink->ops->timestamp == NULL
+        || sink->ops->timestamp (sink, &ahead, &pos.t_ns) != NCAP_OK) {
+        ahead    = sink->ops->latency (sink);
+        pos.t_ns = playpos_now_ns ();
+    }
+
+    pos.frame = pos.end - ahead - (iscounted ? 0 : (int64_t)n);
+    playpos_publish (&pos);
+}
+
+static bool
+pull (void *ctx, void *audio, int32_t nframes)
+{
+    struct cbstate_t *const cb    = ctx;
+    uint8_t *const          dst   = audio;
+    bool                    iseof = false;
+    size_t                  n     = 0;
+
+    // one load per burst: pause, close and volume land on the next burst
+    const uint32_t w = playctl_load ();
+
+    const bool isdrained
+        = atomic_load_explicit (&cb->iseof, memory_order_acquire);
+
+    // paused or stopping: silence until the control loop catches up
+    const bool isread = !(w & (PLAYCTL_PAUSE | PLAYCTL_CLOSE)) && !isdrained;
+
+    if (isread)
+        n = cb->src->read (cb->src->ctx, dst, cb->framesiz, nframes, &iseof);
+
+    if (n < (size_t)nframes) {
+        if (isread && !iseof)
+            atomic_fetch_add_explicit (&cb->src_ur_cnt, 1,
+                                       memory_order_relaxed);
+
+        memset (dst + n * cb->framesiz, 0, (nframes - n) * cb->framesiz);
+    }
+
+    eq_apply (&cb->eq, dst, cb->fmt, n);
+    gain_apply (&cb->gain, dst, cb->fmt, cb->channels, n,
+                src_gain (cb->src, w));
+
+    // paused: once, since the silence that follows is not src's
+    if (!isdrained && (isread || cb->ispub))
+        publish_pos (cb, cb->src, w, n, isread, false);
+
+    // after src is done with its state, e.g. trackq_src_t.pending
+    if (iseof)
+        atomic_store_explicit (&cb->iseof, true, memory_order_release);
+
+    return !atomic_load_explicit (&cb->iseof, memory_order_relaxed);
+}
+
+static int64_t
+now_ms (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/** let gov resize the device buffer. cheap enough to call per burst */
+static void
+adapt_latency (struct sink_t *sink, struct latgov_t *gov)
+{
+    if (sink->ops->xruns == NULL || sink->ops->setbuf == NULL)
+        return;
+
+    const int32_t want
+        = latgov_update (gov, sink->ops->xruns (sink), now_ms ());
+
+    if (want != sink->buf_siz)
+        latgov_settle (gov, sink->ops->setbuf (sink, want));
+}
+
+/**
+ * control loop of the pull mode: applies pause and close, which the pull
+ * only sees as playctl flags, until cb->src is drained. sleeps on playctl,
+ * so a control action is applied as soon as it is made
+ */
+static int
+run_callback (struct sink_t *sink, struct cbstate_t *cb)
+{
+    const int64_t          poll_ns  = 10000000; // 10 ms
+    const struct pcmsrc_t *src      = cb->src;
+    bool                   ispaused = true; // not started yet
+    uint32_t               w        = playctl_load ();
+    int                    ret      = NCAP_OK;
+
+    while (!atomic_load_explicit (&cb->iseof, memory_order_acquire)) {
+        if (w & PLAYCTL_CLOSE) {
+            logi ("stopping playback...; PLAYCTL_CLOSE is set");
+            break;
+        }
+
+        if (atomic_load (&sink->isdisconn)) {
+            loge ("ERROR: output device disconnected");
+            ret = NCAP_EIO;
+            break;
+        }
+
+        const bool wantpause = w & PLAYCTL_PAUSE;
+
+        if (wantpause != ispaused) {
+            logif ("%s the stream", wantpause ? "pausing" : "starting");
+
+            ret = wantpause ? sink->ops->pause (sink)
+                            : sink->ops->start (sink);
+
+            if (ret != NCAP_OK) {
+                logef ("ERROR: changing stream state failed with code %d",
+                       ret);
+                break;
+            }
+
+            // the pull may not run again before the stream is started
+            if (wantpause)
+                playpos_hold (playpos_now_ns ());
+
+            ispaused = wantpause;
+        }
+
+        if (src->poll != NULL)
+            src->poll (src->ctx);
+
+        if (!ispaused)
+            adapt_latency (sink, &cb->gov);
+
+        // wakes early on a control action. the timeout polls src and iseof
+        w = playctl_wait (w, poll_ns);
+    }
+
+    if (src->poll != NULL)
+        src->poll (src->ctx);
+
+    const unsigned int ur = atomic_load (&cb->src_ur_cnt);
+
+    if (ur > 0)
+        logwf ("WARN: PCM source ran dry for %u callbacks", ur);
+
+    return ret;
+}
+
+/**
+ * push mode: one write per burst from this thread
+ */
+static int
+run_blocking (struct sink_t *sink, const struct pcmsrc_t *src,
+              struct cbstate_t *cb)
+{
+    const int32_t burst      = sink->burst;
+    const size_t  framesiz   = cb->framesiz;
+    uint8_t      *buf        = malloc (burst * framesiz);
+    bool          iseof      = false;
+    uint32_t      src_ur_cnt = 0;
+    bool          ispaused   = true; // not started yet
+    int           ret        = NCAP_OK;
+
+    if (buf == NULL) {
+        loge ("ERROR: malloc for the burst buffer failed");
+        return NCAP_EALLOC;
+    }
+
+    while (ret == NCAP_OK && !iseof) {
+        uint32_t w = playctl_load ();
+
+        // check for pause (playback control). sleeps without holding a burst
+
+        if ((w & PLAYCTL_PAUSE) && !(w & PLAYCTL_CLOSE)) {
+            logi ("PLAYCTL_PAUSE is set. waiting on playctl...");
+
+            if (!ispaused && (ret = sink->ops->pause (sink)) != NCAP_OK)
+                break;
+
+            if (!ispaused)
+                publish_pos (cb, src, w, 0, false, true);
+
+            ispaused = true;
+            w        = playctl_waitfor (PLAYCTL_CLOSE, PLAYCTL_PAUSE);
+        }
+
+        // check for window close
+
+        if (w & PLAYCTL_CLOSE) {
+            logi ("stopping playback...; PLAYCTL_CLOSE is set");
+            break;
+        }
+
+        if (ispaused) {
+            if ((ret = sink->ops->start (sink)) != NCAP_OK)
+                break;
+
+            ispaused = false;
+        }
+
+        if (atomic_load (&sink->isdisconn)) {
+            loge ("ERROR: output device disconnected");
+            ret = NCAP_EIO;
+            break;
+        }
+
+        // play
+
+        const size_t nread = src->read (src->ctx, buf, framesiz, burst,
+                                        &iseof);
+
+        if (src->poll != NULL)
+            src->poll (src->ctx);
+
+        if (nread < (size_t)burst) {
+            if (nread == 0 && iseof) {
+                logi ("end of PCM data reached");
+                break;
+            }
+
+            // source underrun or last burst: pad with silence
+            if (!iseof)
+                ++src_ur_cnt;
+
+            memset (buf + nread * framesiz, 0, (burst - nread) * framesiz);
+        }
+
+        eq_apply (&cb->eq, buf, cb->fmt, burst);
+        gain_apply (&cb->gain, buf, cb->fmt, cb->channels, burst,
+                    src_gain (src, w));
+        ret = sink->ops->write (sink, buf, burst);
+
+        publish_pos (cb, src, w, nread, true, true);
+        adapt_latency (sink, &cb->gov);
+    }
+
+    if (src_ur_cnt > 0)
+        logwf ("WARN: PCM source ran dry for %u bursts", src_ur_cnt);
+
+    free (buf);
+
+    return ret;
+}
+
+static bool
+fmteq (const struct cwav_header_t *a, const struct cwav_header_t *b)
+{
+    return a->fmt.wFormatTag == b->fmt.wFormatTag
+           && a->fmt.nChannels == b->fmt.nChannels
+           && a->fmt.nSamplesPerSec == b->fmt.nSamplesPerSec
+           && a->fmt.wBitsPerSample == b->fmt.wBitsPerSample;
+}
+
+/**
+ * the output session: one open stream, kept across tracks until the format,
+ * the mode or the sink changes. opening a low latency stream takes tens of
+ * ms and may click, so tracks of one format share it
+ */
+static struct {
+    struct sink_t       *sink; // NULL while closed
+    struct cwav_header_t header;
+    bool                 isblocking;
+    struct cbstate_t     cb; // the pull's ctx, so it lives as the stream does
+} sess;
+
+void
+audio_close (void)
+{
+    struct sink_t *const sink = sess.sink;
+
+    if (sink == NULL)
+        return;
+
+    logif ("closing the %s sink. latency: %.1f ms, peak %d frames; "
+           "%u underruns, %u grows, %u shrinks",
+           sink->name, latgov_stats_ms (&latgov_stats),
+           atomic_load (&latgov_stats.peak_frames),
+           atomic_load (&latgov_stats.xruns),
+           atomic_load (&latgov_stats.ngrow),
+           atomic_load (&latgov_stats.nshrink));
+
+    sink->ops->close (sink);
+    sess.sink = NULL;
+
+    logi ("Audio stream closed.");
+}
+
+/** the configured EQ preset, designed for a stream of rate and channels */
+static void
+init_eq (struct eq_t *eq, int rate, int channels)
+{
+    const uint8_t id = ncap_config.eq_preset;
+
+    if (id == EQ_PRESET_CUSTOM) {
+        eq_init (eq, rate, channels, ncap_config.eq_bands,
+                 ncap_config.eq_nbands, ncap_config.eq_preamp_db);
+        logif ("EQ: custom, %d bands", eq->nbands);
+        return;
+    }
+
+    if (id >= eq_npresets) {
+        logwf ("WARN: no EQ preset %hhu. EQ off", id);
+        eq_init (eq, rate, channels, NULL, 0, 0);
+        return;
+    }
+
+    eq_init (eq, rate, channels, eq_presets[id].bands, eq_presets[id].nbands,
+             eq_presets[id].preamp_db);
+    logif ("EQ: %s, %d bands", eq_presets[id].name, eq->nbands);
+}
+
+/** open a stream for header on sink, unless the open one already fits */
+static int
+sess_open (struct sink_t *sink, const struct cwav_header_t *header,
+           bool isblocking)
+{
+    struct cbstate_t *const cb       = &sess.cb;
+    const uint32_t          channels = header->fmt.nChannels;
+    int                     stat;
+
+    if (sess.sink == sink && sess.isblocking == isblocking
+        && fmteq (&sess.header, header)) {
+        logi ("same format: reusing the open stream");
+        return NCAP_OK;
+    }
+
+    if (sess.sink != NULL) {
+        logi ("the format changed. reopening the stream...");
+        audio_close ();
+    }
+
+    cb->src      = NULL;
+    cb->sink     = sink;
+    cb->fmt      = header->fmt.wFormatTag;
+    cb->channels = channels;
+    cb->rate     = header->fmt.nSamplesPerSec;
+    cb->framesiz = sample_width (cb->fmt) * channels;
+    init_eq (&cb->eq, header->fmt.nSamplesPerSec, channels);
+    gain_init (&cb->gain, volume_gain (playctl_load ()));
+    atomic_init (&cb->iseof, true);
+    atomic_init (&cb->src_ur_cnt, 0);
+
+    if ((stat = sink->ops->open (sink, header, isblocking ? NULL : pull, cb))
+        != NCAP_OK) {
+        logef ("ERROR: opening the %s sink failed with code %d", sink->name,
+               stat);
+        return stat;
+    }
+
+#ifndef NDEBUG
+    // clang-format off
+    logvf ("sink: %s",             sink->name);
+    logvf ("stream channels: %d",  channels);
+    logvf ("frames_per_burst: %d", sink->burst);
+    logvf ("sample_rate: %d",      header->fmt.nSamplesPerSec);
+    logvf ("buf_cap: %d",          sink->buf_cap);
+    logvf ("buf_siz: %d",          sink->buf_siz);
+    logvf ("blocking: %d",         isblocking);
+    // clang-format on
+#endif // !NDEBUG
+
+    latgov_init (&cb->gov, &latgov_stats, sink, header->fmt.nSamplesPerSec,
+                 ncap_config.latency_ms, now_ms ());
+
+    if (sink->ops->setbuf != NULL)
+        latgov_settle (&cb->gov, sink->ops->setbuf (sink, cb->gov.siz));
+
+    sess.sink       = sink;
+    sess.header     = *header;
+    sess.isblocking = isblocking;
+
+    return NCAP_OK;
+}
+
+/**
+ * play interleaved PCM described by header, pulled from src, on the output
+ * session. the sink pulls unless ncap_config.aaudio_optimize has
+ * CONFIG_AAUDIO_BLOCKING. the stream is left open for the next track; see
+ * audio_close
+ */
+static int
+play (const struct cwav_header_t *header, const struct pcmsrc_t *src)
+{
+    struct sink_t *sink  = get_sink ();
+    const size_t   width = sample_width (header->fmt.wFormatTag);
+    const bool     isblocking
+        = ncap_config.aaudio_optimize & CONFIG_AAUDIO_BLOCKING;
+    int stat;
+
+    if (sink == NULL) {
+        loge ("ERROR: no audio sink set");
+        return NCAP_ENULL;
+    }
+
+    if (width == 0) {
+        logef ("ERROR: unsupported PCM format %u", header->fmt.wFormatTag);
+        return NCAP_EGEN;
+    }
+
+    logif ("Using PCM data width of %zu", width);
+
+    if ((stat = sess_open (sink, header, isblocking)) != NCAP_OK)
+        return stat;
+
+    struct cbstate_t *const cb = &sess.cb;
+
+    // the stream is stopped, so the pull is not running
+    cb->src   = src;
+    cb->nread = 0;
+    cb->len   = header_frames (header);
+    atomic_store (&cb->src_ur_cnt, 0);
+
+    if (src->prepare != NULL
+        && (stat = src->prepare (src->ctx, sink->burst)) != NCAP_OK) {
+        logef ("ERROR: PCM source prepare failed with code %d", stat);
+        return stat;
+    }
+
+    // start on the track's own level rather than ramp to it
+    gain_init (&cb->gain, src_gain (src, playctl_load ()));
+
+    // nothing of the track is heard yet
+    publish_pos (cb, src, playctl_load (), 0, false, true);
+
+    // publishes cb->src to the pull
+    atomic_store_explicit (&cb->iseof, false, memory_order_release);
+
+    const int64_t t0_ms = now_ms ();
+
+    logi ("Stream started. Playing audio...");
+
+    int ret = isblocking ? run_blocking (sink, src, cb)
+                         : run_callback (sink, cb);
+
+    if (ret != NCAP_OK)
+        logef ("Playback stopped due to a sink error with code %d.", ret);
+
+    atomic_store (&cb->iseof, true);
+
+    logif ("Audio play ended after %.3f secs. Stopping stream...",
+           (now_ms () - t0_ms) / 1e3);
+
+    // plays out what the device has buffered, then stops pulling
+    if (sink->ops->stop (sink) != NCAP_OK) {
+        logw ("WARN: the sink failed to stop. Closing it...");
+        ret = ret == NCAP_OK ? NCAP_EIO : ret;
+    }
+
+    // e.g. the device went away: the next track opens a new stream
+    if (ret != NCAP_OK)
+        audio_close ();
+
+    return ret;
+}
+
+struct fill_args_t {
+    struct pcmbuf_t *pb;
+    const char      *fn;
+};
+
+static void *
+tfn_fill (void *args_vp)
+{
+    struct fill_args_t *args = args_vp;
+
+    pcmbuf_fill_wav (args->pb, args->fn);
+
+    return NULL;
+}
+
+/**
+ * the data callback must not do file I/O, so a thread streams fn into a
+ * pcmbuf for it
+ */
+static int
+play_prefetch (const char *fn, const struct cwav_header_t *header,
+               float norm)
+{
+    struct pcmbuf_t    pb;
+    struct fill_args_t args = { .pb = &pb, .fn = fn };
+    pthread_t          tid;
+    int                ret;
+
+    pcmbuf_init (&pb, 0);
+    pb.gain = norm;
+
+    if ((ret = pthread_create (&tid, NULL, tfn_fill, &args)) != 0) {
+        logef ("ERROR: pthread_create failed with code %d: %s", ret,
+               strerror (ret));
+        pcmbuf_deinit (&pb);
+        return NCAP_EGEN;
+    }
+
+    const struct pcmsrc_t src = {
+        .prepare = prepare_pcmbuf,
+        .read    = read_pcmbuf,
+        .norm    = norm_pcmbuf,
+        .ctx     = &pb,
+    };
+
+    ret = play (header, &src);
+
+    pcmbuf_abort (&pb);
+    pcmbuf_wake (&pb);
+    pthread_join (tid, NULL);
+    pcmbuf_deinit (&pb);
+
+    return ret;
+}
+
+int
+audio_play (const char *fn, float norm)
+{
+    FILE *fp = fopen (fn, "rb");
+
+    if (fp == NULL) {
+        logef ("Failed to open file `%s': error: %s", fn, strerror (errno));
+        return NCAP_EIO;
+    }
+
+    logif ("Opened file `%s'", fn);
+
+    struct cwav_header_t header;
+
+    if (fread (&header, CWAV_HEADER_SIZ, 1, fp) != 1) {
+        logef ("Failed to read WAV header of `%s'", fn);
+        fclose (fp);
+        return NCAP_EIO;
+    }
+
+#ifndef NDEBUG
+    // clang-format off
+    logvf ("WAV header RIFF:\t%.4s",          header.riff.ckID);
+    logvf ("WAV header file size:\t%u",       header.riff.cksize);
+    logvf ("WAV header WAVE:\t%.4s",          header.riff.WAVEID);
+    logvf ("WAV header fmt :\t%.4s",          header.fmt.ckID);
+    logvf ("WAV header block size:\t%u",      header.fmt.cksize);
+    logvf ("WAV header audio fmt:\t%u",       header.fmt.wFormatTag);
+    logvf ("WAV header channels:\t%u",        header.fmt.nChannels);
+    logvf ("WAV header sample rate:\t%u",     header.fmt.nSamplesPerSec);
+    logvf ("WAV header byte rate:\t%u",       header.fmt.nAvgBytesPerSec);
+    logvf ("WAV header block alignment:\t%u", header.fmt.nBlockAlign);
+    logvf ("WAV header bits per sample:\t%u", header.fmt.wBitsPerSample);
+    logvf ("WAV header data:\t%.4s",          header.data.ckID);
+    logvf ("WAV header data size:\t%u",       header.data.cksize);
+// clang-format on
+#endif // !NDEBUG
+
+    if (ncap_config.aaudio_optimize & CONFIG_AAUDIO_BLOCKING) {
+        struct file_src_t     fsrc = { .fp = fp, .norm = norm };
+        const struct pcmsrc_t src  = {
+             .read = read_file,
+             .norm = norm_file,
+             .ctx  = &fsrc,
+        };
+        const int ret = play (&header, &src);
+
+        fclose (fp);
+
+        return ret;
+    }
+
+    fclose (fp);
+
+    return play_prefetch (fn, &header, norm);
+}
+
+// gapless playback of a trackq, optionally crossfaded
+
+struct trackq_src_t {
+    struct trackq_t     *q;
+    struct pcmbuf_t     *cur;
+    struct pcmbuf_t     *pending; // next track, needs a new stream
+    struct cwav_header_t header;  // format of cur and of the open stream
+    size_t               burst;
+
+    // crossfade of cur's tail into fade's head. all set in prepare_trackq,
+    // so the pull only mixes what both rings already hold
+    struct pcmbuf_t *fade;     // fading in, or NULL
+    size_t           xfade;    // frames. 0: gapless
+    size_t           fade_len; // frames
+    size_t           fade_pos; // frames
+    void            *fade_buf; // one burst of fade
+
+    int64_t pos; // frames read of the track cur_id names
+
+    // what read_trackq did, for poll_trackq to report
+    atomic_int  cur_id;
+    atomic_uint nskip;
+    int         pub_id;
+    unsigned    pub_nskip;
+};
+
+static int
+prepare_trackq (void *ctx, int32_t frames_per_burst)
+{
+    struct trackq_src_t *src = ctx;
+
+    const size_t framesiz = src->header.fmt.nBlockAlign;
+    void        *buf;
+
+    src->burst = frames_per_burst;
+    src->xfade = (uint64_t)ncap_config.xfade_ms
+                 * src->header.fmt.nSamplesPerSec / 1000;
+
+    if (src->xfade > 0) {
+        if ((buf = realloc (src->fade_buf, frames_per_burst * framesiz))
+            == NULL) {
+            loge ("ERROR: realloc for the crossfade buffer failed");
+            return NCAP_EALLOC;
+        }
+
+        src->fade_buf = buf;
+    }
+
+    return prepare_pcmbuf (src->cur, frames_per_burst);
+}
+
+/**
+ * start fading into the next track once cur is fully decoded, its rest fits
+ * in the crossfade and the next track has at least as much queued. the next
+ * track must be in the same format with its ring allocated, and cur must have
+ * room to be retired once the fade is done
+ */
+static void
+start_fade (struct trackq_src_t *src)
+{
+    struct pcmbuf_t     *next;
+    struct cwav_header_t header;
+    size_t               rest;
+
+    if (src->xfade == 0
+        || !atomic_load_explicit (&src->cur->iseof, memory_order_acquire))
+        return;
+
+    rest = ringbuf_readable (&src->cur->ring);
+
+    if (rest == 0 || rest > src->xfade || (next = trackq_peek (src->q)) == NULL
+        || pcmbuf_tryfmt (next, &header) != 1 || !fmteq (&header, &src->header)
+        || pcmbuf_burst (next) == 0 || ringbuf_readable (&next->ring) < rest
+        || !trackq_canretire (src->q))
+        return;
+
+    trackq_pop (src->q);
+    src->fade     = next;
+    src->fade_len = rest;
+    src->fade_pos = 0;
+    src->pos      = 0;
+    atomic_store_explicit (&src->cur_id, next->id, memory_order_relaxed);
+}
+
+/**
+ * mix up to nframes of the crossfade into dst. once it is done, the faded in
+ * track is cur
+ *
+ * @return frames mixed
+ */
+static size_t
+read_fade (struct trackq_src_t *src, uint8_t *dst, size_t framesiz,
+           size_t nframes)
+{
+    const float step = 1.0f / src->fade_len;
+    size_t      n    = 0;
+    bool        iseof;
+
+    while (n < nframes && src->fade_pos < src->fade_len) {
+        size_t k = src->fade_len - src->fade_pos;
+
+        k = k < nframes - n ? k : nframes - n;
+        k = k < src->burst ? k : src->burst;
+
+        // both are queued already: see start_fade
+        pcmbuf_read (src->cur, dst + n * framesiz, k, &iseof);
+        pcmbuf_read (src->fade, src->fade_buf, k, &iseof);
+
+        mix_xfade (dst + n * framesiz, dst + n * framesiz, src->fade_buf,
+                   src->header.fmt.wFormatTag, src->header.fmt.nChannels, k,
+                   src->fade_pos * step, step);
+
+        src->fade_pos += k;
+        src->pos += k;
+        n += k;
+    }
+
+    // has room: nothing else is retired during a fade. see start_fade
+    if (src->fade_pos == src->fade_len) {
+        trackq_retire (src->q, src->cur);
+        src->cur  = src->fade;
+        src->fade = NULL;
+    }
+
+    return n;
+}
+
+static size_t
+read_trackq (void *ctx, void *buf, size_t framesiz, size_t nframes,
+             bool *iseof)
+{
+    struct trackq_src_t *src = ctx;
+    uint8_t             *dst = buf;
+    size_t               n   = 0;
+    bool                 cur_eof;
+
+    *iseof = false;
+
+    while (n < nframes) {
+        if (src->fade == NULL)
+            start_fade (src);
+
+        if (src->fade != NULL) {
+            n += read_fade (src, dst + n * framesiz, framesiz, nframes - n);
+            continue;
+        }
+
+        const size_t k = pcmbuf_read (src->cur, dst + n * framesiz,
+                                      nframes - n, &cur_eof);
+
+        src->pos += k;
+        n += k;
+
+        if (!cur_eof)
+            break; // whole burst, or the decoder is behind
+
+        // cur is drained: continue with the next track from this exact frame
+
+        struct pcmbuf_t     *next = trackq_peek (src->q);
+        struct cwav_header_t header;
+        int                  stat;
+
+        if (next == NULL) {
+            *iseof = trackq_isend (src->q);
+            break;
+        }
+
+        // still opening, or no room yet to retire a track until the control
+        // thread flushes: pad this burst and try again on the next one
+        if ((stat = pcmbuf_tryfmt (next, &header)) == 0
+            || !trackq_canretire (src->q))
+            break;
+
+        trackq_pop (src->q);
+
+        if (stat < 0) {
+            atomic_fetch_add_explicit (&src->nskip, 1, memory_order_relaxed);
+            trackq_retire (src->q, next);
+            continue;
+        }
+
+        // a ring that is not allocated yet would have to be allocated here,
+        // which the data callback must not do: reopen like on a new format
+        if (!fmteq (&header, &src->header) || pcmbuf_burst (next) == 0) {
+            src->pending = next;
+            *iseof       = true;
+            break;
+        }
+
+        trackq_retire (src->q, src->cur);
+        src->cur = next;
+        src->pos = 0;
+        atomic_store_explicit (&src->cur_id, next->id, memory_order_relaxed);
+    }
+
+    return n;
+}
+
+/** cur's gain, moving to the next track's over a crossfade */
+static float
+norm_trackq (void *ctx)
+{
+    const struct trackq_src_t *src = ctx;
+
+    if (src->fade == NULL)
+        return src->cur->gain;
+
+    const float t = (float)src->fade_pos / src->fade_len;
+
+    return src->cur->gain + t * (src->fade->gain - src->cur->gain);
+}
+
+static void
+tell_trackq (void *ctx, struct playpos_t *pos)
+{
+    const struct trackq_src_t *src = ctx;
+    const struct pcmbuf_t     *pb  = src->fade != NULL ? src->fade : src->cur;
+
+    pos->track = pb->id;
+    pos->end   = src->pos;
+    pos->len   = header_frames (&pb->header);
+}
+
+static void
+poll_trackq (void *ctx)
+{
+    struct trackq_src_t *src = ctx;
+
+    const int      id    = atomic_load_explicit (&src->cur_id,
+                                                 memory_order_relaxed);
+    const unsigned nskip = atomic_load_explicit (&src->nskip,
+                                                 memory_order_relaxed);
+
+    // what the pull moved past: wake its decoder and hand it back
+    trackq_flush (src->q);
+
+    if (nskip != src->pub_nskip) {
+        logwf ("WARN: skipped %u tracks that failed to decode",
+               nskip - src->pub_nskip);
+        src->pub_nskip = nskip;
+    }
+
+    if (id != src->pub_id) {
+        logif ("gapless handover to track %d", id);
+        playctl_settrack (id);
+        src->pub_id = id;
+    }
+}
+
+/**
+ * blocks until a track is queued
+ *
+ * @return the dequeued track, or NULL if none will follow
+ */
+static struct pcmbuf_t *
+wait_track (struct trackq_t *q)
+{
+    const struct timespec ts = { .tv_sec = 0, .tv_nsec = 10000000 }; // 10 ms
+    struct pcmbuf_t      *pb;
+
+    while ((pb = trackq_peek (q)) == NULL) {
+        if (trackq_isend (q))
+            return NULL;
+
+        nanosleep (&ts, NULL);
+    }
+
+    trackq_pop (q);
+
+    return pb;
+}
+
+int
+audio_play_trackq (struct trackq_t *q)
+{
+    struct trackq_src_t   tsrc = { .q = q, .pub_id = -1 };
+    const struct pcmsrc_t src  = {
+         .prepare = prepare_trackq,
+         .read    = read_trackq,
+         .poll    = poll_trackq,
+         .norm    = norm_trackq,
+         .tell    = tell_trackq,
+         .ctx     = &tsrc,
+    };
+
+    atomic_init (&tsrc.cur_id, -1);
+    atomic_init (&tsrc.nskip, 0);
+
+    struct pcmbuf_t *next = wait_track (q);
+    int              ret  = NCAP_OK;
+
+    // one iteration per stream: the first track, then each format change
+    while (next != NULL) {
+        if ((ret = pcmbuf_waitfmt (next, &tsrc.header)) != NCAP_OK) {
+            logwf ("WARN: skipping track %d: decoder failed with code %d",
+                   next->id, ret);
+            trackq_release (q, next);
+            next = wait_track (q);
+            ret  = NCAP_OK;
+            continue;
+        }
+
+        logif ("streaming %u channels at %u Hz, format %u",
+               tsrc.header.fmt.nChannels, tsrc.header.fmt.nSamplesPerSec,
+               tsrc.header.fmt.wFormatTag);
+
+        tsrc.cur = next;
+        tsrc.pos = 0;
+        atomic_store (&tsrc.cur_id, next->id);
+        poll_trackq (&tsrc);
+
+        ret = play (&tsrc.header, &src);
+
+        // the pull has stopped: release what it retired since the last poll
+        trackq_flush (q);
+        trackq_release (q, tsrc.cur);
+        next         = tsrc.pending;
+        tsrc.pending = NULL;
+
+        // stopped mid-fade
+        if (tsrc.fade != NULL) {
+            trackq_release (q, tsrc.fade);
+            tsrc.fade = NULL;
+        }
+
+        if (next != NULL)
+            logif ("track %d changes format. reopening the stream...",
+                   next->id);
+
+        if (ret != NCAP_OK)
+            break;
+    }
+
+    if (next != NULL)
+        trackq_release (q, next);
+
+    free (tsrc.fade_buf);
+
+    return ret;
+}
@@ -0,0 +1,118 @@
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "playpos.h"
+
+// odd while the writer is publishing. the fields are relaxed atomics, so a
+// torn read is detected by seq instead of being a data race
+static _Atomic uint32_t seq = 0;
+
+static _Atomic int64_t frame     = 0;
+static _Atomic int64_t t_ns      = 0;
+static _Atomic int64_t end       = 0;
+static _Atomic int64_t len       = 0;
+static _Atomic int32_t rate      = 0;
+static _Atomic int32_t track     = -1;
+static atomic_bool     isrunning = false;
+
+void
+playpos_init (void)
+{
+    const struct playpos_t pos = { .track = -1 };
+
+    playpos_publish (&pos);
+}
+
+bool
+playpos_publish (const struct playpos_t *pos)
+{
+    uint32_t s = atomic_load_explicit (&seq, memory_order_relaxed);
+
+    // an odd seq is also the writers' lock
+    if ((s & 1) != 0
+        || !atomic_compare_exchange_strong_explicit (
+            &seq, &s, s + 1, memory_order_relaxed, memory_order_relaxed))
+        return false;
+
+    // the odd seq lands before any field
+    atomic_thread_fence (memory_order_release);
+
+    atomic_store_explicit (&frame, pos->frame, memory_order_relaxed);
+    atomic_store_explicit (&t_ns, pos->t_ns, memory_order_relaxed);
+    atomic_store_explicit (&end, pos->end, memory_order_relaxed);
+    atomic_store_explicit (&len, pos->len, memory_order_relaxed);
+    atomic_store_explicit (&rate, pos->rate, memory_order_relaxed);
+    atomic_store_explicit (&track, pos->track, memory_order_relaxed);
+    atomic_store_explicit (&isrunning, pos->isrunning, memory_order_relaxed);
+
+    atomic_store_explicit (&seq, s + 2, memory_order_release);
+
+    return true;
+}
+
+void
+playpos_load (struct playpos_t *pos)
+{
+    uint32_t s0, s1;
+
+    do {
+        s0 = atomic_load_explicit (&seq, memory_order_acquire);
+
+        pos->frame = atomic_load_explicit (&frame, memory_order_relaxed);
+        pos->t_ns  = atomic_load_explicit (&t_ns, memory_order_relaxed);
+        pos->end   = atomic_load_explicit (&end, memory_order_relaxed);
+        pos->len   = atomic_load_explicit (&len, memory_order_relaxed);
+        pos->rate  = atomic_load_explicit (&rate, memory_order_relaxed);
+        pos->track = atomic_load_explicit (&track, memory_order_relaxed);
+        pos->isrunning
+            = atomic_load_explicit (&isrunning, memory_order_relaxed);
+
+        // the fields are read before seq is read again
+        atomic_thread_fence (memory_order_acquire);
+        s1 = atomic_load_explicit (&seq, memory_order_relaxed);
+    } while ((s0 & 1) != 0 || s0 != s1);
+}
+
+void
+playpos_hold (int64_t now_ns)
+{
+    struct playpos_t pos;
+
+    for (;;) {
+        playpos_load (&pos);
+
+        pos.frame     = playpos_frame (&pos, now_ns);
+        pos.t_ns      = now_ns;
+        pos.isrunning = false;
+
+        if (playpos_publish (&pos))
+            return;
+
+        sched_yield (); // the audio thread is publishing
+    }
+}
+
+int64_t
+playpos_frame (const struct playpos_t *pos, int64_t now_ns)
+{
+    int64_t f = pos->frame;
+
+    if (pos->isrunning && pos->rate > 0 && now_ns > pos->t_ns)
+        f += (now_ns - pos->t_ns) * pos->rate / 1000000000LL;
+
+    if (f > pos->end)
+        f = pos->end;
+
+    return f > 0 ? f : 0;
+}
+
+int64_t
+playpos_now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
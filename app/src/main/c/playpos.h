@@ -0,0 +1,53 @@
+#pragma once
+
+#ifndef PLAYPOS_H
+#define PLAYPOS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Where playback is inside the playing track. The thread that writes the
+ * audio publishes a (frame, time) pair after every burst, calibrated with
+ * the sink's presentation timestamp so the frame is the one heard at t_ns.
+ * Readers extrapolate from it at the stream's rate, e.g. the UI once per
+ * drawn frame for a progress bar.
+ *
+ * The pair goes through a seqlock: reads never block a writer and retry if
+ * one was publishing meanwhile. Writers do not wait for each other either:
+ * a publish that finds another one in progress is dropped, which the
+ * per-burst writer makes up for on its next burst.
+ */
+
+struct playpos_t {
+    int64_t frame;     // of the track, heard at t_ns. negative before it
+    int64_t t_ns;      // CLOCK_MONOTONIC
+    int64_t end;       // frames of the track written so far. frame stops here
+    int64_t len;       // frames in the track, 0 if unknown
+    int32_t rate;      // frames per second. 0 until something plays
+    int32_t track;     // id, -1 for none
+    bool    isrunning; // frame advances with time; false while paused
+};
+
+/** no track, not running. call before the threads start */
+extern void playpos_init (void);
+
+/** @return false if dropped for another publish in progress */
+extern bool playpos_publish (const struct playpos_t *pos);
+
+/**
+ * stop the position where the listener is at now_ns, e.g. once the sink is
+ * paused from a thread other than the one that writes the audio
+ */
+extern void playpos_hold (int64_t now_ns);
+
+/** copy what was last published */
+extern void playpos_load (struct playpos_t *pos);
+
+/** @return the frame of pos->track heard at now_ns, 0 to pos->end */
+extern int64_t playpos_frame (const struct playpos_t *pos, int64_t now_ns);
+
+/** @return CLOCK_MONOTONIC now, the clock of playpos_t.t_ns */
+extern int64_t playpos_now_ns (void);
+
+#endif // !PLAYPOS_H
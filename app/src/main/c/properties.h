@@ -10,6 +10,24 @@
 
 #define NCAP_CONFIG_FILE "ncaprc"
 
+/** directory of decoded tracks, see pcmcache.h */
+#define NCAP_PCMCACHE_DIR "pcmcache"
+
+/** loudness table, see lufstab.h */
+#define NCAP_LUFSTAB_FILE "lufstab"
+
+/** index of the tracks under track_path, see trackidx.h */
+#define NCAP_TRACKIDX_FILE "trackidx"
+
+/** tags and durations of the tracks, see tagcache.h */
+#define NCAP_TAGCACHE_FILE "tagcache"
+
+/** bursts of decoded PCM buffered ahead of playback when streaming */
+#define NCAP_PCMBUF_BURSTS 32
+
+/** bursts queued before a streamed track starts playing */
+#define NCAP_PCMBUF_PREFILL 4
+
 #include "config.h"
 
 extern struct config_t ncap_config;
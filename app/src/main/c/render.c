@@ -7,99 +7,48 @@
 
 #include "audio.h"
 #include "logging.h"
+#include "playctl.h"
+#include "playpos.h"
 #include "render.h"
 #include "strvec.h"
+#include "tagcache.h"
 #include "time.h"
+#include "trackwatch.h"
 
 static const char *FILENAME = "render.c";
 
-pthread_mutex_t render_wclose_mx = PTHREAD_MUTEX_INITIALIZER;
-bool            wclose           = false;
-
-pthread_mutex_t render_ready_mx = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t  render_ready_cv = PTHREAD_COND_INITIALIZER;
-bool            render_ready    = false;
-
-pthread_mutex_t render_atrid_mx = PTHREAD_MUTEX_INITIALIZER;
-int             render_atrid    = -1;
-
 static const int FPS_ACTIVE = 30;
 static const int FPS_STATIC = 10;
 static const int FONTSIZ    = 48;
 static int       fps        = FPS_STATIC;
 
-static const struct timespec retry_ts
-    = { .tv_sec = 0, .tv_nsec = 250000000 }; // 250 ms
-
 static void
 act_wclose (struct obj_t *this)
 {
-    int pth_ret;
-
-    logd ("trylocking render_wclose_mx...");
-
-    if ((pth_ret = pthread_mutex_trylock (&render_wclose_mx)) != 0) {
-        logwf ("WARN: could not lock render_wclose_mx. Error "
-               "code %d: %s",
-               pth_ret, strerror (pth_ret));
-        return;
-    }
-
-    wclose = true;
-
-    pth_ret = pthread_mutex_unlock (&render_wclose_mx);
-    logd ("unlocked render_wclose_mx");
-
-    // signal to interrupt aaudio hang
-
-    logi ("locking audio_mx to wake up aaudio_bind thread...");
-
-    while ((pth_ret = pthread_mutex_lock (&audio_mx)) != 0) {
-        logwf ("WARN: could not lock audio_mx. Error code %d: %s. Retrying...",
-               pth_ret, strerror (pth_ret));
-        nanosleep (&retry_ts, NULL);
-    }
-
-    audio_isplay = true;
-    pth_ret      = pthread_cond_signal (&audio_cv);
-    logdf ("pthread_cond_signal returned error code %d: %s", pth_ret,
-           strerror (pth_ret));
-    pthread_mutex_unlock (&audio_mx);
-    logd ("unlocked audio_mx");
+    // also wakes the audio thread if it is paused
+    playctl_set (PLAYCTL_CLOSE);
+    logi ("set PLAYCTL_CLOSE");
 }
 
 static void
 act_toggleplay (struct obj_t *this)
 {
     logi ("act_toggleplay signaled");
-    logdf ("audio_isplay: %d", audio_isplay);
 
     struct rl_rect_arg_t *const par     = this->params;
     struct rl_text_arg_t *const linkpar = this->link->params;
 
-    int pth_ret;
-    if ((pth_ret = pthread_mutex_trylock (&audio_mx)) != 0) {
-        logwf ("WARN: could not lock audio_mx. Error code %d: %s", pth_ret,
-               strerror (pth_ret));
-        return;
-    }
+    const uint32_t w = playctl_toggle (PLAYCTL_PAUSE);
+
+    logdf ("playctl: %#x", w);
 
-    if (audio_isplay) {
-        audio_isplay = false;
+    if (w & PLAYCTL_PAUSE) {
         memcpy (linkpar->str, " play", 6);
         par->color = DARKGREEN;
     } else {
-        audio_isplay = true;
         memcpy (linkpar->str, "pause", 6);
         par->color = MAROON;
-
-        logi ("signaling audio_cv to resume...");
-        pth_ret = pthread_cond_signal (&audio_cv);
-        logdf ("pthread_cond_signal returned error code %d: %s", pth_ret,
-               strerror (pth_ret));
     }
-
-    pthread_mutex_unlock (&audio_mx);
 }
 
 static void
@@ -118,6 +67,7 @@ act_incvol (struct obj_t *this)
     if (ncap_config.volume <= 90) {
         ncap_config.volume += 10;
         logvf ("setting volume to %d%%", ncap_config.volume);
+        playctl_setvol (ncap_config.volume);
     } else {
         logvf ("volume %d%% cannot be increased. Did nothing",
                ncap_config.volume);
@@ -142,6 +92,7 @@ act_decvol (struct obj_t *this)
     if (ncap_config.volume >= 10) {
         ncap_config.volume -= 10;
         logvf ("setting volume to %d%%", ncap_config.volume);
+        playctl_setvol (ncap_config.volume);
     } else {
         logvf ("volume %d%% cannot be decreased. Did nothing",
                ncap_config.volume);
@@ -419,6 +370,7 @@ struct draw_tracks_params_t {
     const int     pad;
     const int     txtpad;
     const int     fontsiz;
+    const int     durw; // room kept at the right for the duration
     const Vector2 rectpos;
     const Vector2 rectsiz;
 };
@@ -430,6 +382,7 @@ init_draw_tracks_params (int pad, int fontsiz)
         .pad     = pad,
         .txtpad  = fontsiz >> 1,
         .fontsiz = fontsiz,
+        .durw    = MeasureText ("00:00", fontsiz) + (fontsiz >> 1),
         .rectpos = { .x = rectbg.pos.x + pad, .y = rectbg.pos.y + pad },
         .rectsiz = { .x = rectbg.siz.x - (pad << 1), .y = fontsiz + fontsiz },
     };
@@ -437,28 +390,175 @@ init_draw_tracks_params (int pad, int fontsiz)
     return params;
 }
 
+/**
+ * fill the part of the track at rectpos that was played. extrapolated from
+ * the audio thread's last burst, so it moves smoothly whatever the burst size
+ */
 static void
-draw_tracks (const char *const *tracks, const size_t len,
-             const struct draw_tracks_params_t *par)
+draw_progress (int atrid, Vector2 rectpos, Vector2 rectsiz)
 {
-    Vector2 rectpos = par->rectpos;
-    int     pth_ret;
+    struct playpos_t pos;
 
-    if ((pth_ret = pthread_mutex_lock (&render_atrid_mx)) != 0) {
-        logwf ("WARN: could not lock render_atrid_mx. Error code %d: %s",
-               pth_ret, strerror (pth_ret));
+    playpos_load (&pos);
+
+    if (pos.track != atrid || pos.len <= 0)
         return;
-    }
+
+    const int64_t frame = playpos_frame (&pos, playpos_now_ns ());
+    const float   frac  = frame < pos.len ? (float)frame / pos.len : 1;
+    const Vector2 siz   = { rectsiz.x * frac, rectsiz.y };
+
+    DrawRectangleV (rectpos, siz, GOLD);
+}
+
+/**
+ * the tracks on screen: those the audio thread plays until the watcher
+ * publishes a list, then the latest list
+ */
+struct shown_t {
+    struct tracklist_t *tl;    // NULL while showing the audio thread's
+    char              **trunc; // fitted to a track's rectangle
+    size_t              len;
+    int                 atrid; // the track playing, of the audio thread's
+    int                 at;    // where it is shown, -1 if it is not
+};
+
+/** set shown to truncated copies of tracks. @return whether it was */
+static bool
+shown_set (struct shown_t *shown, const char *const *tracks, size_t len,
+           const struct draw_tracks_params_t *par)
+{
+    char **trunc = malloc ((len + 1) * sizeof *trunc);
+
+    if (trunc == NULL)
+        return false;
 
     for (size_t i = 0; i < len; ++i) {
+        const size_t siz = strlen (tracks[i]) + 1;
+
+        // truncpos writes to what it measures, and tracks may be shared
+        if ((trunc[i] = malloc (siz)) == NULL) {
+            while (i > 0)
+                free (trunc[--i]);
+
+            free (trunc);
+            return false;
+        }
+
+        memcpy (trunc[i], tracks[i], siz);
+
+        const size_t pos
+            = truncpos (trunc[i], siz, par->fontsiz,
+                        par->rectsiz.x - (par->txtpad << 1) - par->durw);
+
+        if (pos < siz)
+            trunc[i][pos] = '\0';
+
+        logvf ("truncated track `%s' to `%s'", tracks[i], trunc[i]);
+    }
+
+    for (size_t i = 0; i < shown->len; ++i)
+        free (shown->trunc[i]);
+
+    free (shown->trunc);
+    shown->trunc = trunc;
+    shown->len   = len;
+    shown->atrid = -2; // find the track playing again
+
+    return true;
+}
+
+/** swap in a list the watcher published, and find the track playing */
+static void
+shown_update (struct shown_t *shown, const strvec_t *sv,
+              const struct draw_tracks_params_t *par)
+{
+    const uint64_t gen   = tracklist_gen ();
+    const int      atrid = playctl_track (playctl_load ());
+
+    if (gen != (shown->tl != NULL ? shown->tl->gen : 0)) {
+        struct tracklist_t *tl = tracklist_acquire ();
+
+        if (tl != NULL && shown_set (shown, tl->ptr, tl->len, par)) {
+            tracklist_release (shown->tl);
+            shown->tl = tl;
+        } else {
+            tracklist_release (tl);
+        }
+    }
+
+    if (atrid == shown->atrid)
+        return;
+
+    shown->atrid = atrid;
+    shown->at    = -1;
+
+    if (atrid < 0 || (size_t)atrid >= sv->siz)
+        return;
+
+    if (shown->tl == NULL) {
+        shown->at = atrid;
+        return;
+    }
+
+    // tracks move in the list as others come and go
+    for (size_t i = 0; i < shown->tl->len; ++i)
+        if (strcmp (shown->tl->ptr[i], sv->ptr[atrid]) == 0) {
+            shown->at = (int)i;
+            break;
+        }
+}
+
+static void
+shown_free (struct shown_t *shown)
+{
+    for (size_t i = 0; i < shown->len; ++i)
+        free (shown->trunc[i]);
+
+    free (shown->trunc);
+    tracklist_release (shown->tl);
+    *shown = (struct shown_t){ .atrid = -2, .at = -1 };
+}
+
+/** right-align track i's duration in its rectangle, once it was read */
+static void
+draw_duration (const struct tracklist_t *tl, size_t i, Vector2 rectpos,
+               const struct draw_tracks_params_t *par)
+{
+    struct tagcache_tags_t tags;
+    char                   buf[16];
+
+    if (tl == NULL || !tagcache_get (&tl->tags, i, &tags)
+        || tags.duration_ms == 0)
+        return;
+
+    const uint32_t s = tags.duration_ms / 1000;
+
+    snprintf (buf, sizeof buf, "%u:%02u", s / 60, s % 60);
+    DrawText (buf,
+              rectpos.x + par->rectsiz.x - par->txtpad
+                  - MeasureText (buf, par->fontsiz),
+              rectpos.y + par->txtpad, par->fontsiz, DARKGRAY);
+}
+
+static void
+draw_tracks (const struct shown_t *shown,
+             const struct draw_tracks_params_t *par)
+{
+    Vector2 rectpos = par->rectpos;
+
+    for (size_t i = 0; i < shown->len; ++i) {
         DrawRectangleV (rectpos, par->rectsiz,
-                        i == render_atrid ? YELLOW : WHITE);
-        DrawText (tracks[i], rectpos.x + par->txtpad, rectpos.y + par->txtpad,
-                  par->fontsiz, BLACK);
+                        (int)i == shown->at ? YELLOW : WHITE);
+
+        if ((int)i == shown->at)
+            draw_progress (shown->atrid, rectpos, par->rectsiz);
+
+        DrawText (shown->trunc[i], rectpos.x + par->txtpad,
+                  rectpos.y + par->txtpad, par->fontsiz, BLACK);
+        draw_duration (shown->tl, i, rectpos, par);
         rectpos.y += par->rectsiz.y + par->pad; // par->pad is spacing
     }
-
-    pthread_mutex_unlock (&render_atrid_mx);
 }
 
 void
@@ -476,28 +576,9 @@ render (const strvec_t *sv)
     snprintf (str, sizeof str, "hello from raylib in %d x %d", SCW, SCH);
 
     logdf ("Window dimensions: %d x %d", SCW, SCH);
-    logi ("initialization finished, locking and signaling...");
-
-    int pth_ret;
+    logi ("initialization finished, setting PLAYCTL_READY...");
 
-    if ((pth_ret = pthread_mutex_lock (&render_ready_mx)) != 0) {
-        logwf ("WARN: could not lock render_ready_mx. Error code %d: %s. "
-               "Retrying...",
-               pth_ret, strerror (pth_ret));
-        nanosleep (&retry_ts, NULL);
-    }
-
-    render_ready = true;
-
-    // NOTE: change to broadcast when needed
-    while ((pth_ret = pthread_cond_signal (&render_ready_cv)) != 0) {
-        logwf ("WARN: could not signal render_ready_cv. Error code %d: %s. "
-               "Retrying...",
-               pth_ret, strerror (pth_ret));
-        nanosleep (&retry_ts, NULL);
-    }
-
-    pthread_mutex_unlock (&render_ready_mx);
+    playctl_set (PLAYCTL_READY);
 
     init_objs (SCW, SCH);
 
@@ -509,22 +590,15 @@ render (const strvec_t *sv)
     const struct draw_tracks_params_t draw_tracks_par
         = init_draw_tracks_params (10, FONTSIZ);
 
-    char **tracks_trunc = malloc (sv->siz * sizeof (char *));
-
-    for (size_t i = 0; i < sv->siz; ++i) {
-        const size_t pos = truncpos (
-            sv->ptr[i], strlen (sv->ptr[i]) + 1, draw_tracks_par.fontsiz,
-            draw_tracks_par.rectsiz.x - (draw_tracks_par.txtpad << 1));
-
-        tracks_trunc[i] = malloc (pos + 1);
-        memcpy (tracks_trunc[i], sv->ptr[i], pos);
-        tracks_trunc[i][pos] = '\0';
+    struct shown_t shown = { .atrid = -2, .at = -1 };
 
-        logvf ("truncated track `%s' to `%s'", sv->ptr[i], tracks_trunc[i]);
-    }
+    if (!shown_set (&shown, (const char *const *)sv->ptr, sv->siz,
+                    &draw_tracks_par))
+        loge ("ERROR: could not fit the tracks to the screen");
 
     for (; !WindowShouldClose (); ptouched = touched, ptpos = tpos) {
         touched = GetTouchPointCount ();
+        shown_update (&shown, sv, &draw_tracks_par);
 
         if (!touched && !ptouched) {
             if (fps != FPS_STATIC) {
@@ -539,7 +613,7 @@ render (const strvec_t *sv)
                 for (size_t i = 0; i < objs_len; ++i)
                     draw (&objs[i]);
 
-                draw_tracks (tracks_trunc, sv->siz, &draw_tracks_par);
+                draw_tracks (&shown, &draw_tracks_par);
             }
             EndDrawing ();
             continue;
@@ -570,18 +644,8 @@ render (const strvec_t *sv)
 
         // test window close
 
-        if ((pth_ret = pthread_mutex_trylock (&render_wclose_mx)) != 0) {
-            logwf ("WARN: could not lock render_wclose_mx. Error "
-                   "code %d: %s",
-                   pth_ret, strerror (pth_ret));
-        } else {
-            if (wclose) {
-                pthread_mutex_unlock (&render_wclose_mx);
-                break;
-            }
-
-            pthread_mutex_unlock (&render_wclose_mx);
-        }
+        if (playctl_load () & PLAYCTL_CLOSE)
+            break;
 
         BeginDrawing ();
         {
@@ -598,7 +662,7 @@ render (const strvec_t *sv)
             for (size_t i = 0; i < objs_len; ++i)
                 draw (&objs[i]);
 
-            draw_tracks (tracks_trunc, sv->siz, &draw_tracks_par);
+            draw_tracks (&shown, &draw_tracks_par);
         }
         EndDrawing ();
     }
@@ -606,8 +670,9 @@ render (const strvec_t *sv)
     logi ("Closing raylib window...");
     CloseWindow ();
 
-    logd ("freeing tracks_trunc...");
-    for (size_t i = 0; i < sv->siz; ++i)
-        free (tracks_trunc[i]);
-    free (tracks_trunc);
+    // the window may close without act_wclose, e.g. on back
+    playctl_set (PLAYCTL_CLOSE);
+
+    logd ("freeing the tracks shown...");
+    shown_free (&shown);
 }
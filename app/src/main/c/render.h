@@ -65,16 +65,10 @@ struct obj_t {
     struct obj_t *link;
 };
 
-extern pthread_mutex_t render_wclose_mx;
-extern bool            wclose;
-
-extern pthread_mutex_t render_ready_mx;
-extern pthread_cond_t  render_ready_cv;
-extern bool            render_ready;
-
-extern pthread_mutex_t render_atrid_mx;
-extern int             render_atrid;
-
+/**
+ * sets PLAYCTL_READY once the window is up and PLAYCTL_CLOSE when it closes.
+ * the playing track is read from playctl
+ */
 extern void render (const strvec_t *sv);
 
 #endif // !RENDER_H
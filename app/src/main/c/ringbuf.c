@@ -0,0 +1,150 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio.h"
+#include "ringbuf.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+int
+ringbuf_init (struct ringbuf_t *this, size_t framesiz, size_t burst,
+              size_t nbursts)
+{
+    size_t cap = 1;
+
+    while (cap < burst * nbursts)
+        cap <<= 1;
+
+    // aligned_alloc requires a size that is a multiple of the alignment
+    size_t bytes = cap * framesiz;
+    bytes = (bytes + RINGBUF_CACHELINE - 1) & ~(size_t)(RINGBUF_CACHELINE - 1);
+
+    if ((this->buf = aligned_alloc (RINGBUF_CACHELINE, bytes)) == NULL)
+        return NCAP_EALLOC;
+
+    atomic_init (&this->tail, 0);
+    atomic_init (&this->head, 0);
+    this->head_cache = 0;
+    this->tail_cache = 0;
+    this->cap        = cap;
+    this->framesiz   = framesiz;
+    this->burst      = burst;
+
+    return NCAP_OK;
+}
+
+void
+ringbuf_deinit (struct ringbuf_t *this)
+{
+    free (this->buf);
+    this->buf = NULL;
+}
+
+size_t
+ringbuf_writable (struct ringbuf_t *this)
+{
+    const size_t tail = atomic_load_explicit (&this->tail,
+                                              memory_order_relaxed);
+    this->head_cache  = atomic_load_explicit (&this->head,
+                                              memory_order_acquire);
+
+    return this->cap - (tail - this->head_cache);
+}
+
+size_t
+ringbuf_readable (struct ringbuf_t *this)
+{
+    const size_t head = atomic_load_explicit (&this->head,
+                                              memory_order_relaxed);
+    this->tail_cache  = atomic_load_explicit (&this->tail,
+                                              memory_order_acquire);
+
+    return this->tail_cache - head;
+}
+
+size_t
+ringbuf_write (struct ringbuf_t *this, const void *src, size_t nframes)
+{
+    const size_t tail = atomic_load_explicit (&this->tail,
+                                              memory_order_relaxed);
+
+    if (this->cap - (tail - this->head_cache) < nframes)
+        this->head_cache = atomic_load_explicit (&this->head,
+                                                 memory_order_acquire);
+
+    const size_t n = min (nframes, this->cap - (tail - this->head_cache));
+
+    if (n == 0)
+        return 0;
+
+    // the free region may wrap around the end of buf
+    const size_t pos   = tail & (this->cap - 1);
+    const size_t first = min (n, this->cap - pos);
+
+    memcpy (this->buf + pos * this->framesiz, src, first * this->framesiz);
+    memcpy (this->buf, (const uint8_t *)src + first * this->framesiz,
+            (n - first) * this->framesiz);
+
+    atomic_store_explicit (&this->tail, tail + n, memory_order_release);
+
+    return n;
+}
+
+size_t
+ringbuf_peek (struct ringbuf_t *this, void *dst, size_t nframes)
+{
+    const size_t head = atomic_load_explicit (&this->head,
+                                              memory_order_relaxed);
+
+    if (this->tail_cache - head < nframes)
+        this->tail_cache = atomic_load_explicit (&this->tail,
+                                                 memory_order_acquire);
+
+    const size_t n = min (nframes, this->tail_cache - head);
+
+    if (n == 0)
+        return 0;
+
+    const size_t pos   = head & (this->cap - 1);
+    const size_t first = min (n, this->cap - pos);
+
+    memcpy (dst, this->buf + pos * this->framesiz, first * this->framesiz);
+    memcpy ((uint8_t *)dst + first * this->framesiz, this->buf,
+            (n - first) * this->framesiz);
+
+    return n;
+}
+
+size_t
+ringbuf_read (struct ringbuf_t *this, void *dst, size_t nframes)
+{
+    const size_t head = atomic_load_explicit (&this->head,
+                                              memory_order_relaxed);
+    const size_t n    = ringbuf_peek (this, dst, nframes);
+
+    if (n > 0)
+        atomic_store_explicit (&this->head, head + n, memory_order_release);
+
+    return n;
+}
+
+bool
+ringbuf_read_burst (struct ringbuf_t *this, void *dst)
+{
+    const size_t head = atomic_load_explicit (&this->head,
+                                              memory_order_relaxed);
+
+    if (this->tail_cache - head < this->burst) {
+        this->tail_cache = atomic_load_explicit (&this->tail,
+                                                 memory_order_acquire);
+
+        if (this->tail_cache - head < this->burst)
+            return false;
+    }
+
+    return ringbuf_read (this, dst, this->burst) == this->burst;
+}
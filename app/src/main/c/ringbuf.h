@@ -0,0 +1,77 @@
+#pragma once
+
+#ifndef RINGBUF_H
+#define RINGBUF_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef RINGBUF_CACHELINE
+#define RINGBUF_CACHELINE 64
+#endif
+
+/**
+ * Lock-free single-producer/single-consumer ring of fixed-size PCM frames.
+ *
+ * head and tail are free-running frame counters on separate cache lines; each
+ * side also keeps a cached copy of the other's counter so that it only
+ * touches the shared line when its cached view runs out.
+ */
+struct ringbuf_t {
+    alignas (RINGBUF_CACHELINE) atomic_size_t tail; // frames written
+    size_t head_cache;                              // producer view of head
+
+    alignas (RINGBUF_CACHELINE) atomic_size_t head; // frames read
+    size_t tail_cache;                              // consumer view of tail
+
+    alignas (RINGBUF_CACHELINE) uint8_t *buf;
+    size_t cap;      // frames, power of two
+    size_t framesiz; // bytes per frame
+    size_t burst;    // frames per ringbuf_read_burst
+};
+
+/**
+ * capacity is nbursts * burst frames, rounded up to a power of two
+ *
+ * @return NCAP_OK or NCAP_EALLOC
+ */
+extern int ringbuf_init (struct ringbuf_t *this, size_t framesiz, size_t burst,
+                         size_t nbursts);
+
+extern void ringbuf_deinit (struct ringbuf_t *this);
+
+/**
+ * producer only. never blocks
+ *
+ * @return number of frames written, which may be less than nframes
+ */
+extern size_t ringbuf_write (struct ringbuf_t *this, const void *src,
+                             size_t nframes);
+
+/**
+ * consumer only. never blocks
+ *
+ * @return number of frames read, which may be less than nframes
+ */
+extern size_t ringbuf_read (struct ringbuf_t *this, void *dst, size_t nframes);
+
+/**
+ * consumer only. like ringbuf_read, but leaves the frames queued
+ */
+extern size_t ringbuf_peek (struct ringbuf_t *this, void *dst, size_t nframes);
+
+/**
+ * consumer only. reads exactly one burst, or nothing if less is queued
+ */
+extern bool ringbuf_read_burst (struct ringbuf_t *this, void *dst);
+
+/** consumer only */
+extern size_t ringbuf_readable (struct ringbuf_t *this);
+
+/** producer only */
+extern size_t ringbuf_writable (struct ringbuf_t *this);
+
+#endif // !RINGBUF_H
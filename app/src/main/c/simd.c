@@ -0,0 +1,33 @@
+#include <stdatomic.h>
+
+#include "simd.h"
+
+static atomic_int level_cap = SIMD_V256;
+
+static int
+detect (void)
+{
+#if defined(SIMD_HAS_NEON)
+    return SIMD_V128;
+#elif defined(SIMD_HAS_X86)
+    return __builtin_cpu_supports ("avx2") ? SIMD_V256 : SIMD_V128;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+int
+simd_level (void)
+{
+    const int hw  = detect ();
+    const int cap = atomic_load_explicit (&level_cap, memory_order_relaxed);
+
+    return hw < cap ? hw : cap;
+}
+
+int
+simd_setlevel (int level)
+{
+    atomic_store_explicit (&level_cap, level, memory_order_relaxed);
+    return simd_level ();
+}
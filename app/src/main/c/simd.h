@@ -0,0 +1,37 @@
+#pragma once
+
+#ifndef SIMD_H
+#define SIMD_H
+
+/**
+ * Kernel selection shared by the DSP modules. NEON is assumed wherever the
+ * compiler targets it; on x86 SSE2 is the baseline and AVX2 is detected at
+ * run time, with the AVX2 kernels compiled via SIMD_TARGET_AVX2.
+ */
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SIMD_HAS_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define SIMD_HAS_X86 1
+#include <immintrin.h>
+#define SIMD_TARGET_AVX2 __attribute__ ((target ("avx2")))
+#endif
+
+#define SIMD_SCALAR 0
+#define SIMD_V128   1 // NEON or SSE2
+#define SIMD_V256   2 // AVX2
+
+/** @return the widest kernel set allowed by the CPU and simd_setlevel */
+extern int simd_level (void);
+
+/**
+ * cap the kernel set, e.g. to compare kernels in the tests and benchmarks
+ *
+ * @return the resulting simd_level
+ */
+extern int simd_setlevel (int level);
+
+#endif // !SIMD_H
@@ -0,0 +1,141 @@
+#pragma once
+
+#ifndef SINK_H
+#define SINK_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "audio.h"
+
+/**
+ * fill buf with nframes. called from the sink's real-time thread, so it must
+ * not lock, allocate or do I/O
+ *
+ * @return false once the source is drained; the sink may stop pulling
+ */
+typedef bool (*sink_pull_t) (void *ctx, void *buf, int32_t nframes);
+
+struct sink_t;
+
+/**
+ * Audio output device. A sink is opened once per stream format, either in
+ * push mode (write) or in pull mode (a pull function it calls per burst).
+ * Every op returns NCAP_OK or an NCAP error code unless noted otherwise.
+ */
+struct sink_ops_t {
+    /** @param pull NULL for push mode */
+    int (*open) (struct sink_t *this, const struct cwav_header_t *fmt,
+                 sink_pull_t pull, void *ctx);
+
+    int (*start) (struct sink_t *this);
+
+    /** keep what is buffered and stop consuming it */
+    int (*pause) (struct sink_t *this);
+
+    /** play out what is buffered, then stop */
+    int (*stop) (struct sink_t *this);
+
+    void (*close) (struct sink_t *this);
+
+    /** push mode: block until all of buf is queued */
+    int (*write) (struct sink_t *this, const void *buf, int32_t nframes);
+
+    /** @return frames queued ahead of the listener */
+    int32_t (*latency) (struct sink_t *this);
+
+    /** optional. @return underruns since open */
+    int32_t (*xruns) (struct sink_t *this);
+
+    /** optional. @return the buffer size actually set, in frames */
+    int32_t (*setbuf) (struct sink_t *this, int32_t frames);
+
+    /**
+     * optional. how far the listener is behind the writer, from the device's
+     * presentation timestamp. cheap enough to call per burst, also from the
+     * pull. in the pull, the burst being filled is not counted yet
+     *
+     * @param ahead frames written but not yet heard at t_ns
+     * @param t_ns CLOCK_MONOTONIC
+     * @return NCAP_OK, or NCAP_EGEN while the device has no fresh timestamp
+     */
+    int (*timestamp) (struct sink_t *this, int64_t *ahead, int64_t *t_ns);
+};
+
+struct sink_t {
+    const struct sink_ops_t *ops;
+    const char              *name;
+
+    // valid once open
+    int32_t     burst;     // frames per write or pull
+    int32_t     buf_cap;   // frames
+    int32_t     buf_siz;   // frames
+    atomic_bool isdisconn; // the device went away; close and give up
+};
+
+/** the AAudio output. Android only */
+extern struct sink_t *sink_aaudio (void);
+
+/**
+ * what the AAudio sink negotiated with a device. it asks for the lowest
+ * latency the configured performance mode allows (exclusive, i.e. MMAP,
+ * then shared), then falls back through shared and power saving mode
+ */
+struct aaudio_grant_t {
+    int32_t devid;
+    int32_t pm;         // aaudio_performance_mode_t granted
+    int32_t sharing;    // aaudio_sharing_mode_t granted
+    int32_t burst;      // frames
+    int64_t latency_ns; // measured once running. -1 until then
+    uint8_t start;      // first rung for the configured mode
+    uint8_t tier;       // rung granted. opens on this device start here
+};
+
+/**
+ * what the last opened device granted, for the configured mode
+ *
+ * @return NCAP_OK, or NCAP_EGEN if no stream was opened on it yet
+ */
+extern int sink_aaudio_grant (struct aaudio_grant_t *grant);
+
+/**
+ * host sinks, run on a clock of their own: the null sink consumes frames at
+ * the stream's nominal rate and drops them, the file sink writes a WAV file.
+ * in push mode the file sink takes frames as fast as they come; in pull mode
+ * it pulls at speed times the nominal rate, since it cannot tell a source
+ * that is behind from one that is silent
+ */
+struct sink_host_t {
+    struct sink_t base;
+
+    const char          *fn; // NULL for the null sink
+    FILE                *fp;
+    struct cwav_header_t header;
+    size_t               framesiz;
+    uint8_t             *blk; // one burst, for pull mode
+
+    sink_pull_t pull;
+    void       *ctx;
+    pthread_t   tid;
+    atomic_int  state; // SINK_HOST_*
+    bool        isthread;
+    int32_t     speed; // clock rate in stream rates. 0: pull unpaced
+
+    // the clock. position = pos0 + elapsed since t0 while running
+    pthread_mutex_t mx;
+    int64_t         written; // frames
+    int64_t         pos0;    // frames
+    struct timespec t0;
+    int32_t         nxrun;
+};
+
+extern void sink_null_init (struct sink_host_t *this, int32_t burst);
+
+/** @param speed see sink_host_t.speed. 0 to pull as fast as possible */
+extern void sink_file_init (struct sink_host_t *this, const char *fn,
+                            int32_t burst, int32_t speed);
+
+#endif // !SINK_H
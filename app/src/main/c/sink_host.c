@@ -0,0 +1,415 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "audio.h"
+#include "logging.h"
+#include "sink.h"
+
+static const char *FILENAME = "sink_host.c";
+
+#define SINK_HOST_STOPPED 0
+#define SINK_HOST_RUNNING 1
+#define SINK_HOST_PAUSED  2
+#define SINK_HOST_EXIT    3 // pull thread: return
+
+// device buffer of the null sink, in bursts
+#define NULL_BUF_BURSTS 2
+#define NULL_CAP_BURSTS 16
+
+static int64_t
+ts_ns (const struct timespec *ts)
+{
+    return ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+static void
+sleep_ns (int64_t ns)
+{
+    const struct timespec ts = { .tv_sec  = ns / 1000000000LL,
+                                 .tv_nsec = ns % 1000000000LL };
+    nanosleep (&ts, NULL);
+}
+
+/** frames per second the clock runs at */
+static int64_t
+rate (const struct sink_host_t *this)
+{
+    return (int64_t)this->header.fmt.nSamplesPerSec * this->speed;
+}
+
+/**
+ * frames the listener has consumed. call with mx held. may run past written
+ * when the producer falls behind
+ */
+static int64_t
+position (struct sink_host_t *this)
+{
+    struct timespec now;
+
+    if (this->fn != NULL)
+        return this->written; // a file takes everything at once
+
+    if (atomic_load (&this->state) != SINK_HOST_RUNNING)
+        return this->pos0;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+
+    return this->pos0
+           + (ts_ns (&now) - ts_ns (&this->t0)) * rate (this) / 1000000000LL;
+}
+
+static void *
+tfn_pull (void *args)
+{
+    struct sink_host_t *this     = args;
+    const int32_t       burst    = this->base.burst;
+    int64_t             burst_ns = 0; // unpaced
+    bool                isactive = true;
+    struct timespec     next;
+    int                 state;
+
+    if (this->speed > 0)
+        burst_ns = burst * 1000000000LL / rate (this);
+
+    clock_gettime (CLOCK_MONOTONIC, &next);
+
+    while ((state = atomic_load (&this->state)) != SINK_HOST_EXIT) {
+        if (state != SINK_HOST_RUNNING || !isactive) {
+            sleep_ns (1000000); // 1 ms
+            clock_gettime (CLOCK_MONOTONIC, &next);
+            continue;
+        }
+
+        isactive = this->pull (this->ctx, this->blk, burst);
+
+        if (this->fp != NULL
+            && fwrite (this->blk, this->framesiz, burst, this->fp)
+                   != (size_t)burst) {
+            logef ("ERROR: writing `%s' failed: %s", this->fn,
+                   strerror (errno));
+            atomic_store (&this->base.isdisconn, true);
+            isactive = false;
+        }
+
+        pthread_mutex_lock (&this->mx);
+        this->written += burst;
+        pthread_mutex_unlock (&this->mx);
+
+        if (burst_ns > 0) {
+            const int64_t t = ts_ns (&next) + burst_ns;
+            next.tv_sec     = t / 1000000000LL;
+            next.tv_nsec    = t % 1000000000LL;
+            clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        } else {
+            sched_yield (); // let the producer run, even on a single core
+        }
+    }
+
+    return NULL;
+}
+
+static int
+host_open (struct sink_t *base, const struct cwav_header_t *fmt,
+           sink_pull_t pull, void *ctx)
+{
+    struct sink_host_t *this = (struct sink_host_t *)base;
+
+    this->header   = *fmt;
+    this->framesiz = fmt->fmt.nBlockAlign;
+    this->pull     = pull;
+    this->ctx      = ctx;
+    this->written  = 0;
+    this->pos0     = 0;
+    this->nxrun    = 0;
+    this->isthread = false;
+    atomic_store (&this->state, SINK_HOST_STOPPED);
+    atomic_store (&base->isdisconn, false);
+
+    if (this->framesiz == 0 || fmt->fmt.nSamplesPerSec == 0) {
+        loge ("ERROR: sink opened without a format");
+        return NCAP_EGEN;
+    }
+
+    if (this->fn != NULL) {
+        if ((this->fp = fopen (this->fn, "wb")) == NULL
+            || fseek (this->fp, CWAV_HEADER_SIZ, SEEK_SET) != 0) {
+            logef ("ERROR: fopen `%s' failed for wb: %s", this->fn,
+                   strerror (errno));
+            goto err;
+        }
+    }
+
+    if (pull != NULL
+        && (this->blk = malloc (this->framesiz * base->burst)) == NULL) {
+        loge ("ERROR: malloc of the pull block failed");
+        goto err;
+    }
+
+    return NCAP_OK;
+
+err:
+    if (this->fp != NULL)
+        fclose (this->fp);
+
+    this->fp = NULL;
+    return NCAP_EIO;
+}
+
+static int
+host_start (struct sink_t *base)
+{
+    struct sink_host_t *this = (struct sink_host_t *)base;
+
+    pthread_mutex_lock (&this->mx);
+
+    if (atomic_load (&this->state) != SINK_HOST_RUNNING) {
+        clock_gettime (CLOCK_MONOTONIC, &this->t0);
+        atomic_store (&this->state, SINK_HOST_RUNNING);
+    }
+
+    pthread_mutex_unlock (&this->mx);
+
+    if (this->pull != NULL && !this->isthread) {
+        if (pthread_create (&this->tid, NULL, tfn_pull, this) != 0) {
+            loge ("ERROR: pthread_create of the pull thread failed");
+            return NCAP_EGEN;
+        }
+
+        this->isthread = true;
+    }
+
+    return NCAP_OK;
+}
+
+static int
+host_pause (struct sink_t *base)
+{
+    struct sink_host_t *this = (struct sink_host_t *)base;
+
+    pthread_mutex_lock (&this->mx);
+
+    const int64_t pos = position (this);
+    this->pos0        = pos < this->written ? pos : this->written;
+    atomic_store (&this->state, SINK_HOST_PAUSED);
+
+    pthread_mutex_unlock (&this->mx);
+
+    return NCAP_OK;
+}
+
+static int
+host_stop (struct sink_t *base)
+{
+    struct sink_host_t *this = (struct sink_host_t *)base;
+
+    if (this->isthread) {
+        atomic_store (&this->state, SINK_HOST_EXIT);
+        pthread_join (this->tid, NULL);
+        this->isthread = false;
+    }
+
+    // push mode: let the clock catch up with what was written
+    for (;;) {
+        pthread_mutex_lock (&this->mx);
+
+        const int64_t left = this->written - position (this);
+        const bool    isrun
+            = atomic_load (&this->state) == SINK_HOST_RUNNING;
+
+        if (left <= 0 || !isrun) {
+            this->pos0 = this->written;
+            atomic_store (&this->state, SINK_HOST_STOPPED);
+            pthread_mutex_unlock (&this->mx);
+            break;
+        }
+
+        pthread_mutex_unlock (&this->mx);
+
+        sleep_ns (left * 1000000000LL / rate (this));
+    }
+
+    return NCAP_OK;
+}
+
+static void
+host_close (struct sink_t *base)
+{
+    struct sink_host_t *this = (struct sink_host_t *)base;
+
+    if (this->isthread)
+        host_stop (base);
+
+    if (this->fp != NULL) {
+        const uint32_t datasiz = this->written * this->framesiz;
+
+        this->header.riff.cksize = datasiz + CWAV_HEADER_SIZ - 8;
+        this->header.data.cksize = datasiz;
+
+        fseek (this->fp, 0, SEEK_SET);
+        fwrite (&this->header, CWAV_HEADER_SIZ, 1, this->fp);
+        fclose (this->fp);
+        this->fp = NULL;
+    }
+
+    free (this->blk);
+    this->blk = NULL;
+}
+
+static int
+host_write (struct sink_t *base, const void *buf, int32_t nframes)
+{
+    struct sink_host_t *this = (struct sink_host_t *)base;
+
+    if (this->fp != NULL) {
+        if (fwrite (buf, this->framesiz, nframes, this->fp)
+            != (size_t)nframes) {
+            logef ("ERROR: writing `%s' failed: %s", this->fn,
+                   strerror (errno));
+            return NCAP_EIO;
+        }
+
+        pthread_mutex_lock (&this->mx);
+        this->written += nframes;
+        pthread_mutex_unlock (&this->mx);
+
+        return NCAP_OK;
+    }
+
+    for (;;) {
+        pthread_mutex_lock (&this->mx);
+
+        const int64_t pos = position (this);
+
+        // ran dry: the listener heard silence, so the queue restarts here
+        if (pos > this->written) {
+            ++this->nxrun;
+            this->written = pos;
+        }
+
+        const int64_t room = base->buf_siz - (this->written - pos);
+
+        if (room >= nframes) {
+            this->written += nframes;
+            pthread_mutex_unlock (&this->mx);
+            return NCAP_OK;
+        }
+
+        const bool isrun = atomic_load (&this->state) == SINK_HOST_RUNNING;
+
+        pthread_mutex_unlock (&this->mx);
+
+        if (!isrun) {
+            loge ("ERROR: write to a full sink that is not started");
+            return NCAP_EGEN;
+        }
+
+        sleep_ns ((nframes - room) * 1000000000LL / rate (this));
+    }
+}
+
+static int32_t
+host_latency (struct sink_t *base)
+{
+    struct sink_host_t *this = (struct sink_host_t *)base;
+
+    pthread_mutex_lock (&this->mx);
+    const int64_t queued = this->written - position (this);
+    pthread_mutex_unlock (&this->mx);
+
+    return queued > 0 ? queued : 0;
+}
+
+static int32_t
+host_xruns (struct sink_t *base)
+{
+    struct sink_host_t *this = (struct sink_host_t *)base;
+
+    pthread_mutex_lock (&this->mx);
+    const int32_t n = this->nxrun;
+    pthread_mutex_unlock (&this->mx);
+
+    return n;
+}
+
+static int
+host_timestamp (struct sink_t *base, int64_t *ahead, int64_t *t_ns)
+{
+    struct sink_host_t *this = (struct sink_host_t *)base;
+    struct timespec     now;
+
+    pthread_mutex_lock (&this->mx);
+    const int64_t queued = this->written - position (this);
+    pthread_mutex_unlock (&this->mx);
+
+    // the clock is exact, so now is as good as any presentation time
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    *ahead = queued > 0 ? queued : 0;
+    *t_ns  = ts_ns (&now);
+
+    return NCAP_OK;
+}
+
+static int32_t
+host_setbuf (struct sink_t *base, int32_t frames)
+{
+    if (frames > base->buf_cap)
+        frames = base->buf_cap;
+
+    if (frames < base->burst)
+        frames = base->burst;
+
+    return base->buf_siz = frames;
+}
+
+static const struct sink_ops_t host_ops = {
+    .open      = host_open,
+    .start     = host_start,
+    .pause     = host_pause,
+    .stop      = host_stop,
+    .close     = host_close,
+    .write     = host_write,
+    .latency   = host_latency,
+    .xruns     = host_xruns,
+    .setbuf    = host_setbuf,
+    .timestamp = host_timestamp,
+};
+
+static void
+init (struct sink_host_t *this, const char *name, const char *fn,
+      int32_t burst, int32_t speed, int32_t nbuf, int32_t ncap)
+{
+    memset (this, 0, sizeof *this);
+
+    this->base.ops     = &host_ops;
+    this->base.name    = name;
+    this->base.burst   = burst;
+    this->base.buf_siz = burst * nbuf;
+    this->base.buf_cap = burst * ncap;
+    this->fn           = fn;
+    this->speed        = speed;
+
+    pthread_mutex_init (&this->mx, NULL);
+    atomic_init (&this->state, SINK_HOST_STOPPED);
+    atomic_init (&this->base.isdisconn, false);
+}
+
+void
+sink_null_init (struct sink_host_t *this, int32_t burst)
+{
+    init (this, "null", NULL, burst, 1, NULL_BUF_BURSTS, NULL_CAP_BURSTS);
+}
+
+void
+sink_file_init (struct sink_host_t *this, const char *fn, int32_t burst,
+                int32_t speed)
+{
+    init (this, "file", fn, burst, speed, 1, 1);
+}
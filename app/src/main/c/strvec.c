@@ -5,58 +5,143 @@
 
 #include "strvec.h"
 
-#define bytecap(this) (this->cap * sizeof (char *))
+struct strvec_blk_t {
+    struct strvec_blk_t *next; // the block before
+    size_t               cap;
+    size_t               len;
+    char                 buf[];
+};
 
-#define expand(this)                                                          \
-    do {                                                                      \
-        this->cap <<= 1;                                                      \
-        this->ptr = realloc (this->ptr, bytecap (this));                      \
-    } while (0);
+static int
+resize (strvec_t *this, size_t cap)
+{
+    char **p = realloc (this->ptr, cap * sizeof *p);
+
+    if (p == NULL)
+        return STRQUEUE_ENULL;
 
-#define shrink(this)                                                          \
-    do {                                                                      \
-        this->cap >>= 1;                                                      \
-        this->ptr = realloc (this->ptr, bytecap (this));                      \
-    } while (0);
+    this->ptr = p;
+    this->cap = cap;
+    return STRQUEUE_OK;
+}
+
+/** make sure the newest block has siz bytes free, adding one if not */
+static int
+room (strvec_t *this, size_t siz)
+{
+    struct strvec_blk_t *blk = this->blk;
+
+    if (blk != NULL && blk->cap - blk->len >= siz)
+        return STRQUEUE_OK;
+
+    const size_t cap = siz > STRVEC_BLK_SIZ ? siz : STRVEC_BLK_SIZ;
+
+    if ((blk = malloc (sizeof *blk + cap)) == NULL)
+        return STRQUEUE_ENULL;
+
+    blk->next = this->blk;
+    blk->cap  = cap;
+    blk->len  = 0;
+    this->blk = blk;
+    return STRQUEUE_OK;
+}
+
+/** take siz bytes that room made sure of */
+static char *
+take (strvec_t *this, size_t siz)
+{
+    char *p = this->blk->buf + this->blk->len;
+
+    this->blk->len += siz;
+    return p;
+}
 
 int
 strvec_init (strvec_t *this)
 {
-    this->cap = 1;
+    this->cap = STRVEC_MIN_CAP;
     this->siz = 0;
-    this->ptr = malloc (sizeof (char *));
+    this->ptr = malloc (STRVEC_MIN_CAP * sizeof (char *));
+    this->blk = NULL;
     return this->ptr == NULL ? STRQUEUE_ENULL : STRQUEUE_OK;
 }
 
 void
 strvec_deinit (strvec_t *this)
 {
-    while (this->siz)
-        free (this->ptr[--this->siz]);
+    while (this->blk != NULL) {
+        struct strvec_blk_t *next = this->blk->next;
+
+        free (this->blk);
+        this->blk = next;
+    }
 
     free (this->ptr);
+    this->ptr = NULL;
+    this->cap = 0;
+    this->siz = 0;
+}
+
+int
+strvec_reserve (strvec_t *this, size_t n, size_t nbytes)
+{
+    size_t cap = this->cap > 0 ? this->cap : STRVEC_MIN_CAP;
+
+    while (cap < this->siz + n)
+        cap <<= 1;
+
+    if (cap != this->cap && resize (this, cap) != STRQUEUE_OK)
+        return STRQUEUE_ENULL;
+
+    return nbytes > 0 ? room (this, nbytes) : STRQUEUE_OK;
 }
 
 int
 strvec_pushb (strvec_t *this, const char *restrict str, size_t len)
 {
-    if (this->siz == this->cap)
-        expand (this);
+    if (strvec_reserve (this, 1, len + 1) != STRQUEUE_OK)
+        return STRQUEUE_ENULL;
 
-    char *p = this->ptr[this->siz++] = malloc (len + 1);
+    char *p = this->ptr[this->siz++] = take (this, len + 1);
 
-    if (p == NULL)
+    memcpy (p, str, len);
+    p[len] = '\0';
+    return STRQUEUE_OK;
+}
+
+int
+strvec_pushn (strvec_t *this, const char *restrict buf, size_t siz,
+              size_t n)
+{
+    if (n == 0)
+        return STRQUEUE_OK;
+
+    if (strvec_reserve (this, n, siz) != STRQUEUE_OK)
         return STRQUEUE_ENULL;
 
-    memcpy (p, str, len + 1);
+    char *p = take (this, siz);
+
+    memcpy (p, buf, siz);
+
+    for (size_t i = 0; i < n; ++i) {
+        this->ptr[this->siz++] = p;
+        p += strlen (p) + 1;
+    }
+
     return STRQUEUE_OK;
 }
 
 void
 strvec_popb (strvec_t *this)
 {
-    free (this->ptr[--this->siz]);
+    struct strvec_blk_t *blk = this->blk;
+    const char          *str = this->ptr[--this->siz];
+    const size_t         siz = strlen (str) + 1;
+
+    if (blk != NULL && blk->len >= siz && blk->buf + blk->len - siz == str)
+        blk->len -= siz;
 
-    if (this->cap >= this->siz << 1)
-        shrink (this)
+    // halving at a quarter full leaves room to push as much back
+    if (this->cap > STRVEC_MIN_CAP && this->siz <= this->cap >> 2)
+        resize (this, this->cap >> 1);
 }
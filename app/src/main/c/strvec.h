@@ -5,10 +5,24 @@
 
 #include <stddef.h>
 
+/**
+ * Strings are copied into an arena: a chain of blocks that are never moved,
+ * so ptr stays valid as the vector grows and callers may reorder it. Pushing
+ * a string allocates only when a block fills, and teardown frees the blocks,
+ * not each string.
+ */
+
+#define STRVEC_BLK_SIZ 65536 // bytes per arena block, more for a long string
+#define STRVEC_MIN_CAP 16
+
+struct strvec_blk_t;
+
 typedef struct strvec_struct {
     size_t cap;
     size_t siz;
     char **ptr;
+
+    struct strvec_blk_t *blk; // the newest block of the arena
 } strvec_t;
 
 #define STRQUEUE_OK    0
@@ -20,8 +34,26 @@ extern int strvec_init (strvec_t *this);
 
 extern void strvec_deinit (strvec_t *this);
 
+/**
+ * make room for n more strings of nbytes in all, NULs included, so that
+ * pushing them allocates nothing
+ */
+extern int strvec_reserve (strvec_t *this, size_t n, size_t nbytes);
+
+/** push a copy of str's first len bytes. str need not be NUL terminated */
 extern int strvec_pushb (strvec_t *this, const char *str, size_t len);
 
+/**
+ * push the n NUL terminated strings laid end to end in buf, siz bytes in
+ * all, with one copy. nothing is pushed on error
+ */
+extern int strvec_pushn (strvec_t *this, const char *buf, size_t siz,
+                         size_t n);
+
+/**
+ * the last string's bytes are reused if it was the last pushed. the pointer
+ * array shrinks only once a quarter full
+ */
 extern void strvec_popb (strvec_t *this);
 
 /**
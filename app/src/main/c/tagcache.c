@@ -0,0 +1,838 @@
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio.h"
+#include "logging.h"
+#include "strvec.h"
+#include "tagcache.h"
+#include "trackidx.h"
+#include "trackwatch.h"
+
+static const char *FILENAME = "tagcache.c";
+
+#define MAGIC   "NCTG"
+#define VERSION 1
+
+#define MAX_THREADS 16
+#define MIN_SLOTS   1024
+
+#define NONE UINT32_MAX
+
+/**
+ * the file: the header, then each column whole, widest first, then the
+ * strings the columns point at, NUL separated and in id order
+ */
+struct header_t {
+    char     magic[4];
+    uint32_t version;
+    uint32_t nrows;
+    uint32_t nstrs;
+    uint32_t strs_siz;
+    uint32_t reserved;
+};
+
+_Static_assert (sizeof (struct header_t) == 24, "the header is padded");
+
+// bytes a row takes in the file
+#define ROW_SIZ (2 * sizeof (int64_t) + 7 * sizeof (uint32_t))
+
+/** the cache. rows are keyed by path, strings are ids into strs */
+struct store_t {
+    strvec_t  strs; // id 0 is ""
+    uint32_t *str_slots; // open addressing: id + 1, or 0 if free
+    size_t    str_nslots;
+
+    size_t    nrows;
+    size_t    cap;
+    uint32_t *path;
+    int64_t  *size;
+    int64_t  *mtime_ns;
+    uint32_t *duration_ms;
+    uint32_t *trackno;
+    uint32_t *codec;
+    uint32_t *title;
+    uint32_t *artist;
+    uint32_t *album;
+    bool     *isused; // looked up this run. only those are written
+    uint32_t *row_slots; // by path id: row + 1, or 0 if free
+    size_t    row_nslots;
+
+    bool isinit;
+    bool isdirty;
+};
+
+static pthread_mutex_t store_mx = PTHREAD_MUTEX_INITIALIZER;
+static struct store_t  store;
+
+// the strings
+
+static uint64_t
+hash_str (const char *s)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (; *s != '\0'; ++s) {
+        h ^= (unsigned char)*s;
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+/** call with store_mx held. @return the slot of s, free if not interned */
+static size_t
+str_slot (const char *s)
+{
+    const size_t mask = store.str_nslots - 1;
+    size_t       i    = hash_str (s) & mask;
+
+    while (store.str_slots[i] != 0
+           && strcmp (store.strs.ptr[store.str_slots[i] - 1], s) != 0)
+        i = (i + 1) & mask;
+
+    return i;
+}
+
+/** call with store_mx held. @return the id of s, or NONE */
+static uint32_t
+find_str (const char *s)
+{
+    if (store.str_nslots == 0)
+        return NONE;
+
+    const uint32_t slot = store.str_slots[str_slot (s)];
+
+    return slot != 0 ? slot - 1 : NONE;
+}
+
+/** call with store_mx held */
+static bool
+grow_strs (void)
+{
+    const size_t nslots
+        = store.str_nslots > 0 ? store.str_nslots << 1 : MIN_SLOTS;
+    uint32_t *slots = calloc (nslots, sizeof *slots);
+
+    if (slots == NULL)
+        return false;
+
+    free (store.str_slots);
+    store.str_slots  = slots;
+    store.str_nslots = nslots;
+
+    for (uint32_t id = 0; id < store.strs.siz; ++id)
+        store.str_slots[str_slot (store.strs.ptr[id])] = id + 1;
+
+    return true;
+}
+
+/** call with store_mx held. @return the id of s, added if new, or NONE */
+static uint32_t
+intern (const char *s)
+{
+    if (store.strs.siz * 2 >= store.str_nslots && !grow_strs ())
+        return NONE;
+
+    const size_t i = str_slot (s);
+
+    if (store.str_slots[i] != 0)
+        return store.str_slots[i] - 1;
+
+    if (store.strs.siz >= NONE - 1
+        || strvec_pushb (&store.strs, s, strlen (s)) != STRQUEUE_OK)
+        return NONE;
+
+    store.str_slots[i] = (uint32_t)store.strs.siz;
+
+    return (uint32_t)store.strs.siz - 1;
+}
+
+/** call with store_mx held. interned strings never move */
+static inline const char *
+str_of (uint32_t id)
+{
+    return store.strs.ptr[id];
+}
+
+// the rows
+
+/** call with store_mx held. @return the slot of path, free if no row */
+static size_t
+row_slot (uint32_t path)
+{
+    const size_t mask = store.row_nslots - 1;
+    size_t       i    = ((uint64_t)path * 0x9e3779b97f4a7c15ULL >> 32) & mask;
+
+    while (store.row_slots[i] != 0
+           && store.path[store.row_slots[i] - 1] != path)
+        i = (i + 1) & mask;
+
+    return i;
+}
+
+/** call with store_mx held. @return the row of path, or NONE */
+static uint32_t
+find_row (const char *path)
+{
+    const uint32_t id = find_str (path);
+
+    if (id == NONE || store.row_nslots == 0)
+        return NONE;
+
+    const uint32_t slot = store.row_slots[row_slot (id)];
+
+    return slot != 0 ? slot - 1 : NONE;
+}
+
+/** call with store_mx held. index rows 0 to nrows - 1 again */
+static bool
+rehash_rows (size_t nslots)
+{
+    uint32_t *slots = calloc (nslots, sizeof *slots);
+
+    if (slots == NULL)
+        return false;
+
+    free (store.row_slots);
+    store.row_slots  = slots;
+    store.row_nslots = nslots;
+
+    for (uint32_t r = 0; r < store.nrows; ++r)
+        store.row_slots[row_slot (store.path[r])] = r + 1;
+
+    return true;
+}
+
+#define COLUMNS(X)                                                            \
+    X (path)                                                                  \
+    X (size)                                                                  \
+    X (mtime_ns)                                                              \
+    X (duration_ms)                                                           \
+    X (trackno)                                                               \
+    X (codec)                                                                 \
+    X (title)                                                                 \
+    X (artist)                                                                \
+    X (album)                                                                 \
+    X (isused)
+
+/** call with store_mx held */
+static bool
+grow_rows (void)
+{
+    const size_t cap = store.cap > 0 ? store.cap << 1 : MIN_SLOTS;
+
+    // a column that grew stays grown; cap only counts once all did
+#define GROW(col)                                                             \
+    {                                                                         \
+        void *p = realloc (store.col, cap * sizeof *store.col);               \
+                                                                              \
+        if (p == NULL)                                                        \
+            return false;                                                     \
+                                                                              \
+        store.col = p;                                                        \
+    }
+
+    COLUMNS (GROW)
+
+#undef GROW
+
+    store.cap = cap;
+
+    return true;
+}
+
+/** call with store_mx held. @return the row of path, added if new, or NONE */
+static uint32_t
+add_row (uint32_t path)
+{
+    if (store.nrows == store.cap && !grow_rows ())
+        return NONE;
+
+    if (store.nrows * 2 >= store.row_nslots
+        && !rehash_rows (store.row_nslots > 0 ? store.row_nslots << 1
+                                              : MIN_SLOTS))
+        return NONE;
+
+    const size_t i = row_slot (path);
+
+    if (store.row_slots[i] != 0)
+        return store.row_slots[i] - 1;
+
+    const uint32_t r = (uint32_t)store.nrows++;
+
+    store.row_slots[i] = r + 1;
+    store.path[r]      = path;
+    store.isused[r]    = true;
+
+    return r;
+}
+
+/**
+ * call with store_mx held. set path's row from meta
+ *
+ * @return the row, or NONE
+ */
+static uint32_t
+put (const char *path, int64_t size, int64_t mtime_ns,
+     const struct tagcache_meta_t *meta)
+{
+    const uint32_t id     = intern (path);
+    const uint32_t title  = intern (meta->title);
+    const uint32_t artist = intern (meta->artist);
+    const uint32_t album  = intern (meta->album);
+    uint32_t       r;
+
+    if (id == NONE || title == NONE || artist == NONE || album == NONE
+        || (r = add_row (id)) == NONE) {
+        loge ("ERROR: malloc for the tag cache failed");
+        return NONE;
+    }
+
+    store.size[r]        = size;
+    store.mtime_ns[r]    = mtime_ns;
+    store.duration_ms[r] = meta->duration_ms;
+    store.trackno[r]     = meta->trackno;
+    store.codec[r]       = meta->codec;
+    store.title[r]       = title;
+    store.artist[r]      = artist;
+    store.album[r]       = album;
+    store.isused[r]      = true;
+    store.isdirty        = true;
+
+    return r;
+}
+
+/** call with store_mx held. drop the rows not used this run */
+static void
+compact (void)
+{
+    uint32_t *slots;
+    size_t    n = 0;
+
+    for (size_t r = 0; r < store.nrows; ++r)
+        n += store.isused[r];
+
+    if (n == store.nrows
+        || (slots = calloc (store.row_nslots, sizeof *slots)) == NULL)
+        return;
+
+    logif ("dropping %zu tracks gone from the tag cache", store.nrows - n);
+    n = 0;
+
+    for (size_t r = 0; r < store.nrows; ++r) {
+        if (!store.isused[r])
+            continue;
+
+#define MOVE(col) store.col[n] = store.col[r];
+        COLUMNS (MOVE)
+#undef MOVE
+
+        ++n;
+    }
+
+    free (store.row_slots);
+    store.row_slots = slots;
+    store.nrows     = n;
+
+    for (uint32_t r = 0; r < store.nrows; ++r)
+        store.row_slots[row_slot (store.path[r])] = r + 1;
+}
+
+// the file
+
+/** call with store_mx held. @return whether the store is ready */
+static bool
+store_init (void)
+{
+    if (store.isinit)
+        return true;
+
+    if (strvec_init (&store.strs) != STRQUEUE_OK)
+        return false;
+
+    store.isinit = true;
+
+    if (intern ("") != 0) {
+        strvec_deinit (&store.strs);
+        store.isinit = false;
+        return false;
+    }
+
+    return true;
+}
+
+/** call with store_mx held */
+static void
+store_deinit (void)
+{
+    if (store.isinit)
+        strvec_deinit (&store.strs);
+
+#define FREE(col) free (store.col);
+    COLUMNS (FREE)
+#undef FREE
+
+    free (store.str_slots);
+    free (store.row_slots);
+    store = (struct store_t){ 0 };
+}
+
+/** call with store_mx held. @return rows read */
+static size_t
+load (const char *fn)
+{
+    FILE           *in = fopen (fn, "rb");
+    struct header_t header;
+    char           *buf  = NULL;
+    const char    **strs = NULL;
+    size_t          siz, nrows = 0;
+
+    if (in == NULL)
+        return 0;
+
+    if (fread (&header, sizeof header, 1, in) != 1
+        || memcmp (header.magic, MAGIC, 4) != 0 || header.version != VERSION
+        || header.nstrs == 0 || header.strs_siz == 0) {
+        logwf ("WARN: `%s' is not a tag cache. replacing it", fn);
+        goto exit;
+    }
+
+    siz = (size_t)header.nrows * ROW_SIZ + header.strs_siz;
+
+    if ((buf = malloc (siz)) == NULL
+        || (strs = malloc (header.nstrs * sizeof *strs)) == NULL) {
+        loge ("ERROR: malloc for loading the tag cache failed");
+        goto exit;
+    }
+
+    if (fread (buf, 1, siz, in) != siz || buf[siz - 1] != '\0') {
+        logwf ("WARN: `%s' is cut short. replacing it", fn);
+        goto exit;
+    }
+
+    // the columns, as save writes them
+    const size_t    n   = header.nrows;
+    const int64_t  *sz  = (const int64_t *)buf;
+    const int64_t  *mt  = sz + n;
+    const uint32_t *col = (const uint32_t *)(mt + n);
+    const uint32_t *pth = col, *dur = col + n, *tno = col + 2 * n,
+                   *cdc = col + 3 * n, *ids = col + 4 * n;
+    const char     *p   = buf + n * ROW_SIZ;
+    const char     *end = buf + siz;
+
+    for (uint32_t i = 0; i < header.nstrs; ++i) {
+        if (p >= end) {
+            logwf ("WARN: `%s' has too few strings. replacing it", fn);
+            goto exit;
+        }
+
+        strs[i] = p;
+        p += strlen (p) + 1;
+    }
+
+    // strings no row points at anymore are left behind
+    for (size_t r = 0; r < n; ++r) {
+        struct tagcache_meta_t meta = {
+            .duration_ms = dur[r],
+            .trackno     = tno[r],
+            .codec       = cdc[r],
+        };
+        const uint32_t tags[3] = { ids[r], ids[n + r], ids[2 * n + r] };
+        char          *dst[3]  = { meta.title, meta.artist, meta.album };
+        uint32_t       row;
+
+        if (pth[r] >= header.nstrs || tags[0] >= header.nstrs
+            || tags[1] >= header.nstrs || tags[2] >= header.nstrs)
+            continue;
+
+        for (int t = 0; t < 3; ++t)
+            snprintf (dst[t], TAGCACHE_TAG_SIZ, "%s", strs[tags[t]]);
+
+        if ((row = put (strs[pth[r]], sz[r], mt[r], &meta)) == NONE)
+            break;
+
+        store.isused[row] = false;
+        ++nrows;
+    }
+
+    store.isdirty = false;
+
+exit:
+    free (strs);
+    free (buf);
+    fclose (in);
+
+    return nrows;
+}
+
+/** call with store_mx held. write the cache whole, then move it into place */
+static int
+save (const char *fn)
+{
+    struct header_t header = {
+        .magic   = MAGIC,
+        .version = VERSION,
+        .nstrs   = (uint32_t)store.strs.siz,
+    };
+    char  tmp[PATH_MAX];
+    FILE *out;
+    bool  ok;
+
+    compact ();
+    header.nrows = (uint32_t)store.nrows;
+
+    for (size_t id = 0; id < store.strs.siz; ++id)
+        header.strs_siz += (uint32_t)strlen (str_of ((uint32_t)id)) + 1;
+
+    snprintf (tmp, sizeof tmp, "%s.tmp", fn);
+
+    if ((out = fopen (tmp, "wb")) == NULL) {
+        logef ("ERROR: fopen `%s' failed for wb: %s", tmp, strerror (errno));
+        return NCAP_EIO;
+    }
+
+    const size_t n = store.nrows;
+
+    ok = fwrite (&header, sizeof header, 1, out) == 1
+         && fwrite (store.size, sizeof *store.size, n, out) == n
+         && fwrite (store.mtime_ns, sizeof *store.mtime_ns, n, out) == n
+         && fwrite (store.path, sizeof *store.path, n, out) == n
+         && fwrite (store.duration_ms, sizeof *store.duration_ms, n, out)
+                == n
+         && fwrite (store.trackno, sizeof *store.trackno, n, out) == n
+         && fwrite (store.codec, sizeof *store.codec, n, out) == n
+         && fwrite (store.title, sizeof *store.title, n, out) == n
+         && fwrite (store.artist, sizeof *store.artist, n, out) == n
+         && fwrite (store.album, sizeof *store.album, n, out) == n;
+
+    for (size_t id = 0; ok && id < store.strs.siz; ++id) {
+        const char *s = str_of ((uint32_t)id);
+
+        ok = fwrite (s, 1, strlen (s) + 1, out) == strlen (s) + 1;
+    }
+
+    if (fclose (out) != 0 || !ok || rename (tmp, fn) != 0) {
+        logef ("ERROR: could not write `%s'", fn);
+        remove (tmp);
+        return NCAP_EIO;
+    }
+
+    store.isdirty = false;
+    logif ("wrote %zu tracks to the tag cache", n);
+
+    return NCAP_OK;
+}
+
+// the columns of a list
+
+/** call with store_mx held. set row i of cols from row r of the cache */
+static void
+set_row (struct tagcache_cols_t *cols, size_t i, uint32_t r)
+{
+    cols->duration_ms[i] = store.duration_ms[r];
+    cols->trackno[i]     = store.trackno[r];
+    cols->title[i]       = str_of (store.title[r]);
+    cols->artist[i]      = str_of (store.artist[r]);
+    cols->album[i]       = str_of (store.album[r]);
+
+    // the extension says as much, if the file did not
+    if (store.codec[r] != TRACKIDX_CODEC_UNKNOWN)
+        cols->codec[i] = (uint8_t)store.codec[r];
+}
+
+/**
+ * call with store_mx held
+ *
+ * @return the row of path if it is current, or NONE
+ */
+static uint32_t
+find_current (const char *path, int64_t size, int64_t mtime_ns)
+{
+    const uint32_t r = find_row (path);
+
+    if (r == NONE)
+        return NONE;
+
+    store.isused[r] = true;
+
+    return store.size[r] == size && store.mtime_ns[r] == mtime_ns ? r : NONE;
+}
+
+int
+tagcache_cols_init (struct tagcache_cols_t *cols,
+                    const struct trackidx_t *idx)
+{
+    const size_t n   = idx->ntracks;
+    size_t       nleft = 0;
+    char        *p;
+
+    *cols = (struct tagcache_cols_t){ 0 };
+
+    // one allocation, widest columns first so each stays aligned
+    if ((p = malloc (n * (2 * sizeof (int64_t) + 3 * sizeof (char *)
+                          + 2 * sizeof (uint32_t) + sizeof (uint8_t)
+                          + sizeof (atomic_uchar))
+                     + 1))
+        == NULL) {
+        loge ("ERROR: malloc for the tag columns failed");
+        return NCAP_EALLOC;
+    }
+
+    cols->size        = (int64_t *)p;
+    cols->mtime_ns    = cols->size + n;
+    cols->title       = (const char **)(cols->mtime_ns + n);
+    cols->artist      = cols->title + n;
+    cols->album       = cols->artist + n;
+    cols->duration_ms = (uint32_t *)(cols->album + n);
+    cols->trackno     = cols->duration_ms + n;
+    cols->codec       = (uint8_t *)(cols->trackno + n);
+    cols->state       = (atomic_uchar *)(cols->codec + n);
+    cols->n           = n;
+
+    pthread_mutex_lock (&store_mx);
+
+    for (size_t i = 0; i < n; ++i) {
+        const struct trackidx_track_t *t = &idx->tracks[i];
+        const uint32_t                 r
+            = find_current (trackidx_path (idx, i), t->size, t->mtime_ns);
+
+        cols->size[i]     = t->size;
+        cols->mtime_ns[i] = t->mtime_ns;
+        cols->codec[i]    = (uint8_t)t->codec;
+
+        if (r != NONE)
+            set_row (cols, i, r);
+        else
+            ++nleft;
+
+        atomic_init (&cols->state[i],
+                     r != NONE ? TAGCACHE_DONE : TAGCACHE_PENDING);
+    }
+
+    pthread_mutex_unlock (&store_mx);
+
+    atomic_init (&cols->next, 0);
+    atomic_init (&cols->nleft, nleft);
+    atomic_init (&cols->ndone, n - nleft);
+
+    logdf ("%zu of %zu tracks have tags cached", n - nleft, n);
+
+    return NCAP_OK;
+}
+
+void
+tagcache_cols_deinit (struct tagcache_cols_t *cols)
+{
+    free (cols->size);
+    *cols = (struct tagcache_cols_t){ 0 };
+}
+
+// the workers
+
+struct work_t {
+    const char     *fn;
+    const char     *root;
+    tagcache_read_t read;
+    pthread_t       tids[MAX_THREADS];
+    int             nthreads;
+    atomic_bool     isstop;
+};
+
+static pthread_mutex_t work_mx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  work_cv = PTHREAD_COND_INITIALIZER;
+static struct work_t   work;
+
+/** read and set row i of tl's columns, unless another list read it since */
+static void
+work_row (const struct tracklist_t *tl, struct tagcache_cols_t *cols,
+          size_t i)
+{
+    struct tagcache_meta_t meta;
+    char                   fn[PATH_MAX];
+    uint32_t               r;
+
+    pthread_mutex_lock (&store_mx);
+    r = find_current (tl->ptr[i], cols->size[i], cols->mtime_ns[i]);
+
+    if (r != NONE)
+        set_row (cols, i, r);
+
+    pthread_mutex_unlock (&store_mx);
+
+    if (r == NONE) {
+        memset (&meta, 0, sizeof meta);
+        snprintf (fn, sizeof fn, "%s/%s", work.root, tl->ptr[i]);
+
+        // known to have no tags, so it is not read again
+        if (work.read (fn, &meta) != NCAP_OK) {
+            logwf ("WARN: could not read the tags of `%s'", fn);
+            memset (&meta, 0, sizeof meta);
+        }
+
+        pthread_mutex_lock (&store_mx);
+
+        if ((r = put (tl->ptr[i], cols->size[i], cols->mtime_ns[i], &meta))
+            != NONE)
+            set_row (cols, i, r);
+
+        pthread_mutex_unlock (&store_mx);
+    }
+
+    // a row the cache could not take is shown as having no tags
+    if (r == NONE) {
+        cols->duration_ms[i] = 0;
+        cols->trackno[i]     = 0;
+        cols->title[i]       = "";
+        cols->artist[i]      = "";
+        cols->album[i]       = "";
+    }
+
+    atomic_store_explicit (&cols->state[i], TAGCACHE_DONE,
+                           memory_order_release);
+    atomic_fetch_add_explicit (&cols->ndone, 1, memory_order_relaxed);
+}
+
+/** claim and read the rows of tl left, until done or tl is replaced */
+static void
+work_list (struct tracklist_t *tl)
+{
+    struct tagcache_cols_t *cols = &tl->tags;
+    size_t                  i;
+
+    while ((i = atomic_fetch_add (&cols->next, 1)) < cols->n) {
+        if (atomic_load_explicit (&work.isstop, memory_order_relaxed)
+            || tracklist_gen () != tl->gen)
+            return;
+
+        if (atomic_load_explicit (&cols->state[i], memory_order_relaxed)
+            == TAGCACHE_DONE)
+            continue;
+
+        work_row (tl, cols, i);
+
+        // the last row of the list: keep what was read
+        if (atomic_fetch_sub (&cols->nleft, 1) == 1) {
+            pthread_mutex_lock (&store_mx);
+
+            if (store.isdirty)
+                save (work.fn);
+
+            pthread_mutex_unlock (&store_mx);
+        }
+    }
+}
+
+static void *
+tfn_work (void *args)
+{
+    uint64_t seen = 0; // the generation of the list worked last
+
+    (void)args;
+
+    for (;;) {
+        pthread_mutex_lock (&work_mx);
+
+        while (!atomic_load (&work.isstop) && tracklist_gen () == seen)
+            pthread_cond_wait (&work_cv, &work_mx);
+
+        pthread_mutex_unlock (&work_mx);
+
+        if (atomic_load (&work.isstop))
+            break;
+
+        struct tracklist_t *tl = tracklist_acquire ();
+
+        seen = tracklist_gen ();
+
+        if (tl == NULL)
+            continue;
+
+        seen = tl->gen;
+        work_list (tl);
+        tracklist_release (tl);
+    }
+
+    return NULL;
+}
+
+int
+tagcache_start (const char *fn, const char *root, int nthreads,
+                tagcache_read_t read)
+{
+    int ret = NCAP_OK;
+
+    if (work.nthreads > 0)
+        tagcache_stop ();
+
+    pthread_mutex_lock (&store_mx);
+
+    if (!store_init ()) {
+        pthread_mutex_unlock (&store_mx);
+        loge ("ERROR: malloc for the tag cache failed");
+        return NCAP_EALLOC;
+    }
+
+    const size_t nrows = load (fn);
+
+    logif ("tag cache `%s': %zu tracks", fn, nrows);
+    pthread_mutex_unlock (&store_mx);
+
+    work.fn   = fn;
+    work.root = root;
+    work.read = read;
+    atomic_store (&work.isstop, false);
+
+    if (nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+
+    while (work.nthreads < nthreads
+           && pthread_create (&work.tids[work.nthreads], NULL, tfn_work, NULL)
+                  == 0)
+        ++work.nthreads;
+
+    if (work.nthreads == 0) {
+        loge ("ERROR: pthread_create failed for the tag readers");
+        ret = NCAP_EGEN;
+    }
+
+    logif ("reading tags on %d threads", work.nthreads);
+
+    return ret;
+}
+
+void
+tagcache_stop (void)
+{
+    pthread_mutex_lock (&work_mx);
+    atomic_store (&work.isstop, true);
+    pthread_cond_broadcast (&work_cv);
+    pthread_mutex_unlock (&work_mx);
+
+    for (int i = 0; i < work.nthreads; ++i)
+        pthread_join (work.tids[i], NULL);
+
+    pthread_mutex_lock (&store_mx);
+
+    if (work.nthreads > 0 && store.isdirty)
+        save (work.fn);
+
+    store_deinit ();
+    pthread_mutex_unlock (&store_mx);
+
+    work.nthreads = 0;
+}
+
+void
+tagcache_kick (void)
+{
+    pthread_mutex_lock (&work_mx);
+    pthread_cond_broadcast (&work_cv);
+    pthread_mutex_unlock (&work_mx);
+}
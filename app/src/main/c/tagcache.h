@@ -0,0 +1,129 @@
+#pragma once
+
+#ifndef TAGCACHE_H
+#define TAGCACHE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "trackidx.h"
+
+/**
+ * Tags and durations of the tracks, read in the background and kept across
+ * runs. The cache is column-oriented: one array per field, with every
+ * string interned once, so a library of few artists and albums stays small.
+ * A track is known by its path, and read again once its size or mtime
+ * changes, as the track index records them.
+ *
+ * Each track list the watcher publishes carries columns of its own, filled
+ * from the cache as the list is made. A pool of workers reads the tracks
+ * left, in list order, and fills in their rows; a row is published by its
+ * state, stored last, so the UI reads the columns without locking. Workers
+ * move to a newer list as soon as one is published. The cache is written
+ * out whenever a list is done, and on stop.
+ */
+
+#define TAGCACHE_TAG_SIZ 256 // bytes of a tag read, longer ones are cut
+
+/** a row's state */
+#define TAGCACHE_PENDING 0
+#define TAGCACHE_DONE    1
+
+/** what a reader found in a file */
+struct tagcache_meta_t {
+    uint32_t duration_ms; // 0 if unknown
+    uint32_t trackno;     // 0 if unknown
+    uint32_t codec;       // trackidx_codec_t, TRACKIDX_CODEC_UNKNOWN if not
+    char     title[TAGCACHE_TAG_SIZ];
+    char     artist[TAGCACHE_TAG_SIZ];
+    char     album[TAGCACHE_TAG_SIZ];
+};
+
+/**
+ * what reads a file's tags for the workers, e.g. libav_read_meta. must be
+ * safe to call from several threads at once
+ *
+ * @return NCAP_OK, or an error if fn has none to read
+ */
+typedef int (*tagcache_read_t) (const char *fn, struct tagcache_meta_t *meta);
+
+/** one track's row, as tagcache_get copies it */
+struct tagcache_tags_t {
+    uint32_t    duration_ms;
+    uint32_t    trackno;
+    uint32_t    codec;
+    const char *title; // interned, "" if none
+    const char *artist;
+    const char *album;
+};
+
+/** the tags of a track list, row i for track i */
+struct tagcache_cols_t {
+    size_t        n;
+    atomic_uchar *state; // TAGCACHE_PENDING until the rest of the row is set
+    uint32_t     *duration_ms;
+    uint32_t     *trackno;
+    uint8_t      *codec;
+    const char  **title;
+    const char  **artist;
+    const char  **album;
+
+    // the workers'
+    int64_t      *size;
+    int64_t      *mtime_ns;
+    atomic_size_t next;  // the next row to claim
+    atomic_size_t nleft; // rows still pending
+
+    atomic_size_t ndone; // rows set, for the UI to notice new ones
+};
+
+/**
+ * load the cache from fn, then start nthreads workers that read the tracks
+ * of the lists trackwatch publishes, under root. fn and root must outlive
+ * the workers
+ *
+ * @return NCAP_OK, NCAP_EALLOC, or NCAP_EGEN if no worker could be started.
+ * a missing or damaged fn loads as empty
+ */
+extern int tagcache_start (const char *fn, const char *root, int nthreads,
+                           tagcache_read_t read);
+
+/** stop the workers and write the cache out. a no-op if not started */
+extern void tagcache_stop (void);
+
+/** wake the workers, as a new list was published */
+extern void tagcache_kick (void);
+
+/**
+ * make the columns of idx's tracks, set from the cache where it knows them
+ *
+ * @return NCAP_OK or NCAP_EALLOC. cols is empty on error
+ */
+extern int tagcache_cols_init (struct tagcache_cols_t *cols,
+                               const struct trackidx_t *idx);
+
+extern void tagcache_cols_deinit (struct tagcache_cols_t *cols);
+
+/** @return whether row i is set, copied to tags. never blocks */
+static inline bool
+tagcache_get (const struct tagcache_cols_t *cols, size_t i,
+              struct tagcache_tags_t *tags)
+{
+    if (i >= cols->n
+        || atomic_load_explicit (&cols->state[i], memory_order_acquire)
+               != TAGCACHE_DONE)
+        return false;
+
+    tags->duration_ms = cols->duration_ms[i];
+    tags->trackno     = cols->trackno[i];
+    tags->codec       = cols->codec[i];
+    tags->title       = cols->title[i];
+    tags->artist      = cols->artist[i];
+    tags->album       = cols->album[i];
+
+    return true;
+}
+
+#endif // !TAGCACHE_H
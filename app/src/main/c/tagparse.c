@@ -0,0 +1,1048 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "audio.h"
+#include "logging.h"
+#include "tagcache.h"
+#include "tagparse.h"
+#include "trackidx.h"
+
+static const char *FILENAME = "tagparse.c";
+
+// bytes of one tag record read; the rest of a longer one is skipped
+#define MAX_BLOCK 65536
+
+// records looked at per container before giving up on it
+#define MAX_RECORDS 256
+
+/** a file, read from its head and tail where possible */
+struct src_t {
+    int     fd;
+    int64_t siz;
+    size_t  nhead;
+    int64_t tailoff; // -1 until read
+    size_t  ntail;
+    uint8_t head[TAGPARSE_HEAD_SIZ];
+    uint8_t tail[TAGPARSE_TAIL_SIZ];
+    uint8_t blk[MAX_BLOCK]; // the record read last
+};
+
+static bool
+pread_all (int fd, void *dst, size_t len, int64_t off)
+{
+    for (size_t n = 0; n < len;) {
+        const ssize_t got = pread (fd, (uint8_t *)dst + n, len - n,
+                                   (off_t)(off + (int64_t)n));
+
+        if (got < 0 && errno == EINTR)
+            continue;
+
+        if (got <= 0)
+            return false;
+
+        n += (size_t)got;
+    }
+
+    return true;
+}
+
+/** read the tail, once. @return whether it was */
+static bool
+src_tail (struct src_t *src)
+{
+    if (src->tailoff >= 0)
+        return true;
+
+    src->tailoff = src->siz > TAGPARSE_TAIL_SIZ ? src->siz - TAGPARSE_TAIL_SIZ
+                                                : 0;
+    src->ntail   = (size_t)(src->siz - src->tailoff);
+
+    if (pread_all (src->fd, src->tail, src->ntail, src->tailoff))
+        return true;
+
+    src->ntail = 0;
+
+    return false;
+}
+
+/** copy the len bytes of src at off to dst. @return whether there were */
+static bool
+src_read (struct src_t *src, int64_t off, void *dst, size_t len)
+{
+    if (off < 0 || (int64_t)len > src->siz || off > src->siz - (int64_t)len)
+        return false;
+
+    if (off + (int64_t)len <= (int64_t)src->nhead) {
+        memcpy (dst, src->head + off, len);
+        return true;
+    }
+
+    if (off >= src->siz - TAGPARSE_TAIL_SIZ && src_tail (src)) {
+        if (off >= src->tailoff
+            && off + (int64_t)len <= src->tailoff + (int64_t)src->ntail) {
+            memcpy (dst, src->tail + (off - src->tailoff), len);
+            return true;
+        }
+    }
+
+    return pread_all (src->fd, dst, len, off);
+}
+
+/** read up to len bytes at off into src->blk. @return the bytes read */
+static size_t
+src_block (struct src_t *src, int64_t off, uint64_t len)
+{
+    if (len > MAX_BLOCK)
+        len = MAX_BLOCK;
+
+    if (off >= 0 && off < src->siz && (int64_t)len > src->siz - off)
+        len = (uint64_t)(src->siz - off);
+
+    return src_read (src, off, src->blk, (size_t)len) ? (size_t)len : 0;
+}
+
+// byte order
+
+static inline uint32_t
+be16 (const uint8_t *p)
+{
+    return (uint32_t)p[0] << 8 | p[1];
+}
+
+static inline uint32_t
+be24 (const uint8_t *p)
+{
+    return (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+}
+
+static inline uint32_t
+be32 (const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8
+           | p[3];
+}
+
+static inline uint64_t
+be64 (const uint8_t *p)
+{
+    return (uint64_t)be32 (p) << 32 | be32 (p + 4);
+}
+
+static inline uint32_t
+le16 (const uint8_t *p)
+{
+    return (uint32_t)p[1] << 8 | p[0];
+}
+
+static inline uint32_t
+le32 (const uint8_t *p)
+{
+    return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8
+           | p[0];
+}
+
+static inline uint64_t
+le64 (const uint8_t *p)
+{
+    return (uint64_t)le32 (p + 4) << 32 | le32 (p);
+}
+
+/** ID3v2 sizes keep the top bit of each byte clear */
+static inline uint32_t
+syncsafe (const uint8_t *p)
+{
+    return (uint32_t)(p[0] & 0x7f) << 21 | (uint32_t)(p[1] & 0x7f) << 14
+           | (uint32_t)(p[2] & 0x7f) << 7 | (p[3] & 0x7f);
+}
+
+// text. a tag already set is kept, so the first source wins
+
+/** append c to dst as UTF-8. @return false once dst is full */
+static bool
+put_utf8 (char *dst, size_t *n, uint32_t c)
+{
+    char   buf[4];
+    size_t len;
+
+    if (c < 0x80) {
+        buf[0] = (char)c;
+        len    = 1;
+    } else if (c < 0x800) {
+        buf[0] = (char)(0xc0 | c >> 6);
+        buf[1] = (char)(0x80 | (c & 0x3f));
+        len    = 2;
+    } else if (c < 0x10000) {
+        buf[0] = (char)(0xe0 | c >> 12);
+        buf[1] = (char)(0x80 | (c >> 6 & 0x3f));
+        buf[2] = (char)(0x80 | (c & 0x3f));
+        len    = 3;
+    } else {
+        buf[0] = (char)(0xf0 | c >> 18);
+        buf[1] = (char)(0x80 | (c >> 12 & 0x3f));
+        buf[2] = (char)(0x80 | (c >> 6 & 0x3f));
+        buf[3] = (char)(0x80 | (c & 0x3f));
+        len    = 4;
+    }
+
+    if (*n + len >= TAGCACHE_TAG_SIZ)
+        return false;
+
+    memcpy (dst + *n, buf, len);
+    *n += len;
+    dst[*n] = '\0';
+
+    return true;
+}
+
+/** set dst to the UTF-8 in p, cut at a character if too long */
+static void
+set_utf8 (char *dst, const uint8_t *p, size_t len)
+{
+    size_t n = 0;
+
+    if (dst[0] != '\0')
+        return;
+
+    while (n < len && n < TAGCACHE_TAG_SIZ - 1 && p[n] != '\0')
+        ++n;
+
+    if (n < len && p[n] != '\0')
+        while (n > 0 && (p[n] & 0xc0) == 0x80)
+            --n;
+
+    memcpy (dst, p, n);
+    dst[n] = '\0';
+}
+
+static void
+set_latin1 (char *dst, const uint8_t *p, size_t len)
+{
+    size_t n = 0;
+
+    if (dst[0] != '\0')
+        return;
+
+    for (size_t i = 0; i < len && p[i] != '\0' && put_utf8 (dst, &n, p[i]);
+         ++i)
+        ;
+
+    // ID3v1 pads with spaces
+    while (n > 0 && dst[n - 1] == ' ')
+        dst[--n] = '\0';
+}
+
+static void
+set_utf16 (char *dst, const uint8_t *p, size_t len, bool isbe)
+{
+    size_t n = 0;
+
+    if (dst[0] != '\0')
+        return;
+
+    for (size_t i = 0; i + 1 < len; i += 2) {
+        uint32_t c = isbe ? be16 (p + i) : le16 (p + i);
+
+        if (c == 0)
+            break;
+
+        if (c >= 0xd800 && c < 0xdc00 && i + 3 < len) {
+            const uint32_t lo = isbe ? be16 (p + i + 2) : le16 (p + i + 2);
+
+            if (lo >= 0xdc00 && lo < 0xe000) {
+                c = 0x10000 + ((c - 0xd800) << 10) + (lo - 0xdc00);
+                i += 2;
+            }
+        }
+
+        if (!put_utf8 (dst, &n, c))
+            break;
+    }
+}
+
+/** set trackno from text such as "3" or "3/12" */
+static void
+set_trackno (struct tagcache_meta_t *meta, const uint8_t *p, size_t len)
+{
+    uint32_t no = 0;
+
+    if (meta->trackno != 0)
+        return;
+
+    for (size_t i = 0; i < len && p[i] >= '0' && p[i] <= '9' && no < 100000;
+         ++i)
+        no = no * 10 + (p[i] - '0');
+
+    meta->trackno = no;
+}
+
+/** the comments of Vorbis, Opus and FLAC */
+static void
+vorbis_comments (struct tagcache_meta_t *meta, const uint8_t *p, size_t len)
+{
+    static const struct {
+        const char *key;
+        size_t      len;
+    } keys[] = {
+        { "TITLE=", 6 },
+        { "ARTIST=", 7 },
+        { "ALBUM=", 6 },
+        { "TRACKNUMBER=", 12 },
+    };
+    char *const dst[] = { meta->title, meta->artist, meta->album, NULL };
+    size_t      off;
+    uint32_t    n;
+
+    if (len < 8 || le32 (p) > len - 8)
+        return;
+
+    off = 4 + le32 (p);
+    n   = le32 (p + off);
+    off += 4;
+
+    // a block cut short keeps what came before
+    for (; n > 0 && off + 4 <= len; --n) {
+        const uint32_t clen = le32 (p + off);
+        const uint8_t *c    = p + off + 4;
+
+        off += 4;
+
+        if (clen > len - off)
+            break;
+
+        for (size_t k = 0; k < sizeof keys / sizeof *keys; ++k) {
+            if (clen < keys[k].len
+                || strncasecmp ((const char *)c, keys[k].key, keys[k].len)
+                       != 0)
+                continue;
+
+            if (dst[k] != NULL)
+                set_utf8 (dst[k], c + keys[k].len, clen - keys[k].len);
+            else
+                set_trackno (meta, c + keys[k].len, clen - keys[k].len);
+        }
+
+        off += clen;
+    }
+}
+
+// WAV
+
+static void
+riff_info (struct tagcache_meta_t *meta, const uint8_t *p, size_t len)
+{
+    for (size_t off = 4; off + 8 <= len;) {
+        const uint32_t siz = le32 (p + off + 4);
+        const uint8_t *s   = p + off + 8;
+        const size_t   n   = siz < len - off - 8 ? siz : len - off - 8;
+
+        if (memcmp (p + off, "INAM", 4) == 0)
+            set_utf8 (meta->title, s, n);
+        else if (memcmp (p + off, "IART", 4) == 0)
+            set_utf8 (meta->artist, s, n);
+        else if (memcmp (p + off, "IPRD", 4) == 0)
+            set_utf8 (meta->album, s, n);
+        else if (memcmp (p + off, "ITRK", 4) == 0
+                 || memcmp (p + off, "IPRT", 4) == 0)
+            set_trackno (meta, s, n);
+
+        off += 8 + (size_t)siz + (siz & 1);
+    }
+}
+
+static int
+parse_wav (struct src_t *src, struct tagcache_meta_t *meta)
+{
+    struct cwav_header_t h;
+    int64_t              off     = sizeof h.riff;
+    int64_t              datasiz = -1;
+    bool                 hasfmt  = false;
+    uint8_t              ck[8];
+
+    memset (&h, 0, sizeof h);
+    memcpy (&h.riff, src->head, sizeof h.riff);
+
+    for (int i = 0; i < MAX_RECORDS && src_read (src, off, ck, 8); ++i) {
+        const uint32_t siz  = le32 (ck + 4);
+        const int64_t  body = off + 8;
+
+        if (memcmp (ck, "fmt ", 4) == 0 && siz >= 16) {
+            hasfmt = src_read (src, off, &h.fmt, sizeof h.fmt);
+        } else if (memcmp (ck, "data", 4) == 0) {
+            memcpy (&h.data, ck, sizeof h.data);
+
+            // a streamed file may leave the size 0 or all ones
+            datasiz = siz > 0 && siz < UINT32_MAX && siz <= src->siz - body
+                          ? siz
+                          : src->siz - body;
+
+            off = body + datasiz + (datasiz & 1);
+            continue;
+        } else if (memcmp (ck, "LIST", 4) == 0 && siz >= 4) {
+            const size_t n = src_block (src, body, siz);
+
+            if (n >= 4 && memcmp (src->blk, "INFO", 4) == 0)
+                riff_info (meta, src->blk, n);
+        }
+
+        off = body + siz + (siz & 1);
+    }
+
+    meta->codec = TRACKIDX_CODEC_WAV;
+
+    if (hasfmt && datasiz > 0 && h.fmt.nAvgBytesPerSec > 0)
+        meta->duration_ms
+            = (uint32_t)(datasiz * 1000 / h.fmt.nAvgBytesPerSec);
+
+    return hasfmt ? NCAP_OK : NCAP_EGEN;
+}
+
+// FLAC
+
+static int
+parse_flac (struct src_t *src, int64_t off, struct tagcache_meta_t *meta)
+{
+    uint8_t h[4];
+    bool    isinfo = false;
+
+    off += 4; // fLaC
+
+    for (int i = 0; i < MAX_RECORDS && src_read (src, off, h, 4); ++i) {
+        const int      type = h[0] & 0x7f;
+        const uint32_t len  = be24 (h + 1);
+
+        if (type == 0 && len >= 18 && src_block (src, off + 4, 18) == 18) {
+            const uint8_t *b     = src->blk;
+            const uint32_t rate  = be24 (b + 10) >> 4;
+            const uint64_t total = (uint64_t)(b[13] & 0x0f) << 32
+                                   | be32 (b + 14);
+
+            isinfo = rate > 0;
+
+            if (isinfo && total > 0)
+                meta->duration_ms = (uint32_t)(total * 1000 / rate);
+        } else if (type == 4) {
+            vorbis_comments (meta, src->blk, src_block (src, off + 4, len));
+        }
+
+        if (h[0] & 0x80)
+            break;
+
+        off += 4 + (int64_t)len;
+    }
+
+    meta->codec = TRACKIDX_CODEC_FLAC;
+
+    return isinfo ? NCAP_OK : NCAP_EGEN;
+}
+
+// MP3
+
+// kbit/s by MPEG-1 or 2 and 2.5, layer I, II, III, then the bitrate index
+static const uint16_t mpa_kbps[2][3][16] = {
+    {
+        { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416,
+          448, 0 },
+        { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384,
+          0 },
+        { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320,
+          0 },
+    },
+    {
+        { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256,
+          0 },
+        { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 },
+        { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 },
+    },
+};
+
+static const uint32_t mpa_rates[3] = { 44100, 48000, 32000 };
+
+/** an MPEG audio frame header */
+struct mpa_t {
+    int      version; // 0 for MPEG-1, 1 for 2, 2 for 2.5
+    int      layer;   // 0 for layer I
+    uint32_t bps;
+    uint32_t rate;
+    uint32_t len;     // bytes of the frame
+    uint32_t samples; // per frame
+    bool     ismono;
+};
+
+static bool
+mpa_parse (const uint8_t *p, struct mpa_t *f)
+{
+    const uint32_t h   = be32 (p);
+    const int      ver = h >> 19 & 3;
+    const int      lay = h >> 17 & 3;
+    const int      bri = h >> 12 & 15;
+    const int      sri = h >> 10 & 3;
+    const uint32_t pad = h >> 9 & 1;
+
+    if ((h >> 21) != 0x7ff || ver == 1 || lay == 0 || bri == 0 || bri == 15
+        || sri == 3)
+        return false;
+
+    f->version = ver == 3 ? 0 : ver == 2 ? 1 : 2;
+    f->layer   = 3 - lay;
+    f->bps     = 1000u * mpa_kbps[f->version > 0][f->layer][bri];
+    f->rate    = mpa_rates[sri] >> f->version;
+    f->ismono  = (h >> 6 & 3) == 3;
+
+    if (f->layer == 0) {
+        f->samples = 384;
+        f->len     = (12 * f->bps / f->rate + pad) * 4;
+    } else if (f->layer == 2 && f->version > 0) {
+        f->samples = 576;
+        f->len     = 72 * f->bps / f->rate + pad;
+    } else {
+        f->samples = 1152;
+        f->len     = 144 * f->bps / f->rate + pad;
+    }
+
+    return true;
+}
+
+/** find the first frame at or after off, confirmed by the one after */
+static bool
+mpa_first (struct src_t *src, int64_t *off, struct mpa_t *f)
+{
+    uint8_t h[4];
+
+    for (int64_t at = *off; at < *off + 4096 && src_read (src, at, h, 4);
+         ++at) {
+        struct mpa_t next;
+
+        if (!mpa_parse (h, f))
+            continue;
+
+        // a lone frame at the end of the file needs no confirming
+        if (!src_read (src, at + f->len, h, 4)
+            || (mpa_parse (h, &next) && next.rate == f->rate
+                && next.layer == f->layer)) {
+            *off = at;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void
+mpa_duration (struct src_t *src, int64_t start, int64_t end,
+              struct tagcache_meta_t *meta)
+{
+    static const int side[2][2] = { { 32, 17 }, { 17, 9 } };
+
+    struct mpa_t f;
+    uint8_t      b[64];
+    uint64_t     nframes = 0;
+
+    if (!mpa_first (src, &start, &f) || !src_read (src, start, b, sizeof b))
+        return;
+
+    const uint8_t *xing = b + 4 + side[f.version > 0][f.ismono];
+
+    if ((memcmp (xing, "Xing", 4) == 0 || memcmp (xing, "Info", 4) == 0)
+        && (be32 (xing + 4) & 1))
+        nframes = be32 (xing + 8);
+    else if (memcmp (b + 36, "VBRI", 4) == 0)
+        nframes = be32 (b + 36 + 14);
+
+    if (nframes > 0)
+        meta->duration_ms
+            = (uint32_t)(nframes * f.samples * 1000 / f.rate);
+    else if (end > start)
+        meta->duration_ms = (uint32_t)((uint64_t)(end - start) * 8000 / f.bps);
+}
+
+/** what an ID3v2 frame holds, by its 4 or 3 character id */
+static void
+id3_frame (struct tagcache_meta_t *meta, const char *id, const uint8_t *p,
+           size_t len)
+{
+    char  *dst  = NULL;
+    char   buf[16];
+    size_t n;
+
+    if (strcmp (id, "TIT2") == 0 || strcmp (id, "TT2") == 0)
+        dst = meta->title;
+    else if (strcmp (id, "TPE1") == 0 || strcmp (id, "TP1") == 0)
+        dst = meta->artist;
+    else if (strcmp (id, "TALB") == 0 || strcmp (id, "TAL") == 0)
+        dst = meta->album;
+    else if (strcmp (id, "TRCK") != 0 && strcmp (id, "TRK") != 0)
+        return;
+
+    if (len < 1)
+        return;
+
+    // the track number goes through text like the rest
+    if (dst == NULL) {
+        if (meta->trackno != 0)
+            return;
+
+        dst    = buf;
+        buf[0] = '\0';
+    }
+
+    switch (p[0]) {
+    case 0:
+        set_latin1 (dst, p + 1, len - 1);
+        break;
+    case 1:
+        if (len >= 3)
+            set_utf16 (dst, p + 3, len - 3, p[1] == 0xfe && p[2] == 0xff);
+        break;
+    case 2:
+        set_utf16 (dst, p + 1, len - 1, true);
+        break;
+    case 3:
+        set_utf8 (dst, p + 1, len - 1);
+        break;
+    }
+
+    if (dst == buf) {
+        for (n = 0; buf[n] != '\0' && n < sizeof buf - 1; ++n)
+            ;
+
+        set_trackno (meta, (const uint8_t *)buf, n);
+    }
+}
+
+/**
+ * read the ID3v2 tag at 0
+ *
+ * @return where the tag ends
+ */
+static int64_t
+id3v2 (struct src_t *src, struct tagcache_meta_t *meta)
+{
+    const uint8_t *h     = src->head;
+    const int      major = h[3];
+    const int64_t  end   = 10 + (int64_t)syncsafe (h + 6);
+    const int      idlen = major == 2 ? 3 : 4;
+    const int      hdr   = major == 2 ? 6 : 10;
+    int64_t        off   = 10;
+    uint8_t        fh[10];
+
+    // the tag is unsynchronised whole before 2.4; text frames rarely are
+    if (major < 2 || major > 4 || (major < 4 && (h[5] & 0x80)))
+        goto exit;
+
+    if (major > 2 && (h[5] & 0x40) && src_read (src, off, fh, 4))
+        off += major == 4 ? syncsafe (fh) : 4 + be32 (fh);
+
+    for (int i = 0;
+         i < MAX_RECORDS && off + hdr <= end && src_read (src, off, fh, hdr);
+         ++i) {
+        char     id[5] = { 0 };
+        uint32_t len;
+
+        if (fh[0] == 0) // padding
+            break;
+
+        memcpy (id, fh, idlen);
+        len = major == 2 ? be24 (fh + 3) : major == 3 ? be32 (fh + 4)
+                                                      : syncsafe (fh + 4);
+        off += hdr;
+
+        if (len > end - off)
+            break;
+
+        if (id[0] == 'T')
+            id3_frame (meta, id, src->blk, src_block (src, off, len));
+
+        off += len;
+    }
+
+exit:
+    return h[5] & 0x10 ? end + 10 : end;
+}
+
+/** fill in what is missing from the ID3v1 tag at the end, if any */
+static bool
+id3v1 (struct src_t *src, struct tagcache_meta_t *meta)
+{
+    uint8_t t[128];
+
+    if (!src_read (src, src->siz - 128, t, sizeof t)
+        || memcmp (t, "TAG", 3) != 0)
+        return false;
+
+    set_latin1 (meta->title, t + 3, 30);
+    set_latin1 (meta->artist, t + 33, 30);
+    set_latin1 (meta->album, t + 63, 30);
+
+    // ID3v1.1 keeps the track in the last byte of the comment
+    if (meta->trackno == 0 && t[125] == 0)
+        meta->trackno = t[126];
+
+    return true;
+}
+
+static int
+parse_mp3 (struct src_t *src, int64_t start, struct tagcache_meta_t *meta)
+{
+    const bool    hasv1 = id3v1 (src, meta);
+    const int64_t end   = hasv1 ? src->siz - 128 : src->siz;
+
+    mpa_duration (src, start, end, meta);
+    meta->codec = TRACKIDX_CODEC_MP3;
+
+    return NCAP_OK;
+}
+
+// MP4
+
+/**
+ * the atom at *off, before end
+ *
+ * @return whether there is one. *off is moved past it
+ */
+static bool
+next_atom (struct src_t *src, int64_t *off, int64_t end, char type[4],
+           int64_t *body, int64_t *bodyend)
+{
+    uint8_t  h[16];
+    uint64_t siz;
+    int64_t  hdr = 8;
+
+    if (*off + 8 > end || !src_read (src, *off, h, 8))
+        return false;
+
+    siz = be32 (h);
+
+    if (siz == 1) {
+        if (!src_read (src, *off + 8, h + 8, 8))
+            return false;
+
+        siz = be64 (h + 8);
+        hdr = 16;
+    } else if (siz == 0) {
+        siz = (uint64_t)(end - *off); // to the end
+    }
+
+    if (siz < (uint64_t)hdr || siz > (uint64_t)(end - *off))
+        return false;
+
+    memcpy (type, h + 4, 4);
+    *body    = *off + hdr;
+    *bodyend = *off + (int64_t)siz;
+    *off     = *bodyend;
+
+    return true;
+}
+
+/** narrow [*off, *end) to the body of its child of type */
+static bool
+find_atom (struct src_t *src, int64_t *off, int64_t *end, const char *type)
+{
+    char    t[4];
+    int64_t body, bodyend;
+
+    for (int i = 0;
+         i < MAX_RECORDS && next_atom (src, off, *end, t, &body, &bodyend);
+         ++i)
+        if (memcmp (t, type, 4) == 0) {
+            *off = body;
+            *end = bodyend;
+            return true;
+        }
+
+    return false;
+}
+
+/** find the atoms along path, each 4 characters, under [off, end) */
+static bool
+find_path (struct src_t *src, int64_t *off, int64_t *end, const char *path)
+{
+    for (; *path != '\0'; path += 4)
+        if (!find_atom (src, off, end, path))
+            return false;
+
+    return true;
+}
+
+static void
+mp4_ilst (struct src_t *src, int64_t off, int64_t end,
+          struct tagcache_meta_t *meta)
+{
+    char    t[4];
+    int64_t body, bodyend;
+
+    for (int i = 0;
+         i < MAX_RECORDS && next_atom (src, &off, end, t, &body, &bodyend);
+         ++i) {
+        char          *dst = NULL;
+        const uint8_t *v   = src->blk + 8; // past the type and locale
+        size_t         n;
+
+        if (memcmp (t, "\xa9nam", 4) == 0)
+            dst = meta->title;
+        else if (memcmp (t, "\xa9" "ART", 4) == 0)
+            dst = meta->artist;
+        else if (memcmp (t, "\xa9" "alb", 4) == 0)
+            dst = meta->album;
+        else if (memcmp (t, "trkn", 4) != 0)
+            continue;
+
+        if (!find_atom (src, &body, &bodyend, "data")
+            || (n = src_block (src, body, (uint64_t)(bodyend - body))) < 8)
+            continue;
+
+        if (dst != NULL)
+            set_utf8 (dst, v, n - 8);
+        else if (n >= 12 && meta->trackno == 0)
+            meta->trackno = be16 (v + 2);
+    }
+}
+
+static int
+parse_mp4 (struct src_t *src, struct tagcache_meta_t *meta)
+{
+    int64_t moov = 0, moovend = src->siz;
+    int64_t off, end;
+    uint8_t b[32];
+
+    if (!find_atom (src, &moov, &moovend, "moov"))
+        return NCAP_EGEN;
+
+    off = moov;
+    end = moovend;
+
+    if (find_atom (src, &off, &end, "mvhd") && src_read (src, off, b, 32)) {
+        const bool     isv1      = b[0] == 1;
+        const uint32_t timescale = be32 (b + (isv1 ? 20 : 12));
+        const uint64_t duration  = isv1 ? be64 (b + 24) : be32 (b + 16);
+
+        if (timescale > 0)
+            meta->duration_ms = (uint32_t)(duration * 1000 / timescale);
+    }
+
+    // the first track's first sample entry, past stsd's version and count
+    off = moov;
+    end = moovend;
+
+    if (find_path (src, &off, &end, "trakmdiaminfstblstsd")
+        && src_read (src, off + 8, b, 8)
+        && (memcmp (b + 4, "mp4a", 4) == 0 || memcmp (b + 4, "alac", 4) == 0))
+        meta->codec = TRACKIDX_CODEC_AAC;
+
+    off = moov;
+    end = moovend;
+
+    if (!find_path (src, &off, &end, "udtameta"))
+        return NCAP_OK;
+
+    // meta is a full box, but not in QuickTime files
+    if (src_read (src, off, b, 8) && memcmp (b + 4, "hdlr", 4) != 0)
+        off += 4;
+
+    if (find_atom (src, &off, &end, "ilst"))
+        mp4_ilst (src, off, end, meta);
+
+    return NCAP_OK;
+}
+
+// Ogg
+
+/**
+ * the page at *off
+ *
+ * @return whether there is one. *off is moved to its body, *len set to the
+ * body's length and segs to its lacing
+ */
+static bool
+ogg_page (struct src_t *src, int64_t *off, uint8_t h[27], uint8_t segs[255],
+          size_t *len)
+{
+    if (!src_read (src, *off, h, 27) || memcmp (h, "OggS", 4) != 0
+        || !src_read (src, *off + 27, segs, h[26]))
+        return false;
+
+    *len = 0;
+
+    for (int i = 0; i < h[26]; ++i)
+        *len += segs[i];
+
+    *off += 27 + h[26];
+
+    return true;
+}
+
+/**
+ * gather the first two packets of the first stream into src->blk, each cut
+ * to half of it
+ *
+ * @return whether both were found
+ */
+static bool
+ogg_headers (struct src_t *src, uint32_t *serial, size_t len[2])
+{
+    const size_t half = MAX_BLOCK / 2;
+    uint8_t      h[27], segs[255];
+    int64_t      off = 0;
+    int          pkt = 0;
+
+    len[0] = 0;
+    len[1] = 0;
+
+    for (int i = 0; i < MAX_RECORDS && pkt < 2; ++i) {
+        size_t  body;
+        int64_t at;
+
+        if (!ogg_page (src, &off, h, segs, &body))
+            return false;
+
+        at = off;
+        off += (int64_t)body;
+
+        if (i == 0)
+            *serial = le32 (h + 14);
+        else if (le32 (h + 14) != *serial)
+            continue;
+
+        for (int s = 0; s < h[26] && pkt < 2; ++s) {
+            uint8_t     *dst = src->blk + pkt * half;
+            const size_t n
+                = len[pkt] + segs[s] <= half ? segs[s] : half - len[pkt];
+
+            if (n > 0 && !src_read (src, at, dst + len[pkt], n))
+                return false;
+
+            len[pkt] += n;
+            at += segs[s];
+
+            if (segs[s] < 255)
+                ++pkt;
+        }
+    }
+
+    return pkt == 2;
+}
+
+/** @return the granule position of the stream's last page, or -1 */
+static int64_t
+ogg_last_granule (struct src_t *src, uint32_t serial)
+{
+    if (!src_tail (src))
+        return -1;
+
+    for (int64_t i = (int64_t)src->ntail - 27; i >= 0; --i) {
+        const uint8_t *p = src->tail + i;
+
+        if (memcmp (p, "OggS", 4) == 0 && p[4] == 0 && le32 (p + 14) == serial
+            && le64 (p + 6) != UINT64_MAX)
+            return (int64_t)le64 (p + 6);
+    }
+
+    return -1;
+}
+
+static int
+parse_ogg (struct src_t *src, struct tagcache_meta_t *meta)
+{
+    const uint8_t *id = src->blk;
+    const uint8_t *cm = src->blk + MAX_BLOCK / 2;
+    uint32_t       serial, rate;
+    int64_t        skip = 0, granule;
+    size_t         len[2];
+
+    if (!ogg_headers (src, &serial, len))
+        return NCAP_EGEN;
+
+    if (len[0] >= 16 && memcmp (id, "\x01vorbis", 7) == 0 && len[1] >= 7
+        && memcmp (cm, "\x03vorbis", 7) == 0) {
+        meta->codec = TRACKIDX_CODEC_VORBIS;
+        rate        = le32 (id + 12);
+        vorbis_comments (meta, cm + 7, len[1] - 7);
+    } else if (len[0] >= 19 && memcmp (id, "OpusHead", 8) == 0
+               && len[1] >= 8 && memcmp (cm, "OpusTags", 8) == 0) {
+        meta->codec = TRACKIDX_CODEC_OPUS;
+        rate        = 48000; // granules always count at 48 kHz
+        skip        = le16 (id + 10);
+        vorbis_comments (meta, cm + 8, len[1] - 8);
+    } else {
+        return NCAP_EGEN;
+    }
+
+    if (rate > 0 && (granule = ogg_last_granule (src, serial)) > skip)
+        meta->duration_ms = (uint32_t)((granule - skip) * 1000 / rate);
+
+    return NCAP_OK;
+}
+
+// dispatch
+
+int
+tagparse_read (const char *fn, struct tagcache_meta_t *meta)
+{
+    struct src_t  *src;
+    struct stat    st;
+    const uint8_t *h;
+    int            ret = NCAP_EGEN;
+
+    if ((src = malloc (sizeof *src)) == NULL) {
+        loge ("ERROR: malloc for reading tags failed");
+        return NCAP_EALLOC;
+    }
+
+    if ((src->fd = open (fn, O_RDONLY | O_CLOEXEC)) < 0
+        || fstat (src->fd, &st) != 0) {
+        logef ("ERROR: could not open `%s': %s", fn, strerror (errno));
+        ret = NCAP_EIO;
+        goto exit;
+    }
+
+    src->siz     = st.st_size;
+    src->nhead   = st.st_size < TAGPARSE_HEAD_SIZ ? (size_t)st.st_size
+                                                  : TAGPARSE_HEAD_SIZ;
+    src->tailoff = -1;
+    src->ntail   = 0;
+    h            = src->head;
+
+    if (src->nhead < 12 || !pread_all (src->fd, src->head, src->nhead, 0)) {
+        ret = src->nhead < 12 ? NCAP_EGEN : NCAP_EIO;
+        goto exit;
+    }
+
+    if (memcmp (h, "RIFF", 4) == 0 && memcmp (h + 8, "WAVE", 4) == 0) {
+        ret = parse_wav (src, meta);
+    } else if (memcmp (h, "fLaC", 4) == 0) {
+        ret = parse_flac (src, 0, meta);
+    } else if (memcmp (h, "OggS", 4) == 0) {
+        ret = parse_ogg (src, meta);
+    } else if (memcmp (h + 4, "ftyp", 4) == 0) {
+        ret = parse_mp4 (src, meta);
+    } else if (memcmp (h, "ID3", 3) == 0) {
+        const int64_t end = id3v2 (src, meta);
+        uint8_t       magic[4];
+
+        // FLAC is sometimes tagged so too
+        if (src_read (src, end, magic, 4) && memcmp (magic, "fLaC", 4) == 0)
+            ret = parse_flac (src, end, meta);
+        else
+            ret = parse_mp3 (src, end, meta);
+    } else {
+        struct mpa_t f;
+
+        if (mpa_parse (h, &f))
+            ret = parse_mp3 (src, 0, meta);
+    }
+
+exit:
+    if (src->fd >= 0)
+        close (src->fd);
+
+    free (src);
+
+    return ret;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#ifndef TAGPARSE_H
+#define TAGPARSE_H
+
+#include "tagcache.h"
+
+/**
+ * Tags and duration of the common containers, without libav. A file's first
+ * TAGPARSE_HEAD_SIZ bytes are read at once, and its last TAGPARSE_TAIL_SIZ
+ * when needed; anything past those is read by the record, skipping the
+ * audio and embedded pictures.
+ *
+ * - WAV: the RIFF header, read into a cwav_header_t, and LIST INFO
+ * - FLAC: STREAMINFO and the Vorbis comment, after an ID3v2 tag if any
+ * - MP3: ID3v2.2 to 2.4, then ID3v1 for what is missing. the length comes
+ *   from a Xing, Info or VBRI header, or else from the bitrate
+ * - MP4: mvhd, the first sample entry, and the iTunes ilst
+ * - Ogg Vorbis and Opus: the comment header, and the granule position of
+ *   the last page
+ */
+
+#define TAGPARSE_HEAD_SIZ 16384
+#define TAGPARSE_TAIL_SIZ 8192
+
+/**
+ * read fn's tags into meta, which should be zeroed. safe to call from
+ * several threads at once
+ *
+ * @return NCAP_OK, NCAP_EIO if fn cannot be read, or NCAP_EGEN if fn is not
+ * in a container parsed here, which libav_read_meta may still read
+ */
+extern int tagparse_read (const char *fn, struct tagcache_meta_t *meta);
+
+#endif // !TAGPARSE_H
@@ -0,0 +1,24 @@
+#pragma once
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+
+/** monotonic time in seconds */
+static inline double
+bench_now (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#define bench_report(unit, n, secs)                                           \
+    printf ("%s:\t%zu in %.3f s (%.3g %s/s)\n", unit, (size_t)(n), secs,     \
+            (n) / (secs), unit)
+
+#endif // !BENCH_H
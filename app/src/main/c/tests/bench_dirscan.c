@@ -0,0 +1,170 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "bench.h"
+
+#include "../audio.h"
+#include "../dirscan.h"
+#include "../strvec.h"
+
+// a library laid out artist/album/track, with a cover per album
+#define TREE     "build/bench_dirscan"
+#define NARTISTS 100
+#define NALBUMS  10
+#define NTRACKS  15
+#define NFILES   (NARTISTS * NALBUMS * NTRACKS)
+#define NRUNS    5
+
+static int
+make_tree (void)
+{
+    char path[256];
+
+    mkdir (TREE, 0700);
+
+    for (int a = 0; a < NARTISTS; ++a) {
+        snprintf (path, sizeof path, TREE "/artist %03d", a);
+        mkdir (path, 0700);
+
+        for (int b = 0; b < NALBUMS; ++b) {
+            snprintf (path, sizeof path, TREE "/artist %03d/album %02d", a,
+                      b);
+            mkdir (path, 0700);
+
+            for (int t = 0; t <= NTRACKS; ++t) {
+                FILE *fp;
+
+                if (t < NTRACKS)
+                    snprintf (path, sizeof path,
+                              TREE "/artist %03d/album %02d/%02d.flac", a, b,
+                              t);
+                else
+                    snprintf (path, sizeof path,
+                              TREE "/artist %03d/album %02d/cover.jpg", a, b);
+
+                if ((fp = fopen (path, "w")) == NULL)
+                    return -1;
+
+                fclose (fp);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int
+rm (const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove (path);
+}
+
+/** the old load_dir made recursive: readdir, a path string per entry */
+static void
+readdir_scan (strvec_t *sv, const char *dir)
+{
+    struct dirent *ent;
+    struct stat    st;
+    DIR           *dp = opendir (dir);
+    char           path[PATH_MAX];
+
+    if (dp == NULL)
+        return;
+
+    while ((ent = readdir (dp)) != NULL) {
+        if (ent->d_name[0] == '.')
+            continue;
+
+        snprintf (path, sizeof path, "%s/%s", dir, ent->d_name);
+
+        if (ent->d_type == DT_DIR
+            || (ent->d_type == DT_UNKNOWN && lstat (path, &st) == 0
+                && S_ISDIR (st.st_mode)))
+            readdir_scan (sv, path);
+        else if (strstr (ent->d_name, ".flac") != NULL)
+            strvec_pushb (sv, path, strlen (path));
+    }
+
+    closedir (dp);
+}
+
+static void
+report (const char *name, double secs, size_t n)
+{
+    char unit[64];
+
+    snprintf (unit, sizeof unit, "%s files", name);
+    bench_report (unit, n, secs);
+}
+
+int
+main (void)
+{
+    strvec_t sv;
+    size_t   n;
+    double   t0;
+
+    nftw (TREE, rm, 16, FTW_DEPTH | FTW_PHYS);
+
+    t0 = bench_now ();
+
+    if (make_tree () != 0) {
+        fputs ("could not make the tree\n", stderr);
+        return 1;
+    }
+
+    printf ("%d files in %d directories, made in %.3f s\n",
+            NFILES + NARTISTS * NALBUMS, NARTISTS * (NALBUMS + 1),
+            bench_now () - t0);
+
+    // warm the dentry cache, as a rescan would find it
+    strvec_init (&sv);
+    readdir_scan (&sv, TREE);
+    strvec_deinit (&sv);
+
+    n  = 0;
+    t0 = bench_now ();
+
+    for (int r = 0; r < NRUNS; ++r) {
+        strvec_init (&sv);
+        readdir_scan (&sv, TREE);
+        n += sv.siz;
+        strvec_deinit (&sv);
+    }
+
+    report ("readdir", bench_now () - t0, n);
+
+    for (int nthreads = 1; nthreads <= 8; nthreads <<= 1) {
+        char name[32];
+
+        n  = 0;
+        t0 = bench_now ();
+
+        for (int r = 0; r < NRUNS; ++r) {
+            strvec_init (&sv);
+            dirscan (&sv, TREE, dirscan_audio_exts, nthreads);
+            n += sv.siz;
+            strvec_deinit (&sv);
+        }
+
+        snprintf (name, sizeof name, "dirscan %d threads", nthreads);
+        report (name, bench_now () - t0, n);
+    }
+
+    if (n != (size_t)NFILES * NRUNS)
+        fprintf (stderr, "dirscan found %zu of %d files\n", n / NRUNS,
+                 NFILES);
+
+    nftw (TREE, rm, 16, FTW_DEPTH | FTW_PHYS);
+
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+#include "../eq.h"
+#include "../simd.h"
+
+// a power saving stream's burst, stereo
+#define RATE     48000
+#define BURST    960
+#define CHANNELS 2
+#define SECS     60 // of audio per run
+
+static const char *const LEVELS[] = { "scalar", "v128", "v256" };
+static const char *const FMTS[]   = { "", "S16", "S32", "FLT" };
+
+/** @return the first preset of nbands, or NULL */
+static const struct eq_preset_t *
+preset (int nbands)
+{
+    for (uint8_t p = 0; p < eq_npresets; ++p)
+        if (eq_presets[p].nbands == nbands)
+            return &eq_presets[p];
+
+    return NULL;
+}
+
+static void
+fill (void *buf, uint16_t fmt)
+{
+    for (size_t i = 0; i < BURST * CHANNELS; ++i) {
+        const int r = rand () - RAND_MAX / 2;
+
+        if (fmt == 1)
+            ((int16_t *)buf)[i] = r >> 18; // headroom for the boosts
+        else if (fmt == 2)
+            ((int32_t *)buf)[i] = r >> 2;
+        else
+            ((float *)buf)[i] = (float)r / RAND_MAX / 4;
+    }
+}
+
+static void
+run (const struct eq_preset_t *p, uint16_t fmt, int level)
+{
+    static float src[BURST * CHANNELS], buf[BURST * CHANNELS];
+    const size_t nbursts = (size_t)SECS * RATE / BURST;
+    struct eq_t  eq;
+
+    simd_setlevel (level);
+    eq_init (&eq, RATE, CHANNELS, p->bands, p->nbands, p->preamp_db);
+    fill (src, fmt);
+
+    const double t0 = bench_now ();
+
+    // a copy of the same noise every burst, so boosts never run away
+    for (size_t i = 0; i < nbursts; ++i) {
+        memcpy (buf, src, sizeof buf);
+        eq_apply (&eq, buf, fmt, BURST);
+    }
+
+    const double secs = bench_now () - t0;
+    char         unit[64];
+
+    snprintf (unit, sizeof unit, "%d bands %s %s frames", p->nbands,
+              FMTS[fmt], LEVELS[level]);
+    bench_report (unit, nbursts * BURST, secs);
+    printf ("\t%.3f ms of CPU per second of audio (%.3f%% of a core)\n",
+            secs * 1000 / SECS, secs * 100 / SECS);
+}
+
+int
+main (void)
+{
+    const int      best      = simd_setlevel (SIMD_V256);
+    const int      nbands[2] = { 5, 10 };
+    const uint16_t fmts[]    = { 1, 3 };
+
+    srand (1);
+
+    for (int b = 0; b < 2; ++b) {
+        const struct eq_preset_t *p = preset (nbands[b]);
+
+        if (p == NULL) {
+            fprintf (stderr, "no preset of %d bands\n", nbands[b]);
+            return 1;
+        }
+
+        for (size_t f = 0; f < sizeof fmts / sizeof *fmts; ++f)
+            for (int level = SIMD_SCALAR; level <= best; ++level)
+                run (p, fmts[f], level);
+    }
+
+    simd_setlevel (SIMD_V256);
+
+    return 0;
+}
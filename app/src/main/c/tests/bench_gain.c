@@ -0,0 +1,118 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+#include "../gain.h"
+#include "../simd.h"
+
+// a low latency stream's burst, stereo
+#define BURST    192
+#define CHANNELS 2
+#define ITERS    400000
+#define REFILL   64 // bursts between refills, so floats never go denormal
+
+static const char *const LEVELS[] = { "scalar", "v128", "v256" };
+static const char *const FMTS[]   = { "", "S16", "S32", "FLT" };
+
+static pthread_mutex_t mx     = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t         volume = 80;
+
+/** the loop gain replaced: a lock per burst, a switch per sample */
+static void
+sclbuf (void *buf, uint16_t fmt, const size_t width, size_t len)
+{
+    pthread_mutex_lock (&mx);
+    const float scl = volume / 100.0f;
+    pthread_mutex_unlock (&mx);
+
+    for (uint8_t *p = buf; len--; p += width) {
+        switch (fmt) {
+            case 1:
+                *(int16_t *)p *= scl;
+                break;
+            case 2:
+                *(int32_t *)p *= scl;
+                break;
+            case 3:
+                *(float *)p *= scl;
+                break;
+            default:
+                return;
+        }
+    }
+}
+
+static void
+fill (void *buf, uint16_t fmt)
+{
+    for (size_t i = 0; i < BURST * CHANNELS; ++i) {
+        const int r = rand () - RAND_MAX / 2;
+
+        if (fmt == 1)
+            ((int16_t *)buf)[i] = r >> 16;
+        else if (fmt == 2)
+            ((int32_t *)buf)[i] = r;
+        else
+            ((float *)buf)[i] = (float)r / RAND_MAX;
+    }
+}
+
+/** @param level -1 for sclbuf */
+static void
+run (uint16_t fmt, int level, int isramp)
+{
+    static float  src[BURST * CHANNELS], buf[BURST * CHANNELS];
+    const size_t  width = fmt == 1 ? 2 : 4;
+    struct gain_t g;
+
+    fill (src, fmt);
+    memcpy (buf, src, sizeof buf);
+    gain_init (&g, 0.8f);
+
+    if (level >= 0)
+        simd_setlevel (level);
+
+    const double t0 = bench_now ();
+
+    for (int i = 0; i < ITERS; ++i) {
+        if (i % REFILL == 0)
+            memcpy (buf, src, sizeof buf);
+
+        if (level < 0)
+            sclbuf (buf, fmt, width, BURST * CHANNELS);
+        else
+            gain_apply (&g, buf, fmt, CHANNELS, BURST,
+                        isramp && i % 2 ? 0.7f : 0.8f);
+    }
+
+    const double secs = bench_now () - t0;
+    char         unit[64];
+
+    snprintf (unit, sizeof unit, "%s %s%s samples", FMTS[fmt],
+              level < 0 ? "sclbuf" : LEVELS[level], isramp ? " ramp" : "");
+    bench_report (unit, (size_t)BURST * CHANNELS * ITERS, secs);
+}
+
+int
+main (void)
+{
+    const int best = simd_setlevel (SIMD_V256);
+
+    srand (1);
+
+    for (uint16_t fmt = 1; fmt <= 3; ++fmt) {
+        run (fmt, -1, 0);
+
+        for (int level = SIMD_SCALAR; level <= best; ++level)
+            run (fmt, level, 0);
+
+        // a new target every burst, the worst case
+        run (fmt, best, 1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+#include "../interleave.h"
+#include "../simd.h"
+
+// one AAC frame is 1024, MP3 1152; a FLAC block is often 4096
+#define NFRAMES 4096
+#define ITERS   20000
+
+static const char *const LEVELS[] = { "scalar", "v128", "v256" };
+
+static void
+run (const char *name, int bps, int channels, int level)
+{
+    uint8_t *planes[8];
+    uint8_t *dst = malloc ((size_t)NFRAMES * channels * bps);
+
+    for (int ch = 0; ch < channels; ++ch) {
+        planes[ch] = malloc ((size_t)NFRAMES * bps);
+        memset (planes[ch], ch + 1, (size_t)NFRAMES * bps);
+    }
+
+    simd_setlevel (level);
+
+    const double t0 = bench_now ();
+
+    for (int i = 0; i < ITERS; ++i)
+        interleave (dst, planes, channels, NFRAMES, bps);
+
+    const double secs = bench_now () - t0;
+    char         unit[64];
+
+    snprintf (unit, sizeof unit, "%s %dch %s frames", name, channels,
+              LEVELS[level]);
+    bench_report (unit, (size_t)NFRAMES * ITERS, secs);
+
+    for (int ch = 0; ch < channels; ++ch)
+        free (planes[ch]);
+
+    free (dst);
+}
+
+int
+main (void)
+{
+    const int best = simd_setlevel (SIMD_V256);
+
+    for (int level = SIMD_SCALAR; level <= best; ++level) {
+        run ("S16P", 2, 2, level);
+        run ("FLTP", 4, 2, level);
+    }
+
+    run ("S16P", 2, 6, SIMD_SCALAR);
+    run ("FLTP", 4, 6, SIMD_SCALAR);
+
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "bench.h"
+
+#include "../audio.h"
+#include "../config.h"
+#include "../playctl.h"
+#include "../sink.h"
+
+// a 3 min stereo S16 track at 48 kHz
+#define RATE     48000
+#define NFRAMES  (RATE * 180)
+#define NREAL    (RATE * 2) // frames played in real time by the null sink
+#define BURST    192
+#define TRACK_FN "build/bench_player.wav"
+#define REAL_FN  "build/bench_player_real.wav"
+
+static bool
+write_wav (const char *path, size_t nframes)
+{
+    const uint32_t       datasiz = nframes * 4;
+    struct cwav_header_t header  = {
+         .riff = { .ckID = "RIFF", .WAVEID = "WAVE" },
+         .fmt  = { .ckID           = "fmt ",
+                   .cksize         = 16,
+                   .wFormatTag     = 1,
+                   .nChannels      = 2,
+                   .nSamplesPerSec = RATE,
+                   .nBlockAlign    = 4,
+                   .wBitsPerSample = 16 },
+         .data = { .ckID = "data", .cksize = datasiz },
+    };
+    header.riff.cksize         = 36 + datasiz;
+    header.fmt.nAvgBytesPerSec = RATE * 4;
+
+    static int16_t chunk[RATE * 2];
+    FILE          *fp = fopen (path, "wb");
+    bool           ok;
+
+    if (fp == NULL)
+        return false;
+
+    for (size_t i = 0; i < RATE * 2; ++i)
+        chunk[i] = (int16_t)(i * 31);
+
+    ok = fwrite (&header, CWAV_HEADER_SIZ, 1, fp) == 1;
+
+    for (size_t left = nframes; ok && left > 0;) {
+        const size_t n = left < RATE ? left : RATE;
+        ok             = fwrite (chunk, 4, n, fp) == n;
+        left -= n;
+    }
+
+    return fclose (fp) == 0 && ok;
+}
+
+/**
+ * everything after decoding, as fast as the sink takes it. push mode only:
+ * in pull mode the prefetch thread refills at the nominal rate
+ */
+static void
+bench_file (void)
+{
+    struct sink_host_t sink;
+
+    ncap_config.aaudio_optimize = CONFIG_AAUDIO_BLOCKING;
+    sink_file_init (&sink, "/dev/null", BURST, 0);
+    audio_set_sink (&sink.base);
+
+    const double t0  = bench_now ();
+    const int    ret = audio_play (TRACK_FN, 1);
+    const double dt  = bench_now () - t0;
+
+    audio_close ();
+
+    if (ret != NCAP_OK) {
+        fprintf (stderr, "audio_play failed with code %d\n", ret);
+        return;
+    }
+
+    puts ("blocking mode, file sink");
+    bench_report ("frames", NFRAMES, dt);
+    printf ("realtime:\t%.0fx\n", (double)NFRAMES / RATE / dt);
+}
+
+/** how closely the player keeps up with a device clock */
+static void
+bench_null (uint8_t mode, const char *name)
+{
+    struct sink_host_t sink;
+
+    ncap_config.aaudio_optimize = mode;
+    sink_null_init (&sink, BURST);
+    audio_set_sink (&sink.base);
+
+    const double t0  = bench_now ();
+    const int    ret = audio_play (REAL_FN, 1);
+    const double dt  = bench_now () - t0;
+
+    audio_close ();
+
+    if (ret != NCAP_OK) {
+        fprintf (stderr, "audio_play failed with code %d\n", ret);
+        return;
+    }
+
+    const double dur = (double)NREAL / RATE;
+
+    printf ("%s mode, null sink\n", name);
+    printf ("played:\t%.3f s in %.3f s (%+.1f ms)\n", dur, dt,
+            (dt - dur) * 1e3);
+    printf ("xruns:\t%d, buffer %d of %d frames\n", sink.nxrun,
+            sink.base.buf_siz, sink.base.buf_cap);
+}
+
+int
+main (void)
+{
+    mkdir ("build", 0755);
+
+    if (!write_wav (TRACK_FN, NFRAMES) || !write_wav (REAL_FN, NREAL)) {
+        fputs ("could not write the bench tracks\n", stderr);
+        return 1;
+    }
+
+    playctl_init (0);
+    playctl_setvol (80); // not 100, so the gain is applied
+
+    bench_file ();
+    bench_null (CONFIG_AAUDIO_BLOCKING, "blocking");
+    bench_null (0, "callback");
+
+    remove (TRACK_FN);
+    remove (REAL_FN);
+
+    return 0;
+}
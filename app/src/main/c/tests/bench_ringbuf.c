@@ -0,0 +1,100 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+
+#include "../audio.h"
+#include "../ringbuf.h"
+
+// stereo float, bursts of 192 frames as on a typical low latency stream
+#define FRAMESIZ 8
+#define BURST    192
+#define NBURSTS  32
+#define CHUNK    1152 // frames per decoded mp3 frame
+#define NFRAMES  (1 << 27)
+
+static void *
+tfn_produce (void *rb_vp)
+{
+    struct ringbuf_t *rb = rb_vp;
+    static uint8_t    chunk[CHUNK * FRAMESIZ];
+
+    memset (chunk, 0x5a, sizeof chunk);
+
+    for (size_t sent = 0; sent < NFRAMES;) {
+        const uint8_t *p = chunk;
+        size_t         n = CHUNK;
+
+        while (n > 0) {
+            const size_t w = ringbuf_write (rb, p, n);
+
+            // the decoder sleeps when the ring is full; yield so this also
+            // works on a single core
+            if (w == 0)
+                sched_yield ();
+
+            p += w * FRAMESIZ;
+            n -= w;
+        }
+
+        sent += CHUNK;
+    }
+
+    return NULL;
+}
+
+int
+main (void)
+{
+    struct ringbuf_t rb;
+    static uint8_t   burst[BURST * FRAMESIZ];
+
+    if (ringbuf_init (&rb, FRAMESIZ, BURST, NBURSTS) != NCAP_OK) {
+        fputs ("ringbuf_init failed\n", stderr);
+        return 1;
+    }
+
+    printf ("ring of %zu frames, %d bytes per frame, bursts of %d\n", rb.cap,
+            FRAMESIZ, BURST);
+
+    const double start = bench_now ();
+
+    pthread_t tid;
+    pthread_create (&tid, NULL, tfn_produce, &rb);
+
+    size_t   recv = 0;
+    uint64_t miss = 0;
+
+    while (recv + BURST <= NFRAMES) {
+        if (ringbuf_read_burst (&rb, burst)) {
+            recv += BURST;
+        } else {
+            ++miss;
+            sched_yield ();
+        }
+    }
+
+    while (recv < NFRAMES) {
+        const size_t left = NFRAMES - recv;
+        recv += ringbuf_read (&rb, burst, left < BURST ? left : BURST);
+    }
+
+    pthread_join (tid, NULL);
+
+    const double secs = bench_now () - start;
+
+    bench_report ("frames", recv, secs);
+    printf ("throughput:\t%.1f MiB/s\n",
+            recv * FRAMESIZ / secs / (1 << 20));
+    printf ("realtime:\t%.0fx at 48 kHz\n", recv / secs / 48000);
+    printf ("empty polls:\t%" PRIu64 "\n", miss);
+
+    ringbuf_deinit (&rb);
+
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+#include "../strvec.h"
+
+// names as dirscan finds them in an artist/album/track library
+#define NMAX  1000000
+#define NRUNS 3
+
+static char  *names; // NUL separated, as a dirscan worker's buffer
+static size_t names_siz;
+
+static void
+make_names (void)
+{
+    char *p;
+
+    names = malloc ((size_t)NMAX * 40);
+    p     = names;
+
+    for (int i = 0; i < NMAX; ++i)
+        p += sprintf (p, "artist %04d/album %02d/%02d.flac", i / 150,
+                      i / 15 % 10, i % 15)
+             + 1;
+
+    names_siz = p - names;
+}
+
+/** the previous strvec: a malloc per string and one per doubling */
+static double
+run_malloc (size_t n)
+{
+    const double t0  = bench_now ();
+    size_t       cap = 1;
+    size_t       siz = 0;
+    char       **ptr = malloc (sizeof *ptr);
+    const char  *p   = names;
+
+    for (size_t i = 0; i < n; ++i) {
+        const size_t len = strlen (p);
+
+        if (siz == cap)
+            ptr = realloc (ptr, (cap <<= 1) * sizeof *ptr);
+
+        ptr[siz] = malloc (len + 1);
+        memcpy (ptr[siz++], p, len + 1);
+        p += len + 1;
+    }
+
+    while (siz > 0)
+        free (ptr[--siz]);
+
+    free (ptr);
+
+    return bench_now () - t0;
+}
+
+static double
+run_pushb (size_t n, double *teardown)
+{
+    const double t0 = bench_now ();
+    strvec_t     sv;
+    const char  *p = names;
+
+    strvec_init (&sv);
+
+    for (size_t i = 0; i < n; ++i) {
+        const size_t len = strlen (p);
+
+        strvec_pushb (&sv, p, len);
+        p += len + 1;
+    }
+
+    const double t1 = bench_now ();
+
+    strvec_deinit (&sv);
+    *teardown = bench_now () - t1;
+
+    return bench_now () - t0;
+}
+
+static double
+run_pushn (size_t n)
+{
+    const double t0  = bench_now ();
+    const char  *end = names;
+    strvec_t     sv;
+
+    for (size_t i = 0; i < n; ++i)
+        end += strlen (end) + 1;
+
+    strvec_init (&sv);
+    strvec_pushn (&sv, names, end - names, n);
+    strvec_deinit (&sv);
+
+    return bench_now () - t0;
+}
+
+int
+main (void)
+{
+    make_names ();
+    printf ("%d names in %zu bytes\n", NMAX, names_siz);
+
+    for (size_t n = 10000; n <= NMAX; n *= 10) {
+        double t_malloc = 0, t_pushb = 0, t_pushn = 0, t_free = 0;
+
+        for (int r = 0; r < NRUNS; ++r) {
+            double teardown;
+
+            t_malloc += run_malloc (n);
+            t_pushb += run_pushb (n, &teardown);
+            t_pushn += run_pushn (n);
+            t_free += teardown;
+        }
+
+        printf ("%zu strings, ns per string:\tmalloc each %.1f\tpushb %.1f "
+                "(teardown %.2f)\tpushn %.1f\n",
+                n, t_malloc * 1e9 / (n * NRUNS), t_pushb * 1e9 / (n * NRUNS),
+                t_free * 1e9 / (n * NRUNS), t_pushn * 1e9 / (n * NRUNS));
+    }
+
+    free (names);
+
+    return 0;
+}
@@ -0,0 +1,354 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#include "../audio.h"
+#include "../tagcache.h"
+#include "../tagparse.h"
+
+/*
+ * Files per second read by tagparse_read. Built with -DBENCH_LIBAV, and
+ * libav_bind with its DEPS and the libav libraries, the same files are read
+ * by libav_read_meta too. The audio is left as holes, so the files are as
+ * large as real ones without taking the disk; both readers see them from the
+ * page cache.
+ */
+
+#define DIR     "build/tagparse_bench"
+#define NFILES  200 // per container
+#define NRUNS   3
+#define PIC_SIZ 65536 // cover art, as ID3 and FLAC embed it
+
+struct buf_t {
+    uint8_t p[2 * PIC_SIZ];
+    size_t  n;
+};
+
+static void
+put (struct buf_t *b, const void *src, size_t len)
+{
+    if (src != NULL)
+        memcpy (b->p + b->n, src, len);
+    else
+        memset (b->p + b->n, 0, len);
+
+    b->n += len;
+}
+
+static void
+put_be32 (struct buf_t *b, uint32_t v)
+{
+    const uint8_t p[4] = { v >> 24, v >> 16, v >> 8, v };
+
+    put (b, p, 4);
+}
+
+static void
+put_le32 (struct buf_t *b, uint32_t v)
+{
+    const uint8_t p[4] = { v, v >> 8, v >> 16, v >> 24 };
+
+    put (b, p, 4);
+}
+
+static void
+put_comment (struct buf_t *b)
+{
+    static const char *const kv[] = { "TITLE=Some title", "ARTIST=Someone",
+                                      "ALBUM=Some album", "TRACKNUMBER=4" };
+
+    put_le32 (b, 6);
+    put (b, "vendor", 6);
+    put_le32 (b, 4);
+
+    for (int i = 0; i < 4; ++i) {
+        put_le32 (b, (uint32_t)strlen (kv[i]));
+        put (b, kv[i], strlen (kv[i]));
+    }
+}
+
+/** a file of siz bytes, head at its start and tail at its end */
+static bool
+write_parts (const char *fn, const struct buf_t *head, off_t siz,
+             const struct buf_t *tail)
+{
+    const int fd = open (fn, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    bool      ok;
+
+    if (fd < 0)
+        return false;
+
+    ok = pwrite (fd, head->p, head->n, 0) == (ssize_t)head->n
+         && ftruncate (fd, siz) == 0
+         && (tail == NULL
+             || pwrite (fd, tail->p, tail->n, siz - (off_t)tail->n)
+                    == (ssize_t)tail->n);
+
+    return close (fd) == 0 && ok;
+}
+
+static struct buf_t head, tail;
+
+static bool
+make_wav (const char *fn)
+{
+    static const uint8_t fmt[16] = { 1, 0, 2, 0, 0x44, 0xac, 0, 0,
+                                     0x10, 0xb1, 0x02, 0, 4, 0, 16, 0 };
+    const uint32_t       datasiz = 30 << 20;
+
+    head.n = 0;
+    put (&head, "RIFF", 4);
+    put_le32 (&head, 36 + datasiz);
+    put (&head, "WAVEfmt ", 8);
+    put_le32 (&head, 16);
+    put (&head, fmt, sizeof fmt);
+    put (&head, "data", 4);
+    put_le32 (&head, datasiz);
+
+    return write_parts (fn, &head, CWAV_HEADER_SIZ + datasiz, NULL);
+}
+
+static bool
+make_flac (const char *fn)
+{
+    static const uint8_t info[34] = {
+        0x10, 0, 0x10, 0, 0, 0, 0, 0, 0, 0, 0x0a, 0xc4, 0x42, 0xf0,
+        0x00, 0xa1, 0x80, 0xc0, // 44.1 kHz, 240 s
+    };
+
+    head.n = 0;
+    put (&head, "fLaC\x00\x00\x00\x22", 8);
+    put (&head, info, sizeof info);
+    put_be32 (&head, 6u << 24 | PIC_SIZ);
+    put (&head, NULL, PIC_SIZ);
+
+    const size_t at = head.n;
+
+    put_be32 (&head, 0);
+    put_comment (&head);
+    head.p[at]     = 0x80 | 4;
+    head.p[at + 3] = (uint8_t)(head.n - at - 4);
+
+    return write_parts (fn, &head, 25 << 20, NULL);
+}
+
+static bool
+make_mp3 (const char *fn)
+{
+    const uint32_t tagsiz = 10 + 11 + 10 + 10 + PIC_SIZ;
+
+    head.n = 0;
+    put (&head, "ID3\x03\x00\x00", 6);
+    put_be32 (&head, (tagsiz >> 21 & 0x7f) << 24 | (tagsiz >> 14 & 0x7f) << 16
+                         | (tagsiz >> 7 & 0x7f) << 8 | (tagsiz & 0x7f));
+    put (&head, "TIT2", 4);
+    put_be32 (&head, 11);
+    put (&head, "\x00\x00\x00Some title", 13);
+    put (&head, "APIC", 4);
+    put_be32 (&head, 10 + PIC_SIZ);
+    put (&head, "\0\0\0image/\0\3\0", 12);
+    put (&head, NULL, PIC_SIZ);
+
+    // two CBR frames, the rest a hole
+    for (int i = 0; i < 2; ++i) {
+        put_be32 (&head, 0xfffb9000);
+        put (&head, NULL, 413);
+    }
+
+    tail.n = 0;
+    put (&tail, "TAG", 3);
+    put (&tail, "Some title", 10);
+    put (&tail, NULL, 115);
+
+    return write_parts (fn, &head, 6 << 20, &tail);
+}
+
+/** an MP4 atom of the body given, its size first */
+static void
+put_atom (struct buf_t *b, const char *type, const void *body, size_t len)
+{
+    put_be32 (b, (uint32_t)(8 + len));
+    put (b, type, 4);
+    put (b, body, len);
+}
+
+static bool
+make_mp4 (const char *fn)
+{
+    static struct buf_t a, c;
+    const off_t         siz = 8 << 20;
+
+    a.n = 0;
+    c.n = 0;
+
+    head.n = 0;
+    put_atom (&head, "ftyp", "M4A \0\0\0\0", 8);
+
+    // moov at the end, the way most encoders leave it; built inside out
+    put (&a, "\0\0\0\1\0\0\0\0Some title", 18);
+    put_atom (&c, "data", a.p, a.n);
+    a.n = 0;
+    put_atom (&a, "\xa9nam", c.p, c.n);
+    c.n = 0;
+    put (&c, NULL, 4);
+    put_atom (&c, "hdlr", NULL, 25);
+    put_atom (&c, "ilst", a.p, a.n);
+    a.n = 0;
+    put_atom (&a, "meta", c.p, c.n);
+    c.n = 0;
+    put_atom (&c, "udta", a.p, a.n);
+
+    a.n = 0;
+    put (&a, NULL, 12);
+    put_be32 (&a, 44100);
+    put_be32 (&a, 44100 * 240);
+    put (&a, NULL, 80);
+
+    tail.n = 0;
+    put_be32 (&tail, (uint32_t)(8 + 8 + a.n + c.n));
+    put (&tail, "moov", 4);
+    put_atom (&tail, "mvhd", a.p, a.n);
+    put (&tail, c.p, c.n);
+
+    put_be32 (&head, (uint32_t)(siz - (off_t)head.n - (off_t)tail.n));
+    put (&head, "mdat", 4);
+
+    return write_parts (fn, &head, siz, &tail);
+}
+
+static void
+put_page (struct buf_t *b, int type, uint64_t granule, const void *body,
+          size_t len)
+{
+    put (b, "OggS", 4);
+    put (b, (const uint8_t[]){ 0, (uint8_t)type }, 2);
+    put_le32 (b, (uint32_t)granule);
+    put_le32 (b, (uint32_t)(granule >> 32));
+    put_le32 (b, 1);
+    put (b, NULL, 8);
+    put (b, (const uint8_t[]){ 1, (uint8_t)len }, 2);
+    put (b, body, len);
+}
+
+static bool
+make_ogg (const char *fn)
+{
+    static struct buf_t cm;
+
+    cm.n = 0;
+
+    put (&cm, "OpusTags", 8);
+    put_comment (&cm);
+
+    head.n = 0;
+    put_page (&head, 2, 0, "OpusHead\1\2\x38\1\x80\xbb\0\0\0\0\0", 19);
+    put_page (&head, 0, 0, cm.p, cm.n);
+
+    tail.n = 0;
+    put_page (&tail, 4, 48000 * 240 + 312, NULL, 200);
+
+    return write_parts (fn, &head, 4 << 20, &tail);
+}
+
+static const struct {
+    const char *ext;
+    bool (*make) (const char *fn);
+} kinds[] = {
+    { "wav", make_wav }, { "flac", make_flac }, { "mp3", make_mp3 },
+    { "m4a", make_mp4 }, { "opus", make_ogg },
+};
+#define NKINDS (sizeof kinds / sizeof *kinds)
+
+static void
+path (char *dst, size_t kind, int i)
+{
+    sprintf (dst, DIR "/%03d.%s", i, kinds[kind].ext);
+}
+
+/** @return the seconds to read every file of kind, once, by read */
+static double
+run (size_t kind, tagcache_read_t read, size_t *nok)
+{
+    struct tagcache_meta_t meta;
+    char                   fn[64];
+    const double           t0 = bench_now ();
+
+    for (int i = 0; i < NFILES; ++i) {
+        path (fn, kind, i);
+        memset (&meta, 0, sizeof meta);
+        *nok += read (fn, &meta) == NCAP_OK && meta.duration_ms > 0;
+    }
+
+    return bench_now () - t0;
+}
+
+static void
+bench (const char *name, tagcache_read_t read)
+{
+    double total = 0;
+
+    printf ("%s\n", name);
+
+    for (size_t k = 0; k < NKINDS; ++k) {
+        double best = 1e9;
+        size_t nok  = 0;
+
+        for (int r = 0; r < NRUNS; ++r) {
+            const double secs = run (k, read, &nok);
+
+            best = secs < best ? secs : best;
+        }
+
+        printf ("  %-5s %zu/%d read with a duration, ", kinds[k].ext,
+                nok / NRUNS, NFILES);
+        bench_report ("files", NFILES, best);
+        total += best;
+    }
+
+    printf ("  all   ");
+    bench_report ("files", NFILES * NKINDS, total);
+}
+
+int
+main (void)
+{
+    char fn[64];
+
+    mkdir ("build", 0700);
+    mkdir (DIR, 0700);
+
+    for (size_t k = 0; k < NKINDS; ++k)
+        for (int i = 0; i < NFILES; ++i) {
+            path (fn, k, i);
+
+            if (!kinds[k].make (fn)) {
+                fprintf (stderr, "could not write %s\n", fn);
+                return 1;
+            }
+        }
+
+    bench ("tagparse_read", tagparse_read);
+
+#ifdef BENCH_LIBAV
+    bench ("libav_read_meta", libav_read_meta);
+#endif
+
+    for (size_t k = 0; k < NKINDS; ++k)
+        for (int i = 0; i < NFILES; ++i) {
+            path (fn, k, i);
+            remove (fn);
+        }
+
+    rmdir (DIR);
+
+    return 0;
+}
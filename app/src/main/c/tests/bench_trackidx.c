@@ -0,0 +1,180 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "bench.h"
+
+#include "../audio.h"
+#include "../dirscan.h"
+#include "../strvec.h"
+#include "../trackidx.h"
+
+// the library of bench_dirscan: artist/album/track, with a cover per album
+#define TREE     "build/bench_trackidx"
+#define IDX      "build/bench_trackidx.idx"
+#define NARTISTS 100
+#define NALBUMS  10
+#define NTRACKS  15
+#define NFILES   (NARTISTS * NALBUMS * NTRACKS)
+#define NDIRS    (1 + NARTISTS * (NALBUMS + 1))
+#define NRUNS    20
+
+static int
+make_tree (void)
+{
+    char path[256];
+
+    mkdir (TREE, 0700);
+
+    for (int a = 0; a < NARTISTS; ++a) {
+        snprintf (path, sizeof path, TREE "/artist %03d", a);
+        mkdir (path, 0700);
+
+        for (int b = 0; b < NALBUMS; ++b) {
+            snprintf (path, sizeof path, TREE "/artist %03d/album %02d", a,
+                      b);
+            mkdir (path, 0700);
+
+            for (int t = 0; t <= NTRACKS; ++t) {
+                FILE *fp;
+
+                if (t < NTRACKS)
+                    snprintf (path, sizeof path,
+                              TREE "/artist %03d/album %02d/%02d.flac", a, b,
+                              t);
+                else
+                    snprintf (path, sizeof path,
+                              TREE "/artist %03d/album %02d/cover.jpg", a, b);
+
+                if ((fp = fopen (path, "w")) == NULL)
+                    return -1;
+
+                fclose (fp);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int
+rm (const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove (path);
+}
+
+/** a track added to one album, as a sync from a computer would */
+static void
+add_track (int run)
+{
+    static time_t   sec = 1000000000;
+    struct timespec ts[2] = { { .tv_nsec = UTIME_OMIT }, { .tv_sec = ++sec } };
+    char            path[256];
+    FILE           *fp;
+
+    snprintf (path, sizeof path, TREE "/artist %03d/album 00/new %02d.flac",
+              run % NARTISTS, run);
+
+    if ((fp = fopen (path, "w")) != NULL)
+        fclose (fp);
+
+    snprintf (path, sizeof path, TREE "/artist %03d/album 00",
+              run % NARTISTS);
+    utimensat (AT_FDCWD, path, ts, 0);
+}
+
+int
+main (void)
+{
+    struct trackidx_t idx;
+    strvec_t          sv;
+    size_t            n, nscanned;
+    double            t0;
+
+    nftw (TREE, rm, 16, FTW_DEPTH | FTW_PHYS);
+    remove (IDX);
+
+    // a tree just made is racy, not how a library is found at startup
+    trackidx_racy_ns = 0;
+
+    if (make_tree () != 0) {
+        fputs ("could not make the tree\n", stderr);
+        return 1;
+    }
+
+    printf ("%d files in %d directories\n", NFILES + NARTISTS * NALBUMS,
+            NDIRS);
+
+    // warm the dentry cache, as a rescan would find it
+    strvec_init (&sv);
+    dirscan (&sv, TREE, dirscan_audio_exts, 1);
+    strvec_deinit (&sv);
+
+    n  = 0;
+    t0 = bench_now ();
+
+    for (int r = 0; r < NRUNS; ++r) {
+        strvec_init (&sv);
+        dirscan (&sv, TREE, dirscan_audio_exts, 1);
+        n += sv.siz;
+        strvec_deinit (&sv);
+    }
+
+    bench_report ("dirscan files", n, bench_now () - t0);
+
+    n  = 0;
+    t0 = bench_now ();
+
+    for (int r = 0; r < NRUNS; ++r) {
+        remove (IDX);
+        trackidx_open (&idx, IDX);
+        trackidx_update (&idx, IDX, TREE, dirscan_audio_exts, NULL);
+        n += idx.ntracks;
+        trackidx_close (&idx);
+    }
+
+    bench_report ("trackidx built files", n, bench_now () - t0);
+
+    // startup: map the index, stat each directory
+
+    n  = 0;
+    t0 = bench_now ();
+
+    for (int r = 0; r < NRUNS; ++r) {
+        trackidx_open (&idx, IDX);
+        trackidx_update (&idx, IDX, TREE, dirscan_audio_exts, &nscanned);
+        n += idx.ntracks;
+        trackidx_close (&idx);
+    }
+
+    bench_report ("trackidx unchanged files", n, bench_now () - t0);
+
+    n  = 0;
+    t0 = bench_now ();
+
+    for (int r = 0; r < NRUNS; ++r) {
+        add_track (r);
+        trackidx_open (&idx, IDX);
+        trackidx_update (&idx, IDX, TREE, dirscan_audio_exts, &nscanned);
+        n += idx.ntracks;
+        trackidx_close (&idx);
+    }
+
+    bench_report ("trackidx one album changed files", n, bench_now () - t0);
+
+    if (nscanned != 1)
+        fprintf (stderr, "%zu directories were listed, not 1\n", nscanned);
+
+    nftw (TREE, rm, 16, FTW_DEPTH | FTW_PHYS);
+    remove (IDX);
+
+    return 0;
+}
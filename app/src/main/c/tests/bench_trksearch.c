@@ -0,0 +1,191 @@
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+#include "../simd.h"
+#include "../trksearch.h"
+
+// names as the track index lists an artist/album/track library
+#define NNAMES 500000
+#define NRUNS  5
+
+static const char *const words[] = {
+    "love", "night", "blue", "heart", "river", "dream", "fire", "rain",
+    "light", "home", "gold", "road", "storm", "shadow", "summer", "ghost",
+};
+#define NWORDS (sizeof words / sizeof *words)
+
+// typed one key at a time
+static const char *const queries[] = { "river", "summer rain", "ARTIST 01" };
+
+static char        *buf;
+static const char **names;
+
+static void
+make_names (void)
+{
+    unsigned seed = 1;
+    char    *p;
+
+    buf   = malloc ((size_t)NNAMES * 80);
+    names = malloc (NNAMES * sizeof *names);
+    p     = buf;
+
+    for (int i = 0; i < NNAMES; ++i) {
+        names[i] = p;
+        p += sprintf (p, "Artist %04d/%s %s/%02d %s %s.flac", i / 150,
+                      words[rand_r (&seed) % NWORDS],
+                      words[rand_r (&seed) % NWORDS], i % 15,
+                      words[rand_r (&seed) % NWORDS],
+                      words[rand_r (&seed) % NWORDS])
+             + 1;
+    }
+}
+
+/** the lookup without the index: a substring scan of every name */
+static double
+run_scan (const char *query, size_t *nfound)
+{
+    const double t0 = bench_now ();
+    size_t       n  = 0;
+
+    for (size_t i = 0; i < NNAMES; ++i)
+        n += strcasestr (names[i], query) != NULL;
+
+    *nfound = n;
+
+    return bench_now () - t0;
+}
+
+/** type query a key at a time, as the UI would */
+static double
+run_typed (const struct trksearch_t *idx, const char *query, size_t *nfound)
+{
+    char                 typed[TRKSEARCH_MAX_QUERY];
+    struct trksearch_q_t q;
+    const size_t         len = strlen (query);
+    const double         t0  = bench_now ();
+
+    trksearch_q_init (&q);
+
+    for (size_t i = 1; i <= len; ++i) {
+        memcpy (typed, query, i);
+        typed[i] = '\0';
+        trksearch_query (idx, &q, typed);
+    }
+
+    *nfound = q.nids;
+    trksearch_q_deinit (&q);
+
+    return (bench_now () - t0) / len;
+}
+
+typedef size_t (*intersect_fn) (uint32_t *, size_t, const uint32_t *,
+                                size_t);
+
+/**
+ * intersect the names holding "in" with those holding "er", two long lists
+ * of about the same length, as the first keys of a cold query do
+ */
+static double
+run_intersect (const struct trksearch_t *idx, intersect_fn f)
+{
+    struct trksearch_q_t q;
+    uint32_t            *a, *b, *tmp;
+    size_t               na, nb;
+    double               t = 0;
+
+    trksearch_q_init (&q);
+
+    trksearch_query (idx, &q, "in");
+    na = q.nids;
+    a  = malloc (na * sizeof *a);
+    memcpy (a, q.ids, na * sizeof *a);
+
+    trksearch_query (idx, &q, "er");
+    nb = q.nids;
+    b  = malloc (nb * sizeof *b);
+    memcpy (b, q.ids, nb * sizeof *b);
+
+    tmp = malloc (na * sizeof *tmp);
+
+    for (int r = 0; r < NRUNS; ++r) {
+        memcpy (tmp, a, na * sizeof *tmp);
+
+        const double t0 = bench_now ();
+
+        f (tmp, na, b, nb);
+        t += bench_now () - t0;
+    }
+
+    printf ("intersect %zu and %zu ids:", na, nb);
+
+    free (tmp);
+    free (b);
+    free (a);
+    trksearch_q_deinit (&q);
+
+    return t / NRUNS;
+}
+
+int
+main (void)
+{
+    struct trksearch_t idx;
+
+    make_names ();
+
+    double t_init = 0;
+
+    for (int r = 0; r < NRUNS; ++r) {
+        const double t0 = bench_now ();
+
+        trksearch_init (&idx, names, NNAMES);
+        t_init += bench_now () - t0;
+
+        if (r + 1 < NRUNS)
+            trksearch_deinit (&idx);
+    }
+
+    printf ("%d names, build %.1f ms, %u postings\n", NNAMES,
+            t_init * 1e3 / NRUNS, idx.post_off[TRKSEARCH_NKEYS]);
+
+    for (size_t i = 0; i < sizeof queries / sizeof *queries; ++i) {
+        size_t nscan, ntyped;
+        double t_scan = 0, t_typed = 0;
+
+        for (int r = 0; r < NRUNS; ++r) {
+            t_scan += run_scan (queries[i], &nscan);
+            t_typed += run_typed (&idx, queries[i], &ntyped);
+        }
+
+        printf ("'%s':\tscan %.2f ms\tindexed %.3f ms per key\t"
+                "(%zu, %zu found)\n",
+                queries[i], t_scan * 1e3 / NRUNS, t_typed * 1e3 / NRUNS, nscan,
+                ntyped);
+    }
+
+    for (int level = simd_level (); level >= SIMD_SCALAR; --level) {
+        simd_setlevel (level);
+
+        const double t = run_intersect (&idx, trksearch_intersect);
+
+        printf ("\tsimd_level %d %.3f ms\n", level, t * 1e3);
+    }
+
+    const double t = run_intersect (&idx, trksearch_intersect_scalar);
+
+    printf ("\tscalar merge %.3f ms\n", t * 1e3);
+
+    simd_setlevel (SIMD_V256);
+    trksearch_deinit (&idx);
+    free (names);
+    free (buf);
+
+    return 0;
+}
@@ -29,6 +29,10 @@ main (void)
     ncap_config.isrepeat         = 0; // false
     ncap_config.isshuffle        = 0; // false
     ncap_config.volume           = 80;
+    ncap_config.eq_preset        = EQ_PRESET_CUSTOM;
+    ncap_config.eq_nbands        = 1;
+    ncap_config.eq_preamp_db     = -3;
+    ncap_config.eq_bands[0]      = (struct eq_band_t){ 1000, 3, 1, EQ_PEAK };
     ncap_config.track_path       = "foo/bar";
     ncap_config.track_path_len   = strlen (ncap_config.track_path) + 1;
     const struct config_t cfgcpy = ncap_config;
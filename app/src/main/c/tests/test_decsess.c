@@ -0,0 +1,116 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/mem.h>
+
+#include "test.h"
+
+#include "../decsess.h"
+
+/*
+ * Needs libav, so it is built with its libraries, e.g.
+ * make test TARG=decsess LDLIBS="-lm -lavcodec -lavutil -lswresample"
+ */
+
+size_t passcnt = 0;
+size_t failcnt = 0;
+
+// 4096-frame blocks, 44.1 kHz, 2 channels, 16 bits
+static const uint8_t streaminfo[34] = {
+    0x10, 0x00, 0x10, 0x00, 0x00, 0x00, 0x0e, 0x00, 0x38, 0x00, 0x0a, 0xc4,
+    0x42, 0xf0, 0x00, 0xa1, 0x80, 0xc0, 0x5d, 0x41, 0x0c, 0x8a, 0x27, 0x19,
+    0xe3, 0x06, 0xb2, 0x74, 0x90, 0x1f, 0xcc, 0x38, 0x6a, 0x55,
+};
+
+/** FLAC stream parameters from info, as libavformat fills them */
+static AVCodecParameters *
+flac_par (const uint8_t *info)
+{
+    AVCodecParameters *par = avcodec_parameters_alloc ();
+
+    if (par == NULL)
+        return NULL;
+
+    par->codec_type  = AVMEDIA_TYPE_AUDIO;
+    par->codec_id    = AV_CODEC_ID_FLAC;
+    par->sample_rate = 44100;
+    av_channel_layout_default (&par->ch_layout, 2);
+
+    par->extradata = av_mallocz (sizeof streaminfo
+                                 + AV_INPUT_BUFFER_PADDING_SIZE);
+
+    if (par->extradata == NULL) {
+        avcodec_parameters_free (&par);
+        return NULL;
+    }
+
+    memcpy (par->extradata, info, sizeof streaminfo);
+    par->extradata_size = sizeof streaminfo;
+
+    return par;
+}
+
+int
+main (void)
+{
+    const AVCodec         *codec = avcodec_find_decoder (AV_CODEC_ID_FLAC);
+    AVCodecParameters     *a = NULL, *b = NULL, *c = NULL;
+    struct decsess_t      *s, *t;
+    struct decsess_stats_t st;
+    uint8_t                info[sizeof streaminfo];
+
+    assert_fatal (codec != NULL, "libav has no FLAC decoder", exit);
+
+    // another file of the same format: its frame sizes, total samples and
+    // MD5 differ
+    memcpy (info, streaminfo, sizeof info);
+    info[6] = 0x0f;
+    info[13] |= 0x01;
+    info[16] ^= 0xff;
+
+    for (size_t i = 18; i < sizeof info; ++i)
+        info[i] ^= 0x5a;
+
+    a = flac_par (streaminfo);
+    b = flac_par (info);
+
+    // and one with smaller blocks
+    memcpy (info, streaminfo, sizeof info);
+    info[0] = info[2] = 0x04;
+    info[1] = info[3] = 0x80;
+    c = flac_par (info);
+
+    assert_fatal (a != NULL && b != NULL && c != NULL,
+                  "allocating the parameters failed", exit);
+
+    s = decsess_acquire (codec, a);
+    assert_fatal (s != NULL, "opening a FLAC decoder failed", exit);
+    decsess_release (s, true);
+
+    t = decsess_acquire (codec, b);
+    assert_fatal (t != NULL, "opening a FLAC decoder failed", exit);
+    assert_nonfatal (t == s, "a track with other STREAMINFO missed the pool");
+    decsess_release (t, true);
+
+    t = decsess_acquire (codec, c);
+    assert_fatal (t != NULL, "opening a FLAC decoder failed", exit);
+    assert_nonfatal (t != s, "a track with other block sizes hit the pool");
+    decsess_release (t, true);
+
+    decsess_stats (&st);
+    assert_nonfatal (st.hits == 1 && st.misses == 2,
+                     "the pool stats do not count one hit and two misses");
+
+exit:
+    decsess_clear ();
+    avcodec_parameters_free (&a);
+    avcodec_parameters_free (&b);
+    avcodec_parameters_free (&c);
+    report ();
+
+    return 0;
+}
@@ -0,0 +1,163 @@
+#define _GNU_SOURCE
+
+#include <ftw.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#include "../audio.h"
+#include "../dirscan.h"
+#include "../strvec.h"
+
+size_t passcnt = 0;
+size_t failcnt = 0;
+
+#define TREE  "build/dirscan"
+#define NWIDE 150 // subdirectories of one directory: more than the queue
+
+// besides wide/NNN/NNN.mp3. in strcmp order
+static const char *const audio[] = {
+    "B.MP3", "a.flac", "sub/d.wav", "sub/deep/deeper/g.ogg",
+    "sub/deep/e.opus",
+};
+
+static const char *const other[] = { "c.txt", "sub/deep/f.jpg" };
+
+static bool
+touch (const char *rel)
+{
+    char  path[256];
+    FILE *fp;
+
+    snprintf (path, sizeof path, TREE "/%s", rel);
+
+    if ((fp = fopen (path, "w")) == NULL)
+        return false;
+
+    return fclose (fp) == 0;
+}
+
+static bool
+make_tree (void)
+{
+    char rel[64];
+    bool isok = true;
+
+    mkdir (TREE, 0700);
+    mkdir (TREE "/sub", 0700);
+    mkdir (TREE "/sub/deep", 0700);
+    mkdir (TREE "/sub/deep/deeper", 0700);
+    mkdir (TREE "/wide", 0700);
+
+    for (size_t i = 0; i < sizeof audio / sizeof *audio; ++i)
+        isok = isok && touch (audio[i]);
+
+    for (size_t i = 0; i < sizeof other / sizeof *other; ++i)
+        isok = isok && touch (other[i]);
+
+    for (int i = 0; i < NWIDE; ++i) {
+        snprintf (rel, sizeof rel, TREE "/wide/%03d", i);
+        mkdir (rel, 0700);
+        snprintf (rel, sizeof rel, "wide/%03d/%03d.mp3", i, i);
+        isok = isok && touch (rel);
+    }
+
+    // links are skipped, so a link back up cannot loop
+    isok = isok && symlink ("a.flac", TREE "/link.flac") == 0
+           && symlink ("..", TREE "/sub/up") == 0;
+
+    return isok;
+}
+
+static int
+rm (const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove (path);
+}
+
+/** @return whether sv from siz0 on is audio, then the wide tracks */
+static bool
+isaudio (const strvec_t *sv, size_t siz0)
+{
+    char   rel[64];
+    size_t k = siz0;
+
+    if (sv->siz - siz0 != sizeof audio / sizeof *audio + NWIDE)
+        return false;
+
+    for (size_t i = 0; i < sizeof audio / sizeof *audio; ++i)
+        if (strcmp (sv->ptr[k++], audio[i]) != 0)
+            return false;
+
+    for (int i = 0; i < NWIDE; ++i) {
+        snprintf (rel, sizeof rel, "wide/%03d/%03d.mp3", i, i);
+
+        if (strcmp (sv->ptr[k++], rel) != 0)
+            return false;
+    }
+
+    return true;
+}
+
+int
+main (void)
+{
+    strvec_t sv;
+
+    nftw (TREE, rm, 16, FTW_DEPTH | FTW_PHYS);
+    assert_fatal (make_tree (), "could not make the tree", exit);
+    assert_fatal (strvec_init (&sv) == STRQUEUE_OK, "strvec_init failed",
+                  exit);
+
+    for (int nthreads = 1; nthreads <= 4; nthreads += 3) {
+        assert_nonfatal (dirscan (&sv, TREE, dirscan_audio_exts, nthreads)
+                                 == NCAP_OK
+                             && isaudio (&sv, 0),
+                         "the scan doesn't list exactly the audio files");
+
+        strvec_deinit (&sv);
+        strvec_init (&sv);
+    }
+
+    // as on a filesystem that reports no types. appends to what sv holds
+    dirscan_isuntyped = true;
+    strvec_pushb (&sv, "kept", 4);
+
+    assert_nonfatal (dirscan (&sv, TREE, dirscan_audio_exts, 4) == NCAP_OK
+                         && strcmp (sv.ptr[0], "kept") == 0
+                         && isaudio (&sv, 1),
+                     "DT_UNKNOWN entries weren't typed");
+
+    dirscan_isuntyped = false;
+    strvec_deinit (&sv);
+    strvec_init (&sv);
+
+    const size_t nall = sizeof audio / sizeof *audio
+                        + sizeof other / sizeof *other + NWIDE;
+
+    assert_nonfatal (dirscan (&sv, TREE, NULL, 2) == NCAP_OK
+                         && sv.siz == nall,
+                     "without exts, not every regular file was listed");
+
+    assert_nonfatal (dirscan (&sv, "build/nonexistent", NULL, 2) == NCAP_EIO
+                         && sv.siz == nall,
+                     "a missing dir was scanned");
+
+    strvec_deinit (&sv);
+
+exit:
+    nftw (TREE, rm, 16, FTW_DEPTH | FTW_PHYS);
+
+    report ();
+
+    return 0;
+}
@@ -0,0 +1,221 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+#include "../eq.h"
+#include "../simd.h"
+
+size_t passcnt = 0;
+size_t failcnt = 0;
+
+#define RATE         48000
+#define MAX_CHANNELS 3
+#define MAX_FRAMES   1031
+
+static union {
+    int16_t s16[MAX_CHANNELS * MAX_FRAMES];
+    int32_t s32[MAX_CHANNELS * MAX_FRAMES];
+    float   flt[MAX_CHANNELS * MAX_FRAMES];
+} src, want, got;
+
+static float sine[RATE];
+
+// an odd number of bands, so the vector kernels pass stages through
+static const struct eq_band_t custom[] = {
+    { 60, 6, 0.8f, EQ_LOWSHELF },
+    { 2500, -4, 2, EQ_PEAK },
+    { 12000, 3, 1, EQ_HIGHSHELF },
+};
+
+/** the vector kernels may round an S16 or S32 sample the other way */
+static int
+near (uint16_t fmt, size_t i)
+{
+    switch (fmt) {
+        case 1:
+            return abs (want.s16[i] - got.s16[i]) <= 1;
+        case 2:
+            return llabs ((long long)want.s32[i] - got.s32[i]) <= 256;
+        default:
+            return fabsf (want.flt[i] - got.flt[i])
+                   <= 1e-5f * (fabsf (want.flt[i]) + 1e-3f);
+    }
+}
+
+/**
+ * @return whether eq_apply matches eq_apply_scalar at simd_level, over two
+ * calls so the state carries between them
+ */
+static int
+check_level (void)
+{
+    static const uint16_t fmts[]    = { 1, 2, 3 };
+    static const size_t   nframes[] = { 0, 1, 2, 3, 4, 5, 17, 192, 1031 };
+    struct eq_t           ref, eq;
+
+    const struct eq_band_t *bands[] = { eq_presets[3].bands,
+                                        eq_presets[4].bands, custom };
+    const int nbands[] = { eq_presets[3].nbands, eq_presets[4].nbands, 3 };
+
+    for (size_t fi = 0; fi < sizeof fmts / sizeof *fmts; ++fi)
+        for (int ch = 1; ch <= MAX_CHANNELS; ++ch)
+            for (size_t n = 0; n < sizeof nframes / sizeof *nframes; ++n)
+                for (size_t b = 0; b < sizeof nbands / sizeof *nbands; ++b) {
+                    const size_t len   = nframes[n] * ch;
+                    const size_t width = fmts[fi] == 1 ? 2 : 4;
+                    const size_t half  = nframes[n] / 2;
+
+                    eq_init (&ref, RATE, ch, bands[b], nbands[b], -3);
+                    eq_init (&eq, RATE, ch, bands[b], nbands[b], -3);
+
+                    memcpy (&want, &src, sizeof src);
+                    memcpy (&got, &src, sizeof src);
+                    eq_apply_scalar (&ref, &want, fmts[fi], half);
+                    eq_apply_scalar (&ref, (char *)&want + half * ch * width,
+                                     fmts[fi], nframes[n] - half);
+                    eq_apply (&eq, &got, fmts[fi], half);
+                    eq_apply (&eq, (char *)&got + half * ch * width,
+                              fmts[fi], nframes[n] - half);
+
+                    for (size_t i = 0; i < len; ++i) {
+                        if (!near (fmts[fi], i)) {
+                            fprintf (stderr,
+                                     "mismatch: format %u, %d channels, "
+                                     "%zu frames, %d bands, sample %zu\n",
+                                     fmts[fi], ch, nframes[n], nbands[b], i);
+                            return 0;
+                        }
+                    }
+
+                    // past the end is untouched
+                    if (memcmp ((char *)&got + len * width,
+                                (char *)&src + len * width,
+                                sizeof src - len * width)
+                        != 0) {
+                        fprintf (stderr, "overrun: %d channels\n", ch);
+                        return 0;
+                    }
+                }
+
+    return 1;
+}
+
+/** @return the peak of the second half of a 1 s mono sine at hz through eq */
+static float
+response (struct eq_t *eq, float hz)
+{
+    float peak = 0;
+
+    for (size_t i = 0; i < RATE; ++i)
+        sine[i] = 0.25f * sinf (2 * (float)M_PI * hz * i / RATE);
+
+    eq_apply (eq, sine, 3, RATE);
+
+    for (size_t i = RATE / 2; i < RATE; ++i)
+        peak = fabsf (sine[i]) > peak ? fabsf (sine[i]) : peak;
+
+    return peak / 0.25f;
+}
+
+int
+main (void)
+{
+    struct eq_t eq;
+
+    srand (1);
+
+    for (size_t i = 0; i < MAX_CHANNELS * MAX_FRAMES; ++i)
+        src.s16[i] = (int16_t)rand ();
+
+    for (size_t i = 0; i < MAX_CHANNELS * MAX_FRAMES; ++i)
+        src.flt[i] = (float)(rand () - RAND_MAX / 2) / RAND_MAX;
+
+    // the response: 6 dB is 2x
+    const struct eq_band_t peak  = { 1000, 6, 1, EQ_PEAK };
+    const struct eq_band_t shelf = { 100, 6, 1, EQ_LOWSHELF };
+    const struct eq_band_t treb  = { 5000, -6, 1, EQ_HIGHSHELF };
+
+    eq_init (&eq, RATE, 1, &peak, 1, 0);
+    assert_nonfatal (fabsf (response (&eq, 1000) - 2) < 0.02f,
+                     "the peak isn't at its gain at its center");
+    eq_init (&eq, RATE, 1, &peak, 1, 0);
+    assert_nonfatal (fabsf (response (&eq, 60) - 1) < 0.02f,
+                     "the peak reaches far below its center");
+
+    eq_init (&eq, RATE, 1, &shelf, 1, 0);
+    assert_nonfatal (fabsf (response (&eq, 20) - 2) < 0.05f,
+                     "the low shelf isn't at its gain");
+    eq_init (&eq, RATE, 1, &shelf, 1, 0);
+    assert_nonfatal (fabsf (response (&eq, 5000) - 1) < 0.02f,
+                     "the low shelf reaches the highs");
+
+    eq_init (&eq, RATE, 1, &treb, 1, 0);
+    assert_nonfatal (fabsf (response (&eq, 20000) - 0.5f) < 0.02f,
+                     "the high shelf isn't at its gain");
+    eq_init (&eq, RATE, 1, &treb, 1, 0);
+    assert_nonfatal (fabsf (response (&eq, 200) - 1) < 0.02f,
+                     "the high shelf reaches the lows");
+
+    eq_init (&eq, RATE, 1, NULL, 0, -6.0206f);
+    assert_nonfatal (fabsf (response (&eq, 440) - 0.5f) < 1e-3f,
+                     "the preamp alone isn't applied");
+
+    // nothing to filter: bypassed
+    const struct eq_band_t nyq = { RATE / 2, 6, 1, EQ_PEAK };
+
+    eq_init (&eq, RATE, 2, &nyq, 1, 0);
+    assert_nonfatal (eq.nbands == 0, "a band at Nyquist was kept");
+    eq_init (&eq, RATE, EQ_MAX_CHANNELS + 1, &peak, 1, 0);
+    assert_nonfatal (eq.nbands == 0, "too many channels weren't bypassed");
+
+    for (uint8_t p = 0; p < eq_npresets; ++p) {
+        eq_init (&eq, RATE, 2, eq_presets[p].bands, eq_presets[p].nbands,
+                 eq_presets[p].preamp_db);
+        assert_nonfatal (eq.nbands == eq_presets[p].nbands,
+                         "a preset band was dropped at 48 kHz");
+    }
+
+    // S16 saturates instead of wrapping
+    int16_t dc[2 * 4800];
+
+    for (size_t i = 0; i < 2 * 4800; ++i)
+        dc[i] = i % 2 ? -20000 : 20000;
+
+    eq_init (&eq, RATE, 2, &shelf, 1, 0);
+    eq_apply (&eq, dc, 1, 4800);
+    assert_nonfatal (dc[2 * 4799] == INT16_MAX
+                         && dc[2 * 4799 + 1] == INT16_MIN,
+                     "S16 doesn't saturate");
+
+    // a tail decays to exact zeros, never through denormals
+    for (size_t i = 0; i < RATE; ++i)
+        sine[i] = i == 0;
+
+    eq_init (&eq, RATE, 1, &shelf, 1, 0);
+    eq_apply (&eq, sine, 3, RATE);
+    memset (sine, 0, sizeof sine);
+    eq_apply (&eq, sine, 3, RATE);
+    assert_nonfatal (eq.z1[0][0] == 0 && eq.z2[0][0] == 0,
+                     "the state wasn't flushed");
+
+    const int best = simd_level ();
+
+    printf ("simd_level:\t%d\n", best);
+
+    for (int level = SIMD_SCALAR; level <= best; ++level) {
+        assert_nonfatal (simd_setlevel (level) == level,
+                         "simd_setlevel didn't apply");
+        assert_nonfatal (check_level (),
+                         "eq_apply doesn't match eq_apply_scalar");
+    }
+
+    simd_setlevel (SIMD_V256);
+
+    report ();
+
+    return 0;
+}
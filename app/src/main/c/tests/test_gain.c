@@ -0,0 +1,159 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+#include "../gain.h"
+#include "../simd.h"
+
+size_t passcnt = 0;
+size_t failcnt = 0;
+
+#define MAX_CHANNELS 6
+#define MAX_FRAMES   1031
+
+// + 16 samples to catch overruns
+static union {
+    int16_t s16[MAX_CHANNELS * MAX_FRAMES + 16];
+    int32_t s32[MAX_CHANNELS * MAX_FRAMES + 16];
+    float   flt[MAX_CHANNELS * MAX_FRAMES + 16];
+} src, want, got;
+
+/** the vector kernels may round an S16 or S32 sample the other way */
+static int
+near (uint16_t fmt, size_t i)
+{
+    switch (fmt) {
+        case 1:
+            return abs (want.s16[i] - got.s16[i]) <= 1;
+        case 2:
+            return llabs ((long long)want.s32[i] - got.s32[i]) <= 1;
+        default:
+            return fabsf (want.flt[i] - got.flt[i])
+                   <= 1e-6f * fabsf (want.flt[i]);
+    }
+}
+
+/** @return whether every layout matches gain_ramp_scalar at simd_level */
+static int
+check_level (void)
+{
+    static const uint16_t fmts[]     = { 1, 2, 3 };
+    static const size_t   nframes[]  = { 0, 1, 3, 4, 7, 8, 17, 192, 1031 };
+    static const float    ramps[][2] = {
+        { 1, 0.5f }, { 0.5f, 1 }, { 0.8f, 0.8f }, { 0, 1 }, { 1, 1 }
+    };
+
+    for (size_t fi = 0; fi < sizeof fmts / sizeof *fmts; ++fi)
+        for (int ch = 1; ch <= MAX_CHANNELS; ++ch)
+            for (size_t n = 0; n < sizeof nframes / sizeof *nframes; ++n)
+                for (size_t r = 0; r < sizeof ramps / sizeof *ramps; ++r) {
+                    const size_t len  = nframes[n] * ch;
+                    const size_t siz  = len * (fmts[fi] == 1 ? 2 : 4);
+                    const float  g0   = ramps[r][0];
+                    const float  step = nframes[n] == 0
+                                            ? 0
+                                            : (ramps[r][1] - g0) / nframes[n];
+
+                    memcpy (&want, &src, sizeof src);
+                    memcpy (&got, &src, sizeof src);
+                    gain_ramp_scalar (&want, fmts[fi], ch, nframes[n], g0,
+                                      step);
+                    gain_ramp (&got, fmts[fi], ch, nframes[n], g0, step);
+
+                    for (size_t i = 0; i < len; ++i) {
+                        if (!near (fmts[fi], i)) {
+                            fprintf (stderr,
+                                     "mismatch: format %u, %d channels, "
+                                     "%zu frames, sample %zu\n",
+                                     fmts[fi], ch, nframes[n], i);
+                            return 0;
+                        }
+                    }
+
+                    // past the end is untouched
+                    if (memcmp ((char *)&got + siz, (char *)&src + siz, 32)
+                        != 0) {
+                        fprintf (stderr, "overrun: %d channels\n", ch);
+                        return 0;
+                    }
+                }
+
+    return 1;
+}
+
+int
+main (void)
+{
+    srand (1);
+
+    for (size_t i = 0; i < sizeof src; ++i)
+        ((uint8_t *)&src)[i] = (uint8_t)rand ();
+
+    for (size_t i = 0; i < MAX_CHANNELS * MAX_FRAMES; ++i)
+        src.flt[i] = (float)(rand () - RAND_MAX / 2) / RAND_MAX;
+
+    // extremes
+    int16_t s16[] = { INT16_MIN, INT16_MAX, -1, 1 };
+    gain_ramp_scalar (s16, 1, 1, 4, 1, 0);
+    assert_nonfatal (s16[0] == -32767 && s16[1] == 32766 && s16[2] == -1
+                         && s16[3] == 1,
+                     "S16 at unity isn't within an LSB");
+
+    int32_t s32[] = { INT32_MIN, INT32_MAX };
+    gain_ramp_scalar (s32, 2, 2, 1, 1, 0);
+    assert_nonfatal (s32[0] == INT32_MIN && s32[1] > INT32_MAX - 256,
+                     "S32 at unity overflowed");
+
+    // a ramp: no step bigger than the per-frame increment, lands on target
+    struct gain_t g;
+    int16_t       ramp[2 * 192];
+    gain_init (&g, 0.5f);
+
+    for (size_t i = 0; i < 2 * 192; ++i)
+        ramp[i] = 16384;
+
+    gain_apply (&g, ramp, 1, 2, 192, 1);
+    int smooth = ramp[0] == 8192 && ramp[1] == 8192;
+
+    for (size_t f = 1; f < 192; ++f)
+        smooth = smooth && ramp[2 * f] >= ramp[2 * f - 2]
+                 && ramp[2 * f] - ramp[2 * f - 2] <= 44
+                 && ramp[2 * f + 1] == ramp[2 * f];
+
+    assert_nonfatal (smooth, "the ramp isn't smooth");
+    assert_nonfatal (ramp[2 * 191] > 16300 && g.cur == 1,
+                     "the ramp doesn't end on the target");
+
+    // unity is a no-op
+    for (size_t i = 0; i < 2 * 192; ++i)
+        ramp[i] = 16384;
+
+    gain_apply (&g, ramp, 1, 2, 192, 1);
+    assert_nonfatal (ramp[0] == 16384 && ramp[2 * 191 + 1] == 16384,
+                     "unity gain changed the samples");
+
+    // out of range targets clamp
+    gain_apply (&g, ramp, 1, 2, 192, 7);
+    assert_nonfatal (g.cur == 1, "gain above 1 wasn't clamped");
+
+    const int best = simd_level ();
+
+    printf ("simd_level:\t%d\n", best);
+
+    for (int level = SIMD_SCALAR; level <= best; ++level) {
+        assert_nonfatal (simd_setlevel (level) == level,
+                         "simd_setlevel didn't apply");
+        assert_nonfatal (check_level (),
+                         "gain_ramp doesn't match gain_ramp_scalar");
+    }
+
+    simd_setlevel (SIMD_V256);
+
+    report ();
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+#include "../interleave.h"
+#include "../simd.h"
+
+size_t passcnt = 0;
+size_t failcnt = 0;
+
+#define MAX_CHANNELS 8
+#define MAX_FRAMES   1031
+
+static uint8_t planes[MAX_CHANNELS][MAX_FRAMES * 8];
+static uint8_t want[MAX_CHANNELS * MAX_FRAMES * 8];
+static uint8_t got[MAX_CHANNELS * MAX_FRAMES * 8 + 64]; // + overrun canary
+
+/** @return whether every layout matches interleave_scalar at simd_level */
+static int
+check_level (void)
+{
+    static const int    bps[]     = { 1, 2, 3, 4, 8 };
+    static const size_t nframes[] = { 0, 1, 7, 8, 15, 16, 17, 33, MAX_FRAMES };
+    uint8_t            *src[MAX_CHANNELS];
+
+    for (int ch = 0; ch < MAX_CHANNELS; ++ch)
+        src[ch] = planes[ch];
+
+    for (size_t b = 0; b < sizeof bps / sizeof *bps; ++b)
+        for (int ch = 1; ch <= MAX_CHANNELS; ++ch)
+            for (size_t n = 0; n < sizeof nframes / sizeof *nframes; ++n) {
+                const size_t siz = nframes[n] * ch * bps[b];
+
+                memset (got, 0xa5, siz + 64);
+                interleave_scalar (want, src, ch, nframes[n], bps[b]);
+                interleave (got, src, ch, nframes[n], bps[b]);
+
+                if (memcmp (want, got, siz) != 0 || got[siz] != 0xa5) {
+                    fprintf (stderr,
+                             "mismatch: %d bytes, %d channels, %zu frames\n",
+                             bps[b], ch, nframes[n]);
+                    return 0;
+                }
+            }
+
+    return 1;
+}
+
+int
+main (void)
+{
+    srand (1);
+
+    for (int ch = 0; ch < MAX_CHANNELS; ++ch)
+        for (size_t i = 0; i < sizeof *planes; ++i)
+            planes[ch][i] = (uint8_t)rand ();
+
+    uint8_t *src[2] = { planes[0], planes[1] };
+    uint8_t  out[4 * 4];
+    interleave_scalar (out, src, 2, 4, 2);
+    assert_nonfatal (memcmp (out, planes[0], 2) == 0
+                         && memcmp (out + 2, planes[1], 2) == 0
+                         && memcmp (out + 4, planes[0] + 2, 2) == 0,
+                     "scalar S16 stereo isn't L R L R");
+
+    const int best = simd_level ();
+
+    printf ("simd_level:\t%d\n", best);
+
+    for (int level = SIMD_SCALAR; level <= best; ++level) {
+        assert_nonfatal (simd_setlevel (level) == level,
+                         "simd_setlevel didn't apply");
+        assert_nonfatal (check_level (),
+                         "interleave doesn't match interleave_scalar");
+    }
+
+    simd_setlevel (SIMD_V256);
+    assert_nonfatal (simd_level () == best, "simd_setlevel didn't restore");
+
+    report ();
+
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "test.h"
+
+#include "../latgov.h"
+#include "../sink.h"
+
+size_t passcnt = 0;
+size_t failcnt = 0;
+
+#define RATE  48000
+#define BURST 192
+
+int
+main (void)
+{
+    struct latgov_stats_t stats = { 0 };
+    struct latgov_t       gov;
+    struct sink_t         sink = {
+        .burst   = BURST,
+        .buf_cap = BURST * 16,
+        .buf_siz = BURST * 2,
+    };
+    int64_t t = 0;
+
+    // 10 ms at 48 kHz is 480 frames, rounded up to 3 bursts
+    latgov_init (&gov, &stats, &sink, RATE, 10, t);
+    assert_nonfatal (gov.floor == 3 * BURST && gov.siz == 3 * BURST,
+                     "the target isn't rounded up to whole bursts");
+    assert_nonfatal (atomic_load (&stats.buf_frames) == 3 * BURST,
+                     "the first decision isn't published");
+    assert_nonfatal (latgov_stats_ms (&stats) == 12.0,
+                     "the published latency isn't in ms");
+
+    // no target: the device's size at open
+    latgov_init (&gov, NULL, &sink, RATE, 0, t);
+    assert_nonfatal (gov.floor == 2 * BURST, "target 0 isn't the device's");
+
+    // a target past the cap is the cap
+    latgov_init (&gov, NULL, &sink, RATE, 1000, t);
+    assert_nonfatal (gov.floor == 16 * BURST, "the target isn't capped");
+
+    latgov_init (&gov, &stats, &sink, RATE, 10, t);
+
+    // underruns grow a burst per update that sees new ones
+    assert_nonfatal (latgov_update (&gov, 0, t += 10) == 3 * BURST,
+                     "grew without an underrun");
+    assert_nonfatal (latgov_update (&gov, 3, t += 10) == 4 * BURST,
+                     "didn't grow on an underrun");
+    assert_nonfatal (latgov_update (&gov, 4, t += 10) == 5 * BURST,
+                     "didn't grow on the next underrun");
+    assert_nonfatal (atomic_load (&stats.xruns) == 4
+                         && atomic_load (&stats.ngrow) == 2,
+                     "underruns and grows aren't counted");
+
+    // holds while stable for less than LATGOV_HOLD_MS
+    assert_nonfatal (latgov_update (&gov, 4, t + LATGOV_HOLD_MS - 1)
+                         == 5 * BURST,
+                     "shrank before the hold");
+
+    // then shrinks a burst per hold, down to the floor and no further
+    t += LATGOV_HOLD_MS;
+    assert_nonfatal (latgov_update (&gov, 4, t) == 4 * BURST,
+                     "didn't shrink after the hold");
+    assert_nonfatal (latgov_update (&gov, 4, t + 1) == 4 * BURST,
+                     "shrank twice in one hold");
+    t += LATGOV_HOLD_MS;
+    assert_nonfatal (latgov_update (&gov, 4, t) == 3 * BURST,
+                     "didn't shrink to the floor");
+    t += LATGOV_HOLD_MS;
+    assert_nonfatal (latgov_update (&gov, 4, t) == 3 * BURST,
+                     "shrank below the floor");
+    assert_nonfatal (atomic_load (&stats.nshrink) == 2
+                         && atomic_load (&stats.peak_frames) == 5 * BURST,
+                     "shrinks or the peak aren't counted");
+
+    // an underrun soon after a shrink doubles the hold
+    latgov_update (&gov, 5, t += 10); // 4 bursts
+    t += LATGOV_HOLD_MS;
+    latgov_update (&gov, 5, t); // shrink to 3
+    latgov_update (&gov, 6, t += 10);
+    assert_nonfatal (gov.hold_ms == 2 * LATGOV_HOLD_MS,
+                     "the hold didn't back off");
+    assert_nonfatal (latgov_update (&gov, 6, t + LATGOV_HOLD_MS) == 4 * BURST,
+                     "shrank before the doubled hold");
+    assert_nonfatal (latgov_update (&gov, 6, t + 2 * LATGOV_HOLD_MS)
+                         == 3 * BURST,
+                     "didn't shrink after the doubled hold");
+
+    // growth stops at the cap
+    for (int i = 7; i < 40; ++i)
+        latgov_update (&gov, i, t += 10);
+
+    assert_nonfatal (gov.siz == 16 * BURST, "grew past the cap");
+
+    // a device that takes less lowers the cap
+    latgov_init (&gov, &stats, &sink, RATE, 10, t);
+    latgov_update (&gov, 1, t += 10);
+    latgov_settle (&gov, 3 * BURST + 100);
+    assert_nonfatal (gov.cap == 3 * BURST + 100
+                         && latgov_update (&gov, 2, t += 10) == gov.cap,
+                     "a device limit isn't kept");
+
+    // a device that won't go as low as the target raises the floor
+    latgov_init (&gov, &stats, &sink, RATE, 1, t);
+    latgov_settle (&gov, 2 * BURST);
+    assert_nonfatal (gov.floor == 2 * BURST
+                         && atomic_load (&stats.floor_frames) == 2 * BURST,
+                     "the device's minimum isn't the floor");
+
+    report ();
+
+    return 0;
+}
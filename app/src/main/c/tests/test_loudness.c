@@ -0,0 +1,131 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "test.h"
+
+#include "../loudness.h"
+
+size_t passcnt = 0;
+size_t failcnt = 0;
+
+#define RATE  48000
+#define SECS  5
+#define CHUNK 1000 // frames per loudness_add, as a decoder hands them over
+
+static float buf[RATE * SECS * 2];
+
+/**
+ * a stereo sine at dbfs into buf, frames [begin, end)
+ *
+ * @param phase of the first sample, in cycles
+ */
+static void
+sine (size_t begin, size_t end, double hz, double dbfs, double phase,
+      int rate)
+{
+    const double a = pow (10, dbfs / 20);
+
+    for (size_t f = begin; f < end; ++f) {
+        const double t = hz * (f - begin) / rate + phase;
+        const double x = a * sin (2 * M_PI * t);
+
+        buf[2 * f] = buf[2 * f + 1] = (float)x;
+    }
+}
+
+/** measure buf as fmt, fed in CHUNK frames */
+static void
+measure (size_t nframes, uint16_t fmt, int rate, float *lufs, float *peak)
+{
+    static int16_t    s16[CHUNK * 2];
+    struct loudness_t m;
+
+    loudness_init (&m, rate, 2);
+
+    for (size_t f = 0; f < nframes; f += CHUNK) {
+        const size_t n = nframes - f < CHUNK ? nframes - f : CHUNK;
+
+        if (fmt == 1) {
+            for (size_t i = 0; i < n * 2; ++i)
+                s16[i] = (int16_t)lrintf (buf[2 * f + i] * 32767);
+
+            loudness_add (&m, s16, 1, n);
+        } else {
+            loudness_add (&m, buf + 2 * f, 3, n);
+        }
+    }
+
+    loudness_result (&m, lufs, peak);
+}
+
+int
+main (void)
+{
+    const size_t n = RATE * SECS;
+    float        lufs;
+    float        peak;
+
+    // EBU Tech 3341 case 1: a 1 kHz stereo sine at -23 dBFS is -23 LUFS
+    sine (0, n, 1000, -23, 0, RATE);
+    measure (n, 3, RATE, &lufs, &peak);
+    printf ("1 kHz at -23 dBFS:\t%.2f LUFS, peak %.4f\n", lufs, peak);
+    assert_nonfatal (fabsf (lufs + 23) < 0.1f, "a -23 dBFS sine isn't -23");
+    assert_nonfatal (fabsf (peak - powf (10, -23 / 20.0f)) < 1e-3f,
+                     "the peak of a sine isn't its amplitude");
+
+    // and from S16, at another rate
+    sine (0, RATE * SECS, 1000, -20, 0, 44100);
+    measure (44100 * SECS, 1, 44100, &lufs, &peak);
+    printf ("S16 at 44.1 kHz, -20 dBFS:\t%.2f LUFS\n", lufs);
+    assert_nonfatal (fabsf (lufs + 20) < 0.1f, "S16 at 44.1 kHz is off");
+
+    // silence after the tone is below the absolute gate. the 3 blocks that
+    // straddle the edge are partly silent but pass, and lower it a little
+    sine (0, n / 2, 1000, -23, 0, RATE);
+
+    for (size_t i = n; i < 2 * n; ++i)
+        buf[i] = 0;
+
+    measure (n, 3, RATE, &lufs, &peak);
+    printf ("half silent:\t%.2f LUFS\n", lufs);
+    assert_nonfatal (fabsf (lufs + 23) < 0.3f, "silence isn't gated");
+
+    // and a tone 20 LU lower below the relative gate
+    sine (n / 2, n, 1000, -43, 0, RATE);
+    measure (n, 3, RATE, &lufs, &peak);
+    printf ("half at -43 dBFS:\t%.2f LUFS\n", lufs);
+    assert_nonfatal (fabsf (lufs + 23) < 0.3f, "quiet passages aren't gated");
+
+    // all silent
+    for (size_t i = 0; i < 2 * n; ++i)
+        buf[i] = 0;
+
+    measure (n, 3, RATE, &lufs, &peak);
+    assert_nonfatal (lufs == LOUDNESS_SILENT && peak == 0,
+                     "silence has a loudness");
+
+    // a quarter rate sine sampled 45 degrees off its peaks: every sample is
+    // at 0.707 of the true peak
+    sine (0, n, RATE / 4.0, -6, 0.125, RATE);
+    measure (n, 3, RATE, &lufs, &peak);
+    printf ("fs / 4 at -6 dBFS:\tsample peak %.4f, true peak %.4f\n",
+            fabsf (buf[0]), peak);
+    assert_nonfatal (peak > 0.95f * powf (10, -6 / 20.0f)
+                         && peak < 1.05f * powf (10, -6 / 20.0f),
+                     "the true peak isn't between the samples");
+
+    // too short for one gating block
+    sine (0, n, 1000, -23, 0, RATE);
+    measure (RATE / 4, 3, RATE, &lufs, &peak);
+    assert_nonfatal (lufs == LOUDNESS_SILENT, "a partial block was gated");
+
+    struct loudness_t m;
+    loudness_init (&m, RATE, LOUDNESS_MAX_CHANNELS + 1);
+    assert_nonfatal (!m.isok, "too many channels were accepted");
+
+    report ();
+
+    return 0;
+}
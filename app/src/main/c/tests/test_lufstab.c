@@ -0,0 +1,178 @@
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#include "../audio.h"
+#include "../loudness.h"
+#include "../lufstab.h"
+#include "../pcmcache.h"
+
+size_t passcnt = 0;
+size_t failcnt = 0;
+
+#define TAB    "build/lufstab"
+#define DIR    "build/lufscan"
+#define NFILES 24
+#define RATE   48000
+
+static atomic_int nmeasure;
+
+/**
+ * stand-in for libav_measure: the file holds a level in dBFS, measured as
+ * half a second of a 1 kHz mono sine
+ */
+static int
+measure (const char *fn, struct loudness_t *meter)
+{
+    static _Thread_local float buf[RATE / 2];
+    FILE                      *fp = fopen (fn, "r");
+    int                        db;
+
+    if (fp == NULL || fscanf (fp, "%d", &db) != 1) {
+        if (fp != NULL)
+            fclose (fp);
+
+        return NCAP_EIO;
+    }
+
+    fclose (fp);
+
+    for (size_t i = 0; i < RATE / 2; ++i)
+        buf[i] = powf (10, db / 20.0f)
+                 * sinf (2 * (float)M_PI * 1000 * i / RATE);
+
+    loudness_init (meter, RATE, 1);
+    loudness_add (meter, buf, 3, RATE / 2);
+    atomic_fetch_add (&nmeasure, 1);
+
+    return NCAP_OK;
+}
+
+static long
+file_siz (const char *fn)
+{
+    struct stat st;
+    return stat (fn, &st) == 0 ? st.st_size : -1;
+}
+
+int
+main (void)
+{
+    struct lufstab_ent_t ent;
+    atomic_bool          isstop = false;
+    size_t               n;
+    char                 path[64];
+
+    remove (TAB);
+
+    // persists, and the last record of a key wins
+    assert_fatal (lufstab_init (TAB) == NCAP_OK, "lufstab_init failed",
+                  exit);
+
+    for (uint64_t k = 0; k < 100; ++k) {
+        ent = (struct lufstab_ent_t){ .key = k * 7919, .lufs = -(float)k };
+        lufstab_put (&ent);
+    }
+
+    ent = (struct lufstab_ent_t){ .key = 7919, .lufs = -42, .peak = 0.5f };
+    lufstab_put (&ent);
+
+    lufstab_deinit ();
+    assert_nonfatal (!lufstab_find (7919, &ent), "deinit kept entries");
+
+    lufstab_init (TAB);
+    assert_nonfatal (lufstab_find (99 * 7919, &ent) && ent.lufs == -99,
+                     "entries didn't persist");
+    assert_nonfatal (lufstab_find (7919, &ent) && ent.lufs == -42
+                         && ent.peak == 0.5f,
+                     "the last record didn't win");
+    assert_nonfatal (!lufstab_find (1, &ent), "found a key never put");
+
+    // a file mostly of stale records is compacted on load
+    for (int i = 0; i < 200; ++i) {
+        ent = (struct lufstab_ent_t){ .key = 1, .lufs = -(float)i };
+        lufstab_put (&ent);
+    }
+
+    lufstab_init (TAB);
+    assert_nonfatal (file_siz (TAB) == 8 + 101 * (long)sizeof ent,
+                     "stale records weren't compacted");
+    assert_nonfatal (lufstab_find (1, &ent) && ent.lufs == -199,
+                     "compaction lost the last record");
+
+    // gains: down to the target, never clipping, never up
+    ent = (struct lufstab_ent_t){ .lufs = -8, .peak = 0.9f };
+    assert_nonfatal (fabsf (lufstab_gain (&ent) - powf (10, -0.5f)) < 1e-4f,
+                     "a loud track isn't brought to the target");
+    ent = (struct lufstab_ent_t){ .lufs = -17, .peak = 1.25f };
+    assert_nonfatal (fabsf (lufstab_gain (&ent) - 0.8f) < 1e-4f,
+                     "the gain would clip the true peak");
+    ent = (struct lufstab_ent_t){ .lufs = -30, .peak = 0.1f };
+    assert_nonfatal (lufstab_gain (&ent) == 1, "a quiet track was boosted");
+    ent = (struct lufstab_ent_t){ .lufs = LOUDNESS_SILENT };
+    assert_nonfatal (lufstab_gain (&ent) == 1, "silence has a gain");
+
+    // batch scan on several threads, once per track
+    mkdir (DIR, 0700);
+
+    for (int i = 0; i < NFILES; ++i) {
+        snprintf (path, sizeof path, DIR "/%02d.wav", i);
+        FILE *fp = fopen (path, "w");
+        fprintf (fp, "%d", -10 - i);
+        fclose (fp);
+    }
+
+    atomic_store (&isstop, true);
+    lufstab_scan (DIR, 4, measure, &isstop, &n);
+    assert_nonfatal (n == 0 && atomic_load (&nmeasure) == 0,
+                     "a stopped scan measured");
+
+    atomic_store (&isstop, false);
+    assert_nonfatal (lufstab_scan (DIR, 4, measure, &isstop, &n) == NCAP_OK
+                         && n == NFILES,
+                     "the scan missed files");
+
+    // a mono sine at x dBFS is x - 3 LUFS
+    bool isok = true;
+    for (int i = 0; i < NFILES; ++i) {
+        uint64_t key;
+
+        snprintf (path, sizeof path, DIR "/%02d.wav", i);
+        isok = isok && pcmcache_key (path, &key) == NCAP_OK
+               && lufstab_find (key, &ent)
+               && fabsf (ent.lufs - (-10 - i - 3.01f)) < 0.1f;
+    }
+
+    assert_nonfatal (isok, "scanned entries are wrong");
+
+    lufstab_scan (DIR, 4, measure, &isstop, &n);
+    assert_nonfatal (n == 0 && atomic_load (&nmeasure) == NFILES,
+                     "known tracks were measured again");
+
+    assert_nonfatal (lufstab_scan ("build/nonexistent", 4, measure, &isstop,
+                                   &n)
+                         == NCAP_EIO,
+                     "a missing dir was scanned");
+
+    for (int i = 0; i < NFILES; ++i) {
+        snprintf (path, sizeof path, DIR "/%02d.wav", i);
+        remove (path);
+    }
+
+    rmdir (DIR);
+
+exit:
+    lufstab_deinit ();
+    remove (TAB);
+
+    report ();
+
+    return 0;
+}
@@ -0,0 +1,166 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+#include "../mix.h"
+#include "../simd.h"
+
+size_t passcnt = 0;
+size_t failcnt = 0;
+
+#define MAX_CHANNELS 6
+#define MAX_FRAMES   1031
+
+// + 16 samples to catch overruns
+static union {
+    int16_t s16[MAX_CHANNELS * MAX_FRAMES + 16];
+    int32_t s32[MAX_CHANNELS * MAX_FRAMES + 16];
+    float   flt[MAX_CHANNELS * MAX_FRAMES + 16];
+} outs, ins, want, got;
+
+/** the vector kernels may round an S16 or S32 sample the other way */
+static int
+near (uint16_t fmt, size_t i)
+{
+    switch (fmt) {
+        case 1:
+            return abs (want.s16[i] - got.s16[i]) <= 1;
+        case 2:
+            // float math: within an ulp of the mix, 256 at full scale
+            return llabs ((long long)want.s32[i] - got.s32[i]) <= 256;
+        default:
+            return fabsf (want.flt[i] - got.flt[i])
+                   <= 1e-6f * (fabsf (want.flt[i]) + 1e-3f);
+    }
+}
+
+/** @return whether every layout matches mix_xfade_scalar at simd_level */
+static int
+check_level (void)
+{
+    static const uint16_t fmts[]    = { 1, 2, 3 };
+    static const size_t   nframes[] = { 0, 1, 3, 4, 7, 8, 17, 192, 1031 };
+    static const float    fades[][2] = {
+        { 0, 1 }, { 0.25f, 0.75f }, { 0.5f, 0.5f }, { -0.5f, 1.5f }
+    };
+
+    for (size_t fi = 0; fi < sizeof fmts / sizeof *fmts; ++fi)
+        for (int ch = 1; ch <= MAX_CHANNELS; ++ch)
+            for (size_t n = 0; n < sizeof nframes / sizeof *nframes; ++n)
+                for (size_t r = 0; r < sizeof fades / sizeof *fades; ++r) {
+                    const size_t len  = nframes[n] * ch;
+                    const size_t siz  = len * (fmts[fi] == 1 ? 2 : 4);
+                    const float  t0   = fades[r][0];
+                    const float  step = nframes[n] == 0
+                                            ? 0
+                                            : (fades[r][1] - t0) / nframes[n];
+
+                    // in place on out, as the player does
+                    memcpy (&got, &outs, sizeof outs);
+                    mix_xfade_scalar (&want, &outs, &ins, fmts[fi], ch,
+                                      nframes[n], t0, step);
+                    mix_xfade (&got, &got, &ins, fmts[fi], ch, nframes[n],
+                               t0, step);
+
+                    for (size_t i = 0; i < len; ++i) {
+                        if (!near (fmts[fi], i)) {
+                            fprintf (stderr,
+                                     "mismatch: format %u, %d channels, "
+                                     "%zu frames, sample %zu\n",
+                                     fmts[fi], ch, nframes[n], i);
+                            return 0;
+                        }
+                    }
+
+                    // past the end is untouched
+                    if (memcmp ((char *)&got + siz, (char *)&outs + siz, 32)
+                        != 0) {
+                        fprintf (stderr, "overrun: %d channels\n", ch);
+                        return 0;
+                    }
+                }
+
+    return 1;
+}
+
+int
+main (void)
+{
+    srand (1);
+
+    for (size_t i = 0; i < sizeof outs; ++i) {
+        ((uint8_t *)&outs)[i] = (uint8_t)rand ();
+        ((uint8_t *)&ins)[i]  = (uint8_t)rand ();
+    }
+
+    for (size_t i = 0; i < MAX_CHANNELS * MAX_FRAMES; ++i) {
+        outs.flt[i] = (float)(rand () - RAND_MAX / 2) / RAND_MAX;
+        ins.flt[i]  = (float)(rand () - RAND_MAX / 2) / RAND_MAX;
+    }
+
+    // the curve: sin, so the two gains always sum to unit power
+    float maxerr = 0;
+    float maxpow = 0;
+
+    for (int i = 0; i <= 1000; ++i) {
+        const float t  = i / 1000.0f;
+        const float gi = mix_curve (t);
+        const float go = mix_curve (1 - t);
+        const float e  = fabsf (gi - sinf (t * (float)M_PI / 2));
+        const float p  = fabsf (gi * gi + go * go - 1);
+
+        maxerr = e > maxerr ? e : maxerr;
+        maxpow = p > maxpow ? p : maxpow;
+    }
+
+    printf ("curve error:\t%g\npower error:\t%g\n", maxerr, maxpow);
+    assert_nonfatal (maxerr < 1e-6f, "the curve isn't sin");
+    assert_nonfatal (maxpow < 2e-6f, "the fade isn't equal power");
+    assert_nonfatal (mix_curve (-1) == 0 && mix_curve (2) == mix_curve (1),
+                     "the curve isn't clamped");
+
+    // the ends are the inputs, within an LSB
+    int16_t a[] = { 1000, -1000, INT16_MAX, INT16_MIN };
+    int16_t b[] = { -2000, 2000, INT16_MAX, INT16_MIN };
+    int16_t d[4];
+
+    mix_xfade_scalar (d, a, b, 1, 2, 2, 0, 0);
+    assert_nonfatal (d[0] == 1000 && d[1] == -1000 && d[2] >= INT16_MAX - 1
+                         && d[3] <= INT16_MIN + 1,
+                     "t = 0 isn't the outgoing track");
+    mix_xfade_scalar (d, a, b, 1, 2, 2, 1, 0);
+    assert_nonfatal (d[0] == -2000 && d[1] == 2000,
+                     "t = 1 isn't the incoming track");
+
+    // correlated full scale at the middle sums to sqrt 2: saturates
+    mix_xfade_scalar (d, a, b, 1, 2, 2, 0.5f, 0);
+    assert_nonfatal (d[2] == INT16_MAX && d[3] == INT16_MIN,
+                     "S16 doesn't saturate");
+
+    int32_t s32[] = { INT32_MAX, INT32_MIN };
+    int32_t s32d[2];
+    mix_xfade_scalar (s32d, s32, s32, 2, 2, 1, 0.5f, 0);
+    assert_nonfatal (s32d[0] > INT32_MAX - 256 && s32d[1] == INT32_MIN,
+                     "S32 doesn't saturate");
+
+    const int best = simd_level ();
+
+    printf ("simd_level:\t%d\n", best);
+
+    for (int level = SIMD_SCALAR; level <= best; ++level) {
+        assert_nonfatal (simd_setlevel (level) == level,
+                         "simd_setlevel didn't apply");
+        assert_nonfatal (check_level (),
+                         "mix_xfade doesn't match mix_xfade_scalar");
+    }
+
+    simd_setlevel (SIMD_V256);
+
+    report ();
+
+    return 0;
+}
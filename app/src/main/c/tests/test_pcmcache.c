@@ -0,0 +1,153 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#include "../audio.h"
+#include "../pcmbuf.h"
+#include "../pcmcache.h"
+
+size_t passcnt = 0;
+size_t failcnt = 0;
+
+#define DIR     "build/pcmcache"
+#define NFRAMES 256
+
+static int16_t frames[NFRAMES * 2];
+
+/** write a stereo S16 WAV of frames, like libav_cvt_cwav would */
+static bool
+write_wav (const char *path)
+{
+    struct cwav_header_t header = {
+        .riff = { .ckID = "RIFF", .WAVEID = "WAVE" },
+        .fmt  = { .ckID           = "fmt ",
+                  .cksize         = 16,
+                  .wFormatTag     = 1,
+                  .nChannels      = 2,
+                  .nSamplesPerSec = 48000,
+                  .nBlockAlign    = 4,
+                  .wBitsPerSample = 16 },
+        .data = { .ckID = "data", .cksize = sizeof frames },
+    };
+    header.riff.cksize         = 36 + sizeof frames;
+    header.fmt.nAvgBytesPerSec = 48000 * 4;
+
+    FILE *fp = fopen (path, "wb");
+    if (fp == NULL)
+        return false;
+
+    const bool ok = fwrite (&header, CWAV_HEADER_SIZ, 1, fp) == 1
+                    && fwrite (frames, sizeof frames, 1, fp) == 1;
+    return fclose (fp) == 0 && ok;
+}
+
+static void
+write_src (const char *path, const char *s)
+{
+    FILE *fp = fopen (path, "wb");
+    fputs (s, fp);
+    fclose (fp);
+}
+
+static void
+set_mtime (const char *path, time_t sec)
+{
+    const struct timespec ts[2] = { { sec, 0 }, { sec, 0 } };
+    utimensat (AT_FDCWD, path, ts, 0);
+}
+
+int
+main (void)
+{
+    for (size_t i = 0; i < NFRAMES * 2; ++i)
+        frames[i] = (int16_t)(i * 7);
+
+    mkdir ("build", 0755);
+    mkdir (DIR, 0755);
+    write_src ("build/a.src", "a");
+    write_src ("build/b.src", "bb");
+    write_src ("build/c.src", "ccc");
+    write_src (DIR "/stale.tmp", "x");
+
+    const uint64_t entsiz = CWAV_HEADER_SIZ + sizeof frames;
+
+    assert_fatal (pcmcache_init (DIR, entsiz * 2) == NCAP_OK,
+                  "pcmcache_init == NCAP_OK", exit);
+    assert_nonfatal (access (DIR "/stale.tmp", F_OK) != 0,
+                     "stale temporary file not removed on init");
+
+    struct pcmcache_ent_t a, b, c;
+
+    assert_fatal (pcmcache_find ("build/a.src", &a) == PCMCACHE_MISS,
+                  "find on an empty cache is a miss", exit);
+    assert_nonfatal (write_wav (a.tmp), "write a.tmp");
+    assert_nonfatal (pcmcache_commit (&a) == NCAP_OK, "commit a");
+    assert_nonfatal (access (a.tmp, F_OK) != 0, "a.tmp left after commit");
+    assert_nonfatal (pcmcache_find ("build/a.src", &a) == PCMCACHE_HIT,
+                     "find after commit is a hit");
+
+    struct pcmbuf_t pb;
+    int16_t         out[NFRAMES * 2];
+    bool            iseof = false;
+
+    pcmbuf_init (&pb, NFRAMES);
+    assert_nonfatal (pcmcache_read_pcmbuf (&a, &pb) == NCAP_OK,
+                     "pcmcache_read_pcmbuf == NCAP_OK");
+    assert_nonfatal (pb.header.fmt.nChannels == 2, "format not published");
+    assert_nonfatal (pcmbuf_read (&pb, out, NFRAMES, &iseof) == NFRAMES,
+                     "read back every cached frame");
+    assert_nonfatal (memcmp (out, frames, sizeof frames) == 0,
+                     "cached frames don't match written");
+    pcmbuf_read (&pb, out, NFRAMES, &iseof);
+    assert_nonfatal (iseof, "eof after the cached frames");
+    pcmbuf_deinit (&pb);
+
+    write_src ("build/a.src", "A longer source");
+    assert_nonfatal (pcmcache_find ("build/a.src", &a) == PCMCACHE_MISS,
+                     "changed source still hits the old entry");
+    write_src ("build/a.src", "a");
+    set_mtime ("build/a.src", 1000);
+    pcmcache_find ("build/a.src", &a);
+    write_wav (a.tmp);
+    pcmcache_commit (&a);
+
+    // a is older than b, so committing c over budget evicts a
+    assert_nonfatal (pcmcache_find ("build/b.src", &b) == PCMCACHE_MISS,
+                     "find b is a miss");
+    write_wav (b.tmp);
+    pcmcache_commit (&b);
+    set_mtime (a.path, 1000);
+    set_mtime (b.path, 2000);
+
+    pcmcache_find ("build/c.src", &c);
+    write_wav (c.tmp);
+    assert_nonfatal (pcmcache_commit (&c) == NCAP_OK, "commit c");
+    assert_nonfatal (access (a.path, F_OK) != 0, "lru entry not evicted");
+    assert_nonfatal (access (b.path, F_OK) == 0, "b evicted too early");
+    assert_nonfatal (access (c.path, F_OK) == 0, "newest entry evicted");
+
+    pcmcache_find ("build/a.src", &a);
+    write_wav (a.tmp);
+    pcmcache_discard (&a);
+    assert_nonfatal (access (a.tmp, F_OK) != 0, "discard left a.tmp");
+
+    pcmcache_init (DIR, 0);
+    assert_nonfatal (pcmcache_find ("build/b.src", &b) == PCMCACHE_EOFF,
+                     "find with a zero budget is PCMCACHE_EOFF");
+
+    remove (b.path);
+    remove (c.path);
+    rmdir (DIR);
+
+exit:
+    report ();
+
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "test.h"
+
+#include "../playctl.h"
+
+size_t passcnt = 0;
+size_t failcnt = 0;
+
+static double
+now_s (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *
+tfn_close (void *args)
+{
+    const struct timespec ts = { .tv_sec = 0, .tv_nsec = 20000000 }; // 20 ms
+
+    (void)args;
+    nanosleep (&ts, NULL);
+    playctl_set (PLAYCTL_CLOSE);
+
+    return NULL;
+}
+
+int
+main (void)
+{
+    uint32_t w;
+
+    // packing: fields don't step on each other
+
+    playctl_init (PLAYCTL_PAUSE);
+    w = playctl_load ();
+    assert_nonfatal ((w & PLAYCTL_FLAGS) == PLAYCTL_PAUSE,
+                     "playctl_init didn't set the flags");
+    assert_nonfatal (playctl_vol (w) == 100, "the volume isn't 100");
+    assert_nonfatal (playctl_track (w) == -1, "a track is set");
+
+    playctl_setvol (30);
+    playctl_settrack (PLAYCTL_TRACK_MAX);
+    w = playctl_toggle (PLAYCTL_PAUSE | PLAYCTL_READY);
+    assert_nonfatal (w == playctl_load (), "toggle didn't return the word");
+    assert_nonfatal ((w & PLAYCTL_FLAGS) == PLAYCTL_READY,
+                     "toggle didn't flip the flags");
+    assert_nonfatal (playctl_vol (w) == 30, "the volume changed");
+    assert_nonfatal (playctl_track (w) == PLAYCTL_TRACK_MAX,
+                     "the largest track id doesn't fit");
+
+    playctl_setvol (1000);
+    playctl_settrack (PLAYCTL_TRACK_MAX + 1);
+    w = playctl_clear (PLAYCTL_READY);
+    assert_nonfatal (playctl_vol (w) == 100, "the volume wasn't clamped");
+    assert_nonfatal (playctl_track (w) == -1,
+                     "an out of range track id was kept");
+    assert_nonfatal ((w & PLAYCTL_FLAGS) == 0, "clear left a flag set");
+
+    playctl_settrack (7);
+    playctl_setvol (0);
+    w = playctl_load ();
+    assert_nonfatal (playctl_track (w) == 7 && playctl_vol (w) == 0,
+                     "setvol changed the track");
+
+    // a wait with nothing changing times out
+
+    double t0 = now_s ();
+    w         = playctl_wait (w, 10000000); // 10 ms
+    double dt = now_s () - t0;
+
+    assert_nonfatal (dt >= 0.009 && dt < 0.5, "playctl_wait didn't time out");
+
+    // a wait on a stale word returns at once
+
+    t0 = now_s ();
+    playctl_wait (w ^ PLAYCTL_READY, -1);
+    assert_nonfatal (now_s () - t0 < 0.01,
+                     "playctl_wait slept on a stale word");
+
+    // another thread's set wakes the waiter
+
+    pthread_t tid;
+
+    playctl_init (PLAYCTL_PAUSE);
+
+    assert_fatal (pthread_create (&tid, NULL, tfn_close, NULL) == 0,
+                  "pthread_create failed", exit);
+
+    t0 = now_s ();
+    w  = playctl_waitfor (PLAYCTL_CLOSE, PLAYCTL_PAUSE);
+    dt = now_s () - t0;
+    pthread_join (tid, NULL);
+
+    printf ("woke after %.3f ms\n", dt * 1e3);
+    assert_nonfatal (w & PLAYCTL_CLOSE, "waitfor returned without CLOSE");
+    assert_nonfatal (dt < 0.1, "the waiter woke late");
+
+    // and clearing a flag in clr ends the wait too
+
+    playctl_init (0);
+    w = playctl_waitfor (PLAYCTL_CLOSE, PLAYCTL_PAUSE);
+    assert_nonfatal (!(w & PLAYCTL_PAUSE), "waitfor slept while unpaused");
+
+exit:
+    report ();
+
+    return 0;
+}
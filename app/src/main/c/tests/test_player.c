@@ -0,0 +1,588 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "test.h"
+
+#include "../audio.h"
+#include "../config.h"
+#include "../eq.h"
+#include "../mix.h"
+#include "../pcmbuf.h"
+#include "../playctl.h"
+#include "../playpos.h"
+#include "../sink.h"
+#include "../trackq.h"
+
+size_t passcnt = 0;
+size_t failcnt = 0;
+
+#define RATE    48000
+#define NFRAMES 10000 // not a whole number of bursts
+#define BURST   256
+#define OUT_FN  "build/player_out.wav"
+
+// the file sink pulls this much faster than real time
+#define PULL_SPEED 8
+
+static const char *const track_fns[] = { "build/player_a.wav",
+                                         "build/player_b.wav",
+                                         "build/player_c.wav" };
+
+// never 0, so silence the sink pads with can be told apart from the tracks
+static int16_t tracks[2][NFRAMES * 2];
+
+static bool
+write_wav (const char *path, const int16_t *frames, size_t nframes,
+           uint32_t rate)
+{
+    const uint32_t       datasiz = nframes * 4;
+    struct cwav_header_t header  = {
+         .riff = { .ckID = "RIFF", .WAVEID = "WAVE" },
+         .fmt  = { .ckID           = "fmt ",
+                   .cksize         = 16,
+                   .wFormatTag     = 1,
+                   .nChannels      = 2,
+                   .nSamplesPerSec = rate,
+                   .nBlockAlign    = 4,
+                   .wBitsPerSample = 16 },
+         .data = { .ckID = "data", .cksize = datasiz },
+    };
+    header.riff.cksize         = 36 + datasiz;
+    header.fmt.nAvgBytesPerSec = rate * 4;
+
+    FILE *fp = fopen (path, "wb");
+    if (fp == NULL)
+        return false;
+
+    const bool ok = fwrite (&header, CWAV_HEADER_SIZ, 1, fp) == 1
+                    && fwrite (frames, datasiz, 1, fp) == 1;
+    return fclose (fp) == 0 && ok;
+}
+
+/**
+ * read OUT_FN, dropping all-zero frames (sink padding and source underruns)
+ *
+ * @return frames kept, or -1 if the file is not a stereo S16 WAV at rate
+ */
+static long
+read_out (int16_t *dst, size_t cap, size_t *nsilent, uint32_t rate)
+{
+    struct cwav_header_t header;
+    int16_t              frame[2];
+    size_t               n = 0;
+    FILE                *fp;
+
+    *nsilent = 0;
+
+    if ((fp = fopen (OUT_FN, "rb")) == NULL)
+        return -1;
+
+    if (fread (&header, CWAV_HEADER_SIZ, 1, fp) != 1
+        || header.fmt.nSamplesPerSec != rate || header.fmt.nChannels != 2
+        || header.fmt.wFormatTag != 1
+        || header.data.cksize % (BURST * 4) != 0) {
+        fclose (fp);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < header.data.cksize / 4; ++i) {
+        if (fread (frame, sizeof frame, 1, fp) != 1)
+            break;
+
+        if (frame[0] == 0 && frame[1] == 0)
+            ++*nsilent;
+        else if (n < cap)
+            memcpy (dst + 2 * n++, frame, sizeof frame);
+    }
+
+    fclose (fp);
+    return n;
+}
+
+static double
+now_s (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * two tracks of one format share a stream, a third at another rate reopens
+ * it. the file sink truncates its file on open, so a stream per track would
+ * leave only the last track
+ */
+static void
+test_file (uint8_t mode, const char *name)
+{
+    static int16_t     got[2 * NFRAMES * 2];
+    struct sink_host_t sink;
+    size_t             nsilent;
+    long               n;
+
+    printf ("%s mode, file sink\n", name);
+
+    ncap_config.aaudio_optimize = mode;
+    sink_file_init (&sink, OUT_FN, BURST, PULL_SPEED);
+    audio_set_sink (&sink.base);
+
+    assert_fatal (audio_play (track_fns[0], 1) == NCAP_OK
+                      && audio_play (track_fns[1], 1) == NCAP_OK,
+                  "audio_play failed", exit);
+    audio_close ();
+
+    n = read_out (got, 2 * NFRAMES, &nsilent, RATE);
+
+    assert_fatal (n == 2 * NFRAMES, "frames lost, added or reopened", exit);
+    assert_nonfatal (memcmp (got, tracks[0], sizeof tracks[0]) == 0,
+                     "output differs from the first track");
+    assert_nonfatal (
+        memcmp (got + NFRAMES * 2, tracks[1], sizeof tracks[1]) == 0,
+        "output differs from the second track");
+
+    // pushed frames are never short, only each last burst is padded
+    if (mode == CONFIG_AAUDIO_BLOCKING) {
+        assert_nonfatal (nsilent < 2 * BURST, "silence inserted");
+    }
+
+    assert_fatal (audio_play (track_fns[0], 1) == NCAP_OK
+                      && audio_play (track_fns[2], 1) == NCAP_OK,
+                  "audio_play failed", exit);
+    audio_close ();
+
+    n = read_out (got, NFRAMES, &nsilent, RATE / 2);
+
+    assert_fatal (n == NFRAMES, "the stream wasn't reopened", exit);
+    assert_nonfatal (memcmp (got, tracks[0], sizeof tracks[0]) == 0,
+                     "output differs from the reopened track");
+
+exit:
+    audio_close ();
+}
+
+static void
+test_null (uint8_t mode, const char *name)
+{
+    struct sink_host_t sink;
+
+    printf ("%s mode, null sink\n", name);
+
+    ncap_config.aaudio_optimize = mode;
+    sink_null_init (&sink, BURST);
+    audio_set_sink (&sink.base);
+
+    const double t0 = now_s ();
+
+    assert_fatal (audio_play (track_fns[0], 1) == NCAP_OK, "audio_play failed",
+                  exit);
+
+    // paced by the sink's clock, not by how fast the frames come
+    const double dt  = now_s () - t0;
+    const double dur = (double)NFRAMES / RATE;
+
+    printf ("played %.3f s in %.3f s\n", dur, dt);
+    assert_nonfatal (dt > dur * 0.9, "null sink ran ahead of its clock");
+    assert_nonfatal (dt < dur + 1.0, "null sink ran behind its clock");
+
+exit:
+    audio_close ();
+}
+
+static atomic_bool isplayed;
+
+static void *
+tfn_play (void *args)
+{
+    *(int *)args = audio_play (track_fns[0], 1);
+    atomic_store (&isplayed, true);
+    return NULL;
+}
+
+/** a paused player holds its place; close lands within a few bursts */
+static void
+test_control (uint8_t mode, const char *name)
+{
+    const struct timespec hold = { .tv_sec = 0, .tv_nsec = 100000000 };
+    struct sink_host_t    sink;
+    pthread_t             tid;
+    int                   ret = NCAP_EGEN;
+
+    printf ("%s mode, pause and close\n", name);
+
+    ncap_config.aaudio_optimize = mode;
+    sink_null_init (&sink, BURST);
+    audio_set_sink (&sink.base);
+    playctl_init (PLAYCTL_PAUSE);
+    atomic_store (&isplayed, false);
+
+    assert_fatal (pthread_create (&tid, NULL, tfn_play, &ret) == 0,
+                  "pthread_create failed", exit);
+
+    // longer than the track would play at NFRAMES / RATE
+    for (int i = 0; i < 3; ++i)
+        nanosleep (&hold, NULL);
+
+    playctl_clear (PLAYCTL_PAUSE);
+    nanosleep (&hold, NULL);
+    playctl_set (PLAYCTL_PAUSE);
+    nanosleep (&hold, NULL);
+
+    assert_nonfatal (!atomic_load (&isplayed), "played through the pause");
+
+    const double t0 = now_s ();
+
+    playctl_set (PLAYCTL_CLOSE);
+    pthread_join (tid, NULL);
+
+    const double dt = now_s () - t0;
+
+    printf ("closed in %.3f ms\n", dt * 1e3);
+    assert_nonfatal (ret == NCAP_OK, "audio_play failed");
+    assert_nonfatal (dt < 0.05, "close took longer than a few bursts");
+
+exit:
+    audio_close ();
+    playctl_init (0);
+}
+
+/**
+ * the published position follows the null sink's clock, holds while paused
+ * and ends on the last frame
+ */
+static void
+test_pos (uint8_t mode, const char *name)
+{
+    const struct timespec hold = { .tv_sec = 0, .tv_nsec = 50000000 };
+    struct sink_host_t    sink;
+    struct playpos_t      pos, held;
+    pthread_t             tid;
+    int                   ret = NCAP_EGEN;
+
+    printf ("%s mode, position\n", name);
+
+    ncap_config.aaudio_optimize = mode;
+    sink_null_init (&sink, BURST);
+    audio_set_sink (&sink.base);
+    playctl_init (0);
+    playctl_settrack (0);
+    playpos_init ();
+    atomic_store (&isplayed, false);
+
+    const double t0 = now_s ();
+
+    assert_fatal (pthread_create (&tid, NULL, tfn_play, &ret) == 0,
+                  "pthread_create failed", exit);
+
+    nanosleep (&hold, NULL);
+    nanosleep (&hold, NULL);
+
+    playpos_load (&pos);
+
+    const int64_t f       = playpos_frame (&pos, playpos_now_ns ());
+    const int64_t elapsed = (now_s () - t0) * RATE;
+
+    printf ("at %ld of %ld frames after %ld\n", (long)f, (long)pos.len,
+            (long)elapsed);
+    assert_nonfatal (pos.track == 0 && pos.len == NFRAMES
+                         && pos.rate == RATE,
+                     "the position isn't of the track");
+    assert_nonfatal (f <= elapsed && f > elapsed - RATE / 20,
+                     "the position doesn't follow the sink's clock");
+
+    playctl_set (PLAYCTL_PAUSE);
+    nanosleep (&hold, NULL);
+    playpos_load (&held);
+    nanosleep (&hold, NULL);
+    playpos_load (&pos);
+    assert_nonfatal (!pos.isrunning
+                         && playpos_frame (&pos, playpos_now_ns ())
+                                == playpos_frame (&held, 0),
+                     "the position moved while paused");
+
+    playctl_clear (PLAYCTL_PAUSE);
+    pthread_join (tid, NULL);
+    playpos_load (&pos);
+
+    assert_nonfatal (ret == NCAP_OK, "audio_play failed");
+    assert_nonfatal (pos.end == NFRAMES
+                         && playpos_frame (&pos, playpos_now_ns ())
+                                == NFRAMES,
+                     "the position didn't end on the last frame");
+
+exit:
+    audio_close ();
+    playctl_init (0);
+}
+
+struct produce_args_t {
+    struct trackq_t   *q;
+    const char *const *fns; // 2 tracks
+};
+
+static void *
+tfn_produce (void *args_vp)
+{
+    struct produce_args_t *args  = args_vp;
+    struct trackq_t       *q     = args->q;
+    size_t                 burst = 0;
+
+    for (int i = 0; i < 2; ++i) {
+        trackq_reclaim (q);
+
+        struct pcmbuf_t *pb = pcmbuf_new (burst);
+
+        pb->id     = i;
+        pb->min_ms = ncap_config.xfade_ms;
+
+        if (!trackq_push (q, pb)) {
+            pcmbuf_free (pb);
+            break;
+        }
+
+        // pairs with trackq_stop: either it drains and aborts pb, or we see
+        // the stop here and never decode into pb
+        if (trackq_isstop (q))
+            break;
+
+        pcmbuf_fill_wav (pb, args->fns[i]);
+
+        if (pcmbuf_burst (pb) != 0)
+            burst = pcmbuf_burst (pb);
+    }
+
+    trackq_end (q);
+    return NULL;
+}
+
+/**
+ * play fns through a trackq into OUT_FN
+ *
+ * @return whether it played
+ */
+static bool
+play_trackq (const char *const *fns)
+{
+    struct sink_host_t    sink;
+    struct trackq_t       q;
+    struct produce_args_t args = { .q = &q, .fns = fns };
+    pthread_t             tid;
+    int                   ret;
+
+    ncap_config.aaudio_optimize = 0;
+    sink_file_init (&sink, OUT_FN, BURST, PULL_SPEED);
+    audio_set_sink (&sink.base);
+
+    if (trackq_init (&q) != NCAP_OK)
+        return false;
+
+    if (pthread_create (&tid, NULL, tfn_produce, &args) != 0) {
+        trackq_deinit (&q);
+        return false;
+    }
+
+    ret = audio_play_trackq (&q);
+    audio_close ();
+
+    trackq_stop (&q);
+    pthread_join (tid, NULL);
+    trackq_deinit (&q);
+
+    return ret == NCAP_OK;
+}
+
+static void
+test_trackq (void)
+{
+    static int16_t got[2 * NFRAMES * 2];
+    size_t         nsilent;
+
+    puts ("gapless trackq, file sink");
+
+    assert_fatal (play_trackq (track_fns), "audio_play_trackq failed", exit);
+
+    // both tracks on one stream, in order, without a frame lost
+    const long n = read_out (got, 2 * NFRAMES, &nsilent, RATE);
+
+    assert_fatal (n == 2 * NFRAMES, "frames lost or added", exit);
+    assert_nonfatal (memcmp (got, tracks[0], sizeof tracks[0]) == 0,
+                     "first track differs");
+    assert_nonfatal (
+        memcmp (got + NFRAMES * 2, tracks[1], sizeof tracks[1]) == 0,
+        "second track differs");
+
+exit:
+    return;
+}
+
+/**
+ * the first track into itself: the tracks never cancel out, so no mixed
+ * frame is dropped as silence
+ */
+static void
+test_xfade (void)
+{
+    static const char *const fns[] = { "build/player_a.wav",
+                                       "build/player_a.wav" };
+    static int16_t           got[2 * NFRAMES * 2];
+    int16_t                  want[BURST * 2];
+    const long               xfade = 100 * RATE / 1000;
+    size_t                   nsilent;
+    long                     n;
+
+    puts ("crossfaded trackq, file sink");
+
+    ncap_config.xfade_ms = 100;
+    assert_fatal (play_trackq (fns), "audio_play_trackq failed", exit);
+
+    n = read_out (got, 2 * NFRAMES, &nsilent, RATE);
+
+    // the overlap. shorter than xfade if the tail was short when it began
+    const long len = 2 * NFRAMES - n;
+
+    printf ("crossfaded %ld of %ld frames\n", len, xfade);
+    assert_fatal (len >= xfade / 2 && len <= xfade,
+                  "the crossfade has the wrong length", exit);
+    assert_nonfatal (memcmp (got, tracks[0], (NFRAMES - len) * 4) == 0,
+                     "the first track differs before the crossfade");
+    assert_nonfatal (memcmp (got + NFRAMES * 2, tracks[0] + len * 2,
+                             (NFRAMES - len) * 4)
+                         == 0,
+                     "the second track differs after the crossfade");
+
+    // the overlap is the outgoing tail mixed with the incoming head
+    int ismix = 1;
+
+    for (long f = 0; f < len; f += BURST) {
+        const long k = len - f < BURST ? len - f : BURST;
+
+        mix_xfade_scalar (want, tracks[0] + (NFRAMES - len + f) * 2,
+                          tracks[0] + f * 2, 1, 2, k, (float)f / len,
+                          1.0f / len);
+
+        for (long i = 0; i < k * 2; ++i)
+            ismix = ismix
+                    && abs (want[i] - got[(NFRAMES - len + f) * 2 + i]) <= 1;
+    }
+
+    assert_nonfatal (ismix, "the overlap isn't an equal-power mix");
+
+exit:
+    ncap_config.xfade_ms = 0;
+}
+
+/** a track's normalization gain applies from its first frame */
+static void
+test_norm (uint8_t mode, const char *name)
+{
+    static int16_t     got[NFRAMES * 2];
+    struct sink_host_t sink;
+    size_t             nsilent;
+    bool               isok = true;
+
+    printf ("%s mode, normalized\n", name);
+
+    ncap_config.aaudio_optimize = mode;
+    sink_file_init (&sink, OUT_FN, BURST, PULL_SPEED);
+    audio_set_sink (&sink.base);
+
+    assert_fatal (audio_play (track_fns[0], 0.5f) == NCAP_OK,
+                  "audio_play failed", exit);
+    audio_close ();
+
+    assert_fatal (read_out (got, NFRAMES, &nsilent, RATE) == NFRAMES,
+                  "frames lost or added", exit);
+
+    for (size_t i = 0; i < NFRAMES * 2; ++i)
+        isok = isok && abs (got[i] - tracks[0][i] / 2) <= 1;
+
+    assert_nonfatal (isok, "the track wasn't halved");
+
+exit:
+    audio_close ();
+}
+
+/** the configured EQ runs on the output, continuously across a stream */
+static void
+test_eq (void)
+{
+    static int16_t     got[NFRAMES * 2], want[NFRAMES * 2];
+    struct sink_host_t sink;
+    struct eq_t        eq;
+    size_t             nsilent;
+    bool               isok = true;
+
+    printf ("EQ, file sink\n");
+
+    ncap_config.aaudio_optimize = 0;
+    ncap_config.eq_preset       = 1;
+    sink_file_init (&sink, OUT_FN, BURST, PULL_SPEED);
+    audio_set_sink (&sink.base);
+
+    assert_fatal (audio_play (track_fns[0], 1) == NCAP_OK,
+                  "audio_play failed", exit);
+    audio_close ();
+
+    assert_fatal (read_out (got, NFRAMES, &nsilent, RATE) == NFRAMES,
+                  "frames lost or added", exit);
+
+    memcpy (want, tracks[0], sizeof want);
+    eq_init (&eq, RATE, 2, eq_presets[1].bands, eq_presets[1].nbands,
+             eq_presets[1].preamp_db);
+    eq_apply_scalar (&eq, want, 1, NFRAMES);
+
+    for (size_t i = 0; i < NFRAMES * 2; ++i)
+        isok = isok && abs (got[i] - want[i]) <= 1;
+
+    assert_nonfatal (isok, "the output isn't the equalized track");
+
+exit:
+    audio_close ();
+    ncap_config.eq_preset = 0;
+}
+
+int
+main (void)
+{
+    for (size_t i = 0; i < NFRAMES * 2; ++i) {
+        tracks[0][i] = (int16_t)(i % 30000 + 1);
+        tracks[1][i] = (int16_t)-(i % 30000 + 1);
+    }
+
+    assert_fatal (write_wav (track_fns[0], tracks[0], NFRAMES, RATE)
+                      && write_wav (track_fns[1], tracks[1], NFRAMES, RATE)
+                      && write_wav (track_fns[2], tracks[0], NFRAMES,
+                                    RATE / 2),
+                  "could not write the test tracks", exit);
+
+    playctl_init (0);
+
+    test_file (CONFIG_AAUDIO_BLOCKING, "blocking");
+    test_file (0, "callback");
+    test_null (CONFIG_AAUDIO_BLOCKING, "blocking");
+    test_null (0, "callback");
+    test_control (CONFIG_AAUDIO_BLOCKING, "blocking");
+    test_control (0, "callback");
+    test_pos (CONFIG_AAUDIO_BLOCKING, "blocking");
+    test_pos (0, "callback");
+    test_trackq ();
+    test_xfade ();
+    test_norm (CONFIG_AAUDIO_BLOCKING, "blocking");
+    test_norm (0, "callback");
+    test_eq ();
+
+exit:
+    remove (OUT_FN);
+    remove (track_fns[0]);
+    remove (track_fns[1]);
+    remove (track_fns[2]);
+
+    report ();
+
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "test.h"
+
+#include "../playpos.h"
+
+size_t passcnt = 0;
+size_t failcnt = 0;
+
+#define NPUBLISH 2000000
+
+static atomic_bool isdone;
+
+/** every field is derived from k, so a reader can tell a torn copy */
+static void
+make (struct playpos_t *pos, int64_t k)
+{
+    pos->frame     = k;
+    pos->t_ns      = -k;
+    pos->end       = k * 3;
+    pos->len       = k ^ 0x5555;
+    pos->rate      = (int32_t)(k & 0xffff);
+    pos->track     = (int32_t)(k >> 4);
+    pos->isrunning = k & 1;
+}
+
+static void *
+tfn_publish (void *args)
+{
+    struct playpos_t pos;
+
+    (void)args;
+
+    for (int64_t k = 1; k <= NPUBLISH; ++k) {
+        make (&pos, k);
+        playpos_publish (&pos);
+    }
+
+    atomic_store (&isdone, true);
+
+    return NULL;
+}
+
+int
+main (void)
+{
+    struct playpos_t pos, want;
+    pthread_t        tid;
+
+    playpos_init ();
+    playpos_load (&pos);
+    assert_nonfatal (pos.track == -1 && pos.rate == 0 && !pos.isrunning,
+                     "playpos_init left a track");
+
+    // extrapolation: at the rate while running, never past end or below 0
+
+    pos = (struct playpos_t){ .frame     = 1000,
+                              .t_ns      = 1000000000,
+                              .end       = 30000,
+                              .rate      = 48000,
+                              .isrunning = true };
+
+    assert_nonfatal (playpos_frame (&pos, 1500000000) == 25000,
+                     "didn't advance at the rate");
+    assert_nonfatal (playpos_frame (&pos, 2000000000) == 30000,
+                     "ran past the frames written");
+    assert_nonfatal (playpos_frame (&pos, 0) == 1000,
+                     "went back before the timestamp");
+
+    pos.isrunning = false;
+    assert_nonfatal (playpos_frame (&pos, 1500000000) == 1000,
+                     "advanced while paused");
+
+    pos.frame = -500;
+    assert_nonfatal (playpos_frame (&pos, 1500000000) == 0,
+                     "a track that isn't heard yet isn't at 0");
+
+    // hold stops where the listener is
+
+    pos.frame     = 1000;
+    pos.isrunning = true;
+    playpos_publish (&pos);
+    playpos_hold (1250000000);
+    playpos_load (&pos);
+
+    assert_nonfatal (!pos.isrunning && pos.frame == 13000
+                         && playpos_frame (&pos, 2000000000) == 13000,
+                     "hold didn't stop at the extrapolated frame");
+
+    // one writer and a reader: every copy is one whole publish
+
+    size_t  nread  = 0;
+    size_t  ntorn  = 0;
+    int64_t last   = 0;
+    bool    isback = false;
+
+    playpos_init ();
+    atomic_init (&isdone, false);
+
+    assert_fatal (pthread_create (&tid, NULL, tfn_publish, NULL) == 0,
+                  "pthread_create failed", exit);
+
+    while (!atomic_load (&isdone)) {
+        playpos_load (&pos);
+
+        if (pos.frame == 0)
+            continue; // from playpos_init
+
+        make (&want, pos.frame);
+        ntorn += pos.t_ns != want.t_ns || pos.end != want.end
+                 || pos.len != want.len || pos.rate != want.rate
+                 || pos.track != want.track
+                 || pos.isrunning != want.isrunning;
+        isback |= pos.frame < last;
+        last = pos.frame;
+        ++nread;
+    }
+
+    pthread_join (tid, NULL);
+
+    printf ("%zu reads\n", nread);
+    assert_nonfatal (ntorn == 0, "a read mixed two publishes");
+    assert_nonfatal (!isback, "a read went back to an older publish");
+
+    playpos_load (&pos);
+    assert_nonfatal (pos.frame == NPUBLISH, "the last publish was lost");
+
+exit:
+    report ();
+
+    return 0;
+}
@@ -0,0 +1,146 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "test.h"
+
+#include "../audio.h"
+#include "../ringbuf.h"
+
+size_t passcnt = 0;
+size_t failcnt = 0;
+
+#define STRESS_FRAMES 4000000
+
+static void *
+tfn_produce (void *rb_vp)
+{
+    struct ringbuf_t *rb = rb_vp;
+    uint32_t          chunk[37];
+    uint32_t          seq = 0;
+
+    while (seq < STRESS_FRAMES) {
+        size_t n = 0;
+
+        while (n < sizeof chunk / sizeof *chunk && seq + n < STRESS_FRAMES) {
+            chunk[n] = seq + n;
+            ++n;
+        }
+
+        const uint32_t *p = chunk;
+
+        while (n > 0) {
+            const size_t w = ringbuf_write (rb, p, n);
+
+            if (w == 0)
+                sched_yield ();
+
+            p += w;
+            n -= w;
+            seq += w;
+        }
+    }
+
+    return NULL;
+}
+
+int
+main (void)
+{
+    struct ringbuf_t rb;
+    uint32_t         in[64], out[64];
+
+    for (uint32_t i = 0; i < 64; ++i)
+        in[i] = i;
+
+    // 4 byte frames, bursts of 6, 3 bursts -> capacity rounds up to 32
+    assert_fatal (ringbuf_init (&rb, sizeof (uint32_t), 6, 3) == NCAP_OK,
+                  "ringbuf_init == NCAP_OK", exit);
+    assert_nonfatal (rb.cap == 32, "capacity should round up to 32");
+    assert_nonfatal (((uintptr_t)rb.buf & (RINGBUF_CACHELINE - 1)) == 0,
+                     "storage should be cache-line aligned");
+    assert_nonfatal ((uintptr_t)&rb.head - (uintptr_t)&rb.tail
+                         >= RINGBUF_CACHELINE,
+                     "head and tail should not share a cache line");
+
+    assert_nonfatal (ringbuf_readable (&rb) == 0, "new ring should be empty");
+    assert_nonfatal (!ringbuf_read_burst (&rb, out),
+                     "empty ring should not yield a burst");
+
+    assert_nonfatal (ringbuf_write (&rb, in, 5) == 5, "write 5 frames");
+    assert_nonfatal (!ringbuf_read_burst (&rb, out),
+                     "5 frames is less than a burst");
+    assert_nonfatal (ringbuf_write (&rb, in + 5, 7) == 7, "write 7 frames");
+    assert_nonfatal (ringbuf_peek (&rb, out, 3) == 3
+                         && memcmp (out, in, 3 * sizeof *in) == 0
+                         && ringbuf_readable (&rb) == 12,
+                     "peek should not consume frames");
+    assert_nonfatal (ringbuf_read_burst (&rb, out)
+                         && memcmp (out, in, 6 * sizeof *in) == 0,
+                     "first burst should match frames 0..5");
+    assert_nonfatal (ringbuf_read_burst (&rb, out)
+                         && memcmp (out, in + 6, 6 * sizeof *in) == 0,
+                     "second burst should match frames 6..11");
+
+    // head and tail are now at 12; fill past the end of storage
+    assert_nonfatal (ringbuf_write (&rb, in, 64) == 32,
+                     "write should stop at capacity");
+    assert_nonfatal (ringbuf_writable (&rb) == 0, "ring should be full");
+    assert_nonfatal (ringbuf_write (&rb, in, 1) == 0,
+                     "write to a full ring should do nothing");
+    assert_nonfatal (ringbuf_read (&rb, out, 64) == 32
+                         && memcmp (out, in, 32 * sizeof *in) == 0,
+                     "wrapped read should return frames in order");
+    assert_nonfatal (ringbuf_readable (&rb) == 0,
+                     "ring should be empty after draining");
+
+    ringbuf_deinit (&rb);
+
+    // one producer thread, consumer reads whole bursts on this thread
+
+    assert_fatal (ringbuf_init (&rb, sizeof (uint32_t), 16, 8) == NCAP_OK,
+                  "ringbuf_init == NCAP_OK", exit);
+
+    pthread_t tid;
+    pthread_create (&tid, NULL, tfn_produce, &rb);
+
+    uint32_t expect = 0;
+    bool     inorder = true;
+
+    while (expect + rb.burst <= STRESS_FRAMES && inorder) {
+        if (!ringbuf_read_burst (&rb, out)) {
+            sched_yield ();
+            continue;
+        }
+
+        for (size_t i = 0; i < rb.burst; ++i)
+            inorder = inorder && out[i] == expect++;
+    }
+
+    while (expect < STRESS_FRAMES && inorder) {
+        const size_t left = STRESS_FRAMES - expect;
+        const size_t n    = ringbuf_read (&rb, out, left < 64 ? left : 64);
+
+        if (n == 0)
+            sched_yield ();
+
+        for (size_t i = 0; i < n; ++i)
+            inorder = inorder && out[i] == expect++;
+    }
+
+    pthread_join (tid, NULL);
+
+    assert_nonfatal (inorder, "concurrent frames should arrive in order");
+    assert_nonfatal (expect == STRESS_FRAMES,
+                     "consumer should receive every frame");
+
+    ringbuf_deinit (&rb);
+
+exit:
+    report ();
+
+    return 0;
+}
@@ -40,6 +40,72 @@ main (void)
     assert_nonfatal (memcmp (str1, strvec_back (&sq), len1) == 0,
                      "back doesn't match first pushed after pop");
 
+    // popping to empty leaves room to push again
+
+    strvec_popb (&sq);
+    assert_nonfatal (sq.siz == 0 && sq.cap >= STRVEC_MIN_CAP,
+                     "popping the last string left no room");
+    assert_nonfatal (strvec_pushb (&sq, "abcdef", 3) == STRQUEUE_OK
+                         && strcmp (strvec_back (&sq), "abc") == 0,
+                     "a string of len bytes wasn't terminated");
+
+    // pushing and popping at a boundary doesn't resize
+
+    while (sq.siz < sq.cap)
+        strvec_pushb (&sq, "x", 1);
+
+    const size_t cap = sq.cap;
+
+    for (int i = 0; i < 100; ++i) {
+        strvec_pushb (&sq, "y", 1);
+        strvec_popb (&sq);
+        strvec_popb (&sq);
+        strvec_pushb (&sq, "x", 1);
+    }
+
+    assert_nonfatal (sq.cap == cap * 2, "push and pop at a boundary resized");
+
+    while (sq.siz > 0)
+        strvec_popb (&sq);
+
+    assert_nonfatal (sq.cap == STRVEC_MIN_CAP,
+                     "the pointers didn't shrink once empty");
+
+    // bulk and long strings. pointers outlive later blocks
+
+    const char bulk[] = "a\0bb\0ccc";
+
+    assert_nonfatal (strvec_pushn (&sq, bulk, sizeof bulk, 3) == STRQUEUE_OK
+                         && sq.siz == 3 && strcmp (sq.ptr[0], "a") == 0
+                         && strcmp (sq.ptr[1], "bb") == 0
+                         && strcmp (sq.ptr[2], "ccc") == 0,
+                     "strvec_pushn didn't split the buffer");
+
+    char *const first = strvec_front (&sq);
+    static char big[STRVEC_BLK_SIZ * 2];
+
+    memset (big, 'z', sizeof big - 1);
+
+    assert_nonfatal (strvec_reserve (&sq, 10000, 0) == STRQUEUE_OK
+                         && sq.cap >= 10003,
+                     "strvec_reserve didn't make room");
+
+    for (int i = 0; i < 10000; ++i) {
+        char name[32];
+
+        snprintf (name, sizeof name, "track %05d.flac", i);
+        strvec_pushb (&sq, name, strlen (name));
+    }
+
+    assert_nonfatal (strvec_pushb (&sq, big, sizeof big - 1) == STRQUEUE_OK
+                         && strlen (strvec_back (&sq)) == sizeof big - 1,
+                     "a string longer than a block was cut");
+    assert_nonfatal (strvec_front (&sq) == first
+                         && strcmp (first, "a") == 0
+                         && strcmp (sq.ptr[3 + 9999], "track 09999.flac")
+                                == 0,
+                     "a string moved as the arena grew");
+
 deinit:
     strvec_deinit (&sq);
 
@@ -0,0 +1,284 @@
+#define _GNU_SOURCE
+
+#include <ftw.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#include "../audio.h"
+#include "../dirscan.h"
+#include "../tagcache.h"
+#include "../trackidx.h"
+#include "../trackwatch.h"
+
+size_t passcnt = 0;
+size_t failcnt = 0;
+
+#define TREE    "build/tagcache"
+#define IDX     "build/tagcache.idx"
+#define CACHE   "build/tagcache.tags"
+#define WAIT_MS 5000
+
+static atomic_int nread;
+
+/** tags made up from fn, so each file's are its own */
+static int
+fake_read (const char *fn, struct tagcache_meta_t *meta)
+{
+    const char *name = strrchr (fn, '/') + 1;
+    struct stat st;
+
+    atomic_fetch_add (&nread, 1);
+
+    if (strncmp (name, "bad", 3) == 0 || stat (fn, &st) != 0)
+        return NCAP_EGEN;
+
+    meta->duration_ms = 1000 * (uint32_t)(st.st_size + 1);
+    meta->trackno     = (uint32_t)atoi (name);
+    meta->codec       = TRACKIDX_CODEC_FLAC;
+    snprintf (meta->title, sizeof meta->title, "title of %s", name);
+    snprintf (meta->artist, sizeof meta->artist, "someone");
+    snprintf (meta->album, sizeof meta->album, "an album");
+
+    return NCAP_OK;
+}
+
+static bool
+write_file (const char *rel, const char *content)
+{
+    char  path[256];
+    FILE *fp;
+
+    snprintf (path, sizeof path, TREE "/%s", rel);
+
+    if ((fp = fopen (path, "w")) == NULL)
+        return false;
+
+    fputs (content, fp);
+
+    return fclose (fp) == 0;
+}
+
+static int
+rm (const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove (path);
+}
+
+/**
+ * @return a reference to the list published once it has ntracks tracks,
+ * all with their tags set within WAIT_MS, or NULL
+ */
+static struct tracklist_t *
+waitfor (size_t ntracks)
+{
+    const struct timespec ts = { .tv_nsec = 10000000 };
+
+    for (int ms = 0; ms < WAIT_MS; ms += 10) {
+        struct tracklist_t *tl = tracklist_acquire ();
+
+        if (tl != NULL && tl->len == ntracks
+            && atomic_load (&tl->tags.ndone) == ntracks)
+            return tl;
+
+        tracklist_release (tl);
+        nanosleep (&ts, NULL);
+    }
+
+    return NULL;
+}
+
+/** @return whether the row of path in tl has the tags fake_read makes */
+static bool
+hastags (const struct tracklist_t *tl, const char *path, uint32_t duration_ms)
+{
+    struct tagcache_tags_t tags;
+
+    for (size_t i = 0; tl != NULL && i < tl->len; ++i) {
+        if (strcmp (tl->ptr[i], path) != 0)
+            continue;
+
+        if (!tagcache_get (&tl->tags, i, &tags))
+            return false;
+
+        const char *name = strrchr (path, '/') + 1;
+        char        title[64];
+
+        snprintf (title, sizeof title, "title of %s", name);
+
+        return tags.duration_ms == duration_ms
+               && tags.trackno == (uint32_t)atoi (name)
+               && strcmp (tags.title, title) == 0
+               && strcmp (tags.artist, "someone") == 0
+               && strcmp (tags.album, "an album") == 0;
+    }
+
+    return false;
+}
+
+/** @return whether path in tl is set, without tags */
+static bool
+hasnotags (const struct tracklist_t *tl, const char *path)
+{
+    struct tagcache_tags_t tags;
+
+    for (size_t i = 0; tl != NULL && i < tl->len; ++i)
+        if (strcmp (tl->ptr[i], path) == 0)
+            return tagcache_get (&tl->tags, i, &tags)
+                   && tags.duration_ms == 0 && tags.title[0] == '\0'
+                   && tags.codec == TRACKIDX_CODEC_WAV;
+
+    return false;
+}
+
+static bool
+start (struct trackidx_t *idx)
+{
+    return trackidx_open (idx, IDX) == NCAP_OK
+           && trackidx_update (idx, IDX, TREE, dirscan_audio_exts, NULL)
+                  == NCAP_OK
+           && tagcache_start (CACHE, TREE, 2, fake_read) == NCAP_OK
+           && trackwatch_start (idx, IDX, TREE, dirscan_audio_exts)
+                  == NCAP_OK;
+}
+
+static void
+stop (struct trackidx_t *idx)
+{
+    trackwatch_stop ();
+    tagcache_stop ();
+    trackidx_close (idx);
+}
+
+int
+main (void)
+{
+    struct trackidx_t   idx = { 0 };
+    struct tracklist_t *tl  = NULL;
+
+    nftw (TREE, rm, 16, FTW_DEPTH | FTW_PHYS);
+    remove (IDX);
+    remove (CACHE);
+
+    mkdir (TREE, 0700);
+    mkdir (TREE "/a", 0700);
+    mkdir (TREE "/b", 0700);
+
+    assert_fatal (write_file ("a/01.flac", "1") && write_file ("a/02.flac", "")
+                      && write_file ("b/bad.wav", ""),
+                  "could not make the tree", exit);
+
+    // read in the background, then published row by row
+
+    assert_fatal (start (&idx), "could not start", exit);
+
+    tl = waitfor (3);
+    assert_nonfatal (tl != NULL, "the tags weren't all read");
+    assert_nonfatal (hastags (tl, "a/01.flac", 2000)
+                         && hastags (tl, "a/02.flac", 1000),
+                     "the tags read weren't set");
+    assert_nonfatal (hasnotags (tl, "b/bad.wav"),
+                     "a file without tags wasn't set, by its extension");
+    assert_nonfatal (atomic_load (&nread) == 3,
+                     "a track was read more than once");
+
+    tracklist_release (tl);
+    tl = NULL;
+    stop (&idx);
+
+    // the next run starts from the cache
+
+    assert_fatal (start (&idx), "could not start again", exit);
+
+    tl = tracklist_acquire ();
+    assert_nonfatal (tl != NULL && atomic_load (&tl->tags.ndone) == 3
+                         && hastags (tl, "a/01.flac", 2000)
+                         && hasnotags (tl, "b/bad.wav"),
+                     "the first list wasn't set from the cache");
+    assert_nonfatal (atomic_load (&nread) == 3,
+                     "a cached track was read again");
+
+    tracklist_release (tl);
+    tl = NULL;
+
+    // a changed track is read again, and a new one
+
+    assert_nonfatal (remove (TREE "/a/02.flac") == 0
+                         && write_file ("a/02.flac", "22")
+                         && write_file ("b/03.flac", ""),
+                     "could not change the tree");
+
+    tl = waitfor (4);
+    assert_nonfatal (tl != NULL, "the changed tracks weren't read");
+    assert_nonfatal (hastags (tl, "a/02.flac", 3000)
+                         && hastags (tl, "b/03.flac", 1000)
+                         && hastags (tl, "a/01.flac", 2000),
+                     "the changed tracks' tags weren't set");
+    assert_nonfatal (atomic_load (&nread) == 5,
+                     "only the changed tracks should have been read");
+
+    tracklist_release (tl);
+    tl = NULL;
+
+    // tracks removed, one added
+
+    assert_nonfatal (remove (TREE "/b/03.flac") == 0
+                         && remove (TREE "/a/01.flac") == 0
+                         && write_file ("a/04.flac", ""),
+                     "could not change the tree");
+
+    tl = waitfor (3);
+    tracklist_release (tl);
+    tl = NULL;
+    stop (&idx);
+
+    struct stat st_before, st_after;
+
+    assert_nonfatal (stat (CACHE, &st_before) == 0 && start (&idx),
+                     "could not start a third time");
+
+    tl = tracklist_acquire ();
+    assert_nonfatal (tl != NULL && atomic_load (&tl->tags.ndone) == 3
+                         && hastags (tl, "a/04.flac", 1000),
+                     "the cache lost a track");
+
+    tracklist_release (tl);
+    tl = NULL;
+
+    // nothing new was read: the cache is kept as it was
+    stop (&idx);
+    assert_nonfatal (stat (CACHE, &st_after) == 0
+                         && st_after.st_size == st_before.st_size,
+                     "an unchanged cache was written");
+
+    // a damaged cache loads as empty
+
+    assert_nonfatal (truncate (CACHE, 40) == 0 && start (&idx),
+                     "could not start with a damaged cache");
+
+    tl = waitfor (3);
+    assert_nonfatal (tl != NULL && hastags (tl, "a/04.flac", 1000),
+                     "the tracks weren't read again");
+
+exit:
+    tracklist_release (tl);
+    stop (&idx);
+    nftw (TREE, rm, 16, FTW_DEPTH | FTW_PHYS);
+    remove (IDX);
+    remove (CACHE);
+
+    report ();
+
+    return 0;
+}
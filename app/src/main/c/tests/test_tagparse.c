@@ -0,0 +1,694 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+#include "../audio.h"
+#include "../tagcache.h"
+#include "../tagparse.h"
+#include "../trackidx.h"
+
+size_t passcnt = 0;
+size_t failcnt = 0;
+
+#define FILE_WAV  "build/tagparse.wav"
+#define FILE_FLAC "build/tagparse.flac"
+#define FILE_ID3F "build/tagparse.id3.flac"
+#define FILE_VBR  "build/tagparse.vbr.mp3"
+#define FILE_CBR  "build/tagparse.cbr.mp3"
+#define FILE_MP4  "build/tagparse.m4a"
+#define FILE_OGG  "build/tagparse.ogg"
+#define FILE_OPUS "build/tagparse.opus"
+#define FILE_BAD  "build/tagparse.bad"
+#define FILE_CUT  "build/tagparse.cut"
+
+/** a file being made, with the atoms or chunks still open */
+struct buf_t {
+    uint8_t *p;
+    size_t   n;
+    size_t   cap;
+    size_t   open[16];
+    int      nopen;
+};
+
+static void
+put (struct buf_t *b, const void *src, size_t len)
+{
+    if (b->n + len > b->cap) {
+        b->cap = (b->n + len) * 2;
+        b->p   = realloc (b->p, b->cap);
+    }
+
+    if (src != NULL)
+        memcpy (b->p + b->n, src, len);
+    else
+        memset (b->p + b->n, 0, len);
+
+    b->n += len;
+}
+
+static void
+put_str (struct buf_t *b, const char *s)
+{
+    put (b, s, strlen (s));
+}
+
+static void
+put_u8 (struct buf_t *b, uint32_t v)
+{
+    const uint8_t c = (uint8_t)v;
+
+    put (b, &c, 1);
+}
+
+static void
+put_be16 (struct buf_t *b, uint32_t v)
+{
+    put_u8 (b, v >> 8);
+    put_u8 (b, v);
+}
+
+static void
+put_be32 (struct buf_t *b, uint32_t v)
+{
+    put_be16 (b, v >> 16);
+    put_be16 (b, v);
+}
+
+static void
+put_le16 (struct buf_t *b, uint32_t v)
+{
+    put_u8 (b, v);
+    put_u8 (b, v >> 8);
+}
+
+static void
+put_le32 (struct buf_t *b, uint32_t v)
+{
+    put_le16 (b, v);
+    put_le16 (b, v >> 16);
+}
+
+static void
+put_le64 (struct buf_t *b, uint64_t v)
+{
+    put_le32 (b, (uint32_t)v);
+    put_le32 (b, (uint32_t)(v >> 32));
+}
+
+/** open an MP4 atom, sized by atom_end */
+static void
+atom (struct buf_t *b, const char *type)
+{
+    b->open[b->nopen++] = b->n;
+    put_be32 (b, 0);
+    put (b, type, 4);
+}
+
+static void
+atom_end (struct buf_t *b)
+{
+    const size_t at  = b->open[--b->nopen];
+    const size_t siz = b->n - at;
+
+    b->p[at]     = (uint8_t)(siz >> 24);
+    b->p[at + 1] = (uint8_t)(siz >> 16);
+    b->p[at + 2] = (uint8_t)(siz >> 8);
+    b->p[at + 3] = (uint8_t)siz;
+}
+
+/** a Vorbis comment, as FLAC, Vorbis and Opus share it */
+static void
+put_comment (struct buf_t *b, const char *const *kv, uint32_t n)
+{
+    put_le32 (b, 6);
+    put_str (b, "vendor");
+    put_le32 (b, n);
+
+    for (uint32_t i = 0; i < n; ++i) {
+        put_le32 (b, (uint32_t)strlen (kv[i]));
+        put_str (b, kv[i]);
+    }
+}
+
+/** an ID3v2 text frame, sized as major has it */
+static void
+put_id3_text (struct buf_t *b, int major, const char *id, int enc,
+              const void *text, size_t len)
+{
+    const uint32_t siz = (uint32_t)len + 1;
+
+    put_str (b, id);
+
+    if (major == 4) {
+        put_be32 (b, (siz >> 21 & 0x7f) << 24 | (siz >> 14 & 0x7f) << 16
+                         | (siz >> 7 & 0x7f) << 8 | (siz & 0x7f));
+    } else {
+        put_be32 (b, siz);
+    }
+
+    put_be16 (b, 0);
+    put_u8 (b, (uint32_t)enc);
+    put (b, text, len);
+}
+
+/** an ID3v2 header for a tag of siz bytes, padding included */
+static void
+put_id3_header (struct buf_t *b, int major, uint32_t siz)
+{
+    put_str (b, "ID3");
+    put_u8 (b, (uint32_t)major);
+    put_u8 (b, 0);
+    put_u8 (b, 0);
+    put_be32 (b, (siz >> 21 & 0x7f) << 24 | (siz >> 14 & 0x7f) << 16
+                     | (siz >> 7 & 0x7f) << 8 | (siz & 0x7f));
+}
+
+/** an MPEG-1 layer III frame of 128 kbit/s at 44.1 kHz, 417 bytes */
+static void
+put_mpa_frame (struct buf_t *b, uint32_t nframes)
+{
+    const size_t at = b->n;
+
+    put_be32 (b, 0xfffb9000);
+
+    if (nframes > 0) {
+        put (b, NULL, 32);
+        put_str (b, "Xing");
+        put_be32 (b, 1);
+        put_be32 (b, nframes);
+    }
+
+    put (b, NULL, 417 - (b->n - at));
+}
+
+/** an Ogg page of segs, the lacing given */
+static void
+put_ogg_page (struct buf_t *b, int type, uint64_t granule, uint32_t serial,
+              uint32_t seq, const uint8_t *lacing, int nsegs,
+              const void *body, size_t len)
+{
+    put_str (b, "OggS");
+    put_u8 (b, 0);
+    put_u8 (b, (uint32_t)type);
+    put_le64 (b, granule);
+    put_le32 (b, serial);
+    put_le32 (b, seq);
+    put_le32 (b, 0); // not checked
+    put_u8 (b, (uint32_t)nsegs);
+    put (b, lacing, (size_t)nsegs);
+    put (b, body, len);
+}
+
+static bool
+write_buf (const char *fn, struct buf_t *b)
+{
+    FILE *fp = fopen (fn, "wb");
+    bool  ok;
+
+    if (fp == NULL)
+        return false;
+
+    ok = fwrite (b->p, 1, b->n, fp) == b->n;
+
+    free (b->p);
+    memset (b, 0, sizeof *b);
+
+    return fclose (fp) == 0 && ok;
+}
+
+static bool
+make_wav (void)
+{
+    struct buf_t b = { 0 };
+
+    put_str (&b, "RIFF");
+    put_le32 (&b, 0);
+    put_str (&b, "WAVE");
+
+    put_str (&b, "fmt ");
+    put_le32 (&b, 16);
+    put_le16 (&b, 1);
+    put_le16 (&b, 2);
+    put_le32 (&b, 44100);
+    put_le32 (&b, 176400);
+    put_le16 (&b, 4);
+    put_le16 (&b, 16);
+
+    // odd sized, so padded
+    put_str (&b, "LIST");
+    put_le32 (&b, 4 + 8 + 8 + 8 + 8 + 8 + 5 + 1 + 8 + 2);
+    put_str (&b, "INFO");
+    put_str (&b, "INAM");
+    put_le32 (&b, 8);
+    put (&b, "A title", 8);
+    put_str (&b, "IART");
+    put_le32 (&b, 8);
+    put (&b, "Someone", 8);
+    put_str (&b, "IPRD");
+    put_le32 (&b, 5);
+    put (&b, "Alb\0\0", 5);
+    put_u8 (&b, 0);
+    put_str (&b, "ITRK");
+    put_le32 (&b, 2);
+    put (&b, "3", 2);
+
+    put_str (&b, "data");
+    put_le32 (&b, 2 * 176400);
+    put (&b, NULL, 2 * 176400);
+
+    return write_buf (FILE_WAV, &b);
+}
+
+/** FLAC of 3 s, a picture block too large to read whole between */
+static void
+put_flac (struct buf_t *b)
+{
+    static const char *const kv[] = {
+        "title=Flac title",
+        "ARTIST=Flac artist",
+        "Album=Flac album",
+        "TRACKNUMBER=7/12",
+    };
+    const uint64_t total = 3 * 44100;
+    size_t         at;
+
+    put_str (b, "fLaC");
+
+    put_u8 (b, 0);
+    put_u8 (b, 0);
+    put_be16 (b, 34);
+    put_be16 (b, 4096);
+    put_be16 (b, 4096);
+    put (b, NULL, 6);
+    put_u8 (b, 44100 >> 12);
+    put_u8 (b, 44100 >> 4 & 0xff);
+    put_u8 (b, (44100 & 0xf) << 4 | 1 << 1 | 15 >> 4);
+    put_u8 (b, (15 & 0xf) << 4 | (uint32_t)(total >> 32 & 0xf));
+    put_be32 (b, (uint32_t)total);
+    put (b, NULL, 16);
+
+    put_u8 (b, 6);
+    put_u8 (b, 100000 >> 16);
+    put_be16 (b, 100000 & 0xffff);
+    put (b, NULL, 100000);
+
+    put_u8 (b, 0x80 | 4);
+    at = b->n;
+    put (b, NULL, 3);
+    put_comment (b, kv, 4);
+
+    const size_t len = b->n - at - 3;
+
+    b->p[at]     = (uint8_t)(len >> 16);
+    b->p[at + 1] = (uint8_t)(len >> 8);
+    b->p[at + 2] = (uint8_t)len;
+
+    put (b, NULL, 4096);
+}
+
+static bool
+make_flac (void)
+{
+    struct buf_t b = { 0 };
+
+    put_flac (&b);
+
+    if (!write_buf (FILE_FLAC, &b))
+        return false;
+
+    // tagged by ID3 as well, which comes first
+    put_id3_header (&b, 4, 10 + 1 + 8 + 64);
+    put_id3_text (&b, 4, "TIT2", 3, "From ID3", 8);
+    put (&b, NULL, 64);
+    put_flac (&b);
+
+    return write_buf (FILE_ID3F, &b);
+}
+
+static bool
+make_mp3 (void)
+{
+    static const uint8_t utf16[] = {
+        0xff, 0xfe, 'Z', 0, 0xfc, 0, 'r', 0, 'i', 0, 'c', 0, 'h', 0,
+        0x3d, 0xd8, 0xb5, 0xdc, // a surrogate pair, U+1F4B5
+    };
+    struct buf_t b = { 0 };
+
+    // ID3v2.3 in UTF-16, then a Xing header of 100 frames
+    put_id3_header (&b, 3, 2 * 10 + sizeof utf16 + 1 + 4 + 1 + 100);
+    put_id3_text (&b, 3, "TIT2", 1, utf16, sizeof utf16);
+    put_id3_text (&b, 3, "TRCK", 0, "5/10", 4);
+    put (&b, NULL, 100);
+
+    put_mpa_frame (&b, 100);
+
+    for (int i = 0; i < 3; ++i)
+        put_mpa_frame (&b, 0);
+
+    if (!write_buf (FILE_VBR, &b))
+        return false;
+
+    // ID3v2.4 with the artist, then 100 frames and ID3v1 for the rest
+    put_id3_header (&b, 4, 10 + 1 + 7);
+    put_id3_text (&b, 4, "TPE1", 3, "\xc3\x84rtist", 7);
+
+    for (int i = 0; i < 100; ++i)
+        put_mpa_frame (&b, 0);
+
+    char v1[128];
+
+    memset (v1, ' ', sizeof v1);
+    memcpy (v1, "TAG", 3);
+    memcpy (v1 + 3, "Old title", 9);
+    memcpy (v1 + 33, "Old artist", 10);
+    memcpy (v1 + 63, "Old \xe9t\xe9", 8);
+    v1[125] = 0;
+    v1[126] = 9;
+    v1[127] = 0;
+    put (&b, v1, sizeof v1);
+
+    return write_buf (FILE_CBR, &b);
+}
+
+static void
+put_ilst_text (struct buf_t *b, const char *type, const char *text)
+{
+    atom (b, type);
+    atom (b, "data");
+    put_be32 (b, 1);
+    put_be32 (b, 0);
+    put_str (b, text);
+    atom_end (b);
+    atom_end (b);
+}
+
+static bool
+make_mp4 (void)
+{
+    struct buf_t b = { 0 };
+
+    atom (&b, "ftyp");
+    put_str (&b, "M4A ");
+    put_be32 (&b, 0);
+    put_str (&b, "M4A ");
+    atom_end (&b);
+
+    // moov past the head, as it often is
+    atom (&b, "mdat");
+    put (&b, NULL, 50000);
+    atom_end (&b);
+
+    atom (&b, "moov");
+
+    atom (&b, "mvhd");
+    put_be32 (&b, 0);
+    put_be32 (&b, 0);
+    put_be32 (&b, 0);
+    put_be32 (&b, 600);
+    put_be32 (&b, 600 * 61 + 300);
+    put (&b, NULL, 80);
+    atom_end (&b);
+
+    atom (&b, "trak");
+    atom (&b, "tkhd");
+    put (&b, NULL, 84);
+    atom_end (&b);
+    atom (&b, "mdia");
+    atom (&b, "minf");
+    atom (&b, "stbl");
+    atom (&b, "stsd");
+    put_be32 (&b, 0);
+    put_be32 (&b, 1);
+    atom (&b, "mp4a");
+    put (&b, NULL, 28);
+    atom_end (&b);
+    atom_end (&b);
+    atom_end (&b);
+    atom_end (&b);
+    atom_end (&b);
+    atom_end (&b);
+
+    atom (&b, "udta");
+    atom (&b, "meta");
+    put_be32 (&b, 0);
+    atom (&b, "hdlr");
+    put (&b, NULL, 25);
+    atom_end (&b);
+    atom (&b, "ilst");
+    put_ilst_text (&b, "\xa9nam", "Mp4 title");
+    put_ilst_text (&b, "\xa9" "ART", "Mp4 artist");
+    put_ilst_text (&b, "\xa9" "alb", "Mp4 album");
+    atom (&b, "trkn");
+    atom (&b, "data");
+    put_be32 (&b, 0);
+    put_be32 (&b, 0);
+    put_be16 (&b, 0);
+    put_be16 (&b, 11);
+    put_be16 (&b, 12);
+    put_be16 (&b, 0);
+    atom_end (&b);
+    atom_end (&b);
+    atom_end (&b);
+    atom_end (&b);
+    atom_end (&b);
+
+    atom_end (&b);
+
+    return write_buf (FILE_MP4, &b);
+}
+
+/**
+ * an Ogg stream of the two headers given, the comment split over two
+ * pages, ending at granule
+ */
+static bool
+make_ogg (const char *fn, const void *id, size_t idlen, struct buf_t *cm,
+          uint64_t granule)
+{
+    struct buf_t  b      = { 0 };
+    const uint8_t one[1] = { (uint8_t)idlen };
+    uint8_t       lacing[8];
+    int           nsegs = 0;
+
+    put_ogg_page (&b, 2, 0, 0x1234, 0, one, 1, id, idlen);
+
+    // the comment's first 255 bytes, continued on the next page
+    lacing[0] = 255;
+    put_ogg_page (&b, 0, 0, 0x1234, 1, lacing, 1, cm->p, 255);
+
+    for (size_t left = cm->n - 255; left >= 255; left -= 255)
+        lacing[nsegs++] = 255;
+
+    lacing[nsegs++] = (uint8_t)((cm->n - 255) % 255);
+    put_ogg_page (&b, 1, 0, 0x1234, 2, lacing, nsegs, cm->p + 255,
+                  cm->n - 255);
+
+    // audio, then the last page, then another stream's
+    lacing[0] = 200;
+    put_ogg_page (&b, 0, granule / 2, 0x1234, 3, lacing, 1, NULL, 200);
+    put_ogg_page (&b, 4, granule, 0x1234, 4, lacing, 1, NULL, 200);
+    put_ogg_page (&b, 4, granule * 10, 0x5678, 0, lacing, 1, NULL, 200);
+
+    free (cm->p);
+    memset (cm, 0, sizeof *cm);
+
+    return write_buf (fn, &b);
+}
+
+static bool
+make_oggs (void)
+{
+    static const char *const kv[] = {
+        "TITLE=Ogg title",
+        "ARTIST=Ogg artist",
+        "TRACKNUMBER=2",
+        "DESCRIPTION=............................................"
+        "................................................................"
+        "................................................................"
+        "................................................................"
+        "................................................................"
+        "................................................................",
+        "ALBUM=Ogg album",
+    };
+    struct buf_t id = { 0 }, cm = { 0 };
+    bool         ok;
+
+    put_str (&id, "\x01vorbis");
+    put_le32 (&id, 0);
+    put_u8 (&id, 2);
+    put_le32 (&id, 44100);
+    put (&id, NULL, 14);
+    put_str (&cm, "\x03vorbis");
+    put_comment (&cm, kv, 5);
+    put_u8 (&cm, 1);
+
+    ok = make_ogg (FILE_OGG, id.p, id.n, &cm, 4 * 44100);
+    free (id.p);
+    memset (&id, 0, sizeof id);
+
+    if (!ok)
+        return false;
+
+    put_str (&id, "OpusHead");
+    put_u8 (&id, 1);
+    put_u8 (&id, 2);
+    put_le16 (&id, 312);
+    put_le32 (&id, 44100); // the input's, not the granules'
+    put_le16 (&id, 0);
+    put_u8 (&id, 0);
+    put_str (&cm, "OpusTags");
+    put_comment (&cm, kv, 5);
+
+    ok = make_ogg (FILE_OPUS, id.p, id.n, &cm, 5 * 48000 + 312);
+    free (id.p);
+
+    return ok;
+}
+
+/** read fn, checking what was read against the rest */
+static bool
+check (const char *fn, uint32_t codec, uint32_t duration_ms,
+       uint32_t trackno, const char *title, const char *artist,
+       const char *album)
+{
+    struct tagcache_meta_t meta;
+    int                    ret;
+
+    memset (&meta, 0, sizeof meta);
+
+    if ((ret = tagparse_read (fn, &meta)) != NCAP_OK) {
+        fprintf (stderr, "%s: %d\n", fn, ret);
+        return false;
+    }
+
+    if (meta.codec == codec && meta.duration_ms == duration_ms
+        && meta.trackno == trackno && strcmp (meta.title, title) == 0
+        && strcmp (meta.artist, artist) == 0
+        && strcmp (meta.album, album) == 0)
+        return true;
+
+    fprintf (stderr, "%s: %u %u %u `%s' `%s' `%s'\n", fn, meta.codec,
+             meta.duration_ms, meta.trackno, meta.title, meta.artist,
+             meta.album);
+
+    return false;
+}
+
+/** @return whether every prefix of fn, cut step bytes apart, is read */
+static bool
+check_cut (const char *fn, size_t step)
+{
+    FILE                  *fp = fopen (fn, "rb");
+    struct tagcache_meta_t meta;
+    struct buf_t           b = { 0 };
+    uint8_t                chunk[4096];
+    size_t                 n;
+    bool                   ok = fp != NULL;
+
+    while (ok && (n = fread (chunk, 1, sizeof chunk, fp)) > 0)
+        put (&b, chunk, n);
+
+    if (fp != NULL)
+        fclose (fp);
+
+    for (size_t len = 0; ok && len < b.n; len += step) {
+        FILE *out = fopen (FILE_CUT, "wb");
+
+        ok = out != NULL && fwrite (b.p, 1, len, out) == len;
+
+        if (out != NULL)
+            ok = fclose (out) == 0 && ok;
+
+        memset (&meta, 0, sizeof meta);
+
+        // whatever is read, it is read within bounds, and terminated
+        ok = ok && tagparse_read (FILE_CUT, &meta) != NCAP_EIO
+             && memchr (meta.title, '\0', sizeof meta.title) != NULL
+             && memchr (meta.artist, '\0', sizeof meta.artist) != NULL
+             && memchr (meta.album, '\0', sizeof meta.album) != NULL;
+    }
+
+    free (b.p);
+
+    return ok;
+}
+
+int
+main (void)
+{
+    struct tagcache_meta_t meta = { 0 };
+    FILE                  *fp;
+
+    assert_fatal (make_wav () && make_flac () && make_mp3 () && make_mp4 ()
+                      && make_oggs (),
+                  "could not make the files", exit);
+
+    assert_nonfatal (check (FILE_WAV, TRACKIDX_CODEC_WAV, 2000, 3, "A title",
+                            "Someone", "Alb"),
+                     "WAV wasn't read");
+    assert_nonfatal (check (FILE_FLAC, TRACKIDX_CODEC_FLAC, 3000, 7,
+                            "Flac title", "Flac artist", "Flac album"),
+                     "FLAC wasn't read");
+    assert_nonfatal (check (FILE_ID3F, TRACKIDX_CODEC_FLAC, 3000, 7,
+                            "From ID3", "Flac artist", "Flac album"),
+                     "FLAC after ID3 wasn't read");
+    assert_nonfatal (check (FILE_VBR, TRACKIDX_CODEC_MP3, 2612, 5,
+                            "Z\xc3\xbcrich\xf0\x9f\x92\xb5", "", ""),
+                     "MP3 with a Xing header wasn't read");
+    assert_nonfatal (check (FILE_CBR, TRACKIDX_CODEC_MP3, 2606, 9,
+                            "Old title", "\xc3\x84rtist",
+                            "Old \xc3\xa9t\xc3\xa9"),
+                     "MP3 with ID3v1 wasn't read");
+    assert_nonfatal (check (FILE_MP4, TRACKIDX_CODEC_AAC, 61500, 11,
+                            "Mp4 title", "Mp4 artist", "Mp4 album"),
+                     "MP4 wasn't read");
+    assert_nonfatal (check (FILE_OGG, TRACKIDX_CODEC_VORBIS, 4000, 2,
+                            "Ogg title", "Ogg artist", "Ogg album"),
+                     "Ogg Vorbis wasn't read");
+    assert_nonfatal (check (FILE_OPUS, TRACKIDX_CODEC_OPUS, 5000, 2,
+                            "Ogg title", "Ogg artist", "Ogg album"),
+                     "Ogg Opus wasn't read");
+
+    // left to libav
+
+    assert_fatal ((fp = fopen (FILE_BAD, "wb")) != NULL, "could not write",
+                  exit);
+    fputs ("#EXTM3U\nnot audio at all\n", fp);
+    fclose (fp);
+
+    assert_nonfatal (tagparse_read (FILE_BAD, &meta) == NCAP_EGEN,
+                     "an unknown container was taken");
+    assert_nonfatal (tagparse_read ("build/tagparse.none", &meta) == NCAP_EIO,
+                     "a missing file wasn't an error");
+
+    // cut short anywhere, the files are still read safely
+
+    assert_nonfatal (check_cut (FILE_WAV, 97) && check_cut (FILE_FLAC, 89)
+                         && check_cut (FILE_ID3F, 89)
+                         && check_cut (FILE_VBR, 7)
+                         && check_cut (FILE_CBR, 31)
+                         && check_cut (FILE_MP4, 13)
+                         && check_cut (FILE_OGG, 3)
+                         && check_cut (FILE_OPUS, 3),
+                     "a file cut short wasn't read safely");
+
+exit:
+    remove (FILE_WAV);
+    remove (FILE_FLAC);
+    remove (FILE_ID3F);
+    remove (FILE_VBR);
+    remove (FILE_CBR);
+    remove (FILE_MP4);
+    remove (FILE_OGG);
+    remove (FILE_OPUS);
+    remove (FILE_BAD);
+    remove (FILE_CUT);
+
+    report ();
+
+    return 0;
+}
@@ -0,0 +1,228 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#include "../audio.h"
+#include "../dirscan.h"
+#include "../trackidx.h"
+
+size_t passcnt = 0;
+size_t failcnt = 0;
+
+#define TREE "build/trackidx"
+#define IDX  "build/trackidx.idx"
+
+static bool
+touch (const char *rel, const char *text)
+{
+    char  path[256];
+    FILE *fp;
+
+    snprintf (path, sizeof path, TREE "/%s", rel);
+
+    if ((fp = fopen (path, "w")) == NULL)
+        return false;
+
+    fputs (text, fp);
+
+    return fclose (fp) == 0;
+}
+
+/** as a filesystem with a coarse clock might not, move dir's mtime on */
+static bool
+bump (const char *rel)
+{
+    static time_t  sec = 1000000000;
+    struct timespec ts[2] = { { .tv_nsec = UTIME_OMIT }, { .tv_sec = ++sec } };
+    char           path[256];
+
+    snprintf (path, sizeof path, TREE "/%s", rel);
+
+    return utimensat (AT_FDCWD, path, ts, 0) == 0;
+}
+
+static int
+rm (const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove (path);
+}
+
+/** @return whether idx lists exactly want, comma separated */
+static bool
+islisted (const struct trackidx_t *idx, const char *want)
+{
+    char   got[1024] = "";
+    size_t len       = 0;
+
+    for (size_t i = 0; i < idx->ntracks && len < sizeof got; ++i)
+        len += snprintf (got + len, sizeof got - len, i > 0 ? ",%s" : "%s",
+                         trackidx_path (idx, i));
+
+    if (strcmp (got, want) != 0) {
+        fprintf (stderr, "listed `%s', not `%s'\n", got, want);
+        return false;
+    }
+
+    return true;
+}
+
+int
+main (void)
+{
+    struct trackidx_t idx;
+    size_t            n;
+
+    nftw (TREE, rm, 16, FTW_DEPTH | FTW_PHYS);
+    remove (IDX);
+    trackidx_racy_ns = 0;
+
+    mkdir (TREE, 0700);
+    mkdir (TREE "/sub", 0700);
+    mkdir (TREE "/sub/deep", 0700);
+    mkdir (TREE "/empty", 0700);
+
+    assert_fatal (touch ("a.flac", "aaaa") && touch ("c.txt", "")
+                      && touch ("sub/b.mp3", "") && touch ("sub/B.Ogg", "")
+                      && touch ("sub/deep/d.opus", ""),
+                  "could not make the tree", exit);
+
+    // made from nothing
+
+    assert_fatal (trackidx_open (&idx, IDX) == NCAP_OK && idx.ntracks == 0,
+                  "a missing index didn't open empty", exit);
+
+    assert_nonfatal (trackidx_update (&idx, IDX, TREE, dirscan_audio_exts, &n)
+                             == NCAP_OK
+                         && n == 4,
+                     "every directory wasn't listed");
+
+    assert_nonfatal (islisted (&idx, "a.flac,sub/B.Ogg,sub/b.mp3,"
+                                     "sub/deep/d.opus"),
+                     "the first index is wrong");
+
+    assert_nonfatal (idx.tracks[0].size == 4
+                         && idx.tracks[0].codec == TRACKIDX_CODEC_FLAC
+                         && idx.tracks[1].codec == TRACKIDX_CODEC_VORBIS,
+                     "a track's record is wrong");
+
+    // mapped again, and nothing changed
+
+    trackidx_close (&idx);
+
+    assert_nonfatal (trackidx_open (&idx, IDX) == NCAP_OK
+                         && idx.ndirs == 4
+                         && islisted (&idx, "a.flac,sub/B.Ogg,sub/b.mp3,"
+                                            "sub/deep/d.opus"),
+                     "the index didn't map back");
+
+    assert_nonfatal (trackidx_update (&idx, IDX, TREE, dirscan_audio_exts, &n)
+                             == NCAP_OK
+                         && n == 0,
+                     "an unchanged tree was listed");
+
+    // a file added, and a directory with what was in it removed
+
+    assert_fatal (touch ("empty/e.wav", "") && remove (TREE "/sub/deep/d.opus")
+                          == 0
+                      && remove (TREE "/sub/deep") == 0 && bump ("empty")
+                      && bump ("sub"),
+                  "could not change the tree", exit);
+
+    assert_nonfatal (trackidx_update (&idx, IDX, TREE, dirscan_audio_exts, &n)
+                             == NCAP_OK
+                         && n == 2
+                         && islisted (&idx, "a.flac,empty/e.wav,sub/B.Ogg,"
+                                            "sub/b.mp3")
+                         && idx.ndirs == 3,
+                     "the changes weren't patched in");
+
+    // a new tree under the root, and a file that changed
+
+    mkdir (TREE "/new", 0700);
+    mkdir (TREE "/new/x", 0700);
+
+    assert_fatal (touch ("new/x/f.flac", "") && touch ("a.flac", "aaaaaaaa")
+                      && bump ("."),
+                  "could not change the tree", exit);
+
+    assert_nonfatal (trackidx_update (&idx, IDX, TREE, dirscan_audio_exts, &n)
+                             == NCAP_OK
+                         && n == 3
+                         && islisted (&idx, "a.flac,empty/e.wav,new/x/f.flac,"
+                                            "sub/B.Ogg,sub/b.mp3")
+                         && idx.tracks[0].size == 8,
+                     "a new subtree wasn't listed whole");
+
+    assert_nonfatal (idx.dirs[0].parent == TRACKIDX_NONE
+                         && strcmp (trackidx_str (&idx, idx.dirs[3].path),
+                                    "new/x")
+                                == 0
+                         && idx.dirs[3].parent == 2
+                         && idx.dirs[3].first == 2
+                         && idx.dirs[3].ntracks == 1,
+                     "the directory records are wrong");
+
+    // a change too recent to trust is looked at again
+
+    trackidx_racy_ns = 10 * 1000000000LL;
+    touch ("new/g.wav", "");
+
+    assert_nonfatal (trackidx_update (&idx, IDX, TREE, dirscan_audio_exts, &n)
+                             == NCAP_OK
+                         && n == 1
+                         && trackidx_update (&idx, IDX, TREE,
+                                             dirscan_audio_exts, &n)
+                                == NCAP_OK
+                         && n == 1 && idx.ntracks == 6,
+                     "a racy directory wasn't listed again");
+
+    trackidx_racy_ns = 0;
+
+    // another root
+
+    assert_nonfatal (trackidx_update (&idx, IDX, TREE "/sub",
+                                      dirscan_audio_exts, &n)
+                             == NCAP_OK
+                         && n == 1 && islisted (&idx, "B.Ogg,b.mp3"),
+                     "an index of another root was kept");
+
+    trackidx_close (&idx);
+
+    // not an index
+
+    FILE *fp = fopen (IDX, "w");
+
+    assert_fatal (fp != NULL, "could not open the index", exit);
+    fputs ("NCTI but not much else", fp);
+    fclose (fp);
+
+    assert_nonfatal (trackidx_open (&idx, IDX) == NCAP_OK && idx.ntracks == 0
+                         && trackidx_update (&idx, IDX, TREE,
+                                             dirscan_audio_exts, &n)
+                                == NCAP_OK
+                         && n == 5 && idx.ntracks == 6,
+                     "a bad index wasn't made again");
+
+    trackidx_close (&idx);
+
+exit:
+    nftw (TREE, rm, 16, FTW_DEPTH | FTW_PHYS);
+    remove (IDX);
+
+    report ();
+
+    return 0;
+}
@@ -0,0 +1,185 @@
+#define _GNU_SOURCE
+
+#include <ftw.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#include "../audio.h"
+#include "../dirscan.h"
+#include "../trackidx.h"
+#include "../trackwatch.h"
+#include "../trksearch.h"
+
+size_t passcnt = 0;
+size_t failcnt = 0;
+
+#define TREE    "build/trackwatch"
+#define IDX     "build/trackwatch.idx"
+#define WAIT_MS 5000
+
+static bool
+touch (const char *rel)
+{
+    char  path[256];
+    FILE *fp;
+
+    snprintf (path, sizeof path, TREE "/%s", rel);
+
+    if ((fp = fopen (path, "w")) == NULL)
+        return false;
+
+    return fclose (fp) == 0;
+}
+
+static int
+rm (const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove (path);
+}
+
+/** @return whether tl lists exactly want, comma separated */
+static bool
+islisted (const struct tracklist_t *tl, const char *want)
+{
+    char   got[1024] = "";
+    size_t len       = 0;
+
+    for (size_t i = 0; tl != NULL && i < tl->len && len < sizeof got; ++i)
+        len += snprintf (got + len, sizeof got - len, i > 0 ? ",%s" : "%s",
+                         tl->ptr[i]);
+
+    return strcmp (got, want) == 0;
+}
+
+/** @return whether the list published comes to be want within WAIT_MS */
+static bool
+waitfor (const char *want)
+{
+    const struct timespec ts = { .tv_nsec = 10000000 };
+
+    for (int ms = 0; ms < WAIT_MS; ms += 10) {
+        struct tracklist_t *tl   = tracklist_acquire ();
+        const bool          isok = islisted (tl, want);
+
+        tracklist_release (tl);
+
+        if (isok)
+            return true;
+
+        nanosleep (&ts, NULL);
+    }
+
+    return false;
+}
+
+int
+main (void)
+{
+    struct trackidx_t    idx   = { 0 };
+    struct tracklist_t  *first = NULL;
+    struct trksearch_q_t q;
+    uint64_t             gen;
+
+    trksearch_q_init (&q);
+
+    nftw (TREE, rm, 16, FTW_DEPTH | FTW_PHYS);
+    remove (IDX);
+
+    mkdir (TREE, 0700);
+    mkdir (TREE "/sub", 0700);
+
+    assert_fatal (touch ("a.flac") && touch ("sub/b.mp3"),
+                  "could not make the tree", exit);
+
+    assert_fatal (trackidx_open (&idx, IDX) == NCAP_OK
+                      && trackidx_update (&idx, IDX, TREE, dirscan_audio_exts,
+                                          NULL)
+                             == NCAP_OK,
+                  "could not index the tree", exit);
+
+    assert_fatal (trackwatch_start (&idx, IDX, TREE, dirscan_audio_exts)
+                      == NCAP_OK,
+                  "trackwatch_start failed", exit);
+
+    first = tracklist_acquire ();
+
+    assert_nonfatal (tracklist_gen () == 1
+                         && islisted (first, "a.flac,sub/b.mp3"),
+                     "the index wasn't published at start");
+
+    // the search index waits for the first query
+
+    assert_nonfatal (first != NULL && !atomic_load (&first->issearch)
+                         && trksearch_query (tracklist_search (first), &q,
+                                             "B.MP")
+                                == NCAP_OK
+                         && q.nids == 1 && q.ids[0] == 1
+                         && atomic_load (&first->issearch),
+                     "the first query didn't build the search index");
+
+    // a track added in a watched directory
+
+    assert_nonfatal (touch ("sub/c.ogg") && waitfor ("a.flac,sub/b.mp3,"
+                                                     "sub/c.ogg"),
+                     "an added track wasn't published");
+
+    assert_nonfatal (islisted (first, "a.flac,sub/b.mp3"),
+                     "a published list changed");
+
+    // a new directory, filled before its watch may be up
+
+    mkdir (TREE "/new", 0700);
+
+    assert_nonfatal (touch ("new/d.wav") && touch ("new/e.wav")
+                         && waitfor ("a.flac,new/d.wav,new/e.wav,sub/b.mp3,"
+                                     "sub/c.ogg"),
+                     "a new directory's tracks weren't published");
+
+    assert_nonfatal (touch ("new/f.opus")
+                         && waitfor ("a.flac,new/d.wav,new/e.wav,new/f.opus,"
+                                     "sub/b.mp3,sub/c.ogg"),
+                     "a new directory isn't watched");
+
+    // removed, then files that aren't tracks
+
+    assert_nonfatal (remove (TREE "/a.flac") == 0
+                         && waitfor ("new/d.wav,new/e.wav,new/f.opus,"
+                                     "sub/b.mp3,sub/c.ogg"),
+                     "a removed track wasn't dropped");
+
+    gen = tracklist_gen ();
+    touch ("cover.jpg");
+    touch ("sub/notes.txt");
+    usleep ((TRACKWATCH_QUIET_MS + 200) * 1000);
+
+    assert_nonfatal (tracklist_gen () == gen,
+                     "a file that isn't a track made a list");
+
+    trackwatch_stop ();
+
+    assert_nonfatal (tracklist_acquire () == NULL,
+                     "a list was left after trackwatch_stop");
+
+exit:
+    trksearch_q_deinit (&q);
+    tracklist_release (first);
+    trackidx_close (&idx);
+    nftw (TREE, rm, 16, FTW_DEPTH | FTW_PHYS);
+    remove (IDX);
+
+    report ();
+
+    return 0;
+}
@@ -0,0 +1,180 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+#include "../audio.h"
+#include "../simd.h"
+#include "../trksearch.h"
+
+size_t passcnt = 0;
+size_t failcnt = 0;
+
+#define NLIST 4096
+
+/** an ascending list of n ids, each kept with odds 1 in every */
+static size_t
+make_list (uint32_t *p, size_t n, int every, unsigned *seed)
+{
+    size_t k = 0;
+
+    for (uint32_t id = 0; k < n; ++id)
+        if (rand_r (seed) % every == 0)
+            p[k++] = id;
+
+    return k;
+}
+
+/** @return whether trksearch_intersect matches the scalar one at simd_level */
+static bool
+check_level (void)
+{
+    static uint32_t a[NLIST], a0[NLIST], b[NLIST], want[NLIST];
+    const int       every[][2] = { { 1, 1 }, { 2, 3 }, { 5, 2 }, { 1, 64 } };
+    unsigned        seed       = 7;
+
+    for (size_t e = 0; e < sizeof every / sizeof *every; ++e) {
+        for (size_t na = 0; na < NLIST; na = na * 3 + 1) {
+            const size_t nb = NLIST - na / 2;
+
+            make_list (a0, na, every[e][0], &seed);
+            make_list (b, nb, every[e][1], &seed);
+            memcpy (a, a0, na * sizeof *a);
+            memcpy (want, a0, na * sizeof *a);
+
+            const size_t nwant = trksearch_intersect_scalar (want, na, b, nb);
+
+            if (trksearch_intersect (a, na, b, nb) != nwant
+                || memcmp (a, want, nwant * sizeof *a) != 0)
+                return false;
+
+            // and the other way round, for the galloping search
+            if (trksearch_intersect (b, nb, a0, na) != nwant
+                || memcmp (b, want, nwant * sizeof *b) != 0)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/** @return whether q holds exactly the ids in want, -1 terminated */
+static bool
+isfound (const struct trksearch_q_t *q, const int *want)
+{
+    size_t i = 0;
+
+    for (; want[i] >= 0; ++i)
+        if (i >= q->nids || q->ids[i] != (uint32_t)want[i])
+            return false;
+
+    return i == q->nids;
+}
+
+int
+main (void)
+{
+    static const char *const names[] = {
+        "Artist/Album/01 Intro.flac",       // 0
+        "Artist/Album/02 Interlude.flac",   // 1
+        "other/Live at the Forum.mp3",      // 2
+        "other/INTRO (reprise).opus",       // 3
+        "Café/Chanson d'été.ogg",           // 4
+        "aaaaaaaaaaaaaa.wav",               // 5
+        "",                                 // 6
+    };
+    const size_t n = sizeof names / sizeof *names;
+
+    struct trksearch_t   idx;
+    struct trksearch_q_t q;
+
+    trksearch_q_init (&q);
+    assert_fatal (trksearch_init (&idx, names, n) == NCAP_OK,
+                  "trksearch_init failed", exit);
+
+    // case is ignored, whole query is checked
+
+    assert_nonfatal (trksearch_query (&idx, &q, "intro") == NCAP_OK
+                         && isfound (&q, (int[]){ 0, 3, -1 }),
+                     "'intro' didn't find both intros");
+    assert_nonfatal (trksearch_query (&idx, &q, "INTER") == NCAP_OK
+                         && isfound (&q, (int[]){ 1, -1 }),
+                     "'INTER' wasn't case-insensitive");
+    assert_nonfatal (trksearch_query (&idx, &q, "tro.f") == NCAP_OK
+                         && isfound (&q, (int[]){ 0, -1 }),
+                     "a query across punctuation missed");
+    assert_nonfatal (trksearch_query (&idx, &q, "aaaaaaa") == NCAP_OK
+                         && isfound (&q, (int[]){ 5, -1 }),
+                     "a query of repeated trigrams missed");
+    assert_nonfatal (trksearch_query (&idx, &q, "Chanson d'été") == NCAP_OK
+                         && isfound (&q, (int[]){ 4, -1 }),
+                     "a multibyte query missed");
+    assert_nonfatal (trksearch_query (&idx, &q, "d'étè") == NCAP_OK
+                         && isfound (&q, (int[]){ -1 }),
+                     "keys sharing a symbol weren't told apart");
+    assert_nonfatal (trksearch_query (&idx, &q, "zzz") == NCAP_OK
+                         && isfound (&q, (int[]){ -1 }),
+                     "an absent trigram matched");
+
+    // typing on narrows, deleting searches again
+
+    const char *const typed[] = { "", "o", "ot", "oth", "othe", "other/i" };
+    const int         want[][8] = {
+        { 0, 1, 2, 3, 4, 5, 6, -1 },
+        { 0, 2, 3, 4, -1 },
+        { 2, 3, -1 },
+        { 2, 3, -1 },
+        { 2, 3, -1 },
+        { 3, -1 },
+    };
+
+    for (size_t i = 0; i < sizeof typed / sizeof *typed; ++i)
+        assert_nonfatal (trksearch_query (&idx, &q, typed[i]) == NCAP_OK
+                             && isfound (&q, want[i]),
+                         "a typed query didn't narrow to its matches");
+
+    assert_nonfatal (trksearch_query (&idx, &q, "oth") == NCAP_OK
+                         && isfound (&q, (int[]){ 2, 3, -1 }),
+                     "deleting back didn't widen the matches");
+    assert_nonfatal (trksearch_query (&idx, &q, "live") == NCAP_OK
+                         && isfound (&q, (int[]){ 2, -1 }),
+                     "a new query after another missed");
+
+    // an empty index matches nothing
+
+    trksearch_deinit (&idx);
+    assert_fatal (trksearch_init (&idx, names, 0) == NCAP_OK,
+                  "trksearch_init of no names failed", exit);
+    q.isvalid = false;
+    assert_nonfatal (trksearch_query (&idx, &q, "") == NCAP_OK && q.nids == 0,
+                     "an empty index matched");
+    assert_nonfatal (trksearch_query (&idx, &q, "intro") == NCAP_OK
+                         && q.nids == 0,
+                     "an empty index matched");
+
+    // intersection
+
+    const int best = simd_level ();
+
+    printf ("simd_level:\t%d\n", best);
+
+    for (int level = SIMD_SCALAR; level <= best; ++level) {
+        assert_nonfatal (simd_setlevel (level) == level,
+                         "simd_setlevel didn't apply");
+        assert_nonfatal (check_level (),
+                         "trksearch_intersect doesn't match the scalar one");
+    }
+
+    simd_setlevel (SIMD_V256);
+
+exit:
+    trksearch_deinit (&idx);
+    trksearch_q_deinit (&q);
+
+    report ();
+
+    return 0;
+}
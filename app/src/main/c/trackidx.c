@@ -0,0 +1,725 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "audio.h"
+#include "dirscan.h"
+#include "logging.h"
+#include "trackidx.h"
+
+static const char *FILENAME = "trackidx.c";
+
+#define MAGIC   "NCTI"
+#define VERSION 2
+
+#define OPEN_FLAGS (O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
+
+// a directory changed this close to a listing may change again unseen: FAT
+// keeps mtimes to 2 s
+#define RACY_NS 2000000000LL
+
+// no mtime: gone, or to be listed again
+#define MTIME_NONE INT64_MIN
+
+_Static_assert (sizeof (struct trackidx_header_t) == 24,
+                "the header is padded");
+_Static_assert (sizeof (struct trackidx_dir_t) == 24,
+                "directory records are padded");
+_Static_assert (sizeof (struct trackidx_track_t) == 32,
+                "track records are padded");
+
+#ifdef NCAP_ISTEST
+int64_t trackidx_racy_ns = RACY_NS;
+#define racy_ns trackidx_racy_ns
+#else
+#define racy_ns RACY_NS
+#endif // NCAP_ISTEST
+
+static const struct {
+    const char           *ext;
+    enum trackidx_codec_t codec;
+} codecs[] = {
+    { "aac", TRACKIDX_CODEC_AAC },     { "aif", TRACKIDX_CODEC_AIFF },
+    { "aiff", TRACKIDX_CODEC_AIFF },   { "ape", TRACKIDX_CODEC_APE },
+    { "flac", TRACKIDX_CODEC_FLAC },   { "m4a", TRACKIDX_CODEC_AAC },
+    { "mp3", TRACKIDX_CODEC_MP3 },     { "oga", TRACKIDX_CODEC_VORBIS },
+    { "ogg", TRACKIDX_CODEC_VORBIS },  { "opus", TRACKIDX_CODEC_OPUS },
+    { "wav", TRACKIDX_CODEC_WAV },     { "wma", TRACKIDX_CODEC_WMA },
+    { "wv", TRACKIDX_CODEC_WAVPACK },
+};
+
+static enum trackidx_codec_t
+codec_of (const char *name)
+{
+    const char *dot = strrchr (name, '.');
+
+    if (dot != NULL)
+        for (size_t i = 0; i < sizeof codecs / sizeof *codecs; ++i)
+            if (strcasecmp (dot + 1, codecs[i].ext) == 0)
+                return codecs[i].codec;
+
+    return TRACKIDX_CODEC_UNKNOWN;
+}
+
+static int64_t
+mtime_ns (const struct stat *st)
+{
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+// mapping
+
+/** @return whether the records of a mapped file are consistent */
+static bool
+isvalid (const void *map, size_t siz)
+{
+    const struct trackidx_header_t *h = map;
+
+    if (siz < sizeof *h || memcmp (h->magic, MAGIC, 4) != 0
+        || h->version != VERSION)
+        return false;
+
+    const struct trackidx_dir_t *dirs  = (const void *)(h + 1);
+    const size_t                 ndirs = h->ndirs;
+    const size_t                 rsiz
+        = ndirs * sizeof *dirs
+          + (size_t)h->ntracks * sizeof (struct trackidx_track_t);
+    const char *strs = (const char *)map + sizeof *h + rsiz;
+
+    if (siz != sizeof *h + rsiz + h->strs_siz || h->strs_siz == 0
+        || strs[0] != '\0' || strs[h->strs_siz - 1] != '\0')
+        return false;
+
+    // the root first, and every parent before its children
+    if (ndirs > 0 && (dirs[0].path != 0 || dirs[0].parent != TRACKIDX_NONE))
+        return false;
+
+    for (size_t i = 0; i < ndirs; ++i)
+        if ((i > 0 && dirs[i].parent >= i) || dirs[i].first > h->ntracks
+            || dirs[i].ntracks > h->ntracks - dirs[i].first)
+            return false;
+
+    return true;
+}
+
+int
+trackidx_open (struct trackidx_t *idx, const char *fn)
+{
+    struct stat st;
+    void       *map;
+    int         fd;
+
+    *idx = (struct trackidx_t){ 0 };
+
+    if ((fd = open (fn, O_RDONLY | O_CLOEXEC)) < 0) {
+        if (errno == ENOENT)
+            return NCAP_OK;
+
+        logef ("ERROR: opening `%s' failed: %s", fn, strerror (errno));
+        return NCAP_EIO;
+    }
+
+    if (fstat (fd, &st) != 0 || st.st_size <= 0) {
+        close (fd);
+        logwf ("WARN: `%s' is empty. making the track index again", fn);
+        return NCAP_OK;
+    }
+
+    map = mmap (NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+
+    if (map == MAP_FAILED) {
+        logef ("ERROR: mmap `%s' failed: %s", fn, strerror (errno));
+        return NCAP_EIO;
+    }
+
+    if (!isvalid (map, (size_t)st.st_size)) {
+        logwf ("WARN: `%s' is not a track index. making it again", fn);
+        munmap (map, (size_t)st.st_size);
+        return NCAP_OK;
+    }
+
+    idx->map     = map;
+    idx->mapsiz  = (size_t)st.st_size;
+    idx->header  = map;
+    idx->ndirs   = idx->header->ndirs;
+    idx->ntracks = idx->header->ntracks;
+    idx->dirs    = (const void *)(idx->header + 1);
+    idx->tracks  = (const void *)(idx->dirs + idx->ndirs);
+    idx->strs    = (const char *)(idx->tracks + idx->ntracks);
+
+    logif ("track index `%s': %u tracks in %u directories", fn, idx->ntracks,
+           idx->ndirs);
+
+    return NCAP_OK;
+}
+
+void
+trackidx_close (struct trackidx_t *idx)
+{
+    if (idx->map != NULL)
+        munmap (idx->map, idx->mapsiz);
+
+    *idx = (struct trackidx_t){ 0 };
+}
+
+// the next index, made in memory
+
+struct build_t {
+    const struct trackidx_t *old;
+    const int64_t           *mtimes; // of old's directories, MTIME_NONE gone
+    const char *const       *exts;
+    int                      rootfd;
+    size_t                   rootlen;
+    int64_t                  t0_ns; // when the update started
+    int                      ret;
+    size_t                   nscanned;
+
+    struct trackidx_dir_t *dirs;
+    size_t                 ndirs;
+    size_t                 dirs_cap;
+
+    struct trackidx_track_t *tracks;
+    size_t                   ntracks;
+    size_t                   tracks_cap;
+
+    char  *strs;
+    size_t strs_siz;
+    size_t strs_cap;
+
+    // new directories, listed once the old ones are done
+    uint32_t *pending;
+    size_t    npending;
+    size_t    pending_cap;
+};
+
+/** make room in *p for element len, of siz bytes. sets b->ret */
+static bool
+grow (struct build_t *b, void **p, size_t *cap, size_t len, size_t siz)
+{
+    if (len < *cap)
+        return true;
+
+    const size_t ncap = *cap > 0 ? *cap << 1 : 256;
+    void        *tmp;
+
+    if (ncap > UINT32_MAX || (tmp = realloc (*p, ncap * siz)) == NULL) {
+        loge ("ERROR: realloc for the track index failed");
+        b->ret = NCAP_EALLOC;
+        return false;
+    }
+
+    *p   = tmp;
+    *cap = ncap;
+
+    return true;
+}
+
+/** @return the offset of a copy of s, or 0 for "" and on error */
+static uint32_t
+add_str (struct build_t *b, const char *s)
+{
+    const size_t siz = strlen (s) + 1;
+
+    if (siz == 1)
+        return 0;
+
+    while (b->strs_siz + siz > b->strs_cap) {
+        if (b->strs_cap > UINT32_MAX / 2) {
+            b->ret = NCAP_EALLOC;
+            return 0;
+        }
+
+        if (!grow (b, (void **)&b->strs, &b->strs_cap, b->strs_cap, 1))
+            return 0;
+    }
+
+    const uint32_t off = (uint32_t)b->strs_siz;
+
+    memcpy (b->strs + off, s, siz);
+    b->strs_siz += siz;
+
+    return off;
+}
+
+/** @return the new directory's index, or TRACKIDX_NONE on error */
+static uint32_t
+add_dir (struct build_t *b, const char *path, uint32_t parent,
+         int64_t mtime)
+{
+    if (!grow (b, (void **)&b->dirs, &b->dirs_cap, b->ndirs, sizeof *b->dirs))
+        return TRACKIDX_NONE;
+
+    const uint32_t path_off = add_str (b, path);
+
+    if (b->ret != NCAP_OK)
+        return TRACKIDX_NONE;
+
+    b->dirs[b->ndirs] = (struct trackidx_dir_t){
+        .path     = path_off,
+        .parent   = parent,
+        .mtime_ns = mtime,
+    };
+
+    return (uint32_t)b->ndirs++;
+}
+
+/** add t to directory d at path */
+static void
+add_track (struct build_t *b, uint32_t d, const struct trackidx_track_t *t,
+           const char *path)
+{
+    struct trackidx_track_t *dst;
+
+    if (!grow (b, (void **)&b->tracks, &b->tracks_cap, b->ntracks,
+               sizeof *b->tracks))
+        return;
+
+    dst       = &b->tracks[b->ntracks];
+    *dst      = *t;
+    dst->dir  = d;
+    dst->path = add_str (b, path);
+
+    if (b->ret == NCAP_OK) {
+        ++b->ntracks;
+        ++b->dirs[d].ntracks;
+    }
+}
+
+/** @return the index of the old directory at path, or TRACKIDX_NONE */
+static uint32_t
+find_dir (const struct trackidx_t *idx, const char *path)
+{
+    size_t lo = 0;
+    size_t hi = idx->ndirs;
+
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        const int    cmp = strcmp (trackidx_str (idx, idx->dirs[mid].path),
+                                   path);
+
+        if (cmp == 0)
+            return (uint32_t)mid;
+
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return TRACKIDX_NONE;
+}
+
+/** @return old directory o's track at path, or NULL */
+static const struct trackidx_track_t *
+find_track (const struct trackidx_t *idx, uint32_t o, const char *path)
+{
+    size_t lo = idx->dirs[o].first;
+    size_t hi = lo + idx->dirs[o].ntracks;
+
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        const int    cmp = strcmp (trackidx_path (idx, mid), path);
+
+        if (cmp == 0)
+            return &idx->tracks[mid];
+
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return NULL;
+}
+
+/**
+ * a file in directory d, at path. keeps what was known of it if it is
+ * unchanged since old directory o was listed
+ *
+ * @return whether it was written to within racy_ns
+ */
+static bool
+add_file (struct build_t *b, uint32_t d, uint32_t o, const char *path,
+          const struct stat *st)
+{
+    const struct trackidx_track_t *t = NULL;
+    struct trackidx_track_t        fresh;
+
+    if (o != TRACKIDX_NONE && (t = find_track (b->old, o, path)) != NULL
+        && (t->size != st->st_size || t->mtime_ns != mtime_ns (st)))
+        t = NULL;
+
+    if (t != NULL) {
+        add_track (b, d, t, path);
+    } else {
+        fresh = (struct trackidx_track_t){
+            .size     = st->st_size,
+            .mtime_ns = mtime_ns (st),
+            .codec    = codec_of (path),
+        };
+
+        add_track (b, d, &fresh, path);
+    }
+
+    return mtime_ns (st) > b->t0_ns - racy_ns;
+}
+
+/** list directory d, which was old directory o if not TRACKIDX_NONE */
+static void
+list_dir (struct build_t *b, uint32_t d, uint32_t o)
+{
+    struct dirent *ent;
+    struct stat    st;
+    DIR           *dp;
+    char           rel[PATH_MAX];
+    size_t         rellen;
+    int            fd;
+    bool           isracy;
+
+    rellen = strlen (b->strs + b->dirs[d].path);
+    memcpy (rel, b->strs + b->dirs[d].path, rellen + 1);
+    b->dirs[d].mtime_ns = MTIME_NONE;
+    ++b->nscanned;
+
+    if ((fd = openat (b->rootfd, rellen > 0 ? rel : ".", OPEN_FLAGS)) < 0
+        || fstat (fd, &st) != 0 || (dp = fdopendir (fd)) == NULL) {
+        logwf ("WARN: skipping `%s': %s", rellen > 0 ? rel : ".",
+               strerror (errno));
+
+        if (fd >= 0)
+            close (fd);
+
+        return;
+    }
+
+    // the mtime from before the entries are read: a later change moves it
+    isracy = mtime_ns (&st) > b->t0_ns - racy_ns;
+
+    if (!isracy)
+        b->dirs[d].mtime_ns = mtime_ns (&st);
+
+    while (b->ret == NCAP_OK && (ent = readdir (dp)) != NULL) {
+        const char  *name    = ent->d_name;
+        const size_t namelen = strlen (name);
+        const size_t off     = rellen > 0 ? rellen + 1 : 0;
+
+        if (name[0] == '.'
+            && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+
+        if (b->rootlen + 1 + off + namelen >= PATH_MAX) {
+            logwf ("WARN: skipping `%s/%s': the path is too long",
+                   rellen > 0 ? rel : ".", name);
+            continue;
+        }
+
+        if (fstatat (dirfd (dp), name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+            continue;
+
+        if (rellen > 0)
+            rel[rellen] = '/';
+
+        memcpy (rel + off, name, namelen + 1);
+
+        if (S_ISDIR (st.st_mode)) {
+            const uint32_t k = find_dir (b->old, rel);
+
+            // an old subdirectory is listed on its own if it changed
+            if (k == TRACKIDX_NONE || b->mtimes[k] == MTIME_NONE) {
+                const uint32_t nd = add_dir (b, rel, d, MTIME_NONE);
+
+                if (nd != TRACKIDX_NONE
+                    && grow (b, (void **)&b->pending, &b->pending_cap,
+                             b->npending, sizeof *b->pending))
+                    b->pending[b->npending++] = nd;
+            }
+        } else if (S_ISREG (st.st_mode) && dirscan_isext (name, b->exts)) {
+            // a file still being written is looked at again next time
+            if (add_file (b, d, o, rel, &st))
+                isracy = true;
+        }
+
+        rel[rellen] = '\0';
+    }
+
+    if (isracy)
+        b->dirs[d].mtime_ns = MTIME_NONE;
+
+    closedir (dp);
+}
+
+/**
+ * stat every directory of the old index
+ *
+ * @return whether any of them changed
+ */
+static bool
+stat_dirs (const struct build_t *b, int64_t *mtimes)
+{
+    const struct trackidx_t *old       = b->old;
+    bool                     ischanged = old->ndirs == 0;
+    struct stat              st;
+
+    for (size_t o = 0; o < old->ndirs; ++o) {
+        const struct trackidx_dir_t *d    = &old->dirs[o];
+        const char                  *path = trackidx_str (old, d->path);
+
+        mtimes[o] = MTIME_NONE;
+
+        // what was under a directory that is gone is gone too
+        if ((o > 0 && mtimes[d->parent] == MTIME_NONE)
+            || fstatat (b->rootfd, o > 0 ? path : ".", &st,
+                        AT_SYMLINK_NOFOLLOW)
+                   != 0
+            || !S_ISDIR (st.st_mode)) {
+            ischanged = true;
+            continue;
+        }
+
+        mtimes[o] = mtime_ns (&st);
+        ischanged |= mtimes[o] != d->mtime_ns;
+    }
+
+    return ischanged;
+}
+
+/** carry over the old directories, listing those that changed */
+static void
+build (struct build_t *b, uint32_t *newof)
+{
+    const struct trackidx_t *old = b->old;
+
+    b->strs_siz = 1;
+
+    if (!grow (b, (void **)&b->strs, &b->strs_cap, 0, 1))
+        return;
+
+    b->strs[0] = '\0';
+
+    if (old->ndirs == 0 && add_dir (b, "", TRACKIDX_NONE, MTIME_NONE) == 0)
+        list_dir (b, 0, TRACKIDX_NONE);
+
+    for (uint32_t o = 0; o < old->ndirs && b->ret == NCAP_OK; ++o) {
+        const struct trackidx_dir_t *od = &old->dirs[o];
+        uint32_t                     d;
+
+        newof[o] = TRACKIDX_NONE;
+
+        if (b->mtimes[o] == MTIME_NONE)
+            continue;
+
+        d = add_dir (b, trackidx_str (old, od->path),
+                     o > 0 ? newof[od->parent] : TRACKIDX_NONE,
+                     b->mtimes[o]);
+        newof[o] = d;
+
+        if (d == TRACKIDX_NONE)
+            break;
+
+        if (b->mtimes[o] != od->mtime_ns) {
+            list_dir (b, d, o);
+            continue;
+        }
+
+        for (uint32_t i = od->first; i < od->first + od->ntracks; ++i)
+            add_track (b, d, &old->tracks[i], trackidx_path (old, i));
+    }
+
+    while (b->ret == NCAP_OK && b->npending > 0)
+        list_dir (b, b->pending[--b->npending], TRACKIDX_NONE);
+}
+
+// writing
+
+struct dirord_t {
+    const char *path;
+    uint32_t    i;
+};
+
+struct trackord_t {
+    const char *path;
+    uint32_t    dir; // in the order written
+    uint32_t    i;
+};
+
+static int
+cmp_dirord (const void *a_vp, const void *b_vp)
+{
+    const struct dirord_t *a = a_vp;
+    const struct dirord_t *b = b_vp;
+
+    return strcmp (a->path, b->path);
+}
+
+static int
+cmp_trackord (const void *a_vp, const void *b_vp)
+{
+    const struct trackord_t *a = a_vp;
+    const struct trackord_t *b = b_vp;
+
+    if (a->dir != b->dir)
+        return a->dir < b->dir ? -1 : 1;
+
+    return strcmp (a->path, b->path);
+}
+
+/** sort what b holds and write it to fn. @return NCAP_OK, EIO or EALLOC */
+static int
+write_index (struct build_t *b, const char *fn, const char *root)
+{
+    struct trackidx_header_t header = { .magic = MAGIC, .version = VERSION };
+    struct dirord_t         *dord  = malloc (b->ndirs * sizeof *dord);
+    struct trackord_t       *tord  = malloc ((b->ntracks + 1) * sizeof *tord);
+    uint32_t                *rank  = malloc (b->ndirs * sizeof *rank);
+    char                     tmp[PATH_MAX];
+    FILE                    *out;
+    uint32_t                 first = 0;
+    bool                     isok;
+    int                      ret   = NCAP_EALLOC;
+
+    header.root = add_str (b, root);
+
+    if (dord == NULL || tord == NULL || rank == NULL || b->ret != NCAP_OK)
+        goto exit;
+
+    header.ndirs    = (uint32_t)b->ndirs;
+    header.ntracks  = (uint32_t)b->ntracks;
+    header.strs_siz = (uint32_t)b->strs_siz;
+
+    for (uint32_t i = 0; i < b->ndirs; ++i)
+        dord[i] = (struct dirord_t){ b->strs + b->dirs[i].path, i };
+
+    qsort (dord, b->ndirs, sizeof *dord, cmp_dirord);
+
+    for (uint32_t k = 0; k < b->ndirs; ++k)
+        rank[dord[k].i] = k;
+
+    for (uint32_t i = 0; i < b->ntracks; ++i)
+        tord[i] = (struct trackord_t){ b->strs + b->tracks[i].path,
+                                       rank[b->tracks[i].dir], i };
+
+    qsort (tord, b->ntracks, sizeof *tord, cmp_trackord);
+
+    snprintf (tmp, sizeof tmp, "%s.tmp", fn);
+    ret = NCAP_EIO;
+
+    if ((out = fopen (tmp, "wb")) == NULL) {
+        logef ("ERROR: fopen `%s' failed for wb: %s", tmp, strerror (errno));
+        goto exit;
+    }
+
+    isok = fwrite (&header, sizeof header, 1, out) == 1;
+
+    for (uint32_t k = 0; k < b->ndirs && isok; ++k) {
+        struct trackidx_dir_t d = b->dirs[dord[k].i];
+
+        d.parent = d.parent != TRACKIDX_NONE ? rank[d.parent] : TRACKIDX_NONE;
+        d.first  = first;
+        first += d.ntracks;
+        isok = fwrite (&d, sizeof d, 1, out) == 1;
+    }
+
+    for (uint32_t k = 0; k < b->ntracks && isok; ++k) {
+        struct trackidx_track_t t = b->tracks[tord[k].i];
+
+        t.dir = tord[k].dir;
+        isok  = fwrite (&t, sizeof t, 1, out) == 1;
+    }
+
+    isok = isok && fwrite (b->strs, 1, b->strs_siz, out) == b->strs_siz;
+
+    if (fclose (out) != 0 || !isok || rename (tmp, fn) != 0) {
+        logef ("ERROR: could not write `%s'", fn);
+        remove (tmp);
+        goto exit;
+    }
+
+    ret = NCAP_OK;
+
+exit:
+    free (rank);
+    free (tord);
+    free (dord);
+
+    return ret;
+}
+
+int
+trackidx_update (struct trackidx_t *idx, const char *fn, const char *root,
+                 const char *const *exts, size_t *nscanned)
+{
+    static const struct trackidx_t none = { 0 };
+    struct build_t  b = { .old = idx, .exts = exts, .rootlen = strlen (root) };
+    struct timespec ts;
+    int64_t        *mtimes = NULL;
+    uint32_t       *newof  = NULL;
+    int             ret    = NCAP_OK;
+
+    if (nscanned != NULL)
+        *nscanned = 0;
+
+    if ((b.rootfd = open (root, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        logef ("ERROR: opening `%s' failed: %s", root, strerror (errno));
+        return NCAP_EIO;
+    }
+
+    clock_gettime (CLOCK_REALTIME, &ts);
+    b.t0_ns = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+    // an index of another root is made again
+    if (idx->ndirs > 0
+        && strcmp (trackidx_str (idx, idx->header->root), root) != 0)
+        b.old = &none;
+
+    if (b.old->ndirs > 0
+        && ((mtimes = malloc (b.old->ndirs * sizeof *mtimes)) == NULL
+            || (newof = malloc (b.old->ndirs * sizeof *newof)) == NULL)) {
+        ret = NCAP_EALLOC;
+        goto exit;
+    }
+
+    b.mtimes = mtimes;
+
+    if (!stat_dirs (&b, mtimes)) {
+        logif ("track index of `%s' is up to date", root);
+        goto exit;
+    }
+
+    build (&b, newof);
+
+    if ((ret = b.ret) != NCAP_OK
+        || (ret = write_index (&b, fn, root)) != NCAP_OK)
+        goto exit;
+
+    logif ("listed %zu directories of `%s': %zu tracks in %zu directories",
+           b.nscanned, root, b.ntracks, b.ndirs);
+
+    if (nscanned != NULL)
+        *nscanned = b.nscanned;
+
+    trackidx_close (idx);
+    ret = trackidx_open (idx, fn);
+
+exit:
+    free (b.pending);
+    free (b.strs);
+    free (b.tracks);
+    free (b.dirs);
+    free (newof);
+    free (mtimes);
+    close (b.rootfd);
+
+    return ret;
+}
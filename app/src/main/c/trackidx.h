@@ -0,0 +1,120 @@
+#pragma once
+
+#ifndef TRACKIDX_H
+#define TRACKIDX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Persistent index of the tracks under the track directory. The file is
+ * mapped as is: a header, fixed-size directory and track records, and the
+ * strings they point into, so nothing is parsed at startup.
+ *
+ * Every directory is recorded with its mtime, empty ones included. A rescan
+ * stats each recorded directory and lists only those whose mtime changed,
+ * plus any new subdirectory found there. A file written to in place does
+ * not change its directory's mtime, so a file is only looked at again once
+ * an entry in its directory is added, removed or renamed.
+ *
+ * Directories are sorted by path and tracks by directory, then by name.
+ */
+
+#define TRACKIDX_NONE UINT32_MAX
+
+enum trackidx_codec_t {
+    TRACKIDX_CODEC_UNKNOWN = 0,
+    TRACKIDX_CODEC_AAC,
+    TRACKIDX_CODEC_AIFF,
+    TRACKIDX_CODEC_APE,
+    TRACKIDX_CODEC_FLAC,
+    TRACKIDX_CODEC_MP3,
+    TRACKIDX_CODEC_OPUS,
+    TRACKIDX_CODEC_VORBIS,
+    TRACKIDX_CODEC_WAV,
+    TRACKIDX_CODEC_WMA,
+    TRACKIDX_CODEC_WAVPACK,
+};
+
+struct trackidx_header_t {
+    char     magic[4];
+    uint32_t version;
+    uint32_t root; // the track directory the index was made of
+    uint32_t ndirs;
+    uint32_t ntracks;
+    uint32_t strs_siz;
+};
+
+/** strings are offsets into the string table, 0 for "" */
+struct trackidx_dir_t {
+    uint32_t path;   // relative to the root, "" for the root
+    uint32_t parent; // TRACKIDX_NONE for the root
+    uint32_t first;  // its first track
+    uint32_t ntracks;
+    int64_t  mtime_ns;
+};
+
+struct trackidx_track_t {
+    uint32_t path; // relative to the root
+    uint32_t dir;
+    int64_t  size;
+    int64_t  mtime_ns;
+    uint32_t codec; // trackidx_codec_t, from the extension
+    uint32_t reserved;
+};
+
+struct trackidx_t {
+    void                          *map;
+    size_t                         mapsiz;
+    const struct trackidx_header_t *header;
+    const struct trackidx_dir_t    *dirs;
+    const struct trackidx_track_t  *tracks;
+    const char                     *strs;
+    uint32_t                        ndirs;
+    uint32_t                        ntracks;
+};
+
+#ifdef NCAP_ISTEST
+/** how recent a change is looked at again next time, in ns */
+extern int64_t trackidx_racy_ns;
+#endif // NCAP_ISTEST
+
+/**
+ * map fn. an index that is missing or not valid is opened empty
+ *
+ * @return NCAP_OK, or NCAP_EIO if fn exists but could not be mapped
+ */
+extern int trackidx_open (struct trackidx_t *idx, const char *fn);
+
+extern void trackidx_close (struct trackidx_t *idx);
+
+/**
+ * bring idx up to date with root, then write it to fn and map it again if
+ * anything changed. an index of another root is made again
+ *
+ * @param exts NULL terminated extensions of the files kept, see
+ * dirscan_audio_exts
+ * @param nscanned if not NULL, set to the directories listed
+ * @return NCAP_OK, NCAP_EIO or NCAP_EALLOC. idx is left as it was unless
+ * the new index was written
+ */
+extern int trackidx_update (struct trackidx_t *idx, const char *fn,
+                            const char *root, const char *const *exts,
+                            size_t *nscanned);
+
+/** @return a string of idx by its offset, "" if out of bounds */
+static inline const char *
+trackidx_str (const struct trackidx_t *idx, uint32_t off)
+{
+    return idx->header != NULL && off < idx->header->strs_siz ? idx->strs + off
+                                                              : "";
+}
+
+/** @return track i's path relative to the root */
+static inline const char *
+trackidx_path (const struct trackidx_t *idx, size_t i)
+{
+    return trackidx_str (idx, idx->tracks[i].path);
+}
+
+#endif // !TRACKIDX_H
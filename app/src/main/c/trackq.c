@@ -0,0 +1,171 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "audio.h"
+#include "pcmbuf.h"
+#include "ringbuf.h"
+#include "trackq.h"
+
+// tracks queued ahead of the one playing. the decoder blocks on the track it
+// is decoding, so only one is ever waiting in practice
+#define READY_SLOTS   4
+#define RETIRED_SLOTS 4
+#define DONE_SLOTS    8
+
+int
+trackq_init (struct trackq_t *this)
+{
+    if (ringbuf_init (&this->ready, sizeof (struct pcmbuf_t *), 1,
+                      READY_SLOTS)
+        != NCAP_OK)
+        return NCAP_EALLOC;
+
+    if (ringbuf_init (&this->retired, sizeof (struct pcmbuf_t *), 1,
+                      RETIRED_SLOTS)
+        != NCAP_OK) {
+        ringbuf_deinit (&this->ready);
+        return NCAP_EALLOC;
+    }
+
+    if (ringbuf_init (&this->done, sizeof (struct pcmbuf_t *), 1, DONE_SLOTS)
+        != NCAP_OK) {
+        ringbuf_deinit (&this->retired);
+        ringbuf_deinit (&this->ready);
+        return NCAP_EALLOC;
+    }
+
+    atomic_init (&this->isend, false);
+    atomic_init (&this->isstop, false);
+
+    return NCAP_OK;
+}
+
+static void
+freeall (struct ringbuf_t *rb)
+{
+    struct pcmbuf_t *pb;
+
+    while (ringbuf_read (rb, &pb, 1) == 1)
+        pcmbuf_free (pb);
+}
+
+void
+trackq_deinit (struct trackq_t *this)
+{
+    freeall (&this->ready);
+    freeall (&this->retired);
+    freeall (&this->done);
+    ringbuf_deinit (&this->ready);
+    ringbuf_deinit (&this->retired);
+    ringbuf_deinit (&this->done);
+}
+
+bool
+trackq_push (struct trackq_t *this, struct pcmbuf_t *pb)
+{
+    const struct timespec ts = { .tv_sec = 0, .tv_nsec = 10000000 }; // 10 ms
+
+    while (ringbuf_write (&this->ready, &pb, 1) == 0) {
+        if (atomic_load (&this->isstop))
+            return false;
+
+        nanosleep (&ts, NULL);
+    }
+
+    return true;
+}
+
+void
+trackq_end (struct trackq_t *this)
+{
+    atomic_store_explicit (&this->isend, true, memory_order_release);
+}
+
+void
+trackq_reclaim (struct trackq_t *this)
+{
+    freeall (&this->done);
+}
+
+struct pcmbuf_t *
+trackq_peek (struct trackq_t *this)
+{
+    struct pcmbuf_t *pb;
+
+    return ringbuf_peek (&this->ready, &pb, 1) == 1 ? pb : NULL;
+}
+
+void
+trackq_pop (struct trackq_t *this)
+{
+    struct pcmbuf_t *pb;
+    ringbuf_read (&this->ready, &pb, 1);
+}
+
+bool
+trackq_isend (struct trackq_t *this)
+{
+    // isend first: every push happens before it
+    return atomic_load_explicit (&this->isend, memory_order_acquire)
+           && ringbuf_readable (&this->ready) == 0;
+}
+
+void
+trackq_release (struct trackq_t *this, struct pcmbuf_t *pb)
+{
+    pcmbuf_abort (pb);
+    pcmbuf_wake (pb);
+
+    // cannot fill up: the decoder reclaims before every track, and the writer
+    // never gets more than one track ahead of it
+    ringbuf_write (&this->done, &pb, 1);
+}
+
+bool
+trackq_canretire (struct trackq_t *this)
+{
+    return ringbuf_writable (&this->retired) > 0;
+}
+
+bool
+trackq_retire (struct trackq_t *this, struct pcmbuf_t *pb)
+{
+    if (ringbuf_writable (&this->retired) == 0)
+        return false;
+
+    pcmbuf_abort (pb);
+    ringbuf_write (&this->retired, &pb, 1);
+
+    return true;
+}
+
+void
+trackq_flush (struct trackq_t *this)
+{
+    struct pcmbuf_t *pb;
+
+    while (ringbuf_read (&this->retired, &pb, 1) == 1)
+        trackq_release (this, pb);
+}
+
+void
+trackq_stop (struct trackq_t *this)
+{
+    struct pcmbuf_t *pb;
+
+    atomic_store (&this->isstop, true);
+    trackq_flush (this);
+
+    while ((pb = trackq_peek (this)) != NULL) {
+        trackq_pop (this);
+        trackq_release (this, pb);
+    }
+}
+
+bool
+trackq_isstop (struct trackq_t *this)
+{
+    return atomic_load (&this->isstop);
+}
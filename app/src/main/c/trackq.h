@@ -0,0 +1,99 @@
+#pragma once
+
+#ifndef TRACKQ_H
+#define TRACKQ_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "pcmbuf.h"
+#include "ringbuf.h"
+
+/**
+ * Ordered hand-off of decoded tracks from the look-ahead decoder (producer)
+ * to the audio writer (consumer). Both directions are ringbufs of pointers,
+ * so the writer never locks when it moves on to the next track.
+ *
+ * Handing a track back wakes its decoder, which locks, so the data callback
+ * only retires tracks: it aborts them and queues them for the writer's
+ * control thread, which releases them on its next trackq_flush.
+ */
+struct trackq_t {
+    struct ringbuf_t ready;   // struct pcmbuf_t *, decoder -> writer
+    struct ringbuf_t retired; // struct pcmbuf_t *, callback -> control
+    struct ringbuf_t done;    // struct pcmbuf_t *, writer -> decoder
+
+    atomic_bool isend;  // the decoder has queued its last track
+    atomic_bool isstop; // the writer will not read any more tracks
+};
+
+/** @return NCAP_OK or NCAP_EALLOC */
+extern int trackq_init (struct trackq_t *this);
+
+/**
+ * frees every queued pcmbuf. call once both sides are done
+ */
+extern void trackq_deinit (struct trackq_t *this);
+
+/**
+ * producer: queue pb for playback, sleeping while the queue is full. once
+ * queued, pb is freed by trackq_deinit. trackq_stop may have drained the queue
+ * just before pb got in, so check trackq_isstop before writing to it
+ *
+ * @return false if the consumer stopped first. pb was not queued and is still
+ * owned by the caller
+ */
+extern bool trackq_push (struct trackq_t *this, struct pcmbuf_t *pb);
+
+/** producer: no more tracks will be pushed */
+extern void trackq_end (struct trackq_t *this);
+
+/** producer: deinit and free every pcmbuf the consumer is done with */
+extern void trackq_reclaim (struct trackq_t *this);
+
+/**
+ * consumer: lock-free
+ *
+ * @return the next track without dequeuing it, or NULL if none is queued
+ */
+extern struct pcmbuf_t *trackq_peek (struct trackq_t *this);
+
+/** consumer: lock-free. dequeue the track returned by trackq_peek */
+extern void trackq_pop (struct trackq_t *this);
+
+/** consumer: lock-free. @return true if no track will ever follow */
+extern bool trackq_isend (struct trackq_t *this);
+
+/**
+ * consumer, not from the data callback: abort pb, wake its producer and hand
+ * it back to be freed
+ */
+extern void trackq_release (struct trackq_t *this, struct pcmbuf_t *pb);
+
+/** consumer: lock-free. @return whether trackq_retire has room */
+extern bool trackq_canretire (struct trackq_t *this);
+
+/**
+ * consumer: lock-free, for the data callback. abort pb and queue it for
+ * trackq_flush to release
+ *
+ * @return false, and pb is left to the caller, if trackq_canretire is false
+ */
+extern bool trackq_retire (struct trackq_t *this, struct pcmbuf_t *pb);
+
+/**
+ * consumer, not from the data callback: trackq_release every retired track.
+ * call while playing, and once more after the callback has stopped
+ */
+extern void trackq_flush (struct trackq_t *this);
+
+/**
+ * consumer: stop reading. aborts every queued and retired track so a blocked
+ * producer wakes up. call from the consumer side once it has stopped playing
+ */
+extern void trackq_stop (struct trackq_t *this);
+
+/** producer: @return true once the consumer has stopped */
+extern bool trackq_isstop (struct trackq_t *this);
+
+#endif // !TRACKQ_H
@@ -0,0 +1,455 @@
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif // __linux__
+
+#include "audio.h"
+#include "dirscan.h"
+#include "logging.h"
+#include "tagcache.h"
+#include "trackidx.h"
+#include "trackwatch.h"
+#include "trksearch.h"
+
+static const char *FILENAME = "trackwatch.c";
+
+// the list published last, holding a reference
+static pthread_mutex_t     list_mx = PTHREAD_MUTEX_INITIALIZER;
+static struct tracklist_t *cur     = NULL;
+static _Atomic uint64_t    cur_gen = 0;
+
+// track lists
+
+uint64_t
+tracklist_gen (void)
+{
+    return atomic_load_explicit (&cur_gen, memory_order_acquire);
+}
+
+struct tracklist_t *
+tracklist_acquire (void)
+{
+    struct tracklist_t *tl;
+
+    pthread_mutex_lock (&list_mx);
+
+    if ((tl = cur) != NULL)
+        atomic_fetch_add_explicit (&tl->nref, 1, memory_order_relaxed);
+
+    pthread_mutex_unlock (&list_mx);
+
+    return tl;
+}
+
+void
+tracklist_release (struct tracklist_t *tl)
+{
+    if (tl != NULL && atomic_fetch_sub (&tl->nref, 1) == 1) {
+        trksearch_deinit (&tl->search);
+        pthread_mutex_destroy (&tl->search_mx);
+        tagcache_cols_deinit (&tl->tags);
+        free (tl);
+    }
+}
+
+const struct trksearch_t *
+tracklist_search (struct tracklist_t *tl)
+{
+    if (atomic_load_explicit (&tl->issearch, memory_order_acquire))
+        return &tl->search;
+
+    pthread_mutex_lock (&tl->search_mx);
+
+    // a list without search still lists
+    if (!atomic_load_explicit (&tl->issearch, memory_order_relaxed)) {
+        trksearch_init (&tl->search, tl->ptr, tl->len);
+        atomic_store_explicit (&tl->issearch, true, memory_order_release);
+    }
+
+    pthread_mutex_unlock (&tl->search_mx);
+
+    return &tl->search;
+}
+
+/** take over tl's reference, making it the current list. tl may be NULL */
+static void
+publish (struct tracklist_t *tl)
+{
+    struct tracklist_t *old;
+
+    pthread_mutex_lock (&list_mx);
+
+    old = cur;
+    cur = tl;
+
+    if (tl != NULL)
+        atomic_store_explicit (&cur_gen, tl->gen, memory_order_release);
+
+    pthread_mutex_unlock (&list_mx);
+
+    tracklist_release (old);
+
+    if (tl != NULL)
+        tagcache_kick ();
+}
+
+#ifdef __linux__
+/** @return idx's tracks in one allocation, or NULL */
+static struct tracklist_t *
+make_list (const struct trackidx_t *idx, uint64_t gen)
+{
+    struct tracklist_t *tl;
+    const char        **ptr;
+    char               *p;
+    size_t              siz = 0;
+
+    for (size_t i = 0; i < idx->ntracks; ++i)
+        siz += strlen (trackidx_path (idx, i)) + 1;
+
+    if ((tl = malloc (sizeof *tl + idx->ntracks * sizeof *ptr + siz))
+        == NULL) {
+        loge ("ERROR: malloc for a track list failed");
+        return NULL;
+    }
+
+    ptr = (const char **)(tl + 1);
+    p   = (char *)(ptr + idx->ntracks);
+
+    for (size_t i = 0; i < idx->ntracks; ++i) {
+        const char  *path = trackidx_path (idx, i);
+        const size_t len  = strlen (path) + 1;
+
+        memcpy (p, path, len);
+        ptr[i] = p;
+        p += len;
+    }
+
+    atomic_init (&tl->nref, 1);
+    tl->gen = gen;
+    tl->len = idx->ntracks;
+    tl->ptr = ptr;
+
+    // the search index waits for the first query: a batch only lists
+    pthread_mutex_init (&tl->search_mx, NULL);
+    atomic_init (&tl->issearch, false);
+    tl->search = (struct trksearch_t){ 0 };
+
+    // a list without tags still lists
+    tagcache_cols_init (&tl->tags, idx);
+
+    return tl;
+}
+
+/** @return whether tl lists idx's tracks */
+static bool
+issame (const struct tracklist_t *tl, const struct trackidx_t *idx)
+{
+    if (tl == NULL || tl->len != idx->ntracks)
+        return false;
+
+    for (size_t i = 0; i < tl->len; ++i)
+        if (strcmp (tl->ptr[i], trackidx_path (idx, i)) != 0)
+            return false;
+
+    return true;
+}
+
+// the watcher
+
+#define EVENT_MASK                                                            \
+    (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE     \
+     | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+struct watch_t {
+    struct trackidx_t *idx;
+    const char        *fn;
+    const char        *root;
+    const char *const *exts;
+    int                ifd;
+    int                stopfd[2]; // written to on stop
+    int                maxwd;     // watch descriptors only grow
+    bool               isfull;    // out of watches, warned once
+    bool               isrunning;
+    pthread_t          tid;
+};
+
+static struct watch_t w = { .ifd = -1, .stopfd = { -1, -1 } };
+
+static int64_t
+now_ms (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * watch every directory of the index. those already watched keep their
+ * watch
+ *
+ * @return whether a directory was not watched before
+ */
+static bool
+watch_dirs (void)
+{
+    char path[PATH_MAX];
+    bool isnew = false;
+
+    for (size_t i = 0; i < w.idx->ndirs; ++i) {
+        const char *rel = trackidx_str (w.idx, w.idx->dirs[i].path);
+        int         wd;
+
+        if (rel[0] != '\0')
+            snprintf (path, sizeof path, "%s/%s", w.root, rel);
+        else
+            snprintf (path, sizeof path, "%s", w.root);
+
+        if ((wd = inotify_add_watch (w.ifd, path, EVENT_MASK)) < 0) {
+            if (errno == ENOSPC && !w.isfull) {
+                logw ("WARN: out of inotify watches. some directories are "
+                      "not watched");
+                w.isfull = true;
+            }
+
+            continue;
+        }
+
+        if (wd > w.maxwd) {
+            w.maxwd = wd;
+            isnew   = true;
+        }
+    }
+
+    return isnew;
+}
+
+/** @return whether ev may change the tracks */
+static bool
+isrelevant (const struct inotify_event *ev)
+{
+    if (ev->mask & (IN_Q_OVERFLOW | IN_ISDIR | IN_DELETE_SELF | IN_MOVE_SELF))
+        return true;
+
+    return ev->len > 0 && dirscan_isext (ev->name, w.exts);
+}
+
+/**
+ * patch the index with the batch and publish what changed
+ *
+ * @return whether a new directory is watched: what was made in it before
+ * its watch needs another look
+ */
+static bool
+refresh (void)
+{
+    struct tracklist_t *tl;
+    size_t              nscanned;
+    bool                isnew;
+
+    if (trackidx_update (w.idx, w.fn, w.root, w.exts, &nscanned) != NCAP_OK) {
+        logw ("WARN: the track index could not be updated");
+        return false;
+    }
+
+    isnew = watch_dirs ();
+    tl    = tracklist_acquire ();
+
+    if (!issame (tl, w.idx)) {
+        struct tracklist_t *next = make_list (w.idx, tracklist_gen () + 1);
+
+        if (next != NULL)
+            publish (next);
+
+        logif ("listed %zu directories: %u tracks now", nscanned,
+               w.idx->ntracks);
+    }
+
+    tracklist_release (tl);
+
+    return isnew;
+}
+
+static void *
+tfn_watch (void *args)
+{
+    _Alignas (struct inotify_event) char buf[4096];
+    int64_t                              first     = 0;
+    int64_t                              last      = 0;
+    bool                                 ispending = false;
+
+    (void)args;
+
+    for (;;) {
+        struct pollfd fds[2] = {
+            { .fd = w.ifd, .events = POLLIN },
+            { .fd = w.stopfd[0], .events = POLLIN },
+        };
+        int     timeout = -1;
+        int64_t now     = now_ms ();
+
+        if (ispending) {
+            const int64_t quiet = last + TRACKWATCH_QUIET_MS - now;
+            const int64_t most  = first + TRACKWATCH_MAX_MS - now;
+            const int64_t wait  = quiet < most ? quiet : most;
+
+            timeout = wait > 0 ? (int)wait : 0;
+        }
+
+        if (poll (fds, 2, timeout) < 0 && errno != EINTR) {
+            logef ("ERROR: poll failed: %s", strerror (errno));
+            break;
+        }
+
+        if (fds[1].revents != 0)
+            break;
+
+        now = now_ms ();
+
+        if (fds[0].revents & POLLIN) {
+            ssize_t n;
+
+            while ((n = read (w.ifd, buf, sizeof buf)) > 0) {
+                for (char *p = buf; p < buf + n;) {
+                    const struct inotify_event *ev = (const void *)p;
+
+                    p += sizeof *ev + ev->len;
+
+                    if (!isrelevant (ev))
+                        continue;
+
+                    if (!ispending)
+                        first = now;
+
+                    ispending = true;
+                    last      = now;
+                }
+            }
+        }
+
+        if (ispending
+            && (now - last >= TRACKWATCH_QUIET_MS
+                || now - first >= TRACKWATCH_MAX_MS)) {
+            ispending = refresh ();
+            first     = now;
+            last      = now;
+        }
+    }
+
+    logd ("track watcher exiting");
+
+    return NULL;
+}
+
+static void
+close_fds (void)
+{
+    if (w.ifd >= 0)
+        close (w.ifd);
+
+    for (int i = 0; i < 2; ++i)
+        if (w.stopfd[i] >= 0)
+            close (w.stopfd[i]);
+
+    w.ifd       = -1;
+    w.stopfd[0] = -1;
+    w.stopfd[1] = -1;
+}
+
+int
+trackwatch_start (struct trackidx_t *idx, const char *fn, const char *root,
+                  const char *const *exts)
+{
+    struct tracklist_t *tl;
+
+    if (w.isrunning)
+        trackwatch_stop ();
+
+    w = (struct watch_t){
+        .idx    = idx,
+        .fn     = fn,
+        .root   = root,
+        .exts   = exts,
+        .stopfd = { -1, -1 },
+        .maxwd  = -1,
+    };
+
+    if ((w.ifd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC)) < 0
+        || pipe (w.stopfd) != 0) {
+        logef ("ERROR: could not set up inotify: %s", strerror (errno));
+        close_fds ();
+        return NCAP_EIO;
+    }
+
+    if (!watch_dirs ()) {
+        logef ("ERROR: could not watch `%s'", root);
+        close_fds ();
+        return NCAP_EIO;
+    }
+
+    if ((tl = make_list (idx, tracklist_gen () + 1)) == NULL) {
+        close_fds ();
+        return NCAP_EALLOC;
+    }
+
+    publish (tl);
+
+    if (pthread_create (&w.tid, NULL, tfn_watch, NULL) != 0) {
+        loge ("ERROR: pthread_create failed for the track watcher");
+        close_fds ();
+        return NCAP_EGEN;
+    }
+
+    w.isrunning = true;
+    logif ("watching %u directories of `%s'", idx->ndirs, root);
+
+    return NCAP_OK;
+}
+
+void
+trackwatch_stop (void)
+{
+    if (w.isrunning) {
+        if (write (w.stopfd[1], "", 1) != 1)
+            logw ("WARN: could not wake the track watcher");
+
+        pthread_join (w.tid, NULL);
+        w.isrunning = false;
+    }
+
+    close_fds ();
+    publish (NULL);
+}
+#else
+int
+trackwatch_start (struct trackidx_t *idx, const char *fn, const char *root,
+                  const char *const *exts)
+{
+    (void)idx;
+    (void)fn;
+    (void)exts;
+
+    logwf ("WARN: no inotify. `%s' is not watched", root);
+
+    return NCAP_EIO;
+}
+
+void
+trackwatch_stop (void)
+{
+    publish (NULL);
+}
+#endif // __linux__
@@ -0,0 +1,72 @@
+#pragma once
+
+#ifndef TRACKWATCH_H
+#define TRACKWATCH_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tagcache.h"
+#include "trackidx.h"
+#include "trksearch.h"
+
+/**
+ * Live view of the track directory. A watcher thread has inotify watch
+ * every directory of the track index. Events on directories and on files
+ * with a kept extension are batched until none came for TRACKWATCH_QUIET_MS,
+ * or for at most TRACKWATCH_MAX_MS. The batch then patches the index with
+ * trackidx_update, which lists only the directories that changed, and new
+ * directories are watched too.
+ *
+ * When the tracks differ after a batch, a new track list is published. A
+ * list never changes once published and is freed when its last reference
+ * is released, so the UI swaps it in whole and draws from it meanwhile.
+ * Each list carries a search index over its paths, built on its first
+ * query so that a batch does not wait for it, and tag columns that the tag
+ * cache's workers fill in after it is published.
+ */
+
+#define TRACKWATCH_QUIET_MS 300
+#define TRACKWATCH_MAX_MS   2000
+
+struct tracklist_t {
+    atomic_int         nref;
+    uint64_t           gen; // 1 for the first list published
+    size_t             len;
+    const char *const *ptr; // paths relative to the root, as in the index
+
+    pthread_mutex_t        search_mx;
+    atomic_bool            issearch; // search is built
+    struct trksearch_t     search;   // empty if it could not be built
+    struct tagcache_cols_t tags;     // empty if they could not be made
+};
+
+/**
+ * publish idx's tracks, then watch root from a thread of its own. idx is
+ * the watcher's until trackwatch_stop returns, and fn, root and exts must
+ * outlive it
+ *
+ * @return NCAP_OK, NCAP_EALLOC, or NCAP_EIO if root cannot be watched
+ */
+extern int trackwatch_start (struct trackidx_t *idx, const char *fn,
+                             const char *root, const char *const *exts);
+
+/** stop the watcher and release the last list. a no-op if not started */
+extern void trackwatch_stop (void);
+
+/** @return the generation of the list published last, 0 for none yet */
+extern uint64_t tracklist_gen (void);
+
+/** @return a reference to the list published last, or NULL */
+extern struct tracklist_t *tracklist_acquire (void);
+
+/** release a reference from tracklist_acquire. NULL is ignored */
+extern void tracklist_release (struct tracklist_t *tl);
+
+/** @return tl's search index, built by the first call */
+extern const struct trksearch_t *tracklist_search (struct tracklist_t *tl);
+
+#endif // !TRACKWATCH_H
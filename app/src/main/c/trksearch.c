@@ -0,0 +1,461 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio.h"
+#include "logging.h"
+#include "simd.h"
+#include "trksearch.h"
+
+static const char *FILENAME = "trksearch.c";
+
+// lists this much longer than the other are searched, not merged
+#define GALLOP_RATIO 32
+
+static inline char
+fold (char c)
+{
+    return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+}
+
+/** @return the symbol of a folded byte */
+static inline uint32_t
+sym (unsigned char c)
+{
+    if (c >= 'a' && c <= 'z')
+        return c - 'a';
+
+    if (c >= '0' && c <= '9')
+        return 26 + c - '0';
+
+    return c < 0x80 ? 36 : 37;
+}
+
+/** @return the key of the trigram at p */
+static inline uint32_t
+key (const char *p)
+{
+    return (sym (p[0]) * TRKSEARCH_NSYMS + sym (p[1])) * TRKSEARCH_NSYMS
+           + sym (p[2]);
+}
+
+static inline const char *
+name (const struct trksearch_t *idx, uint32_t id)
+{
+    return idx->folded + idx->name_off[id];
+}
+
+/** @return whether folded name s holds the len bytes of query */
+static bool
+contains (const char *s, const char *query, size_t len)
+{
+    if (len == 0)
+        return true;
+
+    for (; (s = strchr (s, query[0])) != NULL; ++s)
+        if (strncmp (s, query, len) == 0)
+            return true;
+
+    return false;
+}
+
+// the index
+
+int
+trksearch_init (struct trksearch_t *idx, const char *const *names, size_t n)
+{
+    uint32_t *last = NULL; // the last name each key was counted for
+    uint32_t *next = NULL; // where each key's next id goes
+    size_t    siz  = 0;
+    int       ret  = NCAP_EALLOC;
+
+    *idx = (struct trksearch_t){ 0 };
+
+    for (size_t i = 0; i < n; ++i)
+        siz += strlen (names[i]) + 1;
+
+    if (n >= UINT32_MAX || siz > UINT32_MAX) {
+        loge ("ERROR: too many names to search");
+        return NCAP_EALLOC;
+    }
+
+    idx->folded   = malloc (siz + 1);
+    idx->name_off = malloc ((n + 1) * sizeof *idx->name_off);
+    idx->post_off = calloc (TRKSEARCH_NKEYS + 1, sizeof *idx->post_off);
+    last          = malloc (TRKSEARCH_NKEYS * sizeof *last);
+    next          = malloc (TRKSEARCH_NKEYS * sizeof *next);
+
+    if (idx->folded == NULL || idx->name_off == NULL || idx->post_off == NULL
+        || last == NULL || next == NULL)
+        goto exit;
+
+    // fold, and count each key once per name
+
+    char *p = idx->folded;
+
+    memset (last, 0xff, TRKSEARCH_NKEYS * sizeof *last);
+
+    for (uint32_t id = 0; id < n; ++id) {
+        const char *s = p;
+
+        idx->name_off[id] = (uint32_t)(p - idx->folded);
+
+        for (const char *c = names[id]; *c != '\0'; ++c)
+            *p++ = fold (*c);
+
+        *p++ = '\0';
+
+        for (; s + 2 < p - 1; ++s) {
+            const uint32_t k = key (s);
+
+            if (last[k] != id) {
+                last[k] = id;
+                ++idx->post_off[k + 1];
+            }
+        }
+    }
+
+    idx->name_off[n] = (uint32_t)(p - idx->folded);
+
+    for (uint32_t k = 0; k < TRKSEARCH_NKEYS; ++k)
+        idx->post_off[k + 1] += idx->post_off[k];
+
+    // ids go in ascending, so each list is sorted
+
+    if ((idx->post = malloc ((idx->post_off[TRKSEARCH_NKEYS] + 1)
+                             * sizeof *idx->post))
+        == NULL)
+        goto exit;
+
+    memcpy (next, idx->post_off, TRKSEARCH_NKEYS * sizeof *next);
+    memset (last, 0xff, TRKSEARCH_NKEYS * sizeof *last);
+
+    for (uint32_t id = 0; id < n; ++id) {
+        const char *s   = name (idx, id);
+        const char *end = idx->folded + idx->name_off[id + 1] - 1;
+
+        for (; s + 2 < end; ++s) {
+            const uint32_t k = key (s);
+
+            if (last[k] != id) {
+                last[k]               = id;
+                idx->post[next[k]++] = id;
+            }
+        }
+    }
+
+    idx->n = (uint32_t)n;
+    ret    = NCAP_OK;
+
+    logif ("search index: %zu names, %u postings", n,
+           idx->post_off[TRKSEARCH_NKEYS]);
+
+exit:
+    free (next);
+    free (last);
+
+    if (ret != NCAP_OK) {
+        loge ("ERROR: malloc for the search index failed");
+        trksearch_deinit (idx);
+    }
+
+    return ret;
+}
+
+void
+trksearch_deinit (struct trksearch_t *idx)
+{
+    free (idx->post);
+    free (idx->post_off);
+    free (idx->name_off);
+    free (idx->folded);
+    *idx = (struct trksearch_t){ 0 };
+}
+
+// intersection
+
+size_t
+trksearch_intersect_scalar (uint32_t *a, size_t na, const uint32_t *b,
+                            size_t nb)
+{
+    size_t i = 0, j = 0, k = 0;
+
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) {
+            ++i;
+        } else if (a[i] > b[j]) {
+            ++j;
+        } else {
+            a[k++] = a[i++];
+            ++j;
+        }
+    }
+
+    return k;
+}
+
+/** a much shorter than b: binary search b for each of a */
+static size_t
+gallop (uint32_t *a, size_t na, const uint32_t *b, size_t nb)
+{
+    size_t lo = 0, k = 0;
+
+    for (size_t i = 0; i < na && lo < nb; ++i) {
+        size_t step = 1;
+        size_t hi   = lo;
+
+        // widen from where the last id was found, then narrow
+        while (hi < nb && b[hi] < a[i]) {
+            lo = hi + 1;
+            hi += step;
+            step <<= 1;
+        }
+
+        if (hi > nb)
+            hi = nb;
+
+        while (lo < hi) {
+            const size_t mid = lo + (hi - lo) / 2;
+
+            if (b[mid] < a[i])
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        if (lo < nb && b[lo] == a[i])
+            a[k++] = a[i];
+    }
+
+    return k;
+}
+
+#if defined(SIMD_HAS_NEON) || defined(SIMD_HAS_X86)
+/**
+ * compare blocks of 4 from each list, all pairs at once, and move on from
+ * the block that ends lower. kept ids are written behind the block read
+ *
+ * @return ids kept. *pi and *pj are where the scalar merge goes on
+ */
+static size_t
+intersect_v128 (uint32_t *a, size_t na, const uint32_t *b, size_t nb,
+                size_t *pi, size_t *pj)
+{
+    size_t   i = 0, j = 0, k = 0;
+    uint32_t lanes[4], hit[4];
+
+    while (i + 4 <= na && j + 4 <= nb) {
+#if defined(SIMD_HAS_NEON)
+        const uint32x4_t va = vld1q_u32 (a + i);
+        const uint32x4_t vb = vld1q_u32 (b + j);
+        const uint32x4_t eq
+            = vorrq_u32 (vorrq_u32 (vceqq_u32 (va, vb),
+                                    vceqq_u32 (va, vextq_u32 (vb, vb, 1))),
+                         vorrq_u32 (vceqq_u32 (va, vextq_u32 (vb, vb, 2)),
+                                    vceqq_u32 (va, vextq_u32 (vb, vb, 3))));
+
+        vst1q_u32 (hit, eq);
+        vst1q_u32 (lanes, va);
+#else
+        const __m128i va = _mm_loadu_si128 ((const __m128i *)(a + i));
+        const __m128i vb = _mm_loadu_si128 ((const __m128i *)(b + j));
+        const __m128i eq = _mm_or_si128 (
+            _mm_or_si128 (
+                _mm_cmpeq_epi32 (va, vb),
+                _mm_cmpeq_epi32 (va, _mm_shuffle_epi32 (vb, 0x39))),
+            _mm_or_si128 (
+                _mm_cmpeq_epi32 (va, _mm_shuffle_epi32 (vb, 0x4e)),
+                _mm_cmpeq_epi32 (va, _mm_shuffle_epi32 (vb, 0x93))));
+
+        _mm_storeu_si128 ((__m128i *)hit, eq);
+        _mm_storeu_si128 ((__m128i *)lanes, va);
+#endif
+
+        const uint32_t amax = lanes[3];
+        const uint32_t bmax = b[j + 3];
+
+        for (int l = 0; l < 4; ++l)
+            if (hit[l] != 0)
+                a[k++] = lanes[l];
+
+        i += amax <= bmax ? 4 : 0;
+        j += bmax <= amax ? 4 : 0;
+    }
+
+    *pi = i;
+    *pj = j;
+
+    return k;
+}
+#endif
+
+size_t
+trksearch_intersect (uint32_t *a, size_t na, const uint32_t *b, size_t nb)
+{
+    size_t i = 0, j = 0, k = 0;
+
+    if (na * GALLOP_RATIO < nb)
+        return gallop (a, na, b, nb);
+
+#if defined(SIMD_HAS_NEON) || defined(SIMD_HAS_X86)
+    if (simd_level () >= SIMD_V128)
+        k = intersect_v128 (a, na, b, nb, &i, &j);
+#endif
+
+    // the tails, appended behind what the kernel kept
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) {
+            ++i;
+        } else if (a[i] > b[j]) {
+            ++j;
+        } else {
+            a[k++] = a[i++];
+            ++j;
+        }
+    }
+
+    return k;
+}
+
+// queries
+
+void
+trksearch_q_init (struct trksearch_q_t *q)
+{
+    *q = (struct trksearch_q_t){ 0 };
+}
+
+void
+trksearch_q_deinit (struct trksearch_q_t *q)
+{
+    free (q->ids);
+    *q = (struct trksearch_q_t){ 0 };
+}
+
+static int
+reserve (struct trksearch_q_t *q, size_t n)
+{
+    if (n <= q->cap)
+        return NCAP_OK;
+
+    uint32_t *p = realloc (q->ids, (n + 1) * sizeof *p);
+
+    if (p == NULL) {
+        loge ("ERROR: realloc for search results failed");
+        return NCAP_EALLOC;
+    }
+
+    q->ids = p;
+    q->cap = n;
+
+    return NCAP_OK;
+}
+
+/** keep the ids in q whose names hold query */
+static void
+filter (const struct trksearch_t *idx, struct trksearch_q_t *q,
+        const char *query, size_t len)
+{
+    size_t k = 0;
+
+    for (size_t i = 0; i < q->nids; ++i)
+        if (contains (name (idx, q->ids[i]), query, len))
+            q->ids[k++] = q->ids[i];
+
+    q->nids = k;
+}
+
+/** candidates for a query of 3 or more bytes, from its postings */
+static int
+lookup (const struct trksearch_t *idx, struct trksearch_q_t *q,
+        const char *query, size_t len)
+{
+    uint32_t keys[TRKSEARCH_MAX_QUERY];
+    size_t   nkeys = 0;
+
+#define postlen(k) (idx->post_off[(k) + 1] - idx->post_off[k])
+
+    // distinct keys, shortest list first: insertion sort, as there are few
+    for (size_t s = 0; s + 2 < len; ++s) {
+        const uint32_t k   = key (query + s);
+        size_t         pos = nkeys;
+        bool           isdup = false;
+
+        for (size_t i = 0; i < nkeys && !isdup; ++i)
+            isdup = keys[i] == k;
+
+        if (isdup)
+            continue;
+
+        while (pos > 0 && postlen (keys[pos - 1]) > postlen (k)) {
+            keys[pos] = keys[pos - 1];
+            --pos;
+        }
+
+        keys[pos] = k;
+        ++nkeys;
+    }
+
+    if (reserve (q, postlen (keys[0])) != NCAP_OK)
+        return NCAP_EALLOC;
+
+    q->nids = postlen (keys[0]);
+    memcpy (q->ids, idx->post + idx->post_off[keys[0]],
+            q->nids * sizeof *q->ids);
+
+    for (size_t i = 1; i < nkeys && q->nids > 0; ++i)
+        q->nids = trksearch_intersect (q->ids, q->nids,
+                                       idx->post + idx->post_off[keys[i]],
+                                       postlen (keys[i]));
+
+#undef postlen
+
+    return NCAP_OK;
+}
+
+int
+trksearch_query (const struct trksearch_t *idx, struct trksearch_q_t *q,
+                 const char *query)
+{
+    char   buf[TRKSEARCH_MAX_QUERY];
+    size_t len = 0;
+
+    for (; query[len] != '\0' && len + 1 < sizeof buf; ++len)
+        buf[len] = fold (query[len]);
+
+    buf[len] = '\0';
+
+    if (q->isvalid && len >= q->len && memcmp (buf, q->query, q->len) == 0) {
+        // typed on: the results can only narrow
+        if (len > q->len)
+            filter (idx, q, buf, len);
+    } else if (len < 3) {
+        q->isvalid = false;
+
+        if (reserve (q, idx->n) != NCAP_OK)
+            return NCAP_EALLOC;
+
+        q->nids = 0;
+
+        for (uint32_t id = 0; id < idx->n; ++id)
+            if (contains (name (idx, id), buf, len))
+                q->ids[q->nids++] = id;
+    } else {
+        q->isvalid = false;
+
+        if (lookup (idx, q, buf, len) != NCAP_OK)
+            return NCAP_EALLOC;
+
+        // keys lose detail, and a name may hold each trigram apart
+        filter (idx, q, buf, len);
+    }
+
+    memcpy (q->query, buf, len + 1);
+    q->len     = len;
+    q->isvalid = true;
+
+    return NCAP_OK;
+}
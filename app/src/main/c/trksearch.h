@@ -0,0 +1,81 @@
+#pragma once
+
+#ifndef TRKSEARCH_H
+#define TRKSEARCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Search-as-you-type over track names. Matching is by substring, ignoring
+ * ASCII case. Names are folded to lowercase once, into one buffer. Every
+ * trigram of a folded name is reduced to a key over 38 symbols: a-z, 0-9,
+ * any other ASCII byte, and any byte of a multibyte character. Each key has
+ * a posting list of name ids, ascending, and all of them live in one
+ * contiguous array.
+ *
+ * A query intersects the postings of its trigrams, shortest first, then
+ * checks each candidate for the whole query, since keys lose detail. A query
+ * shorter than a trigram scans the folded names. A query that extends the
+ * last one only filters the last results, as typing does.
+ */
+
+#define TRKSEARCH_NSYMS 38
+#define TRKSEARCH_NKEYS (TRKSEARCH_NSYMS * TRKSEARCH_NSYMS * TRKSEARCH_NSYMS)
+#define TRKSEARCH_MAX_QUERY 256 // bytes of a query, longer ones are cut
+
+struct trksearch_t {
+    uint32_t  n;
+    char     *folded;   // NUL separated
+    uint32_t *name_off; // n + 1 offsets into folded
+    uint32_t *post_off; // TRKSEARCH_NKEYS + 1 offsets into post
+    uint32_t *post;
+};
+
+/** a query, kept from one keystroke to the next */
+struct trksearch_q_t {
+    char      query[TRKSEARCH_MAX_QUERY]; // folded
+    size_t    len;
+    bool      isvalid; // ids match query
+    uint32_t *ids;     // matching names, ascending
+    size_t    nids;
+    size_t    cap;
+};
+
+/**
+ * index names[0] to names[n - 1]. ids are their indices
+ *
+ * @return NCAP_OK or NCAP_EALLOC. the index is empty on error
+ */
+extern int trksearch_init (struct trksearch_t *idx,
+                           const char *const *names, size_t n);
+
+extern void trksearch_deinit (struct trksearch_t *idx);
+
+extern void trksearch_q_init (struct trksearch_q_t *q);
+
+extern void trksearch_q_deinit (struct trksearch_q_t *q);
+
+/**
+ * match query against idx, leaving the ids in q. an empty query matches
+ * every name. clear q->isvalid before using q with another index
+ *
+ * @return NCAP_OK or NCAP_EALLOC
+ */
+extern int trksearch_query (const struct trksearch_t *idx,
+                            struct trksearch_q_t *q, const char *query);
+
+/**
+ * intersect the ascending lists a and b into a
+ *
+ * @return the ids left in a
+ */
+extern size_t trksearch_intersect (uint32_t *a, size_t na, const uint32_t *b,
+                                   size_t nb);
+
+/** reference implementation for the tests and benchmarks */
+extern size_t trksearch_intersect_scalar (uint32_t *a, size_t na,
+                                          const uint32_t *b, size_t nb);
+
+#endif // !TRKSEARCH_H